@@ -0,0 +1,200 @@
+/*!	\file BufferPool.h
+*	\brief  BufferPool class header file.
+*   A BufferPool caches pages of a record file in a shared memory segment, so every server process reads hot records
+*   from memory without a system call or a semaphore operation. \n
+*   The segment is an anonymous shared mapping created by the server at startup, before any worker is forked, so the
+*   forked servers and the core threads all see one pool. \n
+*   A page is POOL_PAGE_RECORDS consecutive records. Pages are found through a chained hash table and evicted with the
+*   clock algorithm: each access sets a frame's reference bit, and the hand clears bits until it finds a frame without one. \n
+*   The pool is guarded by a process-shared mutex held only for a lookup and a copy, so a hit costs no system call.
+*   The file's own readers-writers semaphores order the pool against the file: pages are loaded under the reader lock
+*   and updates are written through under the writer lock, so a page can never be loaded stale. \n
+*   With LockStripes, a page is loaded under the reader locks of all its records, and an update under its record's writer lock. \n
+*   A page near the end of the file may hold fewer records than fit. Records appended past them are misses that
+*   reload the page, so appends never have to touch the pool. \n
+*
+*/
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include "Packets.h"
+#include <pthread.h>
+
+#define POOL_PAGE_RECORDS 256
+
+/*!
+*   \struct Pool_Stats
+*   \brief Snapshot of a BufferPool's counters.
+*/
+struct Pool_Stats{
+    int frames;
+    int used;
+    long hits;
+    long misses;
+    long evictions;
+};
+
+/*!
+ *	\class BufferPool
+ *	\brief Shared memory page cache of a record file
+ *  \n
+ *   A BufferPool caches pages of fixed size records in shared memory, with clock eviction and hit/miss counters. \n
+ */
+class BufferPool
+{
+private:
+    /*!
+    *   \struct Pool_Header
+    *   \brief State at the start of the segment.
+    */
+    struct Pool_Header{
+        pthread_mutex_t lock;
+        int numFrames;
+        int numBuckets;
+        int recordSize;
+        int hand;
+        int used;
+        long hits;
+        long misses;
+        long evictions;
+    };
+
+    /*!
+    *   \struct Pool_Frame
+    *   \brief A cached page.
+    */
+    struct Pool_Frame{
+        int page;       // page number, or -1 if free
+        int count;      // records of the page held
+        int next;       // next frame in the hash chain, or -1
+        int referenced; // clock reference bit
+    };
+
+    /*!
+    *	\var size_t size - Length of the segment.
+    */
+    size_t size;
+    /*!
+    *	\var Pool_Header *header - Segment header.
+    */
+    Pool_Header *header;
+    /*!
+    *	\var Pool_Frame *frames - Frame table.
+    */
+    Pool_Frame *frames;
+    /*!
+    *	\var int *buckets - Hash chain heads, indexed by page.
+    */
+    int *buckets;
+    /*!
+    *	\var char *data - Page contents, one page per frame.
+    */
+    char *data;
+
+    /*!
+    *   \fn find
+    *	\param int page : Page number.
+    *	\brief Finds a cached page.
+    *	\return Frame index, or -1 if the page is not cached.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    int find(int page);
+    /*!
+    *   \fn evict
+    *	\param None.
+    *	\brief Picks a frame for a new page.
+    *	\return Frame index, unlinked from its hash chain.
+    *
+    *   \par Description
+    *   Takes a free frame if there is one, otherwise runs the clock hand to the first frame not referenced since it last passed.
+    *   Operation is NOT synched.
+    */
+    int evict();
+    /*!
+    *   \fn frameData
+    *	\param int frame : Frame index.
+    *	\brief Contents of a frame.
+    *	\return Pointer to the frame's first record.
+    *
+    */
+    char *frameData(int frame){return data + (size_t) frame * POOL_PAGE_RECORDS * header->recordSize;}
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param int numFrames : Number of pages the pool holds.
+    *	\param int recordSize : Size of a record in bytes.
+    *	\brief Creates the shared pool.
+    *	\return BufferPool
+    *
+    *   \par Description
+    *   Maps the segment shared and anonymous and initializes it empty. Exits on failure.
+    *   Processes forked afterwards share it.
+    *
+    */
+    BufferPool(int numFrames, int recordSize);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Unmaps the segment.
+    *	\return void
+    *
+    */
+    ~BufferPool();
+    /*!
+    *   \fn read
+    *	\param int recordNumber : Record to read.
+    *	\param void *buf : Filled with the record on a hit.
+    *	\brief Reads a record from the pool.
+    *	\return true on a hit.
+    *
+    */
+    bool read(int recordNumber, void *buf);
+    /*!
+    *   \fn update
+    *	\param int recordNumber : Record written.
+    *	\param const void *record : Its new contents.
+    *	\brief Writes a record through to the pool.
+    *	\return void
+    *
+    *   \par Description
+    *   Updates the record if its page is cached. Must be called under the file's writer lock.
+    *
+    */
+    void update(int recordNumber, const void *record);
+    /*!
+    *   \fn insert
+    *	\param int page : Page number.
+    *	\param const void *records : The page's records, read from the file.
+    *	\param int count : Number of records read, at most POOL_PAGE_RECORDS.
+    *	\brief Caches a page.
+    *	\return void
+    *
+    *   \par Description
+    *   Replaces the page if it is cached, or evicts a frame for it. Must be called under the file's reader lock.
+    *
+    */
+    void insert(int page, const void *records, int count);
+    /*!
+    *   \fn stats
+    *	\param None.
+    *	\brief Reads the counters.
+    *	\return Pool_Stats snapshot.
+    *
+    */
+    Pool_Stats stats();
+    /*!
+    *   \fn printStats
+    *	\param None.
+    *	\brief Prints the counters.
+    *	\return void
+    *
+    */
+    void printStats();
+
+};
+
+#endif
@@ -14,6 +14,9 @@
 *        4 : Create\n
 *        5 : (Log when sending a request to the server, Client Connection when logging actions.)\n
 *        6 : Client disconnection\n
+*   Requests are sent as protocol v2 frames, each with its own request id.\n
+*   Several requests can be in flight at once. Replies are matched to requests by id, since the server may answer
+*   a log request after requests sent behind it.\n
 *   
 */
 
@@ -58,7 +61,76 @@ private:
     *	\var SharedMemory shmem - Performs accesses and operations on the client machine's shared memory.
     */
     SharedMemory shmem;
+    /*!
+    *	\var uint32_t nextRequestId - Id given to the next request sent.
+    */
+    uint32_t nextRequestId;
 
+    /*!
+    *   \fn sendRequest
+    *	\param Record_Message &msg: Request to send.
+    *	\brief Sends a request to the server.
+    *	\return Request id, or 0 on error.
+    *   
+    *   \par Description
+    *   Sends the message as a v2 frame with opcode msg.action and a new request id.
+    *
+    */
+    uint32_t sendRequest(Record_Message &msg);
+    /*!
+    *   \fn sendRequest
+    *	\param int opcode: Request opcode.
+    *	\param const void* payload: Request payload.
+    *	\param int length: Payload size in bytes.
+    *	\brief Sends a request with its own payload type to the server.
+    *	\return Request id, or 0 on error.
+    *
+    */
+    uint32_t sendRequest(int opcode, const void* payload, int length);
+    /*!
+    *   \fn readReply
+    *	\param Record_Message &msg: Filled with the reply.
+    *	\param uint32_t &requestId: Filled with the id of the request replied to.
+    *	\brief Waits for the next reply from the server.
+    *	\return False on disconnection.
+    *   
+    *   \par Description
+    *   Replies that arrived together are buffered and returned one per call.
+    *
+    */
+    bool readReply(Record_Message &msg, uint32_t &requestId);
+    /*!
+    *   \fn awaitReply
+    *	\param uint32_t requestId: Id of the request.
+    *	\param Record_Message &msg: Filled with the reply.
+    *	\brief Waits for the reply to one request.
+    *	\return False on disconnection.
+    *   
+    *   \par Description
+    *   Replies to other requests still in flight are handed to messageSwitch as they arrive.
+    *
+    */
+    bool awaitReply(uint32_t requestId, Record_Message &msg);
+    /*!
+    *   \fn dispatchFrame
+    *	\param Frame &frame: Reply frame carrying a Record_Message.
+    *	\brief Hands a reply to another request in flight to messageSwitch.
+    *	\return void
+    *
+    */
+    void dispatchFrame(Frame &frame);
+    /*!
+    *   \fn awaitFrame
+    *	\param uint32_t requestId: Id of the request.
+    *	\param Frame &frame: Filled with the reply frame.
+    *	\brief Waits for the next reply frame of one request.
+    *	\return False on disconnection.
+    *   
+    *   \par Description
+    *   Used for replies that are not a Record_Message. Frames replying to other requests in flight are handed to dispatchFrame.
+    *
+    */
+    bool awaitFrame(uint32_t requestId, Frame &frame);
     /*!
     *   \fn menuSwitch
     *	\param char choice: Character entered by user.
@@ -83,12 +155,12 @@ private:
     void messageSwitch(Record_Message &msg);
     /*!
     *   \fn requestCount
-    *	\param : 
-    *	\brief 
-    *	\return
+    *	\param none
+    *	\brief Requests the record count.
+    *	\return Record count, or -1 on error.
     *   
     *   \par Description
-    *   
+    *   Waits for the count reply, handling replies to earlier requests that arrive first.
     *
     */
     int requestCount();
@@ -109,14 +181,14 @@ private:
     *   \fn requestRead
     *	\param const int recordNumber: record number to request
     *	\brief Requests a record from the server.
-    *	\return true if successfully sent.
+    *	\return Request id, or 0 on error.
     *   
     *   \par Description
-    *   Calls serverSocket.writeMessage to sends a read request.
+    *   Calls sendRequest to send a read request.
     *   msg.action = 2. msg.arg = record number
     *
     */
-    bool requestRead(const int recordNumber);
+    uint32_t requestRead(const int recordNumber);
     /*!
     *   \fn receiveRead
     *	\param Record_Message &msg: message received from server
@@ -137,14 +209,26 @@ private:
     *	\return void
     *   
     *   \par Description
-    *   Repeatedly sends read requests to the server. 
-    *   Replies are immediately read. 
-    *   Logs each individual read request.
+    *   Sends one read range request for every record, 
+    *   then collects the records from its reply frames. 
+    *   Logs the range read.
     *   Prints all records received.
     *
     */
     void readAll(const int count);
     /*!
+    *   \fn receiveRecords
+    *	\param uint32_t requestId: Id of a read range or filter request.
+    *	\param std::vector<Record> &records: Records received are appended here.
+    *	\brief Receives the records streamed in reply to a request.
+    *	\return False on disconnection or if the server reported an error.
+    *   
+    *   \par Description
+    *   Reads frames of records until the frame holding the number sent.
+    *
+    */
+    bool receiveRecords(uint32_t requestId, std::vector<Record> &records);
+    /*!
     *   \fn printRecords
     *	\param std::vector<Record> &records: records to print
     *	\brief Prints a number of records
@@ -178,6 +262,17 @@ private:
     */
     float getFloat();
     /*!
+    *   \fn getKey
+    *	\param none
+    *	\brief Gets a record key from the user
+    *	\return Input key
+    *   
+    *   \par Description
+    *   Takes a 64-bit integer through stdin. Repeatedly calls until a valid integer is read.
+    *
+    */
+    int64_t getKey();
+    /*!
     *   \fn getRecord
     *	\param Record &rec: record struct to store new record
     *	\brief Creates a new record from user input
@@ -265,28 +360,88 @@ private:
     */
     void receiveCreate(Record_Message &msg);
     /*!
+    *   \fn filterMenu
+    *	\param none
+    *	\brief Gets user input for a filter and prints the matching records.
+    *	\return void
+    *   
+    *   \par Description
+    *   Prompts for up to MAX_FILTER_TERMS comparisons of a field with a value, all of which must hold, 
+    *   sends a filter request over every record and prints the matches.
+    *
+    */
+    void filterMenu();
+    /*!
+    *   \fn indexMenu
+    *	\param none
+    *	\brief Gets user input for an index range query and prints the records found.
+    *	\return void
+    *   
+    *   \par Description
+    *   Prompts for a field, a range of its values, an order and a limit, sends an index range request
+    *   and prints the records found, in order of the field. The server must index the field.
+    *
+    */
+    void indexMenu();
+    /*!
+    *   \fn keyMenu
+    *	\param none
+    *	\brief Gets user input for a keyed request and prints the record it read or wrote.
+    *	\return void
+    *   
+    *   \par Description
+    *   Prompts for an operation and a key, and the record's values for an update or create, sends the keyed request
+    *   and prints the record with its slot in the data file. The server must have keyed records enabled.
+    *
+    */
+    void keyMenu();
+    /*!
+    *   \fn datasetMenu
+    *	\param none
+    *	\brief Gets user input for a dataset request and reports the dataset selected.
+    *	\return void
+    *   
+    *   \par Description
+    *   Prompts for a dataset name, or * for the server's data file, and whether to create it if missing, then sends the
+    *   dataset request. The requests sent after it are served from that dataset. The server must have datasets enabled.
+    *
+    */
+    void datasetMenu();
+    /*!
+    *   \fn aggregateMenu
+    *	\param none
+    *	\brief Gets user input for an aggregate query and prints its result.
+    *	\return void
+    *   
+    *   \par Description
+    *   Prompts for a field and a range of months, sends an aggregate request 
+    *   and prints the count, average, minimum, maximum and sum computed by the server.
+    *
+    */
+    void aggregateMenu();
+    /*!
     *   \fn requestLog
     *	\param none
     *	\brief Requests the log file entries from the server
     *	\return true if successfully sent.
     *   
     *   \par Description
-    *   Calls serverSocket.writeMessage to send a log request. Calls receiveLogs to immediate read.
+    *   Calls sendRequest to send a log request. Calls receiveLog to immediately read.
     *   msg.action = 5.
     */
     bool requestLog();
     /*!
     *   \fn receiveLog
-    *	\param none 
+    *	\param uint32_t requestId: Id of the log request.
     *	\brief Receives all log entries from server.
     *	\return void
     *   
     *   \par Description
-    *   Repeatedly calls serverSocket.readMessage to receive log entries from the server as long as msg.arg > 0.
+    *   Reads log frames for the request until the empty one that ends them, handing replies to other requests to messageSwitch.
     *   Prints contents of all log entries received. 
     * 
     */
-    void receiveLog();
+    void receiveLog(uint32_t requestId);
     /*!
     *   \fn clientLog
     *	\param none
@@ -0,0 +1,176 @@
+/*!	\file CoExecutor.h
+*	\brief  CoExecutor class header file.
+*   A CoExecutor runs many coroutines on one thread. \n
+*   Coroutines suspend on socket readiness with co_await readable(fd) or writable(fd), or give up the thread
+*   with co_await yield(). The executor resumes ready coroutines in order, and waits on epoll when none are ready. \n
+*   Descriptors are registered edge-triggered, so a coroutine must only wait after an operation returned EAGAIN. \n
+*
+*/
+
+#ifndef COEXECUTOR_H
+#define COEXECUTOR_H
+
+#include "CoTask.h"
+#include "Packets.h"
+#include <sys/epoll.h>
+#include <deque>
+#include <map>
+
+/*!
+ *	\class CoExecutor
+ *	\brief Single threaded coroutine executor
+ *  \n
+ *   A CoExecutor runs many coroutines on one thread, resuming them when the sockets they wait on become ready. \n
+ */
+class CoExecutor
+{
+private:
+    /*!
+    *   \struct Co_Waiters
+    *   \brief Coroutines suspended on one descriptor.
+    */
+    struct Co_Waiters{
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+    };
+
+    /*!
+    *	\var int epollfd - epoll instance descriptor.
+    */
+    int epollfd;
+    /*!
+    *	\var std::deque<std::coroutine_handle<>> ready - Coroutines waiting to be resumed.
+    */
+    std::deque<std::coroutine_handle<>> ready;
+    /*!
+    *	\var std::map<int, Co_Waiters> waiters - Watched descriptors and their suspended coroutines.
+    */
+    std::map<int, Co_Waiters> waiters;
+
+public:
+    /*!
+    *   \struct Readiness
+    *   \brief Awaitable that suspends until a descriptor is readable or writable.
+    */
+    struct Readiness{
+        CoExecutor &executor;
+        int fd;
+        bool write;
+        bool await_ready() noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h){executor.park(fd, write, h);}
+        void await_resume() noexcept {}
+    };
+
+    /*!
+    *   \struct Yield
+    *   \brief Awaitable that requeues the coroutine behind the others that are ready.
+    */
+    struct Yield{
+        CoExecutor &executor;
+        bool await_ready() noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h){executor.schedule(h);}
+        void await_resume() noexcept {}
+    };
+
+    /*!
+    *   \fn Constructor
+    *	\param None.
+    *	\brief Constructs a CoExecutor.
+    *	\return CoExecutor
+    *
+    */
+    CoExecutor();
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes the epoll instance.
+    *	\return void
+    *
+    */
+    ~CoExecutor();
+    /*!
+    *   \fn watch
+    *	\param int fd : Non-blocking descriptor.
+    *	\param bool exclusive : Register with EPOLLEXCLUSIVE, for listeners shared between processes.
+    *	\brief Registers a descriptor so coroutines can wait on it.
+    *	\return false on error.
+    *
+    */
+    bool watch(int fd, bool exclusive = false);
+    /*!
+    *   \fn unwatch
+    *	\param int fd : Descriptor.
+    *	\brief Deregisters a descriptor before it is closed.
+    *	\return void
+    *
+    */
+    void unwatch(int fd);
+    /*!
+    *   \fn readable
+    *	\param int fd : Watched descriptor.
+    *	\brief Waits for a descriptor to become readable.
+    *	\return Awaitable.
+    *
+    */
+    Readiness readable(int fd){return Readiness{*this, fd, false};}
+    /*!
+    *   \fn writable
+    *	\param int fd : Watched descriptor.
+    *	\brief Waits for a descriptor to become writable.
+    *	\return Awaitable.
+    *
+    */
+    Readiness writable(int fd){return Readiness{*this, fd, true};}
+    /*!
+    *   \fn yield
+    *	\param None.
+    *	\brief Lets the other ready coroutines run.
+    *	\return Awaitable.
+    *
+    */
+    Yield yield(){return Yield{*this};}
+    /*!
+    *   \fn park
+    *	\param int fd : Watched descriptor.
+    *	\param bool write : Wait for writability instead of readability.
+    *	\param std::coroutine_handle<> h : Suspended coroutine.
+    *	\brief Suspends a coroutine on a descriptor.
+    *	\return void
+    *
+    */
+    void park(int fd, bool write, std::coroutine_handle<> h);
+    /*!
+    *   \fn schedule
+    *	\param std::coroutine_handle<> h : Suspended coroutine.
+    *	\brief Queues a coroutine to be resumed.
+    *	\return void
+    *
+    */
+    void schedule(std::coroutine_handle<> h){ready.push_back(h);}
+    /*!
+    *   \fn spawn
+    *	\param CoTask<> task : Coroutine to run.
+    *	\brief Starts a detached coroutine.
+    *	\return void
+    *
+    *   \par Description
+    *   The coroutine first runs on the next pass of the executor, and frees itself when it completes.
+    *
+    */
+    void spawn(CoTask<> task){schedule(task.detach());}
+    /*!
+    *   \fn run
+    *	\param None.
+    *	\brief Executor lifetime.
+    *	\return void
+    *
+    *   \par Description
+    *   Resumes ready coroutines, then waits on epoll for the next descriptors to become ready,
+    *   until an unrecoverable error occurs. SIGINT and SIGCHLD are only delivered while waiting.
+    *
+    */
+    void run();
+
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*!	\file CoLoop.h
+*	\brief  CoLoop class header file.
+*   A CoLoop object services many clients from a single thread with coroutines. \n
+*   Accepting, and the lifetime of every connection, are coroutines on one CoExecutor. Each connection's Server
+*   awaits its requests and the sending of its replies, so a slow reader or a long log stream only suspends its own coroutine. \n
+*   Several worker processes may run a CoLoop over the same listening socket; the kernel wakes only one of them per new connection.\n
+*
+*/
+
+#ifndef COLOOP_H
+#define COLOOP_H
+
+#include "Server.h"
+#include "CoExecutor.h"
+
+/*!
+ *	\class CoLoop
+ *	\brief Coroutine driven connection multiplexer
+ *  \n
+ *   A CoLoop object services many clients from a single thread with coroutines. \n
+ *   Each connection is serviced by its Server's serve coroutine. \n
+ */
+class CoLoop
+{
+private:
+    /*!
+    *	\var const int listenfd - Non-blocking listening socket descriptor.
+    */
+    const int listenfd;
+    /*!
+    *	\var const int binfd - Open binary file descriptor. Duplicated for each connection.
+    */
+    const int binfd;
+    /*!
+    *	\var const int logfd - Open log file descriptor. Duplicated for each connection.
+    */
+    const int logfd;
+    /*!
+    *	\var const int semid - Established system semaphore set id.
+    */
+    const int semid;
+    /*!
+    *	\var int *connectionCount - Incremented for every accepted connection, or NULL. May point into shared memory.
+    */
+    int *connectionCount;
+    /*!
+    *	\var CoExecutor executor - Runs every coroutine of this loop.
+    */
+    CoExecutor executor;
+
+    /*!
+    *   \fn acceptConnections
+    *	\param None.
+    *	\brief Accepts connections for the loop's lifetime.
+    *	\return Coroutine.
+    *
+    *   \par Description
+    *   Accepts every pending connection, then awaits the listening socket. Spawns a connection coroutine for each client.
+    *
+    */
+    CoTask<> acceptConnections();
+    /*!
+    *   \fn serviceConnection
+    *	\param Server *server : Data server of a new connection.
+    *	\brief Connection lifetime.
+    *	\return Coroutine.
+    *
+    *   \par Description
+    *   Runs the Server's serve coroutine, then deregisters and destroys it.
+    *
+    */
+    CoTask<> serviceConnection(Server *server);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int listenfd : Non-blocking listening socket descriptor.
+    *	\param const int bfd : Open binary file descriptor.
+    *	\param const int lfd : Open log file descriptor.
+    *	\param const int semid : Established system semaphore set id.
+    *	\param int *connectionCount : Optional accepted connection counter.
+    *	\brief Constructs a CoLoop.
+    *	\return CoLoop
+    *
+    */
+    CoLoop(const int listenfd, const int bfd, const int lfd, const int semid, int *connectionCount = NULL);
+    /*!
+    *   \fn run
+    *	\param None.
+    *	\brief Event loop lifetime.
+    *	\return void
+    *
+    *   \par Description
+    *   Spawns the accepting coroutine and runs the executor until an unrecoverable error occurs.
+    *
+    */
+    void run();
+
+};
+
+#endif
@@ -0,0 +1,144 @@
+/*!	\file CoTask.h
+*	\brief  CoTask coroutine type header file.
+*   A CoTask is the return type of every coroutine in the server. \n
+*   A CoTask does not start until it is awaited or handed to a CoExecutor. Awaiting a CoTask runs it until it
+*   suspends, and resumes the awaiting coroutine when it completes, so handlers can be split into nested coroutines. \n
+*   A CoTask handed to CoExecutor::spawn is detached and frees itself when it completes. \n
+*
+*/
+
+#ifndef COTASK_H
+#define COTASK_H
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+
+/*!
+*   \struct CoPromiseBase
+*   \brief Promise state shared by every CoTask.
+*/
+struct CoPromiseBase{
+    /*!
+    *	\var std::coroutine_handle<> continuation - Coroutine awaiting this one, resumed on completion.
+    */
+    std::coroutine_handle<> continuation;
+    /*!
+    *	\var bool detached - Set when no coroutine owns the task; the frame is destroyed on completion.
+    */
+    bool detached = false;
+
+    /*!
+    *   \struct FinalAwaiter
+    *   \brief Transfers control to the continuation when the coroutine completes.
+    */
+    struct FinalAwaiter{
+        bool await_ready() noexcept {return false;}
+        template<typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            CoPromiseBase &promise = h.promise();
+            if (promise.continuation){
+                return promise.continuation;
+            }
+            if (promise.detached){
+                h.destroy();
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept {return {};}
+    FinalAwaiter final_suspend() noexcept {return {};}
+    void unhandled_exception(){std::terminate();}
+};
+
+/*!
+*   \struct CoPromise
+*   \brief Promise holding a CoTask's result.
+*/
+template<typename T>
+struct CoPromise : CoPromiseBase{
+    T value;
+    void return_value(T v){value = v;}
+};
+
+/*!
+*   \struct CoPromise<void>
+*   \brief Promise of a CoTask without a result.
+*/
+template<>
+struct CoPromise<void> : CoPromiseBase{
+    void return_void(){}
+};
+
+/*!
+ *	\class CoTask
+ *	\brief Lazily started, awaitable coroutine
+ *  \n
+ *   A CoTask does not start until it is awaited or handed to a CoExecutor. \n
+ *   Awaiting a CoTask yields its co_returned value. \n
+ */
+template<typename T = void>
+class CoTask
+{
+public:
+    struct promise_type : CoPromise<T>{
+        CoTask get_return_object(){return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));}
+    };
+
+private:
+    /*!
+    *	\var std::coroutine_handle<promise_type> handle - Owned coroutine frame, or null.
+    */
+    std::coroutine_handle<promise_type> handle;
+
+    explicit CoTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+public:
+    CoTask(CoTask &&other) noexcept : handle(other.handle) {other.handle = nullptr;}
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destroys the coroutine frame unless it was detached.
+    *	\return void
+    *
+    */
+    ~CoTask(){
+        if (handle){
+            handle.destroy();
+        }
+    }
+
+    /*!
+    *   \fn detach
+    *	\param None.
+    *	\brief Gives up ownership of the coroutine frame.
+    *	\return Handle to resume to start the coroutine.
+    *
+    *   \par Description
+    *   The frame destroys itself when the coroutine completes.
+    *
+    */
+    std::coroutine_handle<> detach(){
+        std::coroutine_handle<promise_type> h = handle;
+        handle = nullptr;
+        h.promise().detached = true;
+        return h;
+    }
+
+    bool await_ready() noexcept {return false;}
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    T await_resume(){
+        if constexpr (!std::is_void_v<T>){
+            return handle.promise().value;
+        }
+    }
+};
+
+#endif
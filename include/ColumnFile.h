@@ -0,0 +1,334 @@
+/*!	\file ColumnFile.h
+*	\brief  Define a columnar implementation of DataFile for Records.
+*   A ColumnFile stores Records as a struct of arrays: the month column and one float column per market-share field,
+*   each contiguous, so a scan over one field reads that field's bytes and nothing else. \n
+*   The file starts with a COLUMN_HEADER byte header holding the record count, followed by segments of COLUMN_SEGMENT records.
+*   A segment holds the five columns of its records one after the other, so a column grows one segment at a time
+*   without any existing data moving, and a column of a whole segment is read with one pread. \n
+*   The record count in the header, not the file size, tells how many records exist. Appends write the columns first
+*   and the count last, so a torn append leaves the file as it was. \n
+*   Every access is a pread or pwrite per column, synchronized like a CriticalFile.
+*   Reading whole records costs a system call per column, so the format pays off for scans of a few fields, not point reads. \n
+*
+*/
+
+#ifndef COLUMNFILE_H
+#define COLUMNFILE_H
+
+#include "DataFile.h"
+#include "SemaphoreSet.h"
+
+#define COLUMN_HEADER 4096
+#define COLUMN_SEGMENT 65536
+#define NUM_COLUMNS 5
+#define COLUMN_MAGIC 0x4c4f4352 // "RCOL"
+
+/*!
+*   \struct Column_Header
+*   \brief Header at the start of a columnar file.
+*/
+struct Column_Header{
+    uint32_t magic;   // COLUMN_MAGIC
+    int32_t records;  // number of records in the file
+    int32_t segment;  // COLUMN_SEGMENT the file was written with
+};
+
+/*!
+ *	\class ColumnFile
+ *	\brief Columnar DataFile of Records
+ *  \n
+*   A ColumnFile serves Record reads and writes by gathering and scattering the columns of a columnar file,
+*   and field scans by reading the field's column alone. \n
+*   Accesses are synchronized through its SemaphoreSet, or the file's LockStripes. \n
+ */
+class ColumnFile : public DataFile<Record>
+{
+private:
+    /*!
+    *	\var const int fd - Open file descriptor.
+    */
+    const int fd;
+    /*!
+    *	\var std::vector<uint32_t> columns - Scratch copy of the columns of the chunk being gathered or scattered.
+    */
+    std::vector<uint32_t> columns;
+
+    /*!
+    *   \fn column
+    *	\param float Record::* member : Field.
+    *	\brief Maps a field to its column.
+    *	\return Column number, or -1 for a member that is not a column.
+    *
+    */
+    static int column(float Record::* member);
+    /*!
+    *   \fn offset
+    *	\param int column : Column number, its member's index in Record.
+    *	\param long recordNumber : Record number.
+    *	\brief File offset of a record's value in a column.
+    *	\return Offset.
+    *
+    */
+    static off_t offset(int column, long recordNumber);
+    /*!
+    *   \fn numRecords
+    *	\param None.
+    *	\brief Reads the record count from the header.
+    *	\return Number of records, or -1 on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    long numRecords();
+    /*!
+    *   \fn setNumRecords
+    *	\param long records : New number of records.
+    *	\brief Writes the record count to the header.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    bool setNumRecords(long records);
+    /*!
+    *   \fn readColumn
+    *	\param int column : Column number.
+    *	\param long first : First record number.
+    *	\param int count : Number of values.
+    *	\param void *buf : Filled with the values.
+    *	\brief Reads consecutive values of a column.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Reads with one pread per segment spanned.
+    *   Operation is NOT synched.
+    */
+    bool readColumn(int column, long first, int count, void *buf);
+    /*!
+    *   \fn writeColumn
+    *	\param int column : Column number.
+    *	\param long first : First record number.
+    *	\param int count : Number of values.
+    *	\param const void *buf : Values to write.
+    *	\brief Writes consecutive values of a column.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Writes with one pwrite per segment spanned.
+    *   Operation is NOT synched.
+    */
+    bool writeColumn(int column, long first, int count, const void *buf);
+    /*!
+    *   \fn readRows
+    *	\param long first : First record number.
+    *	\param int count : Number of records.
+    *	\param Record *buf : Filled with the records.
+    *	\brief Gathers consecutive records from their columns.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    bool readRows(long first, int count, Record *buf);
+    /*!
+    *   \fn writeRows
+    *	\param long first : First record number.
+    *	\param int count : Number of records.
+    *	\param const Record *records : Records to write.
+    *	\brief Scatters consecutive records into their columns.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    bool writeRows(long first, int count, const Record *records);
+    /*!
+    *   \fn clamp
+    *	\param const int first : First record number of a range.
+    *	\param const int count : Number of records in the range.
+    *	\brief Cuts a range short at the end of the file.
+    *	\return Number of records of the range in the file, or -1 on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    long clamp(const int first, const int count);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int filedesc : Open file descriptor of an initialized columnar file.
+    *	\param SemaphoreSet sems : SemaphoreSet object representing initialized semaphores.
+    *	\brief Constructs a ColumnFile.
+    *	\return ColumnFile
+    *
+    *   \par Description
+    *   Sets the fd and sems members.
+    *
+    */
+    ColumnFile(const int filedesc, SemaphoreSet sems);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes the file.
+    *	\return void
+    *
+    *   \par Description
+    *   Calls close() on the file descriptor. Does NOT deallocate system semaphores.
+    *
+    */
+    ~ColumnFile() override;
+    /*!
+    *   \fn initialize
+    *	\param int fd : Open file descriptor.
+    *	\brief Checks a columnar file, writing the header of an empty one.
+    *	\return false if the file is not a columnar file written with this COLUMN_SEGMENT, or on error.
+    *
+    *   \par Description
+    *   Must be called before any ColumnFile of the file is used.
+    *
+    */
+    static bool initialize(int fd);
+    /*!
+    *   \fn readRecord
+    *	\param const int recordNumber : Record number to read
+    *	\param Record &buf : Buffer to read record into.
+    *	\brief Reads a record into the buffer.
+    *	\return false on error, true otherwise.
+    *
+    *   \par Description
+    *   Gathers the record with one pread per column.
+    *   Operation is read-synched, or reads a snapshot without locking with a version store set.
+    *
+    */
+    bool readRecord(const int recordNumber, Record &buf) override;
+    /*!
+    *   \fn readRecords
+    *	\param const int first : First record number to read
+    *	\param const int count : Number of records to read
+    *	\param std::vector<Record> &buf : Filled with the records read.
+    *	\brief Reads a contiguous range of records.
+    *	\return Number of records read, or -1 on error.
+    *
+    *   \par Description
+    *   Reads the records [first, first + count) that exist in the file, column by column.
+    *   Operation is read-synched once for the whole range.
+    *
+    */
+    int readRecords(const int first, const int count, std::vector<Record> &buf) override;
+    /*!
+    *   \fn scanRecords
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<bool(const Record*, int)> visit : Called with each chunk of records and its size. Returning false stops the scan.
+    *	\brief Scans a contiguous range of records in chunks.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    *   \par Description
+    *   Gathers a chunk of at most a segment at a time.
+    *   Operation is read-synched once for the whole scan.
+    *
+    */
+    int scanRecords(const int first, const int count, std::function<bool(const Record*, int)> visit) override;
+    /*!
+    *   \fn scanField
+    *	\param float Record::* member : Field to scan.
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<bool(const float*, int)> visit : Called with each chunk of the field's values and its size. Returning false stops the scan.
+    *	\brief Scans one field of a contiguous range of records in chunks.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    *   \par Description
+    *   Reads the field's column alone, one pread per segment.
+    *   Operation is read-synched once for the whole scan.
+    *
+    */
+    int scanField(float Record::* member, const int first, const int count, std::function<bool(const float*, int)> visit) override;
+    /*!
+    *   \fn selectRecords
+    *	\param float Record::* member : Field tested.
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<long(const float*, int, uint64_t*)> test : Called with each chunk of the field's values and its size,
+    *   sets bit i % 64 of word i / 64 for each value i to select, clears the others, and returns the number selected.
+    *	\param std::vector<Record> &matches : Selected records are appended to it, in file order.
+    *	\brief Selects the records of a contiguous range by one field.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    *   \par Description
+    *   Reads the field's column, and gathers the rest of a segment's records only if something in it was selected.
+    *   Operation is read-synched once for the whole scan.
+    *
+    */
+    int selectRecords(float Record::* member, const int first, const int count,
+        std::function<long(const float*, int, uint64_t*)> test, std::vector<Record> &matches) override;
+    /*!
+    *   \fn writeRecord
+    *	\param Record &record : Record to append
+    *	\brief Appends a record
+    *	\return false on error
+    *
+    *   \par Description
+    *   Writes the record's columns, then the new count.
+    *   Operation is write-synched.
+    *
+    */
+    bool writeRecord(Record &record) override;
+    /*!
+    *   \fn writeRecords
+    *	\param const Record *records : Records to append
+    *	\param const int count : Number of records
+    *	\brief Appends several records
+    *	\return false on error
+    *
+    *   \par Description
+    *   Writes the records column by column, then the new count, so nothing is appended if a write fails.
+    *   Operation is write-synched once for the whole batch.
+    *
+    */
+    bool writeRecords(const Record *records, const int count) override;
+    /*!
+    *   \fn writeBatch
+    *	\param std::vector<int> &positions : Record number to overwrite for each record, or -1 to append it. Appended records get their new number.
+    *	\param std::vector<Record> &records : Records to write.
+    *	\param void (*number)(Record&, int) : Called on each appended record with its new number before it is written, or NULL.
+    *	\brief Writes a batch of updates and appends atomically.
+    *	\return Number of records in the file before the batch, or -1 if nothing was written.
+    *
+    *   \par Description
+    *   Validates every position, saves the records the updates overwrite, and writes each record. The new count is written last.
+    *   If a write fails, the overwritten records are restored and the count left as it was.
+    *   Operation is write-synched once for the whole batch.
+    *
+    */
+    int writeBatch(std::vector<int> &positions, std::vector<Record> &records, void (*number)(Record &record, int recordNumber)) override;
+    /*!
+    *   \fn updateRecord
+    *	\param const int recordNumber : record to update
+    *	\param Record &record : new record information
+    *	\brief Updates a record.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Overwrites the record with one pwrite per column. Records past the end of the file are not created.
+    *   Operation is write-synched.
+    *
+    */
+    bool updateRecord(const int recordNumber, Record &record) override;
+    /*!
+    *   \fn checkNumRecords
+    *	\param none
+    *	\brief Counts records in file.
+    *	\return Number of records, or -1 on error
+    *
+    *   \par Description
+    *   Reads the count from the header.
+    *   Operation is read-synched.
+    *
+    */
+    int checkNumRecords() override;
+
+};
+
+#endif
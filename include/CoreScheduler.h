@@ -0,0 +1,281 @@
+/*!	\file CoreScheduler.h
+*	\brief  CoreScheduler class header file.
+*   A CoreScheduler services all clients from one process with one thread per core. \n
+*   Each core thread runs its own epoll loop and owns the connections it accepted. When a readable connection
+*   has received complete requests, it is queued as a task on the owning core's deque. \n
+*   Cores run tasks from the back of their own deque. A core with nothing to do steals from the front of another
+*   core's deque, so short reads and counts queued behind a long logReply() on one core are run by idle cores. \n
+*   Connections are registered with EPOLLONESHOT, so each connection has at most one task queued or running and its replies stay in order. \n
+*   Every connection opens its own descriptors for the binary and log files, since handlers on different threads
+*   must not share a file offset. The SysV semaphores synchronize threads exactly as they synchronize processes. \n
+*
+*/
+
+#ifndef CORESCHEDULER_H
+#define CORESCHEDULER_H
+
+#include "Server.h"
+#include <sys/epoll.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <map>
+
+/*!
+ *	\class CoreScheduler
+ *	\brief Thread-per-core server with a work-stealing request scheduler
+ *  \n
+ *   A CoreScheduler services all clients from one process with one thread per core. \n
+ *   Each core thread runs its own epoll loop and owns the connections it accepted. Requests become tasks on the
+ *   owning core's deque, and idle cores steal queued tasks from busy ones. \n
+ */
+class CoreScheduler
+{
+private:
+    /*!
+    *   \struct Core_Connection
+    *   \brief A client connection and the core that owns it.
+    */
+    struct Core_Connection{
+        Server *server;
+        int fd;
+        int owner;
+    };
+
+    /*!
+    *   \struct Core_Task
+    *   \brief A connection with received requests, waiting to be handled.
+    */
+    struct Core_Task{
+        Core_Connection *conn;
+    };
+
+    /*!
+    *   \struct Core
+    *   \brief Per-core event loop state, task deque and counters.
+    */
+    struct Core{
+        int index;
+        int epollfd;
+        int wakefd;
+        std::thread thread;
+        std::mutex queueLock;
+        std::deque<Core_Task> queue;
+        std::mutex connectionLock;
+        std::map<int, Core_Connection*> connections;
+        std::atomic<bool> idle;
+        std::atomic<bool> busy;
+        std::atomic<long> depth;
+        std::atomic<long> executed;
+        std::atomic<long> steals;
+        std::atomic<long> stolen;
+        std::atomic<long> accepted;
+    };
+
+    /*!
+    *	\var const int listenfd - Non-blocking listening socket shared by every core.
+    */
+    const int listenfd;
+    /*!
+    *	\var const char *binPath, *logPath - Files opened for each connection.
+    */
+    const char *binPath;
+    const char *logPath;
+    /*!
+    *	\var const int semid - Established system semaphore set id.
+    */
+    const int semid;
+    /*!
+    *	\var const int numCores - Number of core threads.
+    */
+    const int numCores;
+    /*!
+    *	\var Core *cores - Core states.
+    */
+    Core *cores;
+    /*!
+    *	\var std::atomic<bool> stopping - Set by stop; each core thread returns once its current task is done.
+    */
+    std::atomic<bool> stopping;
+
+    /*!
+    *   \fn coreLoop
+    *	\param Core &core : The calling thread's core.
+    *	\brief Core thread lifetime.
+    *	\return void
+    *
+    *   \par Description
+    *   Pins the thread to its core, then alternates between reading requests from ready connections
+    *   and running tasks, stealing from other cores when its own deque is empty.
+    *
+    */
+    void coreLoop(Core &core);
+    /*!
+    *   \fn acceptConnections
+    *	\param Core &core : The accepting core, which becomes the owner.
+    *	\brief Accepts pending connections.
+    *	\return void
+    *
+    */
+    void acceptConnections(Core &core);
+    /*!
+    *   \fn readRequest
+    *	\param Core &core : The owning core.
+    *	\param Core_Connection *conn : Readable connection.
+    *	\brief Queues a task for a connection's received requests.
+    *	\return void
+    *
+    *   \par Description
+    *   Receives from the connection and, once a request is complete, pushes it onto the owning core's deque.
+    *   Closes the connection on disconnection.
+    *
+    */
+    void readRequest(Core &core, Core_Connection *conn);
+    /*!
+    *   \fn pollEvents
+    *	\param Core &core : The calling thread's core.
+    *	\param Core &owner : Core whose epoll instance is polled.
+    *	\param int timeout : epoll_wait timeout in milliseconds.
+    *	\brief Turns ready connections into tasks.
+    *	\return Number of events handled, or -1 on error.
+    *
+    *   \par Description
+    *   Accepts new connections and reads requests from readable ones, queueing them on the owner's deque.
+    *   An idle core calls this on a busy core's epoll instance, so requests arriving behind a long task are queued where they can be stolen.
+    *
+    */
+    int pollEvents(Core &core, Core &owner, int timeout);
+    /*!
+    *   \fn pushTask
+    *	\param Core &core : The owning core.
+    *	\param Core_Task &task : The task.
+    *	\brief Queues a task and wakes an idle core if the owner has a backlog.
+    *	\return void
+    *
+    */
+    void pushTask(Core &core, Core_Task &task);
+    /*!
+    *   \fn popTask
+    *	\param Core &core : The calling core.
+    *	\param Core_Task &task : Filled with the task.
+    *	\brief Takes the newest task from the core's own deque.
+    *	\return false if the deque is empty.
+    *
+    */
+    bool popTask(Core &core, Core_Task &task);
+    /*!
+    *   \fn stealTask
+    *	\param Core &thief : The idle core.
+    *	\param Core_Task &task : Filled with the stolen task.
+    *	\brief Takes the oldest task from the most loaded other core.
+    *	\return false if no other core has queued tasks.
+    *
+    */
+    bool stealTask(Core &thief, Core_Task &task);
+    /*!
+    *   \fn othersPending
+    *	\param Core &core : The calling core.
+    *	\param bool &busy : Set if another core is running a task.
+    *	\brief Checks the other cores for queued tasks.
+    *	\return true if another core has queued tasks.
+    *
+    */
+    bool othersPending(Core &core, bool &busy);
+    /*!
+    *   \fn runTask
+    *	\param Core &core : The core running the task.
+    *	\param Core_Task &task : The task.
+    *	\brief Handles a connection's requests and re-arms it.
+    *	\return void
+    *
+    */
+    void runTask(Core &core, Core_Task &task);
+    /*!
+    *   \fn drainConnection
+    *	\param Core &core : The owning core.
+    *	\param Core_Connection *conn : Writable connection.
+    *	\brief Sends a connection's buffered replies.
+    *	\return void
+    *
+    *   \par Description
+    *   A connection whose replies did not fit in its socket is armed for EPOLLOUT instead of EPOLLIN, so it is
+    *   not read again, and no core blocks on it, until the client has taken them.
+    *
+    */
+    void drainConnection(Core &core, Core_Connection *conn);
+    /*!
+    *   \fn closeConnection
+    *	\param Core &core : The owning core.
+    *	\param Core_Connection *conn : Connection.
+    *	\brief Closes a connection.
+    *	\return void
+    *
+    */
+    void closeConnection(Core &core, Core_Connection *conn);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int listenfd : Non-blocking listening socket descriptor.
+    *	\param const char *binPath : Binary file path.
+    *	\param const char *logPath : Log file path.
+    *	\param const int semid : Established system semaphore set id.
+    *	\param const int numCores : Number of core threads.
+    *	\brief Constructs a CoreScheduler.
+    *	\return CoreScheduler
+    *
+    *   \par Description
+    *   Creates one epoll instance per core and registers the listener with each.
+    *
+    */
+    CoreScheduler(const int listenfd, const char *binPath, const char *logPath, const int semid, const int numCores);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor.
+    *	\return void
+    *
+    *   \par Description
+    *   Core threads that were not stopped are detached; the destructor only releases the core states.
+    *
+    */
+    ~CoreScheduler();
+    /*!
+    *   \fn start
+    *	\param None.
+    *	\brief Starts the core threads.
+    *	\return void
+    *
+    *   \par Description
+    *   The threads inherit the caller's signal mask, so signals should be blocked before calling.
+    *
+    */
+    void start();
+    /*!
+    *   \fn stop
+    *	\param None.
+    *	\brief Stops the core threads.
+    *	\return void
+    *
+    *   \par Description
+    *   Wakes every core and waits for its thread to finish the task it is running and return.
+    *   Once it returns, no request is being handled, so the data files and indexes can be closed.
+    *
+    */
+    void stop();
+    /*!
+    *   \fn printStats
+    *	\param None.
+    *	\brief Prints per-core counters.
+    *	\return void
+    *
+    *   \par Description
+    *   Prints, for every core, the connections it accepted, its current queue depth, tasks run, tasks it stole and tasks stolen from it.
+    *
+    */
+    void printStats();
+
+};
+
+#endif
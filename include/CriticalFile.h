@@ -3,15 +3,18 @@
 *   A CriticalFile object represents an open file which is read from and written to concurrently, conferring a critical section. \n
 *   The file is a binary file whose contents are structured using the struct type used to construct the object. \n
 *   A CriticalFile object supports read, update, append, and record count operations on the file. \n
-*   Accesses are synchronized through its SemaphoreSet member. \n
+*   Accesses are synchronized through its SemaphoreSet, or the file's LockStripes. \n
+*   It is the system call implementation of DataFile. Every access is a pread or pwrite at the record's offset, so the
+*   file offset, which forked servers share through their inherited descriptor, is never used and concurrent readers run in parallel. \n
 *   
 */
 
 #ifndef CRITICALFILE_H 
 #define CRITICALFILE_H   
 
-#include "Packets.h"
+#include "DataFile.h"
 #include "SemaphoreSet.h"
+#include "BufferPool.h"
 
 /*!
  *	\class CriticalFile
@@ -20,10 +23,10 @@
 *   A CriticalFile object represents an open file which is read from and written to concurrently, conferring a critical section. \n
 *   The file is a binary file whose contents are structured using the struct type used to construct the object. \n
 *   A CriticalFile object supports read, update, append, and record count operations on the file. \n
-*   Accesses are synchronized through its SemaphoreSet member. \n
+*   Accesses are synchronized through its SemaphoreSet, or the file's LockStripes. \n
  */
 template<typename T>
-class CriticalFile
+class CriticalFile : public DataFile<T>
 {
 private:
     /*!
@@ -31,21 +34,46 @@ private:
     */
     const int fd;
     /*!
-    *	\var SemaphoreSet sems - Semaphore set object to synchronize access.
+    *	\var BufferPool *pool - Shared page cache consulted before the file, or NULL.
     */
-    SemaphoreSet sems;
+    BufferPool *pool;
 
     /*!
-    *   \fn seekRecord
-    *	\param const int recordNumber : record to seek to
-    *	\brief Seeks to record
+    *   \fn fileSize
+    *	\param None.
+    *	\brief Size of the file in bytes.
+    *	\return Size, or -1 on error.
+    *   
+    *   \par Description
+    *   Reads the size with fstat, leaving the shared file offset alone.
+    *   Operation is NOT synched. 
+    */
+    off_t fileSize();
+    /*!
+    *   \fn writeAt
+    *	\param const void *buf : Bytes to write
+    *	\param size_t size : Number of bytes
+    *	\param off_t offset : File offset to write them at
+    *	\brief Writes a buffer at an offset.
     *	\return false on error.
     *   
     *   \par Description
-    *   Moves file pointer to specified record.
+    *   Calls pwrite until the whole buffer is written.
     *   Operation is NOT synched. 
     */
-    bool seekRecord(const int recordNumber);
+    bool writeAt(const void *buf, size_t size, off_t offset);
+    /*!
+    *   \fn readPage
+    *	\param const int recordNumber : Record number to read
+    *	\param T &buf : Buffer to read record into.
+    *	\brief Reads a record's page into the pool.
+    *	\return false on error, or if the record is past the end of the file.
+    *   
+    *   \par Description
+    *   Reads the POOL_PAGE_RECORDS records of the page holding the record with one pread, and caches them.
+    *   Operation is read-synched.
+    */
+    bool readPage(const int recordNumber, T &buf);
 
 public:
     /*!
@@ -61,6 +89,18 @@ public:
     */
     CriticalFile(const int filedesc, SemaphoreSet sems);
     /*!
+    *   \fn setPool
+    *	\param BufferPool *pool : Shared page cache of this file, or NULL.
+    *	\brief Caches the file's records in a BufferPool.
+    *	\return void
+    *   
+    *   \par Description
+    *   Once set, readRecord is served from the pool when it can be, a miss loads the record's whole page into it,
+    *   and updates are written through to it. Every CriticalFile of the file must use the same pool.
+    *
+    */
+    void setPool(BufferPool *pool){this->pool = pool;}
+    /*!
     *   \fn Destructor
     *	\param None.
     *	\brief Destructor. Closes the file.
@@ -70,7 +110,7 @@ public:
     *   Calls close() on the file descriptor. Does NOT deallocate system semaphores.
     *
     */
-    ~CriticalFile();
+    ~CriticalFile() override;
     /*!
     *   \fn readRecord
     *	\param const int recordNumber : Record number to read
@@ -79,11 +119,40 @@ public:
     *	\return false on error, true otherwise.
     *   
     *   \par Description
-    *   Reads the specified record into the template type buffer.
-    *   Operation is read-synched.
+    *   Reads the specified record into the template type buffer with one pread.
+    *   With a pool set, a cached record is copied out of the pool without locking the file. Otherwise its page is read and cached.
+    *   Operation is read-synched, or reads a snapshot without locking with a version store set.
     *
     */
-    bool readRecord(const int recordNumber, T &buf);
+    bool readRecord(const int recordNumber, T &buf) override;
+    /*!
+    *   \fn readRecords
+    *	\param const int first : First record number to read
+    *	\param const int count : Number of records to read
+    *	\param std::vector<T> &buf : Filled with the records read.
+    *	\brief Reads a contiguous range of records.
+    *	\return Number of records read, or -1 on error.
+    *   
+    *   \par Description
+    *   Reads the records [first, first + count) that exist in the file with one pread. 
+    *   Operation is read-synched once for the whole range.
+    *
+    */
+    int readRecords(const int first, const int count, std::vector<T> &buf) override;
+    /*!
+    *   \fn scanRecords
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<bool(const T*, int)> visit : Called with each chunk of records and its size. Returning false stops the scan.
+    *	\brief Scans a contiguous range of records in chunks.
+    *	\return Number of records scanned, or -1 on error.
+    *   
+    *   \par Description
+    *   Reads the records [first, first + count) that exist in the file one chunk at a time, with one pread per chunk. 
+    *   Operation is read-synched once for the whole scan, so every chunk comes from the same version of the file.
+    *
+    */
+    int scanRecords(const int first, const int count, std::function<bool(const T*, int)> visit) override;
     /*!
     *   \fn writeRecord
     *	\param T &record : Record to append
@@ -91,11 +160,39 @@ public:
     *	\return false on error
     *   
     *   \par Description
-    *   Appends a template type record onto the file. 
+    *   Appends a template type record onto the file with a pwrite at its end. 
     *   Operation is write-synched.
     *
     */
-    bool writeRecord(T &record);
+    bool writeRecord(T &record) override;
+    /*!
+    *   \fn writeRecords
+    *	\param const T *records : Records to append
+    *	\param const int count : Number of records
+    *	\brief Appends several records
+    *	\return false on error
+    *   
+    *   \par Description
+    *   Appends count template type records onto the file with one pwrite at its end, truncating them away if it fails. 
+    *   Operation is write-synched once for the whole batch.
+    *
+    */
+    bool writeRecords(const T *records, const int count) override;
+    /*!
+    *   \fn writeBatch
+    *	\param std::vector<int> &positions : Record number to overwrite for each record, or -1 to append it. Appended records get their new number.
+    *	\param std::vector<T> &records : Records to write.
+    *	\param void (*number)(T&, int) : Called on each appended record with its new number before it is written, or NULL.
+    *	\brief Writes a batch of updates and appends atomically.
+    *	\return Number of records in the file before the batch, or -1 if nothing was written.
+    *   
+    *   \par Description
+    *   Validates every position, then writes each run of consecutive records with one pwritev. 
+    *   If a write fails, the overwritten records are restored and the appended ones truncated away. 
+    *   Operation is write-synched once for the whole batch.
+    *
+    */
+    int writeBatch(std::vector<int> &positions, std::vector<T> &records, void (*number)(T &record, int recordNumber)) override;
     /*!
     *   \fn updateRecord
     *	\param const int recordNumber : record to update 
@@ -104,11 +201,11 @@ public:
     *	\return false on error.
     *   
     *   \par Description
-    *   Overwrites the specified record with the new template type data.
+    *   Overwrites the specified record with the new template type data with one pwrite, and in the pool if it is cached.
     *   Operation is write-synched.
     *
     */
-    bool updateRecord(const int recordNumber, T &record);
+    bool updateRecord(const int recordNumber, T &record) override;
     /*!
     *   \fn checkNumRecords
     *	\param none 
@@ -119,7 +216,7 @@ public:
     *   Counts the number of template type structs of data are in the file.
     *
     */
-    int checkNumRecords();
+    int checkNumRecords() override;
 
 };
 
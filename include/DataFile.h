@@ -0,0 +1,501 @@
+/*!	\file DataFile.h
+*	\brief  Define the interface of a file of fixed size records shared between servers.
+*   A DataFile is a binary file whose contents are an array of the struct type used to instantiate it, read from
+*   and written to concurrently by every server process and thread. \n
+*   CriticalFile implements it with a system call per access, MappedFile with loads and stores into a shared mapping of the file,
+*   ColumnFile with a system call per column, over a file storing each field in its own contiguous column,
+*   and LogFile by appending every write to a log-structured file and reading records where its index points. \n
+*   The server picks one storage engine at startup, and every Server accesses its binary file through this interface. \n
+*   Either engine can log its writes to a WriteAheadLog, in which case a write returns only once it is durable. \n
+*   Given a VersionStore, readRecord reads a snapshot without the reader lock, and writes stamp versions of what they overwrite. \n
+*   Every operation locks the records it touches through the lock helpers below: with the file's SemaphoreSet, one
+*   readers-writers lock covers the whole file, and given LockStripes, only the stripes of those records are locked,
+*   and appends take the tail lock first. \n
+*   A file kept in several parts that can be scanned concurrently, such as a ShardedFile, reports them through partitions. \n
+*
+*/
+
+#ifndef DATAFILE_H
+#define DATAFILE_H
+
+#include "Packets.h"
+#include "WriteAheadLog.h"
+#include "VersionStore.h"
+#include "LockStripes.h"
+#include "SemaphoreSet.h"
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <thread>
+
+/*!
+ *   \enum Storage_Engine
+ *   \brief How a DataFile reaches the file contents.
+ */
+enum Storage_Engine
+{
+    STORAGE_SYSCALL, // CriticalFile: pread/pwrite per access
+    STORAGE_MMAP,    // MappedFile: memory loads and stores into a shared mapping
+    STORAGE_COLUMNS, // ColumnFile: pread/pwrite per column of a columnar file
+    STORAGE_LOG      // LogFile: appends to a log-structured file, read through a shared index
+};
+
+/*!
+ *	\class DataFile
+ *	\brief DataFile template interface
+ *  \n
+*   A DataFile is a binary file of template type records read from and written to concurrently, conferring a critical section. \n
+*   Implementations synchronize every operation with the readers-writers algorithm, so a reader never sees a partial write. \n
+ */
+template<typename T>
+class DataFile
+{
+protected:
+    /*!
+    *	\var SemaphoreSet sems - Readers-writers lock of the whole file, used without stripes.
+    */
+    SemaphoreSet sems;
+    /*!
+    *	\var LockStripes *stripes - Shared per-record locks of the file, or NULL to lock the whole file with sems.
+    */
+    LockStripes *stripes;
+    /*!
+    *	\var std::atomic<std::thread::id> tailOwner - Thread holding the whole file lock for an append, whose record locks are
+    *   taken already. Threads of a process may share a DataFile, so the others still lock.
+    */
+    std::atomic<std::thread::id> tailOwner;
+
+    /*!
+    *   \fn lockRange
+    *	\param long first : First record number.
+    *	\param long count : Number of records.
+    *	\param bool write : Lock for writing instead of reading.
+    *	\brief Locks a range of records.
+    *	\return void
+    *
+    *   \par Description
+    *   Takes the stripes of the records, or the whole file lock unless an append holds it already.
+    */
+    void lockRange(long first, long count, bool write){
+        if (stripes != NULL){
+            stripes->lockRange(first, count, write);
+        }
+        else if (tailOwner.load() != std::this_thread::get_id()){
+            write ? sems.writerLock() : sems.readerLock();
+        }
+    }
+    /*!
+    *   \fn unlockRange
+    *	\param long first : First record number.
+    *	\param long count : Number of records.
+    *	\param bool write : Locked for writing instead of reading.
+    *	\brief Unlocks what lockRange locked.
+    *	\return void
+    */
+    void unlockRange(long first, long count, bool write){
+        if (stripes != NULL){
+            stripes->unlockRange(first, count, write);
+        }
+        else if (tailOwner.load() != std::this_thread::get_id()){
+            write ? sems.writerUnlock() : sems.readerUnlock();
+        }
+    }
+    /*!
+    *   \fn lockRecords
+    *	\param const int *recordNumbers : Record numbers.
+    *	\param int count : Number of records.
+    *	\brief Locks a set of records for writing.
+    *	\return void
+    *
+    *   \par Description
+    *   Takes the stripes of the records, or the whole file lock unless an append holds it already.
+    */
+    void lockRecords(const int *recordNumbers, int count){
+        if (stripes != NULL){
+            stripes->lockRecords(recordNumbers, count, true);
+        }
+        else if (tailOwner.load() != std::this_thread::get_id()){
+            sems.writerLock();
+        }
+    }
+    /*!
+    *   \fn unlockRecords
+    *	\param const int *recordNumbers : Record numbers passed to lockRecords.
+    *	\param int count : Number of records.
+    *	\brief Unlocks what lockRecords locked.
+    *	\return void
+    */
+    void unlockRecords(const int *recordNumbers, int count){
+        if (stripes != NULL){
+            stripes->unlockRecords(recordNumbers, count, true);
+        }
+        else if (tailOwner.load() != std::this_thread::get_id()){
+            sems.writerUnlock();
+        }
+    }
+    /*!
+    *   \fn lockTail
+    *	\param None.
+    *	\brief Locks the end of the file for an append.
+    *	\return void
+    *
+    *   \par Description
+    *   Takes the tail lock, or the whole file lock, before any record lock. The records appended must then be locked too.
+    */
+    void lockTail(){
+        if (stripes != NULL){
+            stripes->lockTail();
+        }
+        else{
+            sems.writerLock();
+            tailOwner = std::this_thread::get_id();
+        }
+    }
+    /*!
+    *   \fn unlockTail
+    *	\param None.
+    *	\brief Unlocks the end of the file, after the records appended.
+    *	\return void
+    */
+    void unlockTail(){
+        if (stripes != NULL){
+            stripes->unlockTail();
+        }
+        else{
+            tailOwner = std::thread::id();
+            sems.writerUnlock();
+        }
+    }
+    /*!
+    *	\var WriteAheadLog *wal - Log every write goes to before it returns, or NULL.
+    */
+    WriteAheadLog *wal;
+
+    /*!
+    *   \fn unlockBatch
+    *	\param const std::vector<int> &positions : Record numbers of a batch, locked with lockRecords.
+    *	\param bool appends : The batch appended, under the tail lock.
+    *	\brief Unlocks a batch's records, then the tail.
+    *	\return void
+    */
+    void unlockBatch(const std::vector<int> &positions, bool appends){
+        unlockRecords(positions.data(), (int) positions.size());
+        if (appends){
+            unlockTail();
+        }
+    }
+    /*!
+    *   \fn logWrites
+    *	\param int fd : Open file descriptor of the file written.
+    *	\param const int *recordNumbers : Record number of each record about to be written.
+    *	\param const T *records : Records about to be written.
+    *	\param int count : Number of records.
+    *	\brief Logs records about to be written to the file, and waits for them to be durable.
+    *	\return Log sequence number to pass to appliedWrites, or -1 if they could not be logged; nothing must be written then.
+    *
+    *   \par Description
+    *   Does nothing without a log. A full log is checkpointed first, after syncing the file.
+    *   Must be called under the write locks of the records, before any of them is written.
+    */
+    long logWrites(int fd, const int *recordNumbers, const T *records, int count){
+        if (wal == NULL){
+            return 0;
+        }
+        long lsn = wal->append(fd, recordNumbers, records, count, sizeof(T));
+        if (lsn >= 0 && !wal->commit(lsn)){
+            appliedWrites(lsn, false);
+            return -1;
+        }
+        return lsn;
+    }
+    /*!
+    *   \fn appliedWrites
+    *	\param long lsn : Log sequence number returned by logWrites.
+    *	\param bool written : Whether the records reached the file.
+    *	\brief Ends logged writes, cancelling them in the log if they were not written.
+    *	\return void
+    *
+    *   \par Description
+    *   Does nothing without a log. Must be called right after writing the records, before publishing them,
+    *   since a checkpoint waits for every logged write to end.
+    */
+    void appliedWrites(long lsn, bool written){
+        if (wal == NULL){
+            return;
+        }
+        if (!written){
+            wal->cancel(lsn, sizeof(T));
+        }
+        wal->applied();
+    }
+    /*!
+    *	\var VersionStore *versions - Versions of the records written, for reads without the reader lock, or NULL.
+    */
+    VersionStore *versions;
+
+    /*!
+    *   \fn snapshotRead
+    *	\param int recordNumber : Record number to read.
+    *	\param T &buf : Buffer to read the record into.
+    *	\param std::function<bool(T&)> load : Reads the record from the file without any lock, false if it is not there.
+    *	\brief Reads a record as of a snapshot, without the reader lock.
+    *	\return VERSION_READ, VERSION_ABSENT, or VERSION_LOCKED to read under the reader lock instead.
+    *
+    */
+    int snapshotRead(int recordNumber, T &buf, std::function<bool(T&)> load){
+        return versions->read(recordNumber, &buf, [&](void *record){return load(*(T *) record);});
+    }
+    /*!
+    *   \fn beginWrites
+    *	\param const int *recordNumbers : Records about to be overwritten.
+    *	\param const T *records : New contents.
+    *	\param int count : Number of records.
+    *	\param long numRecords : Records in the file before the write, or -1 if unknown.
+    *	\param std::function<bool(int, T&)> current : Reads a record's current contents from the file.
+    *	\brief Stamps the records a write overwrites as versions.
+    *	\return Commit sequence number to pass to publishWrites or abortWrites.
+    *
+    *   \par Description
+    *   Does nothing without a version store. Appends are not passed, only counted by publishWrites.
+    *   Must be called under the write locks of the records, before the file is written.
+    */
+    uint64_t beginWrites(const int *recordNumbers, const T *records, int count, long numRecords, std::function<bool(int, T&)> current){
+        if (versions == NULL){
+            return 0;
+        }
+        return versions->begin(recordNumbers, records, count, numRecords,
+            [&](int recordNumber, void *record){return current(recordNumber, *(T *) record);});
+    }
+    /*!
+    *   \fn publishWrites
+    *	\param uint64_t commit : Commit sequence number returned by beginWrites.
+    *	\param long numRecords : Records in the file after the write, or -1 if unchanged.
+    *	\brief Makes a write visible to snapshot reads.
+    *	\return void
+    *
+    *   \par Description
+    *   Does nothing without a version store. Must be called under the write locks of the records, once the file is written.
+    */
+    void publishWrites(uint64_t commit, long numRecords){
+        if (versions != NULL){
+            versions->publish(commit, numRecords);
+        }
+    }
+    /*!
+    *   \fn abortWrites
+    *	\param uint64_t commit : Commit sequence number returned by beginWrites.
+    *	\brief Discards the versions of a write that was rolled back.
+    *	\return void
+    *
+    *   \par Description
+    *   Does nothing without a version store. Must be called under the write locks of the records.
+    */
+    void abortWrites(uint64_t commit){
+        if (versions != NULL){
+            versions->abort(commit);
+        }
+    }
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param SemaphoreSet sems : Readers-writers lock of the whole file.
+    *	\brief Constructs a DataFile without stripes, a log or versions.
+    *	\return DataFile
+    *
+    */
+    DataFile(SemaphoreSet sems) : sems(sems), stripes(NULL), tailOwner(std::thread::id()), wal(NULL), versions(NULL){}
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes the file.
+    *	\return void
+    *
+    */
+    virtual ~DataFile(){}
+    /*!
+    *   \fn setLog
+    *	\param WriteAheadLog *wal : Shared log of this file, or NULL.
+    *	\brief Logs the file's writes to a WriteAheadLog.
+    *	\return void
+    *
+    *   \par Description
+    *   Once set, every write is logged under the records' write locks and returns once the log is synced past it.
+    *   Every DataFile of the file must use the same log.
+    *
+    */
+    void setLog(WriteAheadLog *wal){this->wal = wal;}
+    /*!
+    *   \fn setVersions
+    *	\param VersionStore *versions : Shared version store of this file, of records of sizeof(T) bytes, or NULL.
+    *	\brief Serves readRecord from snapshots instead of under the reader lock.
+    *	\return void
+    *
+    *   \par Description
+    *   Once set, writes stamp versions of the records they overwrite and publish them under the records' write locks.
+    *   Every DataFile of the file must use the same store, or readers may see partial writes.
+    *
+    */
+    void setVersions(VersionStore *versions){this->versions = versions;}
+    /*!
+    *   \fn setStripes
+    *	\param LockStripes *stripes : Shared per-record locks of this file, or NULL.
+    *	\brief Locks the records each operation touches instead of the whole file.
+    *	\return void
+    *
+    *   \par Description
+    *   Every DataFile of the file must use the same stripes, or none of them.
+    *
+    */
+    void setStripes(LockStripes *stripes){this->stripes = stripes;}
+    /*!
+    *   \fn readRecord
+    *	\param const int recordNumber : Record number to read
+    *	\param T &buf : Buffer to read record into.
+    *	\brief Reads a record into the buffer.
+    *	\return false on error, true otherwise.
+    *
+    */
+    virtual bool readRecord(const int recordNumber, T &buf) = 0;
+    /*!
+    *   \fn readRecords
+    *	\param const int first : First record number to read
+    *	\param const int count : Number of records to read
+    *	\param std::vector<T> &buf : Filled with the records read.
+    *	\brief Reads a contiguous range of records.
+    *	\return Number of records read, or -1 on error.
+    *
+    */
+    virtual int readRecords(const int first, const int count, std::vector<T> &buf) = 0;
+    /*!
+    *   \fn scanRecords
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<bool(const T*, int)> visit : Called with each chunk of records and its size. Returning false stops the scan.
+    *	\brief Scans a contiguous range of records in chunks.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    */
+    virtual int scanRecords(const int first, const int count, std::function<bool(const T*, int)> visit) = 0;
+    /*!
+    *   \fn scanField
+    *	\param float T::* member : Field to scan.
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<bool(const float*, int)> visit : Called with each chunk of the field's values and its size. Returning false stops the scan.
+    *	\brief Scans one field of a contiguous range of records in chunks.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    *   \par Description
+    *   Copies the field out of each chunk of scanRecords. A columnar file overrides it to read the field's column alone.
+    *
+    */
+    virtual int scanField(float T::* member, const int first, const int count, std::function<bool(const float*, int)> visit){
+        std::vector<float> values;
+        return scanRecords(first, count, [&](const T *records, int n){
+            values.resize(n);
+            for (int i = 0; i < n; i++){
+                values[i] = records[i].*member;
+            }
+            return visit(values.data(), n);
+        });
+    }
+    /*!
+    *   \fn selectRecords
+    *	\param float T::* member : Field tested.
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<long(const float*, int, uint64_t*)> test : Called with each chunk of the field's values and its size,
+    *   sets bit i % 64 of word i / 64 for each value i to select, clears the others, and returns the number selected.
+    *	\param std::vector<T> &matches : Selected records are appended to it, in file order.
+    *	\brief Selects the records of a contiguous range by one field.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    *   \par Description
+    *   Tests the field copied out of each chunk of scanRecords. A columnar file overrides it to read the field's column alone,
+    *   and the other columns only for the chunks where something was selected.
+    *
+    */
+    virtual int selectRecords(float T::* member, const int first, const int count,
+        std::function<long(const float*, int, uint64_t*)> test, std::vector<T> &matches){
+        std::vector<float> values;
+        std::vector<uint64_t> selected;
+        return scanRecords(first, count, [&](const T *records, int n){
+            values.resize(n);
+            selected.resize((n + 63) / 64);
+            for (int i = 0; i < n; i++){
+                values[i] = records[i].*member;
+            }
+            if (test(values.data(), n, selected.data()) == 0){
+                return true;
+            }
+            for (size_t w = 0; w < selected.size(); w++){
+                for (uint64_t bits = selected[w]; bits; bits &= bits - 1){
+                    matches.push_back(records[w * 64 + __builtin_ctzll(bits)]);
+                }
+            }
+            return true;
+        });
+    }
+    /*!
+    *   \fn writeRecord
+    *	\param T &record : Record to append
+    *	\brief Appends a record
+    *	\return false on error
+    *
+    */
+    virtual bool writeRecord(T &record) = 0;
+    /*!
+    *   \fn writeRecords
+    *	\param const T *records : Records to append
+    *	\param const int count : Number of records
+    *	\brief Appends several records
+    *	\return false on error
+    *
+    */
+    virtual bool writeRecords(const T *records, const int count) = 0;
+    /*!
+    *   \fn writeBatch
+    *	\param std::vector<int> &positions : Record number to overwrite for each record, or -1 to append it. Appended records get their new number.
+    *	\param std::vector<T> &records : Records to write.
+    *	\param void (*number)(T&, int) : Called on each appended record with its new number before it is written, or NULL.
+    *	\brief Writes a batch of updates and appends atomically.
+    *	\return Number of records in the file before the batch, or -1 if nothing was written.
+    *
+    */
+    virtual int writeBatch(std::vector<int> &positions, std::vector<T> &records, void (*number)(T &record, int recordNumber)) = 0;
+    /*!
+    *   \fn updateRecord
+    *	\param const int recordNumber : record to update
+    *	\param T &record : new record information
+    *	\brief Updates a record.
+    *	\return false on error.
+    *
+    */
+    virtual bool updateRecord(const int recordNumber, T &record) = 0;
+    /*!
+    *   \fn checkNumRecords
+    *	\param none
+    *	\brief Counts records in file.
+    *	\return Number of records, or -1 on error
+    *
+    */
+    virtual int checkNumRecords() = 0;
+    /*!
+    *   \fn partitions
+    *	\param const int first : First record number
+    *	\param const int count : Number of records
+    *	\brief Splits a range of records into parts that can be scanned concurrently.
+    *	\return (first, count) of each part, in file order.
+    *
+    *   \par Description
+    *   A single file has one part, the whole range. A ShardedFile has one per shard the range covers.
+    *
+    */
+    virtual std::vector<std::pair<int, int>> partitions(const int first, const int count){
+        return std::vector<std::pair<int, int>>(1, std::make_pair(first, count));
+    }
+
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*!	\file DatasetCache.h
+*	\brief  DatasetCache class header file.
+*   A DatasetCache lets one server serve named datasets besides its data file. Each is a record file of its own,
+*   DATASET_DIR/<name>.bin, with its own readers-writers lock, selected by a client for the requests it sends after. \n
+*   A dataset's semaphores are created the first time any server process opens it, and registered with its name in an
+*   anonymous shared mapping created at startup, so every process forked afterwards finds them there, and the server removes
+*   them all at shutdown. At most DATASET_MAX datasets are registered per run. \n
+*   Each process keeps the CriticalFile handles it opened in a cache of at most the configured number, dropping the least
+*   recently used one past that. A handle still in use by a connection stays open until the connection lets go of it. \n
+*   Given shard boundaries, datasets are created sharded: DATASET_DIR/<name>/ holds a ShardedFile's shard files, and their
+*   semaphores hold a set per shard after the dataset's append lock. A sharded dataset keeps the boundaries it was created
+*   with in its directory, so it is opened and extended as it was created, whatever the boundaries of this run. \n
+*   Named datasets are plain system call files: the buffer pool, write-ahead log, snapshots, lock stripes, field indexes and
+*   keyed records all belong to the server's data file. \n
+*
+*/
+
+#ifndef DATASETCACHE_H
+#define DATASETCACHE_H
+
+#include "CriticalFile.h"
+#include "ShardedFile.h"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+
+#define DATASET_DIR "data/tables"
+#define DATASET_MAX 256
+
+/*!
+*   \struct Dataset_Stats
+*   \brief Snapshot of a DatasetCache's counters.
+*/
+struct Dataset_Stats{
+    long hits;      // opens served by a cached handle
+    long misses;    // opens of a file
+    long evictions; // handles dropped from a full cache
+    long datasets;  // datasets registered
+    long sharded;   // of which sharded
+};
+
+/*!
+ *	\class DatasetCache
+ *	\brief Registry of named datasets and cache of their open files
+ *  \n
+ *   A DatasetCache maps dataset names to their semaphores for every server process, and to open files for its own. \n
+ */
+class DatasetCache
+{
+private:
+    /*!
+    *   \struct Dataset_Entry
+    *   \brief A registered dataset.
+    */
+    struct Dataset_Entry{
+        char name[DATASET_NAME_MAX];
+        int semid;
+        int sets; // 1, or SHARD_SEMAPHORE_SETS for a sharded dataset
+    };
+    /*!
+    *   \struct Dataset_Registry
+    *   \brief Shared state: the registered datasets and the counters.
+    */
+    struct Dataset_Registry{
+        pthread_mutex_t registering;
+        int count;
+        Dataset_Entry entries[DATASET_MAX];
+        std::atomic<long> hits;
+        std::atomic<long> misses;
+        std::atomic<long> evictions;
+    };
+
+    /*!
+    *	\var Dataset_Registry *registry - Shared registry.
+    */
+    Dataset_Registry *registry;
+    /*!
+    *	\var size_t capacity - Most handles kept open by a process.
+    */
+    size_t capacity;
+    /*!
+    *	\var std::vector<int> boundaries - Shard boundaries of new datasets, or none to create them unsharded.
+    */
+    std::vector<int> boundaries;
+    /*!
+    *	\var std::mutex caching - Guards the handles of this process, which the threads of a threaded server share.
+    */
+    std::mutex caching;
+    /*!
+    *	\var std::list<std::pair<std::string, std::shared_ptr<DataFile<Record>>>> handles - Open files, most recently used first.
+    */
+    std::list<std::pair<std::string, std::shared_ptr<DataFile<Record>>>> handles;
+
+    /*!
+    *   \fn semaphores
+    *	\param const char *name : Dataset name.
+    *	\param int sets : Sets of 3 semaphores the dataset needs.
+    *	\brief Finds the semaphores of a dataset, creating them the first time.
+    *	\return Semaphore set id, or -1 if the registry is full or on error.
+    *
+    */
+    int semaphores(const char *name, int sets);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param int capacity : Most handles kept open by a process.
+    *	\param const std::vector<int> &boundaries : Shard boundaries of new datasets, ascending and positive, or none.
+    *	\brief Creates an empty registry.
+    *	\return DatasetCache
+    *
+    *   \par Description
+    *   Maps the registry shared and anonymous, so processes forked afterwards share it. Exits on failure.
+    *
+    */
+    DatasetCache(int capacity, const std::vector<int> &boundaries);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Closes the cached files and unmaps the registry.
+    *	\return void
+    *
+    *   \par Description
+    *   Leaves the semaphores, which destroy removes.
+    *
+    */
+    ~DatasetCache();
+    /*!
+    *   \fn validName
+    *	\param const char *name : Dataset name, at most DATASET_NAME_MAX bytes.
+    *	\brief Checks a dataset name.
+    *	\return true for 1 to DATASET_NAME_MAX - 1 letters, digits, '_' or '-', terminated.
+    *
+    */
+    static bool validName(const char *name);
+    /*!
+    *   \fn open
+    *	\param const char *name : Dataset name.
+    *	\param bool create : Create an empty dataset if there is none of that name.
+    *	\brief Opens a dataset.
+    *	\return Its file, or NULL if the name is invalid, there is no such dataset, or on error.
+    *
+    *   \par Description
+    *   Returns the cached handle if this process has one. Otherwise opens the file, or the shards of a sharded dataset,
+    *   finds or creates its semaphores, and caches the handle, dropping the least recently used one if the cache is full.
+    *   A new dataset is sharded if the cache has boundaries.
+    *
+    */
+    std::shared_ptr<DataFile<Record>> open(const char *name, bool create);
+    /*!
+    *   \fn destroy
+    *	\param None.
+    *	\brief Removes the semaphores of every registered dataset.
+    *	\return void
+    *
+    *   \par Description
+    *   Must only be called when no process uses them any more.
+    *
+    */
+    void destroy();
+    /*!
+    *   \fn stats
+    *	\param None.
+    *	\brief Reads the counters.
+    *	\return Dataset_Stats
+    *
+    */
+    Dataset_Stats stats();
+    /*!
+    *   \fn printStats
+    *	\param None.
+    *	\brief Prints the counters.
+    *	\return void
+    *
+    */
+    void printStats();
+
+};
+
+#endif
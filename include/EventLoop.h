@@ -0,0 +1,158 @@
+/*!	\file EventLoop.h
+*	\brief  EventLoop class header file.
+*   An EventLoop object services many clients from a single process. \n
+*   Accepted connections are made non-blocking and multiplexed through one epoll instance. \n
+*   Each connection is backed by its own Server object, whose handlers run whenever its socket becomes readable. \n
+*   Replies a slow reader leaves unsent are sent when its socket becomes writable, and its requests are not read until then. \n
+*   Several worker processes may run an EventLoop over the same listening socket; the kernel wakes only one of them per new connection.\n
+*
+*/
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include "Server.h"
+#include <sys/epoll.h>
+#include <map>
+
+/*!
+ *	\class EventLoop
+ *	\brief epoll driven connection multiplexer
+ *  \n
+ *   An EventLoop object services many clients from a single process. \n
+ *   Accepted connections are made non-blocking and multiplexed through one epoll instance. \n
+ *   Each connection is backed by its own Server object, whose handlers run whenever its socket becomes readable. \n
+ */
+class EventLoop
+{
+private:
+    /*!
+    *	\var const int listenfd - Non-blocking listening socket descriptor.
+    */
+    const int listenfd;
+    /*!
+    *	\var const int binfd - Open binary file descriptor. Duplicated for each connection.
+    */
+    const int binfd;
+    /*!
+    *	\var const int logfd - Open log file descriptor. Duplicated for each connection.
+    */
+    const int logfd;
+    /*!
+    *	\var const int semid - Established system semaphore set id.
+    */
+    const int semid;
+    /*!
+    *	\var int epollfd - epoll instance descriptor.
+    */
+    int epollfd;
+    /*!
+    *	\var std::map<int, Server*> connections - Data servers keyed by client socket descriptor.
+    */
+    std::map<int, Server*> connections;
+    /*!
+    *	\var int *connectionCount - Incremented for every accepted connection, or NULL. May point into shared memory.
+    */
+    int *connectionCount;
+
+    /*!
+    *   \fn acceptConnections
+    *	\param None.
+    *	\brief Accepts pending connections.
+    *	\return void
+    *
+    *   \par Description
+    *   Accepts every pending connection on the listening socket,
+    *   creates a Server for each and registers it with the epoll instance.
+    *
+    */
+    void acceptConnections();
+    /*!
+    *   \fn serviceConnection
+    *	\param const int fd : Readable client socket descriptor.
+    *	\brief Services a readable connection.
+    *	\return void
+    *
+    *   \par Description
+    *   Lets the connection's Server handle its pending message. Closes the connection on disconnection.
+    *   If the replies did not all fit in the socket, stops reading the connection until they are sent.
+    *
+    */
+    void serviceConnection(const int fd);
+    /*!
+    *   \fn drainConnection
+    *	\param const int fd : Writable client socket descriptor.
+    *	\brief Sends a connection's buffered replies.
+    *	\return void
+    *
+    *   \par Description
+    *   Watches the socket for requests again once every reply has been sent. Closes the connection on error.
+    *
+    */
+    void drainConnection(const int fd);
+    /*!
+    *   \fn watch
+    *	\param const int fd : Client socket descriptor.
+    *	\param uint32_t events : epoll events to wait for.
+    *	\brief Changes the events a connection is watched for.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   A connection with buffered replies is watched for EPOLLOUT only, so no more of its requests are read until they are sent.
+    *
+    */
+    bool watch(const int fd, uint32_t events);
+    /*!
+    *   \fn closeConnection
+    *	\param const int fd : Client socket descriptor.
+    *	\brief Closes a connection.
+    *	\return void
+    *
+    *   \par Description
+    *   Deregisters the socket from epoll and destroys its Server, which closes its descriptors.
+    *
+    */
+    void closeConnection(const int fd);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int listenfd : Non-blocking listening socket descriptor.
+    *	\param const int bfd : Open binary file descriptor.
+    *	\param const int lfd : Open log file descriptor.
+    *	\param const int semid : Established system semaphore set id.
+    *	\param int *connectionCount : Optional accepted connection counter.
+    *	\brief Constructs an EventLoop.
+    *	\return EventLoop
+    *
+    *   \par Description
+    *   Creates the epoll instance and registers the listening socket.
+    *
+    */
+    EventLoop(const int listenfd, const int bfd, const int lfd, const int semid, int *connectionCount = NULL);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes all connections.
+    *	\return void
+    *
+    *   \par Description
+    *   Destroys every remaining Server and closes the epoll instance.
+    *
+    */
+    ~EventLoop();
+    /*!
+    *   \fn run
+    *	\param None.
+    *	\brief Event loop lifetime.
+    *	\return void
+    *
+    *   \par Description
+    *   Waits for socket readiness and dispatches accepts and messages until an unrecoverable error occurs.
+    *
+    */
+    void run();
+
+};
+
+#endif
\ No newline at end of file
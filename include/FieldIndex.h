@@ -0,0 +1,316 @@
+/*!	\file FieldIndex.h
+*	\brief  FieldIndex class header file.
+*   A FieldIndex is an on-disk B+tree secondary index of one market-share field of the binary file's records, kept in its own
+*   file next to it. Its keys are (value, record number) pairs, so records sharing a value are distinct keys, and its leaves are
+*   linked both ways, so a range of values is read in either order from the leaf holding its first key. \n
+*   The file is a sequence of INDEX_PAGE byte pages read and written with pread and pwrite. Page 0 is the header, holding the
+*   root, the number of pages and keys, and whether the index matched the data file when the server last shut down.
+*   Nothing else is kept in memory, so every process and thread sharing the descriptor sees the same tree. \n
+*   A full page is split in two, and a full root gets a new root above it, so every lookup reads one page per level. A key is
+*   erased from its leaf without merging pages: the tree keeps one key per record, so updates refill them. \n
+*   A rebuild sorts the field's values, scanned from the data file, and writes the tree bottom up with pages INDEX_FILL percent full. \n
+*   Accesses are synchronized through the SemaphoreSet INDEX_SEMAPHORE_SET + field of the server's semaphores. \n
+*
+*/
+
+#ifndef FIELDINDEX_H
+#define FIELDINDEX_H
+
+#include "DataFile.h"
+#include "SemaphoreSet.h"
+#include "Packets.h"
+#include <vector>
+
+#define INDEX_PAGE 4096
+#define INDEX_LEAF_KEYS 510
+#define INDEX_BRANCHES 340
+#define INDEX_FILL 90
+#define INDEX_MAGIC 0x58444946 // "FIDX"
+#define INDEX_SEMAPHORE_SET 2
+
+/*!
+*   \struct Index_Key
+*   \brief A key of a FieldIndex: a field value and the record holding it.
+*/
+struct Index_Key{
+    float value;
+    int32_t recordNumber;
+};
+
+/*!
+*   \struct Index_Branch
+*   \brief An entry of an inner page: the smallest key of a child page, and the child.
+*/
+struct Index_Branch{
+    Index_Key key;
+    int32_t child;
+};
+
+/*!
+*   \struct Index_Page
+*   \brief A page of a FieldIndex file after the header. Page 0 is never a node, so it stands for no page.
+*   \n
+*   A leaf holds count keys in order. An inner page holds count branches in order: keys below the first branch's are under first,
+*   and the others under the child of the last branch whose key is not above them.
+*/
+struct Index_Page{
+    uint16_t leaf;
+    uint16_t count;
+    int32_t next;   // leaves: next leaf, or 0
+    int32_t prev;   // leaves: previous leaf, or 0
+    int32_t first;  // inner pages: child holding the keys below the first branch
+    union{
+        Index_Key keys[INDEX_LEAF_KEYS];
+        Index_Branch branches[INDEX_BRANCHES];
+    };
+};
+
+/*!
+*   \struct Index_Header
+*   \brief Page 0 of a FieldIndex file.
+*/
+struct Index_Header{
+    uint32_t magic;
+    int32_t field;
+    int32_t root;
+    int32_t height;   // levels of pages, 1 when the root is a leaf
+    int32_t pages;    // pages in the file, header included
+    int32_t clean;    // 1 if the keys matched the data file when it was last closed
+    int64_t entries;  // keys in the tree
+    int64_t stamp;    // modification time of the data file then, in nanoseconds
+};
+
+/*!
+ *	\class FieldIndex
+ *	\brief On-disk B+tree index of a Record field
+ *  \n
+ *   A FieldIndex finds the records whose field is in a range of values, in order of the field, in O(log n) page reads
+ *   plus one per leaf of results. \n
+ */
+class FieldIndex
+{
+private:
+    /*!
+    *	\var const int fd - Open index file descriptor.
+    */
+    const int fd;
+    /*!
+    *	\var const int field - FIELD_ANDROID, FIELD_IOS, FIELD_KAIOS or FIELD_OTHER.
+    */
+    const int field;
+    /*!
+    *	\var SemaphoreSet sems - Readers-writers lock of the index.
+    */
+    SemaphoreSet sems;
+
+    /*!
+    *   \fn readPage
+    *	\param int page : Page number.
+    *	\param void *buf : Filled with the page's INDEX_PAGE bytes.
+    *	\brief Reads a page of the index file.
+    *	\return false on error.
+    *
+    */
+    bool readPage(int page, void *buf);
+    /*!
+    *   \fn writePage
+    *	\param int page : Page number.
+    *	\param const void *buf : INDEX_PAGE bytes to write.
+    *	\brief Writes a page of the index file.
+    *	\return false on error.
+    *
+    */
+    bool writePage(int page, const void *buf);
+    /*!
+    *   \fn readHeader
+    *	\param Index_Header &header : Filled with page 0.
+    *	\brief Reads the header of the index file.
+    *	\return false on error.
+    *
+    */
+    bool readHeader(Index_Header &header);
+    /*!
+    *   \fn writeHeader
+    *	\param const Index_Header &header : New page 0.
+    *	\brief Writes the header of the index file.
+    *	\return false on error.
+    *
+    */
+    bool writeHeader(const Index_Header &header);
+    /*!
+    *   \fn findLeaf
+    *	\param int root : Root page.
+    *	\param const Index_Key &key : Key searched.
+    *	\param Index_Page &leaf : Filled with the leaf that holds the key if the tree does.
+    *	\param std::vector<int> *path : Filled with the inner pages read, from the root down, or NULL.
+    *	\brief Descends the tree to the leaf of a key.
+    *	\return The leaf's page number, or -1 on error.
+    *
+    */
+    int findLeaf(int root, const Index_Key &key, Index_Page &leaf, std::vector<int> *path);
+    /*!
+    *   \fn insertBranch
+    *	\param Index_Header &header : Header, updated with any new root and pages.
+    *	\param std::vector<int> &path : Inner pages above the split page, from the root down.
+    *	\param Index_Key key : Smallest key of the new page.
+    *	\param int child : New page.
+    *	\brief Links the new half of a split page into its parent, splitting the parents that are full.
+    *	\return false on error.
+    *
+    */
+    bool insertBranch(Index_Header &header, std::vector<int> &path, Index_Key key, int child);
+    /*!
+    *   \fn dataStamp
+    *	\param int binfd : Open data file descriptor.
+    *	\brief Reads the modification time of the data file.
+    *	\return Nanoseconds since the epoch, or -1 on error.
+    *
+    */
+    static int64_t dataStamp(int binfd);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int filedesc : Open index file descriptor.
+    *	\param const int field : Field indexed.
+    *	\param SemaphoreSet sems : SemaphoreSet object representing initialized semaphores.
+    *	\brief Constructs a FieldIndex.
+    *	\return FieldIndex
+    *
+    *   \par Description
+    *   Sets the fd, field and sems members. An empty or stale file must be rebuilt before it is used.
+    *
+    */
+    FieldIndex(const int filedesc, const int field, SemaphoreSet sems);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes the file.
+    *	\return void
+    *
+    *   \par Description
+    *   Calls close() on the file descriptor. Does NOT deallocate system semaphores.
+    *
+    */
+    ~FieldIndex();
+    /*!
+    *   \fn fieldName
+    *	\param int field : Field code.
+    *	\brief Names a field.
+    *	\return "android", "ios", "kaios" or "other", or NULL for an unknown code.
+    *
+    */
+    static const char *fieldName(int field);
+    /*!
+    *   \fn fieldCode
+    *	\param const char *name : Name of a field.
+    *	\brief Finds a field by name.
+    *	\return Its code, or -1 for an unknown name.
+    *
+    */
+    static int fieldCode(const char *name);
+    /*!
+    *   \fn getField
+    *	\param None.
+    *	\brief Indexed field getter.
+    *	\return Field code.
+    *
+    */
+    int getField(){return field;}
+    /*!
+    *   \fn check
+    *	\param int binfd : Open data file descriptor.
+    *	\param long records : Number of records in the data file.
+    *	\brief Checks that the index still matches the data file.
+    *	\return true if it was closed cleanly, with a key per record, and the data file was not modified since.
+    *
+    */
+    bool check(int binfd, long records);
+    /*!
+    *   \fn rebuild
+    *	\param DataFile<Record> &file : The data file.
+    *	\brief Rebuilds the index from the data file.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Scans the field with DataFile::scanField, sorts the keys and writes the tree bottom up over the old file.
+    *   The index is left marked as not closed cleanly.
+    *   Operation is NOT synched: the index must not be in use.
+    *
+    */
+    bool rebuild(DataFile<Record> &file);
+    /*!
+    *   \fn markClean
+    *	\param int binfd : Open data file descriptor.
+    *	\param bool clean : true once the index and data file are closed, false while they are in use.
+    *	\brief Records whether the index matches the data file, and syncs it.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   A clean index is stamped with the data file's modification time, so check notices a data file changed without it.
+    *   An index in use is marked dirty first, so one left by a crash is rebuilt.
+    *
+    */
+    bool markClean(int binfd, bool clean);
+    /*!
+    *   \fn lock
+    *	\param bool write : Lock for writing rather than reading.
+    *	\brief Locks the index.
+    *	\return void
+    *
+    */
+    void lock(bool write);
+    /*!
+    *   \fn unlock
+    *	\param bool write : The lock was taken for writing.
+    *	\brief Unlocks the index.
+    *	\return void
+    *
+    */
+    void unlock(bool write);
+    /*!
+    *   \fn insert
+    *	\param int recordNumber : Record number.
+    *	\param float value : The record's value of the field.
+    *	\brief Adds a record's key.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Splits the leaf and its full parents as needed. A key already in the tree is left as it is.
+    *   Operation is NOT synched: must be called under the writer lock.
+    *
+    */
+    bool insert(int recordNumber, float value);
+    /*!
+    *   \fn erase
+    *	\param int recordNumber : Record number.
+    *	\param float value : The value the record was indexed with.
+    *	\brief Removes a record's key.
+    *	\return false if the key was not in the tree or on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched: must be called under the writer lock.
+    *
+    */
+    bool erase(int recordNumber, float value);
+    /*!
+    *   \fn lookup
+    *	\param float low : Lowest value.
+    *	\param float high : Highest value.
+    *	\param bool descending : Highest values first, rather than lowest.
+    *	\param int limit : Most record numbers to return, or 0 for all.
+    *	\param std::vector<int> &recordNumbers : Filled with the records whose value is in [low, high], in order of value.
+    *	\brief Finds the records with a value in a range.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Descends to the leaf of the first key in the range, then follows the leaf links. Records sharing a value come
+    *   in order of record number, reversed when descending.
+    *   Operation is NOT synched: must be called under the reader or writer lock.
+    *
+    */
+    bool lookup(float low, float high, bool descending, int limit, std::vector<int> &recordNumbers);
+
+};
+
+#endif
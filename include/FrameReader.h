@@ -0,0 +1,147 @@
+/*!	\file FrameReader.h
+*	\brief  FrameReader class header file.
+*   A FrameReader buffers the bytes received on a connection and splits them into messages. \n
+*   Each fill() is one read() of as many bytes as are available, which may hold many messages and the start of another; 
+*   next() returns complete messages until only a partial one is left, which is completed by later reads. \n
+*   The protocol version is detected from the first 4 bytes of the stream: FRAME_MAGIC starts a v2 stream of
+*   Frame_Header framed messages, anything else a v1 stream of bare Record_Message structs. \n
+*
+*/
+
+#ifndef FRAMEREADER_H
+#define FRAMEREADER_H
+
+#include "Packets.h"
+#include <vector>
+
+/*!
+*   \struct Frame
+*   \brief A complete message in the receive buffer.
+*   \n
+*   v1 messages are reported with opcode = action, requestId = 0 and the whole Record_Message as payload.
+*   The payload points into the reader's buffer and is only valid until its next fill() or feed().
+*/
+struct Frame{
+    int version;
+    int opcode;
+    uint32_t requestId;
+    const char *payload;
+    uint32_t length;
+};
+
+/*!
+ *	\class FrameReader
+ *	\brief Buffered message framer
+ *  \n
+ *   A FrameReader buffers the bytes received on a connection and splits them into messages. \n
+ *   Supports protocol v1 (bare Record_Message structs) and v2 (Frame_Header framed messages). \n
+ */
+class FrameReader
+{
+private:
+    /*!
+    *	\var std::vector<char> buffer - Received bytes.
+    */
+    std::vector<char> buffer;
+    /*!
+    *	\var size_t start, end - Unparsed bytes are buffer[start, end).
+    */
+    size_t start;
+    size_t end;
+    /*!
+    *	\var int version - Detected protocol version, or 0 before the first 4 bytes have arrived.
+    */
+    int version;
+    /*!
+    *	\var bool failed - Set when the stream is not a valid message stream.
+    */
+    bool failed;
+
+    /*!
+    *   \fn reserve
+    *	\param size_t size : Free bytes wanted after end.
+    *	\brief Makes room for more bytes.
+    *	\return Pointer to the free space.
+    *
+    *   \par Description
+    *   Moves the unparsed bytes to the front of the buffer, growing it only if that is not enough.
+    *
+    */
+    char* reserve(size_t size);
+    /*!
+    *   \fn parse
+    *	\param Frame &frame : Filled with the next message.
+    *	\brief Finds the next complete message.
+    *	\return Size of the message in the buffer, or 0 if it is incomplete.
+    *
+    */
+    size_t parse(Frame &frame);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param None.
+    *	\brief Constructs an empty FrameReader.
+    *	\return FrameReader
+    *
+    */
+    FrameReader();
+    /*!
+    *   \fn fill
+    *	\param int fd : Connected socket descriptor.
+    *	\brief Reads whatever has arrived on the socket.
+    *	\return Number of bytes read, 0 on disconnection or error, or -1 if a non-blocking read would block.
+    *
+    *   \par Description
+    *   One read() of up to the free buffer space. Invalidates the payloads of previously returned frames.
+    *
+    */
+    int fill(int fd);
+    /*!
+    *   \fn feed
+    *	\param const void *data : Received bytes.
+    *	\param int size : Number of bytes.
+    *	\brief Appends bytes received by the caller.
+    *	\return void
+    *
+    *   \par Description
+    *   Used by I/O engines that receive into their own buffers. Invalidates the payloads of previously returned frames.
+    *
+    */
+    void feed(const void *data, int size);
+    /*!
+    *   \fn next
+    *	\param Frame &frame : Filled with the next message.
+    *	\brief Takes the next complete message from the buffer.
+    *	\return false if no complete message is buffered, or the stream is invalid.
+    *
+    */
+    bool next(Frame &frame);
+    /*!
+    *   \fn hasFrame
+    *	\param None.
+    *	\brief Checks for a complete buffered message without taking it.
+    *	\return true if next() would return a message.
+    *
+    */
+    bool hasFrame();
+    /*!
+    *   \fn getVersion
+    *	\param None.
+    *	\brief Detected protocol version getter.
+    *	\return PROTOCOL_V1, PROTOCOL_V2, or 0 if not yet known.
+    *
+    */
+    int getVersion(){return version;}
+    /*!
+    *   \fn hasFailed
+    *	\param None.
+    *	\brief Invalid stream check.
+    *	\return true once a malformed frame header has been received.
+    *
+    */
+    bool hasFailed(){return failed;}
+
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*!	\file IoUring.h
+*	\brief  IoUring class header file.
+*   An IoUring object owns one io_uring instance, set up directly through the io_uring_setup and io_uring_enter system calls. \n
+*   Submission queue entries are filled in by the caller through getSqe() and handed to the kernel in batches by submit(). \n
+*   Completions are drained with peekCompletion() without entering the kernel. \n
+*
+*/
+
+#ifndef IOURING_H
+#define IOURING_H
+
+#include "Packets.h"
+#include <linux/io_uring.h>
+
+/*!
+ *	\class IoUring
+ *	\brief Minimal io_uring wrapper
+ *  \n
+ *   An IoUring object owns one io_uring instance, set up directly through the io_uring_setup and io_uring_enter system calls. \n
+ *   Submission queue entries are filled in by the caller through getSqe() and handed to the kernel in batches by submit(). \n
+ *   Completions are drained with peekCompletion() without entering the kernel. \n
+ */
+class IoUring
+{
+private:
+    /*!
+    *	\var int ringfd - io_uring instance descriptor, or -1.
+    */
+    int ringfd;
+    /*!
+    *	\var io_uring_params params - Ring parameters filled in by the kernel.
+    */
+    io_uring_params params;
+
+    /*!
+    *	\var void *sqRing, *cqRing - Mapped submission and completion rings.
+    */
+    void *sqRing;
+    void *cqRing;
+    /*!
+    *	\var size_t sqRingSize, cqRingSize - Sizes of the ring mappings.
+    */
+    size_t sqRingSize;
+    size_t cqRingSize;
+    /*!
+    *	\var io_uring_sqe *sqes - Mapped submission queue entry array.
+    */
+    io_uring_sqe *sqes;
+
+    /*!
+    *	\var Submission ring fields shared with the kernel.
+    */
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    /*!
+    *	\var Completion ring fields shared with the kernel.
+    */
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    io_uring_cqe *cqes;
+
+    /*!
+    *	\var unsigned localTail - Tail including entries not yet published to the kernel.
+    */
+    unsigned localTail;
+    /*!
+    *	\var unsigned long enterCalls - Number of io_uring_enter system calls made.
+    */
+    unsigned long enterCalls;
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param None.
+    *	\brief Constructs an uninitialized IoUring.
+    *	\return IoUring
+    *
+    *   \par Description
+    *   No kernel resources are allocated until init() is called.
+    *
+    */
+    IoUring();
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Unmaps the rings and closes the instance.
+    *	\return void
+    *
+    */
+    ~IoUring();
+    /*!
+    *   \fn init
+    *	\param unsigned entries : Submission queue size.
+    *	\brief Sets up the ring.
+    *	\return false if io_uring is unavailable.
+    *
+    *   \par Description
+    *   Calls io_uring_setup and maps the rings. Fails cleanly on kernels or sandboxes without io_uring,
+    *   so callers can fall back to ordinary system calls.
+    *
+    */
+    bool init(unsigned entries);
+    /*!
+    *   \fn getSqe
+    *	\param None.
+    *	\brief Gets a free submission queue entry.
+    *	\return Zeroed entry, or NULL if the submission queue is full.
+    *
+    *   \par Description
+    *   The entry becomes visible to the kernel on the next submit().
+    *
+    */
+    io_uring_sqe* getSqe();
+    /*!
+    *   \fn submit
+    *	\param unsigned waitNr : Number of completions to wait for.
+    *	\brief Submits queued entries.
+    *	\return Number of entries submitted, or -1 on error.
+    *
+    *   \par Description
+    *   Publishes every entry obtained since the last submit and, in the same system call,
+    *   waits until at least waitNr completions are available.
+    *
+    */
+    int submit(unsigned waitNr);
+    /*!
+    *   \fn peekCompletion
+    *	\param io_uring_cqe &cqe : Filled with the next completion.
+    *	\brief Pops a completion.
+    *	\return false if the completion queue is empty.
+    *
+    */
+    bool peekCompletion(io_uring_cqe &cqe);
+    /*!
+    *   \fn getEnterCalls
+    *	\param None.
+    *	\brief io_uring_enter call count getter.
+    *	\return Number of io_uring_enter system calls made so far.
+    *
+    */
+    unsigned long getEnterCalls(){return enterCalls;}
+
+};
+
+#endif
@@ -0,0 +1,287 @@
+/*!	\file KeyIndex.h
+*	\brief  KeyIndex class header file.
+*   A KeyIndex is a persistent hash index mapping 64-bit record keys, such as YYYYMM dates, to the record slots of the binary
+*   file holding them, kept in its own file next to it. Keyed records live in the data file like the others and keep their
+*   slot as their month, so positional requests still see them. \n
+*   The file is a header page followed by an open addressing hash table of Key_Entry, KEY_PAGE_ENTRIES to an INDEX_PAGE,
+*   probed linearly. A key is found in one page read while the table is at most KEY_MAX_LOAD percent full; past that it is
+*   rehashed into a table twice the size, or the same size when erased entries fill it, written next to the old one before the
+*   header points at it, so a crash never leaves a half written table in use. The old table's pages are then released. \n
+*   Deleted records are not removed from the data file: each becomes a tombstone whose negative month links it to the next free
+*   slot, starting from the header's, and keyed creates reuse the free slots before appending. \n
+*   Every change writes the data file before the entry or header that points at it, so a crash can leak a slot but never
+*   points a key at a record it did not write. \n
+*   Accesses are synchronized through the SemaphoreSet KEY_SEMAPHORE_SET of the server's semaphores. \n
+*
+*/
+
+#ifndef KEYINDEX_H
+#define KEYINDEX_H
+
+#include "DataFile.h"
+#include "SemaphoreSet.h"
+#include "Packets.h"
+#include <vector>
+
+#define KEY_PAGE 4096
+#define KEY_PAGE_ENTRIES 256
+#define KEY_INITIAL_PAGES 4
+#define KEY_MAX_LOAD 75
+#define KEY_MAGIC 0x4459454B // "KEYD"
+#define KEY_SEMAPHORE_SET 6 // after the field indexes' INDEX_SEMAPHORE_SET + NUM_FIELDS
+
+#define KEY_EMPTY 0
+#define KEY_USED 1
+#define KEY_ERASED 2
+
+/*!
+*   \struct Key_Entry
+*   \brief An entry of the hash table: a key and the slot of its record.
+*/
+struct Key_Entry{
+    int64_t key;
+    int32_t slot;
+    int32_t state;  // KEY_EMPTY, KEY_USED, or KEY_ERASED to keep probing past it
+};
+
+/*!
+*   \struct Key_Header
+*   \brief Page 0 of a KeyIndex file.
+*/
+struct Key_Header{
+    uint32_t magic;
+    int32_t freeHead;  // first free slot, or -1
+    int64_t table;     // first page of the table
+    int64_t capacity;  // entries in the table, a power of 2
+    int64_t used;      // KEY_USED entries
+    int64_t erased;    // KEY_ERASED entries
+    int64_t freeSlots; // slots on the free list
+    int32_t clean;     // 1 if closed cleanly
+    int32_t pad;
+    int64_t stamp;     // modification time of the data file then, in nanoseconds
+};
+
+/*!
+ *	\class KeyIndex
+ *	\brief Persistent hash index of Record keys
+ *  \n
+ *   A KeyIndex finds the slot of a key in O(1) page reads, and keeps the list of slots freed by deletes. \n
+ */
+class KeyIndex
+{
+private:
+    /*!
+    *	\var const int fd - Open index file descriptor.
+    */
+    const int fd;
+    /*!
+    *	\var SemaphoreSet sems - Readers-writers lock of the index.
+    */
+    SemaphoreSet sems;
+
+    /*!
+    *   \fn readPages
+    *	\param long page : First page number.
+    *	\param long count : Number of pages.
+    *	\param void *buf : Filled with the pages' bytes.
+    *	\brief Reads pages of the index file.
+    *	\return false on error.
+    *
+    */
+    bool readPages(long page, long count, void *buf);
+    /*!
+    *   \fn writePages
+    *	\param long page : First page number.
+    *	\param long count : Number of pages.
+    *	\param const void *buf : Bytes to write.
+    *	\brief Writes pages of the index file.
+    *	\return false on error.
+    *
+    */
+    bool writePages(long page, long count, const void *buf);
+    /*!
+    *   \fn readHeader
+    *	\param Key_Header &header : Filled with page 0.
+    *	\brief Reads the header of the index file.
+    *	\return false on error.
+    *
+    */
+    bool readHeader(Key_Header &header);
+    /*!
+    *   \fn writeHeader
+    *	\param const Key_Header &header : New page 0.
+    *	\brief Writes the header of the index file.
+    *	\return false on error.
+    *
+    */
+    bool writeHeader(const Key_Header &header);
+    /*!
+    *   \fn writeEntry
+    *	\param const Key_Header &header : Header of the table.
+    *	\param long position : Entry of the table.
+    *	\param const Key_Entry &entry : New contents.
+    *	\brief Writes one entry of the table.
+    *	\return false on error.
+    *
+    */
+    bool writeEntry(const Key_Header &header, long position, const Key_Entry &entry);
+    /*!
+    *   \fn probe
+    *	\param const Key_Header &header : Header of the table.
+    *	\param int64_t key : Key searched.
+    *	\param Key_Entry &found : Filled with the key's entry if the table holds it.
+    *	\param long &vacant : Set to the first entry probed that is not in use, where the key would be inserted.
+    *	\brief Probes the table for a key, from the entry it hashes to.
+    *	\return The position of the key's entry, -1 if the table does not hold it, or -2 on error.
+    *
+    */
+    long probe(const Key_Header &header, int64_t key, Key_Entry &found, long &vacant);
+    /*!
+    *   \fn rehash
+    *	\param Key_Header &header : Header, updated with the new table.
+    *	\param long capacity : Entries of the new table.
+    *	\brief Moves the keys to a new table.
+    *	\return false on error, leaving the old table in use.
+    *
+    */
+    bool rehash(Key_Header &header, long capacity);
+    /*!
+    *   \fn dataStamp
+    *	\param int binfd : Open data file descriptor.
+    *	\brief Reads the modification time of the data file.
+    *	\return Nanoseconds since the epoch, or -1 on error.
+    *
+    */
+    static int64_t dataStamp(int binfd);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int filedesc : Open index file descriptor.
+    *	\param SemaphoreSet sems : SemaphoreSet object representing initialized semaphores.
+    *	\brief Constructs a KeyIndex.
+    *	\return KeyIndex
+    *
+    *   \par Description
+    *   Sets the fd and sems members. The file must be opened with open before it is used.
+    *
+    */
+    KeyIndex(const int filedesc, SemaphoreSet sems);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes the file.
+    *	\return void
+    *
+    *   \par Description
+    *   Calls close() on the file descriptor. Does NOT deallocate system semaphores.
+    *
+    */
+    ~KeyIndex();
+    /*!
+    *   \fn open
+    *	\param int binfd : Open data file descriptor.
+    *	\brief Prepares the index for use.
+    *	\return false if the file is not a KeyIndex, or no longer matches the data file.
+    *
+    *   \par Description
+    *   Writes an empty table to a new file. An existing one closed cleanly must be stamped with the data file's modification
+    *   time, since its keys cannot be rebuilt from a data file changed without it. It is then marked in use.
+    *   Operation is NOT synched: the index must not be in use.
+    *
+    */
+    bool open(int binfd);
+    /*!
+    *   \fn close
+    *	\param int binfd : Open data file descriptor, synced.
+    *	\brief Marks the index closed cleanly, and syncs it.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Stamps it with the data file's modification time, so open notices a data file changed without it.
+    *
+    */
+    bool close(int binfd);
+    /*!
+    *   \fn lock
+    *	\param bool write : Lock for writing rather than reading.
+    *	\brief Locks the index.
+    *	\return void
+    *
+    */
+    void lock(bool write);
+    /*!
+    *   \fn unlock
+    *	\param bool write : The lock was taken for writing.
+    *	\brief Unlocks the index.
+    *	\return void
+    *
+    */
+    void unlock(bool write);
+    /*!
+    *   \fn find
+    *	\param int64_t key : Key.
+    *	\brief Finds the slot of a key.
+    *	\return The slot, or -1 if the key is not in the index or on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched: must be called under the reader or writer lock.
+    *
+    */
+    int find(int64_t key);
+    /*!
+    *   \fn insert
+    *	\param int64_t key : Key.
+    *	\param int slot : Slot of its record.
+    *	\brief Adds a key.
+    *	\return false if the key is already in the index or on error.
+    *
+    *   \par Description
+    *   Rehashes the table first if the entry would fill it past KEY_MAX_LOAD percent.
+    *   Operation is NOT synched: must be called under the writer lock.
+    *
+    */
+    bool insert(int64_t key, int slot);
+    /*!
+    *   \fn erase
+    *	\param int64_t key : Key.
+    *	\brief Removes a key.
+    *	\return Its slot, or -1 if the key was not in the index or on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched: must be called under the writer lock.
+    *
+    */
+    int erase(int64_t key);
+    /*!
+    *   \fn popFree
+    *	\param DataFile<Record> &file : The data file.
+    *	\param Record &tombstone : Filled with the contents of the slot taken.
+    *	\brief Takes the first slot of the free list.
+    *	\return The slot, or -1 if the list is empty or on error.
+    *
+    *   \par Description
+    *   A slot that no longer holds a tombstone was overwritten by a positional update: the list is dropped from it, leaking
+    *   the slots behind it, rather than handing out a record in use.
+    *   Operation is NOT synched: must be called under the writer lock.
+    *
+    */
+    int popFree(DataFile<Record> &file, Record &tombstone);
+    /*!
+    *   \fn pushFree
+    *	\param DataFile<Record> &file : The data file.
+    *	\param int slot : Slot of a deleted record.
+    *	\param Record &tombstone : Filled with the tombstone written to the slot.
+    *	\brief Frees a slot.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Overwrites the slot with a tombstone linking it to the head of the free list, then makes it the head.
+    *   Operation is NOT synched: must be called under the writer lock.
+    *
+    */
+    bool pushFree(DataFile<Record> &file, int slot, Record &tombstone);
+
+};
+
+#endif
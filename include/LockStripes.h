@@ -0,0 +1,232 @@
+/*!	\file LockStripes.h
+*	\brief  LockStripes class header file.
+*   LockStripes splits a data file's readers-writers lock into stripes, so operations on different records run concurrently. \n
+*   Record n is guarded by stripe n % stripes. Each stripe is a System V semaphore starting at STRIPE_READERS: a reader takes
+*   one from it and a writer takes all of them, so a writer waits for the readers to leave and readers wait for the writer. \n
+*   An operation on several records takes every stripe they hash to with a single semop, which the kernel applies
+*   all at once or not at all, so no order between stripes is needed to avoid deadlocks. A range of at least as many
+*   records as there are stripes takes them all. \n
+*   Appends take a separate tail lock first, a semaphore starting at 1, so appenders are serialized while the end of the
+*   file moves, and then the stripes of the records they append. Updates and reads never take the tail lock. \n
+*   The counters live in an anonymous shared mapping created at startup, so all the server processes and threads share them. \n
+*
+*/
+
+#ifndef LOCKSTRIPES_H
+#define LOCKSTRIPES_H
+
+#include "Packets.h"
+#include <atomic>
+#include <vector>
+
+#define STRIPE_READERS 32767
+#define MAX_STRIPES 256
+
+/*!
+*   \struct Stripe_Stats
+*   \brief Snapshot of a LockStripes' counters.
+*/
+struct Stripe_Stats{
+    long acquired;  // stripe acquisitions, one per operation
+    long waited;    // acquisitions that had to wait
+    long tails;     // tail lock acquisitions
+    long tailWaits; // tail lock acquisitions that had to wait
+};
+
+/*!
+ *	\class LockStripes
+ *	\brief Striped readers-writers lock over the records of a file
+ *  \n
+ *   LockStripes guards each record with one of several semaphores, and appends with a tail semaphore. \n
+ */
+class LockStripes
+{
+private:
+    /*!
+    *   \struct Stripe_Counters
+    *   \brief Shared counters.
+    */
+    struct Stripe_Counters{
+        std::atomic<long> acquired;
+        std::atomic<long> waited;
+        std::atomic<long> tails;
+        std::atomic<long> tailWaits;
+    };
+
+    /*!
+    *	\var int semid - Semaphore set: the stripes, then the tail lock.
+    */
+    int semid;
+    /*!
+    *	\var int numStripes - Number of stripes.
+    */
+    int numStripes;
+    /*!
+    *	\var Stripe_Counters *counters - Shared counters.
+    */
+    Stripe_Counters *counters;
+
+    /*!
+    *   \fn apply
+    *	\param std::vector<sembuf> &ops : Operations, one per semaphore.
+    *	\param std::atomic<long> &waits : Counter of operations that had to wait.
+    *	\brief Applies semaphore operations atomically, waiting if they cannot be yet.
+    *	\return void
+    *
+    *   \par Description
+    *   Tries without waiting first, so an uncontended lock costs one system call and contention can be counted.
+    *
+    */
+    void apply(std::vector<sembuf> &ops, std::atomic<long> &waits);
+    /*!
+    *   \fn stripeOps
+    *	\param std::vector<char> &marked : Stripes to operate on, nonzero for each.
+    *	\param bool write : Writer instead of reader.
+    *	\param int sign : -1 to acquire, 1 to release.
+    *	\brief Builds the operations on a set of stripes.
+    *	\return One operation per marked stripe.
+    *
+    */
+    std::vector<sembuf> stripeOps(std::vector<char> &marked, bool write, int sign);
+    /*!
+    *   \fn rangeOps
+    *	\param long first : First record number.
+    *	\param long count : Number of records.
+    *	\param bool write : Writer instead of reader.
+    *	\param int sign : -1 to acquire, 1 to release.
+    *	\brief Builds the operations on the stripes of a range of records.
+    *	\return One operation per stripe.
+    *
+    */
+    std::vector<sembuf> rangeOps(long first, long count, bool write, int sign);
+    /*!
+    *   \fn recordOps
+    *	\param const int *recordNumbers : Record numbers.
+    *	\param int count : Number of records.
+    *	\param bool write : Writer instead of reader.
+    *	\param int sign : -1 to acquire, 1 to release.
+    *	\brief Builds the operations on the stripes of a set of records.
+    *	\return One operation per stripe.
+    *
+    */
+    std::vector<sembuf> recordOps(const int *recordNumbers, int count, bool write, int sign);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param int numStripes : Number of stripes, from 1 to MAX_STRIPES.
+    *	\brief Creates the stripes.
+    *	\return LockStripes
+    *
+    *   \par Description
+    *   Creates a private semaphore set and maps the counters shared and anonymous. Exits on failure.
+    *   Processes forked afterwards share both.
+    *
+    */
+    LockStripes(int numStripes);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Unmaps the counters.
+    *	\return void
+    *
+    *   \par Description
+    *   Leaves the semaphores, which destroy removes.
+    *
+    */
+    ~LockStripes();
+    /*!
+    *   \fn destroy
+    *	\param None.
+    *	\brief Removes the semaphore set.
+    *	\return void
+    *
+    */
+    void destroy();
+    /*!
+    *   \fn getNumStripes
+    *	\param None.
+    *	\brief Number of stripes.
+    *	\return int
+    *
+    */
+    int getNumStripes(){return numStripes;}
+    /*!
+    *   \fn lockRange
+    *	\param long first : First record number.
+    *	\param long count : Number of records.
+    *	\param bool write : Writer instead of reader.
+    *	\brief Locks the stripes of a range of records.
+    *	\return void
+    *
+    */
+    void lockRange(long first, long count, bool write);
+    /*!
+    *   \fn unlockRange
+    *	\param long first : First record number.
+    *	\param long count : Number of records.
+    *	\param bool write : Writer instead of reader.
+    *	\brief Unlocks what lockRange locked.
+    *	\return void
+    *
+    */
+    void unlockRange(long first, long count, bool write);
+    /*!
+    *   \fn lockRecords
+    *	\param const int *recordNumbers : Record numbers, in any order and possibly repeated.
+    *	\param int count : Number of records.
+    *	\param bool write : Writer instead of reader.
+    *	\brief Locks the stripes of a set of records.
+    *	\return void
+    *
+    */
+    void lockRecords(const int *recordNumbers, int count, bool write);
+    /*!
+    *   \fn unlockRecords
+    *	\param const int *recordNumbers : Record numbers passed to lockRecords.
+    *	\param int count : Number of records.
+    *	\param bool write : Writer instead of reader.
+    *	\brief Unlocks what lockRecords locked.
+    *	\return void
+    *
+    */
+    void unlockRecords(const int *recordNumbers, int count, bool write);
+    /*!
+    *   \fn lockTail
+    *	\param None.
+    *	\brief Locks the end of the file for an append.
+    *	\return void
+    *
+    *   \par Description
+    *   Must be taken before any stripe.
+    *
+    */
+    void lockTail();
+    /*!
+    *   \fn unlockTail
+    *	\param None.
+    *	\brief Unlocks the end of the file.
+    *	\return void
+    *
+    */
+    void unlockTail();
+    /*!
+    *   \fn stats
+    *	\param None.
+    *	\brief Reads the counters.
+    *	\return Stripe_Stats
+    *
+    */
+    Stripe_Stats stats();
+    /*!
+    *   \fn printStats
+    *	\param None.
+    *	\brief Prints the counters.
+    *	\return void
+    *
+    */
+    void printStats();
+
+};
+
+#endif
@@ -0,0 +1,226 @@
+/*!	\file LogFile.h
+*	\brief  Define a log-structured implementation of DataFile for Records.
+*   A LogFile never writes a record in place: creates and updates append an entry to the end of the file, and the shared
+*   LogIndex points the record at it, so every write is sequential. \n
+*   A record is read from the entry its index points at, with one pread. A range is read with one pread per run of
+*   records whose entries are adjacent in the file, which they are after an import or a compaction. \n
+*   compact is run by a background thread: it copies the live entries of the segment with the most garbage to the end
+*   of the file, in record order and under their write locks, and punches the segment out. \n
+*   Accesses are synchronized through its SemaphoreSet, or the file's LockStripes, like the other engines. \n
+*
+*/
+
+#ifndef LOGFILE_H
+#define LOGFILE_H
+
+#include "DataFile.h"
+#include "LogIndex.h"
+#include "SemaphoreSet.h"
+
+#define LOG_COMPACT_BATCH 1024
+#define LOG_COMPACT_INTERVAL 100000
+
+/*!
+ *	\class LogFile
+ *	\brief Log-structured DataFile of Records
+ *  \n
+*   A LogFile serves Record reads through its LogIndex and turns every write into an append. \n
+*   Accesses are synchronized through its SemaphoreSet, or the file's LockStripes. \n
+ */
+class LogFile : public DataFile<Record>
+{
+private:
+    /*!
+    *	\var const int fd - Open file descriptor.
+    */
+    const int fd;
+    /*!
+    *	\var LogIndex *index - Shared index of the file.
+    */
+    LogIndex *index;
+
+    /*!
+    *   \fn fetch
+    *	\param int recordNumber : Record number, below the record count.
+    *	\param Record &buf : Filled with the record.
+    *	\brief Reads a record's latest entry.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Without the record's lock, the compactor may move the entry and punch it out while it is read,
+    *   so an entry that no longer holds the record is read again from where the index points now.
+    *   Operation is NOT synched.
+    */
+    bool fetch(int recordNumber, Record &buf);
+    /*!
+    *   \fn fetchRange
+    *	\param long first : First record number.
+    *	\param int count : Number of records, all below the record count.
+    *	\param Record *buf : Filled with the records.
+    *	\brief Reads consecutive records, with one pread per run of adjacent entries.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    bool fetchRange(long first, int count, Record *buf);
+    /*!
+    *   \fn clamp
+    *	\param const int first : First record number of a range.
+    *	\param const int count : Number of records in the range.
+    *	\brief Cuts a range short at the end of the file.
+    *	\return Number of records of the range in the file.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    long clamp(const int first, const int count);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int filedesc : Open file descriptor of a log-structured file.
+    *	\param SemaphoreSet sems : SemaphoreSet object representing initialized semaphores.
+    *	\param LogIndex *index : Shared index of the file, loaded from it.
+    *	\brief Constructs a LogFile.
+    *	\return LogFile
+    *
+    *   \par Description
+    *   Sets the fd, sems and index members.
+    *
+    */
+    LogFile(const int filedesc, SemaphoreSet sems, LogIndex *index);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes the file.
+    *	\return void
+    *
+    *   \par Description
+    *   Calls close() on the file descriptor. Does NOT deallocate system semaphores or the index.
+    *
+    */
+    ~LogFile() override;
+    /*!
+    *   \fn compact
+    *	\param None.
+    *	\brief Compacts the segment with the most garbage.
+    *	\return true if a segment was punched out, false if none needed it or on error.
+    *
+    *   \par Description
+    *   Picks a segment the head has left with at most half of its entries live, and appends the live ones again
+    *   LOG_COMPACT_BATCH at a time, each batch under the write locks of its records. The segment is punched
+    *   once none of its entries is live, after the file is synced.
+    *
+    */
+    bool compact();
+    /*!
+    *   \fn readRecord
+    *	\param const int recordNumber : Record number to read
+    *	\param Record &buf : Buffer to read record into.
+    *	\brief Reads a record into the buffer.
+    *	\return false on error, true otherwise.
+    *
+    *   \par Description
+    *   Reads the record's latest entry with one pread.
+    *   Operation is read-synched, or reads a snapshot without locking with a version store set.
+    *
+    */
+    bool readRecord(const int recordNumber, Record &buf) override;
+    /*!
+    *   \fn readRecords
+    *	\param const int first : First record number to read
+    *	\param const int count : Number of records to read
+    *	\param std::vector<Record> &buf : Filled with the records read.
+    *	\brief Reads a contiguous range of records.
+    *	\return Number of records read, or -1 on error.
+    *
+    *   \par Description
+    *   Reads the records [first, first + count) that exist in the file.
+    *   Operation is read-synched once for the whole range.
+    *
+    */
+    int readRecords(const int first, const int count, std::vector<Record> &buf) override;
+    /*!
+    *   \fn scanRecords
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<bool(const Record*, int)> visit : Called with each chunk of records and its size. Returning false stops the scan.
+    *	\brief Scans a contiguous range of records in chunks.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    *   \par Description
+    *   Reads LOG_SEGMENT_ENTRIES records at a time.
+    *   Operation is read-synched once for the whole scan.
+    *
+    */
+    int scanRecords(const int first, const int count, std::function<bool(const Record*, int)> visit) override;
+    /*!
+    *   \fn writeRecord
+    *	\param Record &record : Record to append
+    *	\brief Appends a record
+    *	\return false on error
+    *
+    *   \par Description
+    *   Appends the record's entry.
+    *   Operation is write-synched.
+    *
+    */
+    bool writeRecord(Record &record) override;
+    /*!
+    *   \fn writeRecords
+    *	\param const Record *records : Records to append
+    *	\param const int count : Number of records
+    *	\brief Appends several records
+    *	\return false on error
+    *
+    *   \par Description
+    *   Appends all the entries with one pwrite, so nothing is appended if it fails.
+    *   Operation is write-synched once for the whole batch.
+    *
+    */
+    bool writeRecords(const Record *records, const int count) override;
+    /*!
+    *   \fn writeBatch
+    *	\param std::vector<int> &positions : Record number to overwrite for each record, or -1 to append it. Appended records get their new number.
+    *	\param std::vector<Record> &records : Records to write.
+    *	\param void (*number)(Record&, int) : Called on each appended record with its new number before it is written, or NULL.
+    *	\brief Writes a batch of updates and appends atomically.
+    *	\return Number of records in the file before the batch, or -1 if nothing was written.
+    *
+    *   \par Description
+    *   Validates every position, then appends an entry per record with one pwrite, in batch order.
+    *   Nothing points at the entries until they are all written, so a failed batch needs no rollback.
+    *   Operation is write-synched once for the whole batch.
+    *
+    */
+    int writeBatch(std::vector<int> &positions, std::vector<Record> &records, void (*number)(Record &record, int recordNumber)) override;
+    /*!
+    *   \fn updateRecord
+    *	\param const int recordNumber : record to update
+    *	\param Record &record : new record information
+    *	\brief Updates a record.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Appends a new entry of the record. Records past the end of the file are not created.
+    *   Operation is write-synched.
+    *
+    */
+    bool updateRecord(const int recordNumber, Record &record) override;
+    /*!
+    *   \fn checkNumRecords
+    *	\param none
+    *	\brief Counts records in file.
+    *	\return Number of records, or -1 on error
+    *
+    *   \par Description
+    *   Reads the count from the index.
+    *   Operation is read-synched.
+    *
+    */
+    int checkNumRecords() override;
+
+};
+
+#endif
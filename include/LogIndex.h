@@ -0,0 +1,303 @@
+/*!	\file LogIndex.h
+*	\brief  LogIndex class header file.
+*   A LogIndex is the shared state of a log-structured record file: the file offset of every record's latest entry,
+*   the number of live entries in each segment, and the head of the log. \n
+*   The file is a sequence of LOG_ENTRY byte entries, each a record number, the record's contents and a checksum.
+*   Creates, updates and compaction copies are all appended at the head, under a process-shared mutex, and indexed before it
+*   is released, so a record's entries are in the file in the order they were written and the latest one is the last. \n
+*   The file is cut into segments of LOG_SEGMENT bytes. Once the head has left a segment, its entries that a later one
+*   replaced are garbage, and the compactor copies the live rest to the head and punches the segment out of the file. \n
+*   Recovery is a replay: load reads the file from the start, skipping the punched holes, and indexes the last valid entry
+*   of every record. A torn entry fails its checksum and is ignored. \n
+*   A checkpoint saves the index, the live counts and the head to a file of its own, so a restart restores them with one mmap
+*   of it and replays only the entries appended past its head. The log is synced before the checkpoint is written, and the
+*   checkpoint replaces the last one with a rename, so a crash leaves one that only points at entries on disk. It names the log
+*   file it was taken of by inode and creation time, so one left beside a log file that was replaced is not used. \n
+*   The state lives in an anonymous shared mapping created at startup, so all the server processes and threads share it.
+*   The index of record offsets is reserved for LOG_MAX_RECORDS records, but only the pages holding records take memory. \n
+*
+*/
+
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include "Packets.h"
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <pthread.h>
+
+#define LOG_ENTRY 32
+#define LOG_SEGMENT (1 << 18)
+#define LOG_SEGMENT_ENTRIES (LOG_SEGMENT / LOG_ENTRY)
+#define LOG_MAX_RECORDS (1 << 24)
+#define LOG_MAX_SEGMENTS 65536
+#define LOG_MAGIC 0x474f4c52 // "RLOG"
+#define LOG_CHECKPOINT_MAGIC 0x504b434c // "LCKP"
+#define LOG_CHECKPOINT_INTERVAL 30
+
+/*!
+*   \struct Log_Entry
+*   \brief An entry of a log-structured file.
+*/
+struct Log_Entry{
+    uint32_t magic;       // LOG_MAGIC
+    int32_t recordNumber;
+    Record record;
+    uint32_t checksum;    // of the fields above
+};
+
+/*!
+*   \struct Log_Checkpoint
+*   \brief Header of a checkpoint file.
+*   \n
+*   It is followed by the offset of each record's latest entry, then the live entry count of each segment from tail to the
+*   segment holding head.
+*/
+struct Log_Checkpoint{
+    uint32_t magic;      // LOG_CHECKPOINT_MAGIC
+    uint32_t pad;
+    uint64_t inode;      // of the log file
+    int64_t birth;       // creation time of the log file, in nanoseconds, or 0 if the file system does not keep it
+    uint64_t head;       // entries before it are in the checkpoint
+    int64_t tail;
+    int64_t records;
+};
+
+/*!
+*   \struct Log_Stats
+*   \brief Snapshot of a LogIndex's counters.
+*/
+struct Log_Stats{
+    long appended;  // entries written by creates and updates
+    long moved;     // entries copied to the head by the compactor
+    long compacted; // segments punched out of the file
+    long records;   // records in the file
+    long segments;  // segments still in the file
+};
+
+/*!
+ *	\class LogIndex
+ *	\brief Shared index of a log-structured record file
+ *  \n
+ *   A LogIndex maps each record number to the offset of its latest entry and appends new entries at the head. \n
+ */
+class LogIndex
+{
+private:
+    /*!
+    *   \struct Log_Header
+    *   \brief Shared state at the start of the segment.
+    */
+    struct Log_Header{
+        pthread_mutex_t appending;    // held while entries are written at the head and indexed
+        std::atomic<long> records;    // records in the file
+        std::atomic<uint64_t> head;   // offset of the next entry, written under appending
+        std::atomic<long> tail;       // oldest segment still in the file, written under appending
+        std::atomic<long> appended;
+        std::atomic<long> moved;
+        std::atomic<long> compacted;
+    };
+
+    /*!
+    *	\var size_t size - Length of the mapping.
+    */
+    size_t size;
+    /*!
+    *	\var Log_Header *header - Shared state.
+    */
+    Log_Header *header;
+    /*!
+    *	\var std::atomic<uint64_t> *offsets - Offset of each record's latest entry.
+    */
+    std::atomic<uint64_t> *offsets;
+    /*!
+    *	\var std::atomic<int> *live - Live entries of each segment, by segment number modulo LOG_MAX_SEGMENTS, or -1 once punched.
+    */
+    std::atomic<int> *live;
+
+    /*!
+    *   \fn segment
+    *	\param uint64_t offset : File offset.
+    *	\brief Finds the counter of the segment holding an offset.
+    *	\return Its live entry count.
+    *
+    */
+    std::atomic<int> &segment(uint64_t offset){return live[(offset / LOG_SEGMENT) % LOG_MAX_SEGMENTS];}
+    /*!
+    *   \fn checksum
+    *	\param const Log_Entry &entry : Entry.
+    *	\brief Computes the checksum of an entry's fields.
+    *	\return FNV-1a hash of the bytes before the checksum.
+    *
+    */
+    static uint32_t checksum(const Log_Entry &entry);
+    /*!
+    *   \fn replay
+    *	\param int fd : Open descriptor of the log-structured file.
+    *	\param uint64_t from : Offset of the first entry to replay.
+    *	\param off_t end : Size of the file.
+    *	\param std::vector<char> &present : Set to 1 for every segment read, by segment number.
+    *	\param const std::function<void(const Log_Entry &, uint64_t)> &visit : Called on every valid entry with its offset, in file order.
+    *	\brief Reads the entries of the file from an offset on, skipping the punched holes.
+    *	\return Number of valid entries, or -1 on error.
+    *
+    */
+    static long replay(int fd, uint64_t from, off_t end, std::vector<char> &present, const std::function<void(const Log_Entry &, uint64_t)> &visit);
+    /*!
+    *   \fn identify
+    *	\param int fd : Open descriptor of the log-structured file.
+    *	\param Log_Checkpoint &checkpoint : Filled with the inode and creation time of the file.
+    *	\brief Identifies the file a checkpoint is taken of.
+    *	\return false on error.
+    *
+    */
+    static bool identify(int fd, Log_Checkpoint &checkpoint);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param None.
+    *	\brief Creates an empty shared index.
+    *	\return LogIndex
+    *
+    *   \par Description
+    *   Maps the state shared and anonymous. Exits on failure. Processes forked afterwards share it.
+    *
+    */
+    LogIndex();
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Unmaps the state.
+    *	\return void
+    *
+    */
+    ~LogIndex();
+    /*!
+    *   \fn load
+    *	\param int fd : Open descriptor of the log-structured file.
+    *	\brief Rebuilds the index by replaying the file.
+    *	\return Number of valid entries replayed, or -1 on error.
+    *
+    *   \par Description
+    *   Indexes the last valid entry of each record, and counts the records numbered from 0 without a gap.
+    *   Must be called before the index is shared, on an empty index.
+    *
+    */
+    long load(int fd);
+    /*!
+    *   \fn restore
+    *	\param int fd : Open descriptor of the log-structured file.
+    *	\param const char *path : Checkpoint file.
+    *	\brief Restores the index from a checkpoint, then replays the entries appended after it.
+    *	\return Number of valid entries replayed past the checkpoint, or -1 if there is no usable checkpoint or on error.
+    *
+    *   \par Description
+    *   The checkpoint is mapped whole and copied into the index. Segments compacted since are found as holes.
+    *   Must be called before the index is shared, on an empty index, which must be discarded if it fails.
+    *
+    */
+    long restore(int fd, const char *path);
+    /*!
+    *   \fn checkpoint
+    *	\param int fd : Open descriptor of the log-structured file.
+    *	\param const char *path : Checkpoint file.
+    *	\brief Writes a checkpoint of the index.
+    *	\return false on error, leaving the last checkpoint as it was.
+    *
+    *   \par Description
+    *   Copies the state under the append mutex, so appends wait for the copy but not for the writes. Syncs the log, then writes
+    *   the copy to path.tmp, syncs it and renames it over path.
+    *
+    */
+    bool checkpoint(int fd, const char *path);
+    /*!
+    *   \fn getHead
+    *	\param None.
+    *	\brief Offset of the next entry.
+    *	\return uint64_t
+    *
+    */
+    uint64_t getHead(){return header->head.load();}
+    /*!
+    *   \fn numRecords
+    *	\param None.
+    *	\brief Number of records in the file.
+    *	\return long
+    *
+    */
+    long numRecords(){return header->records.load();}
+    /*!
+    *   \fn offset
+    *	\param int recordNumber : Record number, below numRecords.
+    *	\brief Finds a record's latest entry.
+    *	\return File offset of the entry.
+    *
+    */
+    uint64_t offset(int recordNumber){return offsets[recordNumber].load();}
+    /*!
+    *   \fn valid
+    *	\param const Log_Entry &entry : Entry read from the file.
+    *	\param int recordNumber : Record number it should hold, or -1 for any.
+    *	\brief Checks an entry read from the file.
+    *	\return false for a hole, a torn entry or another record's entry.
+    *
+    */
+    static bool valid(const Log_Entry &entry, int recordNumber);
+    /*!
+    *   \fn append
+    *	\param int fd : Open descriptor of the log-structured file.
+    *	\param const int *recordNumbers : Record number of each record, the next ones in order for new records.
+    *	\param const Record *records : Contents.
+    *	\param int count : Number of records.
+    *	\param bool moving : The entries are compaction copies, not writes.
+    *	\brief Writes entries at the head and indexes them.
+    *	\return false if nothing was written.
+    *
+    *   \par Description
+    *   Writes all the entries with one pwrite, then points the records at them and counts the new records.
+    *   Must be called under the write locks of the records.
+    *
+    */
+    bool append(int fd, const int *recordNumbers, const Record *records, int count, bool moving);
+    /*!
+    *   \fn pickSegment
+    *	\param None.
+    *	\brief Picks the segment to compact next.
+    *	\return The segment the head has left with the fewest live entries, if at most half of them are, or -1.
+    *
+    */
+    long pickSegment();
+    /*!
+    *   \fn release
+    *	\param int fd : Open descriptor of the log-structured file.
+    *	\param long segment : Segment with no live entry left.
+    *	\brief Punches a compacted segment out of the file.
+    *	\return false if it still has live entries or could not be punched.
+    *
+    *   \par Description
+    *   Syncs the file first, so the copies of its entries are durable before it is gone.
+    *
+    */
+    bool release(int fd, long segment);
+    /*!
+    *   \fn stats
+    *	\param None.
+    *	\brief Reads the counters.
+    *	\return Log_Stats
+    *
+    */
+    Log_Stats stats();
+    /*!
+    *   \fn printStats
+    *	\param None.
+    *	\brief Prints the counters.
+    *	\return void
+    *
+    */
+    void printStats();
+
+};
+
+#endif
@@ -0,0 +1,223 @@
+/*!	\file MappedFile.h
+*	\brief  Define a memory-mapped implementation of DataFile.
+*   A MappedFile maps the whole file MAP_SHARED, so every server process and thread that maps it sees the same
+*   page cache pages: a store by one is a load away for all the others, with no read or write system calls. \n
+*   The mapping is reserved in MAP_CHUNK sized steps past the end of the file, so appends only extend the file
+*   with ftruncate and rarely need the mapping itself grown. \n
+*   The number of records is cached per object. The file never shrinks, so a cached count is always safe to read
+*   below, and it is only refreshed from the file size when an access goes past it, since another process may have appended. \n
+*   Accesses are synchronized exactly like a CriticalFile, so both keep the same file format. \n
+*
+*/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "DataFile.h"
+#include "SemaphoreSet.h"
+
+#define MAP_CHUNK (64L << 20)
+
+/*!
+ *	\class MappedFile
+ *	\brief Memory-mapped DataFile template class
+ *  \n
+*   A MappedFile serves reads as copies out of a shared mapping of the file and writes as copies into it. \n
+*   Accesses are synchronized through its SemaphoreSet, or the file's LockStripes. \n
+ */
+template<typename T>
+class MappedFile : public DataFile<T>
+{
+private:
+    /*!
+    *	\var const int fd - Open file descriptor.
+    */
+    const int fd;
+    /*!
+    *	\var char *map - Start of the shared mapping, or NULL before the first access.
+    */
+    char *map;
+    /*!
+    *	\var size_t mapped - Length of the mapping, a multiple of MAP_CHUNK.
+    */
+    size_t mapped;
+    /*!
+    *	\var long numRecords - Records known to be in the file.
+    */
+    long numRecords;
+
+    /*!
+    *   \fn refresh
+    *	\param None.
+    *	\brief Rereads the file size.
+    *	\return Number of records, or -1 on error.
+    *
+    *   \par Description
+    *   Updates numRecords from the file size and grows the mapping to cover it.
+    *   Operation is NOT synched.
+    */
+    long refresh();
+    /*!
+    *   \fn reserve
+    *	\param size_t size : Bytes the mapping must cover.
+    *	\brief Grows the mapping.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Maps or remaps the file to size rounded up to MAP_CHUNK. Pages past the end of the file are never touched.
+    *   Operation is NOT synched.
+    */
+    bool reserve(size_t size);
+    /*!
+    *   \fn extend
+    *	\param long records : New number of records.
+    *	\brief Grows the file.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Grows the mapping and then the file, leaving the new records zeroed for the caller to fill in.
+    *   Operation is NOT synched.
+    */
+    bool extend(long records);
+    /*!
+    *   \fn record
+    *	\param long recordNumber : Record number.
+    *	\brief Address of a record in the mapping.
+    *	\return Pointer to the record.
+    *
+    */
+    T *record(long recordNumber){return (T *) (map + recordNumber * sizeof(T));}
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int filedesc : Open file descriptor, opened read-write.
+    *	\param SemaphoreSet sems : SemaphoreSet object representing initialized semaphores.
+    *	\brief Constructs a MappedFile.
+    *	\return MappedFile
+    *
+    *   \par Description
+    *   Sets the fd and sems members. The file is mapped on first access.
+    *
+    */
+    MappedFile(const int filedesc, SemaphoreSet sems);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Unmaps and closes the file.
+    *	\return void
+    *
+    *   \par Description
+    *   Stores already in the mapping reach the file through the page cache. Does NOT deallocate system semaphores.
+    *
+    */
+    ~MappedFile() override;
+    /*!
+    *   \fn readRecord
+    *	\param const int recordNumber : Record number to read
+    *	\param T &buf : Buffer to read record into.
+    *	\brief Reads a record into the buffer.
+    *	\return false on error, true otherwise.
+    *
+    *   \par Description
+    *   Copies the record out of the mapping.
+    *   Operation is read-synched, or reads a snapshot without locking with a version store set.
+    *
+    */
+    bool readRecord(const int recordNumber, T &buf) override;
+    /*!
+    *   \fn readRecords
+    *	\param const int first : First record number to read
+    *	\param const int count : Number of records to read
+    *	\param std::vector<T> &buf : Filled with the records read.
+    *	\brief Reads a contiguous range of records.
+    *	\return Number of records read, or -1 on error.
+    *
+    *   \par Description
+    *   Copies the records [first, first + count) that exist in the file out of the mapping.
+    *   Operation is read-synched once for the whole range.
+    *
+    */
+    int readRecords(const int first, const int count, std::vector<T> &buf) override;
+    /*!
+    *   \fn scanRecords
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<bool(const T*, int)> visit : Called with each chunk of records and its size. Returning false stops the scan.
+    *	\brief Scans a contiguous range of records in chunks.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    *   \par Description
+    *   Hands the visitor chunks of the mapping itself, so nothing is copied.
+    *   Operation is read-synched once for the whole scan.
+    *
+    */
+    int scanRecords(const int first, const int count, std::function<bool(const T*, int)> visit) override;
+    /*!
+    *   \fn writeRecord
+    *	\param T &record : Record to append
+    *	\brief Appends a record
+    *	\return false on error
+    *
+    *   \par Description
+    *   Extends the file by one record and stores it in the mapping.
+    *   Operation is write-synched.
+    *
+    */
+    bool writeRecord(T &record) override;
+    /*!
+    *   \fn writeRecords
+    *	\param const T *records : Records to append
+    *	\param const int count : Number of records
+    *	\brief Appends several records
+    *	\return false on error
+    *
+    *   \par Description
+    *   Extends the file once for all the records and stores them in the mapping.
+    *   Operation is write-synched once for the whole batch.
+    *
+    */
+    bool writeRecords(const T *records, const int count) override;
+    /*!
+    *   \fn writeBatch
+    *	\param std::vector<int> &positions : Record number to overwrite for each record, or -1 to append it. Appended records get their new number.
+    *	\param std::vector<T> &records : Records to write.
+    *	\param void (*number)(T&, int) : Called on each appended record with its new number before it is written, or NULL.
+    *	\brief Writes a batch of updates and appends atomically.
+    *	\return Number of records in the file before the batch, or -1 if nothing was written.
+    *
+    *   \par Description
+    *   Validates every position and extends the file for the appends. Only then are the records stored,
+    *   and stores into the mapping cannot fail, so the batch needs no undo.
+    *   Operation is write-synched once for the whole batch.
+    *
+    */
+    int writeBatch(std::vector<int> &positions, std::vector<T> &records, void (*number)(T &record, int recordNumber)) override;
+    /*!
+    *   \fn updateRecord
+    *	\param const int recordNumber : record to update
+    *	\param T &record : new record information
+    *	\brief Updates a record.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   Stores the record over the existing one in the mapping. Records past the end of the file are not created.
+    *   Operation is write-synched.
+    *
+    */
+    bool updateRecord(const int recordNumber, T &record) override;
+    /*!
+    *   \fn checkNumRecords
+    *	\param none
+    *	\brief Counts records in file.
+    *	\return Number of records, or -1 on error
+    *
+    *   \par Description
+    *   Rereads the file size, since other processes may have appended.
+    *
+    */
+    int checkNumRecords() override;
+
+};
+
+#endif
@@ -25,6 +25,7 @@
 #include <arpa/inet.h>
 #include <sys/sem.h>
 #include <errno.h>
+#include <stdint.h>
 
 /*!
 *   \struct Record
@@ -49,6 +50,145 @@ struct Record_Message{
     Record record;
 };
 
+/*!
+*   \struct Frame_Header
+*   \brief Header preceding every protocol v2 message.
+*   \n
+*   A v2 stream is a sequence of frames, each a Frame_Header followed by length payload bytes. 
+*   Fields are in host byte order, like the v1 structs. 
+*   A v1 stream is a sequence of bare Record_Message structs; since FRAME_MAGIC is never a valid action,
+*   the first 4 bytes of a connection tell the two apart.
+*/
+struct Frame_Header{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t opcode;
+    uint32_t requestId;
+    uint32_t length;
+};
+
+/*!
+*   \struct Range_Request
+*   \brief Payload of a v2 read range request, for the records [start, end).
+*/
+struct Range_Request{
+    int start;
+    int end;
+};
+
+/*!
+*   \struct Aggregate_Request
+*   \brief Payload of a v2 aggregate request, over one field of the records [start, end).
+*/
+struct Aggregate_Request{
+    int field;
+    int start;
+    int end;
+};
+
+/*!
+*   \struct Aggregate_Reply
+*   \brief Payload of a v2 aggregate reply. count is -1 on error.
+*/
+struct Aggregate_Reply{
+    double sum;
+    double avg;
+    float min;
+    float max;
+    int field;
+    int count;
+};
+
+#define FIELD_ANDROID 0
+#define FIELD_IOS 1
+#define FIELD_KAIOS 2
+#define FIELD_OTHER 3
+#define NUM_FIELDS 4
+
+#define MAX_FILTER_TERMS 4
+
+/*!
+*   \struct Filter_Term
+*   \brief One comparison of a filter: field op value.
+*/
+struct Filter_Term{
+    int field;
+    int op;
+    float value;
+};
+
+/*!
+*   \struct Filter_Request
+*   \brief Payload of a v2 filter request, over the records [start, end).
+*   \n
+*   The first count terms are combined with FILTER_AND or FILTER_OR. With no terms every record matches.
+*/
+struct Filter_Request{
+    int start;
+    int end;
+    int combine;
+    int count;
+    Filter_Term terms[MAX_FILTER_TERMS];
+};
+
+#define FILTER_AND 0
+#define FILTER_OR 1
+
+#define FILTER_LT 0
+#define FILTER_LE 1
+#define FILTER_GT 2
+#define FILTER_GE 3
+#define FILTER_EQ 4
+#define FILTER_NE 5
+
+/*!
+*   \struct Index_Request
+*   \brief Payload of a v2 index range request, for the records whose field is in [low, high], in order of that field.
+*   \n
+*   The field must be indexed on the server. At most limit records are sent, or all of them with a limit of 0.
+*/
+struct Index_Request{
+    int field;
+    int order;
+    int limit;
+    float low;
+    float high;
+};
+
+#define INDEX_ASCENDING 0
+#define INDEX_DESCENDING 1
+
+/*!
+*   \struct Key_Message
+*   \brief Payload of a v2 keyed request and of its reply: a record key, the slot of its record, and the record.
+*   \n
+*   The slot is ignored in requests, and -1 in a reply if nothing was read or written.
+*/
+struct Key_Message{
+    int64_t key;
+    int slot;
+    Record record;
+};
+
+#define DATASET_NAME_MAX 32
+
+/*!
+*   \struct Dataset_Request
+*   \brief Payload of a v2 dataset request, selecting the dataset the connection's next requests are served from.
+*   \n
+*   An empty name selects the server's data file again. The reply is the int number of records in the dataset, or -1 if it
+*   cannot be used.
+*/
+struct Dataset_Request{
+    int create; // 1 to create an empty dataset of that name if there is none
+    char name[DATASET_NAME_MAX];
+};
+
+#define FRAME_MAGIC 0x52464444 // "DDFR"
+#define PROTOCOL_V1 1
+#define PROTOCOL_V2 2
+#define MAX_FRAME_PAYLOAD (1 << 20)
+
 /*!
 *   \struct Log
 *   \brief Represents a logged action.
@@ -83,6 +223,36 @@ struct Log{
         case 6: //Disonnected
             printf("Disconnected from server.\n");
             break;
+        case 7: //Read range
+            printf("Read Records from %d.\n", arg);
+            break;
+        case 8: //Batch write
+            printf("Wrote Batch of %d Records.\n", arg);
+            break;
+        case 9: //Aggregate
+            printf("Aggregated %d Records.\n", arg);
+            break;
+        case 10: //Filter
+            printf("Filtered %d Records.\n", arg);
+            break;
+        case 11: //Index range
+            printf("Looked up %d Records by Index.\n", arg);
+            break;
+        case 12: //Keyed read
+            printf("Read Keyed Record %d.\n", arg);
+            break;
+        case 13: //Keyed update
+            printf("Updated Keyed Record %d.\n", arg);
+            break;
+        case 14: //Keyed create
+            printf("Created Keyed Record %d.\n", arg);
+            break;
+        case 15: //Keyed delete
+            printf("Deleted Keyed Record %d.\n", arg);
+            break;
+        case 16: //Dataset
+            printf("Selected Dataset of %d Records.\n", arg);
+            break;
         default:
             printf("Performed unspecified action (%d|%d).\n", action, arg);
             break;
@@ -0,0 +1,142 @@
+/*!	\file RecordQuery.h
+*	\brief  RecordQuery class header file.
+*   A RecordQuery evaluates queries over the records of the binary file on the server, so clients receive results
+*   instead of the records themselves. \n
+*   Aggregates are scanned in chunks of QUERY_CHUNK records, each read with one DataFile::scanField call, so a scan
+*   of a multi-million record file needs neither a buffer for the whole file nor a reader lock held across all of it. \n
+*   Aggregates, and filters whose terms all test one field, only ask the file for that field, so a columnar file
+*   reads that field's column alone. \n
+*   Ranges are of record numbers, which are the months the records were created for. \n
+*   Filters are evaluated a chunk at a time: each term is computed for the whole chunk into a bitmask by SimdKernels,
+*   the bitmasks are combined a word of 64 records at a time, and the matches copied out by their set bits. \n
+*   Aggregates reduce each chunk of the field with SimdKernels too. \n
+*   A file in several parts, such as a ShardedFile, is queried a part per thread, each by a RecordQuery of its own,
+*   and the parts' aggregates merged or matches joined in file order. \n
+*   A file with keyed records may hold slots freed by deletes, whose month is negative. A query told so leaves them out,
+*   reading whole records to tell them apart. \n
+*
+*/
+
+#ifndef RECORDQUERY_H
+#define RECORDQUERY_H
+
+#include "DataFile.h"
+#include "Packets.h"
+#include <vector>
+
+/*!
+ *	\class RecordQuery
+ *	\brief Server-side record query evaluator
+ *  \n
+ *   A RecordQuery evaluates queries over the records of the binary file, scanning it in chunks. \n
+ */
+class RecordQuery
+{
+private:
+    /*!
+    *	\var DataFile<Record> &binFile - The binary file queried.
+    */
+    DataFile<Record> &binFile;
+    /*!
+    *	\var bool skipFreed - Leave out records with a negative month, which are freed keyed slots.
+    */
+    bool skipFreed;
+    /*!
+    *	\var std::vector<uint64_t> match, mask - Bitmasks of the records matching the filter and its current term.
+    */
+    std::vector<uint64_t> match;
+    std::vector<uint64_t> mask;
+
+    /*!
+    *   \fn evaluateTerm
+    *	\param const Record *records : Chunk of records.
+    *	\param int count : Number of records.
+    *	\param const Filter_Term &term : Comparison to evaluate.
+    *	\brief Evaluates one comparison over a chunk into the mask.
+    *	\return void
+    *
+    */
+    void evaluateTerm(const Record *records, int count, const Filter_Term &term);
+    /*!
+    *   \fn evaluateTerm
+    *	\param const float *values : Chunk of values of the term's field.
+    *	\param int count : Number of values.
+    *	\param const Filter_Term &term : Comparison to evaluate.
+    *	\brief Evaluates one comparison over a chunk of a field's values into the mask.
+    *	\return void
+    *
+    */
+    void evaluateTerm(const float *values, int count, const Filter_Term &term);
+    /*!
+    *   \fn combineTerm
+    *	\param int term : Index of the term just evaluated into the mask.
+    *	\param int count : Number of records.
+    *	\param bool any : true to OR the terms, false to AND them.
+    *	\brief Combines the mask of a term into the match.
+    *	\return Number of records matching so far.
+    *
+    */
+    long combineTerm(int term, int count, bool any);
+    /*!
+    *   \fn scatter
+    *	\param size_t parts : Number of parts.
+    *	\param std::function<bool(size_t)> run : Queries a part, false on error.
+    *	\brief Runs a task for each part of a range on parallel threads.
+    *	\return false if any part failed.
+    *
+    *   \par Description
+    *   Runs the parts on the process's ScanPool, started once, and the calling thread, each taking the next part left.
+    *
+    */
+    static bool scatter(size_t parts, std::function<bool(size_t)> run);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param DataFile<Record> &binFile : The binary file to query.
+    *	\param bool skipFreed : The file may hold freed keyed slots, which no query should see.
+    *	\brief Constructs a RecordQuery.
+    *	\return RecordQuery
+    *
+    */
+    RecordQuery(DataFile<Record> &binFile, bool skipFreed = false);
+    /*!
+    *   \fn fieldMember
+    *	\param int field : FIELD_ANDROID, FIELD_IOS, FIELD_KAIOS or FIELD_OTHER.
+    *	\brief Maps a field code to the Record member it names.
+    *	\return Pointer to the member, or NULL for an unknown code.
+    *
+    */
+    static float Record::* fieldMember(int field);
+    /*!
+    *   \fn aggregate
+    *	\param const Aggregate_Request &request : Field and record range.
+    *	\param Aggregate_Reply &reply : Filled with the result.
+    *	\brief Computes the count, sum, average, minimum and maximum of a field over a range.
+    *	\return false on an unknown field or a read error.
+    *   
+    *   \par Description
+    *   A range running past the end of the file is cut short. An empty range gives a count of 0 and zeroed statistics.
+    *   The parts of a file reported by DataFile::partitions are aggregated in parallel. Skipping freed slots reads
+    *   whole records with DataFile::scanRecords, instead of the field alone with DataFile::scanField.
+    *
+    */
+    bool aggregate(const Aggregate_Request &request, Aggregate_Reply &reply);
+    /*!
+    *   \fn filter
+    *	\param const Filter_Request &request : Terms and record range.
+    *	\param std::vector<Record> &matches : Filled with the matching records, in file order.
+    *	\brief Finds the records of a range matching a filter.
+    *	\return false on an invalid filter or a read error.
+    *   
+    *   \par Description
+    *   The range is scanned under one reader lock, with DataFile::selectRecords when every term tests the same field
+    *   and no freed slots are skipped, and DataFile::scanRecords otherwise. The parts of a file reported by
+    *   DataFile::partitions are filtered in parallel, each under its own lock.
+    *
+    */
+    bool filter(const Filter_Request &request, std::vector<Record> &matches);
+
+};
+
+#endif
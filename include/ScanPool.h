@@ -0,0 +1,113 @@
+/*!	\file ScanPool.h
+*	\brief  ScanPool class header file.
+*   A ScanPool runs the parts of a scan, such as the shards of a range, on helper threads started once per process. \n
+*   The calling thread takes parts too, and waits for the helpers to finish the ones they took, so a scan costs no thread
+*   creation. A process has one pool, started the first time it scans: a process forked afterwards, which inherits none
+*   of its threads, starts its own. \n
+*   Several threads of a threaded server can scan at once; the helpers take parts from the oldest scan first. \n
+*
+*/
+
+#ifndef SCANPOOL_H
+#define SCANPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+/*!
+ *	\class ScanPool
+ *	\brief Helper threads for the parts of scans
+ *  \n
+ *   A ScanPool hands the parts of each scan to its threads and the calling one, each taking the next part left. \n
+ */
+class ScanPool
+{
+private:
+    /*!
+    *   \struct Scan_Job
+    *   \brief A scan in progress.
+    */
+    struct Scan_Job{
+        std::function<bool(size_t)> *run;
+        size_t parts;
+        size_t next;  // next part to take
+        size_t done;  // parts finished
+        size_t users; // helpers working on it
+        bool ok;
+    };
+
+    /*!
+    *	\var std::mutex queueing - Guards jobs and the counters of each job.
+    */
+    std::mutex queueing;
+    /*!
+    *	\var std::condition_variable queued - Signalled when a scan is queued.
+    */
+    std::condition_variable queued;
+    /*!
+    *	\var std::condition_variable finished - Signalled when a helper leaves a scan.
+    */
+    std::condition_variable finished;
+    /*!
+    *	\var std::deque<Scan_Job*> jobs - Scans with parts left, oldest first.
+    */
+    std::deque<Scan_Job*> jobs;
+
+    /*!
+    *   \fn Constructor
+    *	\param int helpers : Number of helper threads.
+    *	\brief Starts the helper threads.
+    *	\return ScanPool
+    *
+    */
+    ScanPool(int helpers);
+    /*!
+    *   \fn help
+    *	\param None.
+    *	\brief Runs parts of the queued scans until the process exits.
+    *	\return void
+    *
+    */
+    void help();
+    /*!
+    *   \fn work
+    *	\param Scan_Job &job : A scan.
+    *	\param std::unique_lock<std::mutex> &lock : Lock of queueing, held.
+    *	\brief Takes and runs the parts of a scan until none is left.
+    *	\return void
+    *
+    *   \par Description
+    *   Releases the lock while a part runs.
+    */
+    void work(Scan_Job &job, std::unique_lock<std::mutex> &lock);
+
+public:
+    /*!
+    *   \fn shared
+    *	\param None.
+    *	\brief Finds the pool of this process, starting it the first time.
+    *	\return The pool.
+    *
+    *   \par Description
+    *   Starts one helper per core but the calling one, so a single core scans without any.
+    *
+    */
+    static ScanPool &shared();
+    /*!
+    *   \fn run
+    *	\param size_t parts : Number of parts.
+    *	\param std::function<bool(size_t)> run : Runs a part, false on error.
+    *	\brief Runs a task for each part, on the helpers and the calling thread.
+    *	\return false if any part failed.
+    *
+    *   \par Description
+    *   Returns once every part has run.
+    *
+    */
+    bool run(size_t parts, std::function<bool(size_t)> run);
+
+};
+
+#endif
@@ -2,8 +2,9 @@
 *	\brief  Server class header file.
 *   A Server object represents a child data server. \n
 *   It handles all communication with a single client and all operations on data requested by that client. \n
-*   The operation lifetime of a Server is its run method. \n
-*   Operations on the binary file are handled in the CriticalFile<Record> binFile.\n
+*   The operation lifetime of a Server is its run method, or its serve coroutine when many clients share one thread. \n
+*   Operations on the binary file are handled in the DataFile<Record> binFile, a CriticalFile, a MappedFile, a ColumnFile
+*   or a LogFile depending on the storage engine picked at startup.\n
 *   Operations on the log file are handled in the CriticalFile<Server_Log_Entry>.\n
 *   Communication with the client is performed in SocketConnection clientSocket.\n
 *   Wherever numeric codes are used to correspond to operations, these codes are used:\n
@@ -14,6 +15,31 @@
 *        4 : Create\n
 *        5 : (Log when determining operations, Client Connection when logging actions.)\n
 *        6 : Client disconnection\n
+*   Clients speak protocol v1 (bare Record_Message structs) or v2 (Frame_Header framed messages), detected from their first message.\n
+*   In v2, opcodes 1-4 carry a Record_Message payload both ways and replies echo the request id.\n
+*   v2 clients may pipeline requests. Of the requests received together, log requests are answered after the others,
+*   so replies can arrive out of order and must be matched to requests by id. v1 replies always follow request order.\n
+*   A v2 log reply is a sequence of opcode 5 frames holding arrays of Server_Log_Entry, ended by an empty one.\n
+*   v2 clients can also send opcode 6 with a Range_Request to read records [start, end). The reply is a sequence of
+*   opcode 6 frames holding arrays of Record, ended by a frame holding an int: the number of records sent, or -1 on error.\n
+*   Opcode 7 carries an array of Record_Message updates (action 3) and creates (action 4), written all or nothing.
+*   The reply is one opcode 7 frame holding an int per message: the record number written, or -1 for all if nothing was written.\n
+*   Opcode 8 carries an Aggregate_Request and is answered with one opcode 8 frame holding an Aggregate_Reply,
+*   computed on the server by a RecordQuery.\n
+*   Opcode 9 carries a Filter_Request and is answered like a read range, with opcode 9 frames holding the matching records.\n
+*   Opcode 10 carries an Index_Request and is answered like a read range, with opcode 10 frames holding the records found
+*   through the FieldIndex of its field, in order of that field. The count is -1 if the field is not indexed.\n
+*   Opcodes 11 to 14 address records by a 64-bit key through the server's KeyIndex instead of by record number: each carries
+*   a Key_Message and is answered with one frame of the same opcode holding a Key_Message, whose slot is -1 on error.\n
+*        11 : Read the record of a key\n
+*        12 : Update the record of a key\n
+*        13 : Create a record for a key not in use, in a slot freed by a delete if any\n
+*        14 : Delete the record of a key, replying with its last contents\n
+*   Opcode 15 carries a Dataset_Request selecting the named dataset of the server's DatasetCache that the connection's next
+*   requests are served from, or the data file again for an empty name. It is answered with one opcode 15 frame holding an
+*   int: the number of records in the dataset, or -1 if it cannot be used, which leaves the selection as it was.
+*   Index ranges and keyed requests only cover the data file, and fail while a dataset is selected.
+*   Range reads, aggregates and filters over a sharded dataset scan its shards in parallel.\n
 *   
 */
 
@@ -22,7 +48,15 @@
 
 #include "SocketConnection.h"
 #include "CriticalFile.h"
+#include "MappedFile.h"
+#include "ColumnFile.h"
+#include "LogFile.h"
+#include "FieldIndex.h"
+#include "KeyIndex.h"
+#include "DatasetCache.h"
 #include "Packets.h"
+#include <vector>
+#include <memory>
 
 
 
@@ -33,7 +67,7 @@
  *   A Server object represents a child data server. \n
  *   It handles all communication with a single client and all operations on data requested by that client. \n
  *   The operation lifetime of a Server is its run method. \n
- *   Operations on the binary file are handled in the CriticalFile<Record> binFile.\n
+ *   Operations on the binary file are handled in the DataFile<Record> binFile.\n
  *   Operations on the log file are handled in the CriticalFile<Server_Log_Entry>.\n
  *   Communication with the client is performed in SocketConnection clientSocket.\n
  */
@@ -45,13 +79,37 @@ private:
     */
     SocketConnection clientSocket;
     /*!
-    *	\var CriticalFile<Record> binFile - Performs accesses and operations on the binary file.
+    *	\var DataFile<Record> *dataFile - Performs accesses and operations on the binary file.
     */
-    CriticalFile<Record> binFile;
+    DataFile<Record> *dataFile;
+    /*!
+    *	\var std::shared_ptr<DataFile<Record>> dataset - The named dataset selected, or NULL.
+    */
+    std::shared_ptr<DataFile<Record>> dataset;
+    /*!
+    *	\var DataFile<Record> *binFile - The file requests are served from: the dataset selected, or else dataFile.
+    */
+    DataFile<Record> *binFile;
     /*!
     *	\var CriticalFile<Server_Log_Entry> logFile - Performs accesses and operations on the log file.
     */
     CriticalFile<Server_Log_Entry> logFile;
+    /*!
+    *	\var std::vector<Server_Log_Entry> *logQueue - When set, log entries are collected here for a batched append instead of being written.
+    */
+    std::vector<Server_Log_Entry> *logQueue;
+    /*!
+    *	\var uint32_t requestId - Id of the v2 request being handled, echoed in its replies.
+    */
+    uint32_t requestId;
+    /*!
+    *	\var std::vector<Server_Log_Entry> logChunk - Log entries waiting to be sent in one v2 frame.
+    */
+    std::vector<Server_Log_Entry> logChunk;
+    /*!
+    *	\var Frame request - Frame of the request being handled. Its payload is valid until more bytes are received.
+    */
+    Frame request;
 
     /*!
     *   \fn messageSwitch
@@ -76,6 +134,36 @@ private:
     */
     void composeReply(Record_Message &msg);
     /*!
+    *   \fn sendReply
+    *	\param Record_Message &msg : Reply to be sent to client.
+    *	\brief Sends a reply in the client's protocol.
+    *	\return void
+    *   
+    *   \par Description
+    *   v1 clients get the bare struct, v2 clients a frame carrying the id of the request being handled.
+    *
+    */
+    void sendReply(Record_Message &msg);
+    /*!
+    *   \fn nextMessage
+    *	\param Record_Message &msg : Filled with the next request.
+    *	\brief Takes the next complete request from the receive buffer.
+    *	\return false if no complete request is buffered.
+    *
+    */
+    bool nextMessage(Record_Message &msg);
+    /*!
+    *   \fn deferLog
+    *	\param Record_Message &msg : Received request.
+    *	\brief Checks whether a request can be completed after the ones behind it.
+    *	\return true for log requests from v2 clients.
+    *
+    *   \par Description
+    *   A log dump is long, so cheap requests pipelined behind it are answered first.
+    *
+    */
+    bool deferLog(Record_Message &msg);
+    /*!
     *   \fn countReply
     *	\param Record_Message &msg : Message struct to be sent to client.
     *	\brief Reply to a count request.
@@ -119,11 +207,207 @@ private:
     *   
     *   \par Description
     *   Overwrites the record number in msg.arg with the record in msg.record.
+    *   Under keyed records, a slot freed by a keyed delete, or a record with a negative month, is refused; a keyed record
+    *   is overwritten like any other, and its key reads the new contents.
     *   msg.arg = the record number updated, or -1 on error.
     * 
     */
     void updateReply(Record_Message &msg);
     /*!
+    *   \fn rangeReply
+    *	\param None.
+    *	\brief Replies to a read range request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Reads the records of the Range_Request in the request payload under one reader lock, 
+    *   then sends them with sendRecords. A range running past the end of the file is cut short.
+    *
+    */
+    void rangeReply();
+    /*!
+    *   \fn filterReply
+    *	\param None.
+    *	\brief Replies to a filter request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Scans the range of the Filter_Request in the request payload under one reader lock and sends only the records matching its terms.
+    *
+    */
+    void filterReply();
+    /*!
+    *   \fn indexReply
+    *	\param None.
+    *	\brief Replies to an index range request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Looks up the records of the Index_Request in the request payload in the index of its field, and reads and sends them
+    *   in the order found. The index's reader lock is held until they are read, so every record sent is in the range.
+    *
+    */
+    void indexReply();
+    /*!
+    *   \fn readIndexed
+    *	\param std::vector<int> &numbers : Record numbers found by an index lookup.
+    *	\param std::vector<Record> &records : Filled with the records, in the same order.
+    *	\brief Reads the records an index lookup found, in the order found.
+    *	\return false on a read error.
+    *   
+    *   \par Description
+    *   Records are read one at a time, unless at least one of every INDEX_SCAN_DENSITY records of their span was found:
+    *   those are read with one DataFile::scanRecords of the span instead of a lock and a read each.
+    *
+    */
+    bool readIndexed(std::vector<int> &numbers, std::vector<Record> &records);
+    /*!
+    *   \fn lockIndexes
+    *	\param None.
+    *	\brief Takes the writer lock of every field index.
+    *	\return true if any field is indexed, and requests are served from the data file.
+    *   
+    *   \par Description
+    *   Takes none while a dataset is selected, since the indexes only cover the data file.
+    *   Writes hold the index locks from before they read the records they replace until the indexes are updated,
+    *   so the indexes change in the same order as the file. They are taken in field order, before any lock of the file.
+    *
+    */
+    bool lockIndexes();
+    /*!
+    *   \fn unlockIndexes
+    *	\param None.
+    *	\brief Releases the writer lock of every field index.
+    *	\return void
+    *
+    */
+    void unlockIndexes();
+    /*!
+    *   \fn indexRecord
+    *	\param int recordNumber : Record written.
+    *	\param const Record *old : Contents it was indexed with, or NULL for a new record.
+    *	\param const Record &record : Contents written.
+    *	\brief Updates the field indexes after a write.
+    *	\return void
+    *   
+    *   \par Description
+    *   Replaces the record's key in the index of every field whose value changed. A freed keyed slot, whose month is
+    *   negative, is in no index: freeing a record only erases it, and reusing the slot only inserts. Must be called
+    *   under lockIndexes.
+    *
+    */
+    void indexRecord(int recordNumber, const Record *old, const Record &record);
+    /*!
+    *   \fn keyRequest
+    *	\param Key_Message &msg : Filled with the request payload.
+    *	\brief Reads a keyed request.
+    *	\return true if keyed records are enabled, and requests are served from the data file.
+    *   
+    *   \par Description
+    *   Sets msg.slot to -1, so a request that fails replies with it as it is.
+    *
+    */
+    bool keyRequest(Key_Message &msg);
+    /*!
+    *   \fn keyReadReply
+    *	\param None.
+    *	\brief Replies to a keyed read request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Finds the slot of the key under the KeyIndex reader lock and reads its record into the reply.
+    *
+    */
+    void keyReadReply();
+    /*!
+    *   \fn keyUpdateReply
+    *	\param None.
+    *	\brief Replies to a keyed update request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Overwrites the record of the key under the KeyIndex reader lock, which keeps the key from being deleted meanwhile.
+    *   The record keeps its slot as its month.
+    *
+    */
+    void keyUpdateReply();
+    /*!
+    *   \fn keyCreateReply
+    *	\param None.
+    *	\brief Replies to a keyed create request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Under the KeyIndex writer lock, writes the record to the first free slot, or appends it if there is none, then keys it.
+    *   Fails if the key is already in use.
+    *
+    */
+    void keyCreateReply();
+    /*!
+    *   \fn keyDeleteReply
+    *	\param None.
+    *	\brief Replies to a keyed delete request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Under the KeyIndex writer lock, erases the key, then frees its slot for the next keyed create.
+    *   Replies with the record it held.
+    *
+    */
+    void keyDeleteReply();
+    /*!
+    *   \fn datasetReply
+    *	\param None.
+    *	\brief Replies to a dataset request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Opens the named dataset through the DatasetCache, creating it if asked to, and serves the next requests from it.
+    *   Replies with its record count.
+    *
+    */
+    void datasetReply();
+    /*!
+    *   \fn sendRecords
+    *	\param int opcode : Opcode of the reply frames.
+    *	\param std::vector<Record> &records : Records to send.
+    *	\param int count : Number of records to send, or -1 on error.
+    *	\brief Streams records back to the client.
+    *	\return void
+    *   
+    *   \par Description
+    *   Sends the records RANGE_CHUNK per frame, then a frame holding count. Under keyed records, freed slots of the data
+    *   file are left out and the count lowered to match.
+    *
+    */
+    void sendRecords(int opcode, std::vector<Record> &records, int count);
+    /*!
+    *   \fn batchReply
+    *	\param None.
+    *	\brief Replies to a batch write request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Applies the updates and creates in the request payload under one writer lock. 
+    *   Replies with the record number of every update and create, or -1 for all of them if the batch was rejected.
+    *   An empty payload, or one that is not a whole number of Record_Message, is answered with a single -1.
+    *   Under keyed records, a batch updating a freed slot, or with a negative month, is rejected as updateReply refuses them.
+    *
+    */
+    void batchReply();
+    /*!
+    *   \fn aggregateReply
+    *	\param None.
+    *	\brief Replies to an aggregate request.
+    *	\return void
+    *   
+    *   \par Description
+    *   Computes the count, sum, average, minimum and maximum of the requested field over the requested range, 
+    *   and sends only the Aggregate_Reply. Its count is -1 on error.
+    *
+    */
+    void aggregateReply();
+    /*!
     *   \fn logReply
     *	\param None.
     *	\brief Replies to a log request.
@@ -137,6 +421,48 @@ private:
     */
     void logReply();
     /*!
+    *   \fn sendLogEntry
+    *	\param Server_Log_Entry &entry : Log entry.
+    *	\brief Sends one entry of a log reply.
+    *	\return void
+    *   
+    *   \par Description
+    *   v1 clients get a Log_Message with arg = 1. For v2 clients, entries are collected and sent LOG_CHUNK per frame.
+    *
+    */
+    void sendLogEntry(Server_Log_Entry &entry);
+    /*!
+    *   \fn endLogReply
+    *	\param None.
+    *	\brief Ends a log reply.
+    *	\return void
+    *   
+    *   \par Description
+    *   v1 clients get a Log_Message with arg = 0. v2 clients get the remaining entries, then an empty frame.
+    *
+    */
+    void endLogReply();
+    /*!
+    *   \fn logReplyAsync
+    *	\param CoExecutor &executor : Executor the coroutine runs on.
+    *	\brief Replies to a log request without blocking the thread.
+    *	\return Awaitable yielding false if the client could not be written to.
+    *   
+    *   \par Description
+    *   Sends the same messages as logReply, in chunks of LOG_CHUNK entries.
+    *   Yields to the executor after every chunk, so a long log stream does not stall the other clients.
+    *
+    */
+    CoTask<bool> logReplyAsync(CoExecutor &executor);
+    /*!
+    *   \fn flushOutput
+    *	\param CoExecutor &executor : Executor the coroutine runs on.
+    *	\brief Sends the buffered reply bytes.
+    *	\return Awaitable yielding false if the client could not be written to.
+    *
+    */
+    CoTask<bool> flushOutput(CoExecutor &executor);
+    /*!
     *   \fn writeLog
     *	\param int action : Numeric code denoting the operation performed.
     *	\param int arg : Numeric argument related to the action performed.
@@ -150,6 +476,61 @@ private:
     void writeLog(int action, int arg);
 
 public:
+    /*!
+    *	\var static Storage_Engine storage - Storage engine every Server opens the binary file with.
+    *   Set once at startup, before any Server is constructed.
+    */
+    static Storage_Engine storage;
+    /*!
+    *	\var static BufferPool *pool - Shared page cache of the binary file, or NULL.
+    *   Created at startup, before any Server is constructed. Only the system call engine uses it, since a mapping already is one.
+    */
+    static BufferPool *pool;
+    /*!
+    *	\var static WriteAheadLog *wal - Shared log of the binary file's writes, or NULL to leave durability to the kernel.
+    *   Created at startup, before any Server is constructed.
+    */
+    static WriteAheadLog *wal;
+    /*!
+    *	\var static VersionStore *versions - Shared record versions the binary file's reads take snapshots from, or NULL to read under the reader lock.
+    *   Created at startup, before any Server is constructed.
+    */
+    static VersionStore *versions;
+    /*!
+    *	\var static LockStripes *stripes - Shared per-record locks of the binary file, or NULL to lock the whole file.
+    *   Created at startup, before any Server is constructed.
+    */
+    static LockStripes *stripes;
+    /*!
+    *	\var static LogIndex *logIndex - Shared index of the log-structured binary file, or NULL for the other engines.
+    *   Created and loaded from the file at startup, before any Server is constructed.
+    */
+    static LogIndex *logIndex;
+    /*!
+    *	\var static FieldIndex *indexes[NUM_FIELDS] - Index of each field of the binary file's records, or NULL for the fields not indexed.
+    *   Opened, and rebuilt if stale, at startup, before any Server is constructed. Creates, updates and batches keep them up to date.
+    */
+    static FieldIndex *indexes[NUM_FIELDS];
+    /*!
+    *	\var static KeyIndex *keys - Index of the keyed records of the binary file, or NULL if keyed requests are disabled.
+    *   Opened at startup, before any Server is constructed.
+    */
+    static KeyIndex *keys;
+    /*!
+    *	\var static DatasetCache *datasets - Named datasets, or NULL if dataset requests are disabled.
+    *   Created at startup, before any Server is constructed.
+    */
+    static DatasetCache *datasets;
+
+    /*!
+    *   \fn openBinFile
+    *	\param const int bfd : Open binary file descriptor.
+    *	\param const int semid : Established system semaphore set id.
+    *	\brief Opens the binary file with the configured storage engine.
+    *	\return The binary file object, owned by the caller. It closes bfd.
+    *
+    */
+    static DataFile<Record> *openBinFile(const int bfd, const int semid);
     /*!
     *   \fn Constructor
     *	\param const int bfd : Open binary file descriptor.
@@ -161,18 +542,19 @@ public:
     *	\return Server
     *   
     *   \par Description
-    *   Constructs the clientSocket, binFile, and logFile objects.
+    *   Constructs the clientSocket, binFile, and logFile objects. binFile is a MappedFile when storage is STORAGE_MMAP,
+    *   a ColumnFile when it is STORAGE_COLUMNS, a LogFile on logIndex when it is STORAGE_LOG, and otherwise a CriticalFile reading through pool. Any of them logs its writes to wal, versions them in versions, and locks the records it touches with stripes.
     *
     */
     Server(const int bfd, const int clifd, const int lfd, const sockaddr_in cliAddr, const int semid);
     /*!
     *   \fn Destructor
     *	\param None.
-    *	\brief Default destructor.
+    *	\brief Destructor.
     *	\return void
     *   
     *   \par Description
-    *   Default destructor.
+    *   Deletes binFile, closing the binary file.
     *
     */
     ~Server();
@@ -187,6 +569,155 @@ public:
     *
     */
     void run();
+    /*!
+    *   \fn logConnection
+    *	\param None.
+    *	\brief Records a new client connection.
+    *	\return void
+    *   
+    *   \par Description
+    *   Prints and logs the client's connection. Called once before the first message is serviced.
+    *
+    */
+    void logConnection();
+    /*!
+    *   \fn serviceMessage
+    *	\param None.
+    *	\brief Services one message from the client.
+    *	\return false once the client has disconnected.
+    *   
+    *   \par Description
+    *   Receives whatever the client has sent and responds to every complete message in it. 
+    *   Used by run() and by event loops that multiplex many clients. 
+    *   On a non-blocking socket with no data pending, returns true without doing anything.
+    *
+    */
+    bool serviceMessage();
+    /*!
+    *   \fn receive
+    *	\param None.
+    *	\brief Buffers whatever the client has sent without responding.
+    *	\return Number of bytes read, 0 on disconnection, or -1 if a non-blocking read would block.
+    *   
+    *   \par Description
+    *   Lets a scheduler receive on one thread and call handleMessages on another.
+    *
+    */
+    int receive();
+    /*!
+    *   \fn feed
+    *	\param const void* data : Bytes received from the client.
+    *	\param int size : Number of bytes.
+    *	\brief Buffers bytes received by an I/O engine.
+    *	\return void
+    *
+    */
+    void feed(const void* data, int size);
+    /*!
+    *   \fn hasMessage
+    *	\param None.
+    *	\brief Checks for a complete buffered request.
+    *	\return true if handleMessages has a request to respond to, or a malformed frame to reject.
+    *
+    */
+    bool hasMessage();
+    /*!
+    *   \fn handleMessages
+    *	\param None.
+    *	\brief Responds to every complete buffered request.
+    *	\return Number of requests handled, or -1 if the client sent a malformed frame.
+    *   
+    *   \par Description
+    *   A partial request is left buffered until the rest of it is received.
+    *   Log requests from v2 clients are answered after the other buffered requests.
+    *
+    */
+    int handleMessages();
+    /*!
+    *   \fn serve
+    *	\param CoExecutor &executor : Executor the coroutine runs on.
+    *	\brief Coroutine data server lifetime.
+    *	\return Awaitable that completes when the client disconnects.
+    *   
+    *   \par Description
+    *   Coroutine counterpart of run(). Awaits each request and the sending of its reply instead of blocking, 
+    *   so one thread can service many clients. The client socket must be non-blocking and watched by the executor.
+    *   Accesses to the binary and log files are not awaited: they are short, and a semaphore must never be held across a suspension.
+    *
+    */
+    CoTask<> serve(CoExecutor &executor);
+    /*!
+    *   \fn logDisconnection
+    *	\param None.
+    *	\brief Records a client disconnection.
+    *	\return void
+    *   
+    *   \par Description
+    *   Prints and logs the client's disconnection.
+    *
+    */
+    void logDisconnection();
+    /*!
+    *   \fn setAsyncIO
+    *	\param std::vector<Server_Log_Entry> *queue : Shared log entry queue, or NULL to write directly.
+    *	\brief Hands reply and log I/O to the caller.
+    *	\return void
+    *   
+    *   \par Description
+    *   With a queue set, replies are buffered on the client connection (see getOutput) 
+    *   and log entries are appended to the queue, so an I/O engine can submit them in batches.
+    *
+    */
+    void setAsyncIO(std::vector<Server_Log_Entry> *queue);
+    /*!
+    *   \fn getOutput
+    *	\param None.
+    *	\brief Buffered reply getter.
+    *	\return Reference to the buffered reply bytes.
+    *
+    */
+    std::vector<char>& getOutput();
+    /*!
+    *   \fn sendOutput
+    *	\param None.
+    *	\brief Sends replies left buffered by a full non-blocking socket.
+    *	\return Number of bytes still buffered, or -1 on error.
+    *   
+    *   \par Description
+    *   Event loops call it when the client socket becomes writable, and read no more requests until it returns 0.
+    *
+    */
+    int sendOutput();
+    /*!
+    *   \fn hasOutput
+    *	\param None.
+    *	\brief Checks for replies waiting to be sent.
+    *	\return true if sendOutput has bytes to send.
+    *
+    */
+    bool hasOutput();
+    /*!
+    *   \fn getSocketfd
+    *	\param None.
+    *	\brief Client socket descriptor getter.
+    *	\return Client socket descriptor.
+    *   
+    *   \par Description
+    *   Returns the descriptor of the connected client socket.
+    *
+    */
+    int getSocketfd();
+    /*!
+    *   \fn setNonBlocking
+    *	\param None.
+    *	\brief Puts the client socket in non-blocking mode.
+    *	\return false on error.
+    *   
+    *   \par Description
+    *   Sets the client connection non-blocking so it can be driven by an event loop.
+    *
+    */
+    bool setNonBlocking();
 
 };
 
@@ -0,0 +1,322 @@
+/*!	\file ShardedFile.h
+*	\brief  Define a sharded implementation of DataFile for Records.
+*   A ShardedFile splits one dataset's records into shard files by range of record numbers, which are months, kept in a
+*   directory as <first month>.bin. Each shard is a CriticalFile of its own with its own readers-writers lock, so a write
+*   to one shard never waits for readers or writers of another. \n
+*   A shard holds the months from its first up to the next shard's. New shards start at the configured boundaries: an append
+*   that reaches the next boundary after the last shard's first month creates the shard starting there. Past the last
+*   boundary, shards are as wide as the last interval between boundaries. Since every shard but the last is full, the shards
+*   are found from the first, 0.bin, each starting where the one before ends, so changing the boundaries between runs only
+*   affects shards created afterwards. \n
+*   The boundaries a dataset was created with are saved in its directory, and used whenever it is opened again, so the
+*   shards are found and extended the same way whatever the boundaries of a later run. \n
+*   Appends and batches are serialized by the dataset's append lock, the first set of its semaphores; shard n is locked with
+*   set n + 1. A batch spanning shards is written a shard at a time, and the shards already written are rolled back if
+*   a later one fails. \n
+*   Ranges are reported as one part per shard by partitions, so queries can scan the shards concurrently, and
+*   readRecords reads the shards of a range in parallel, on the threads of the process's ScanPool. \n
+*   Every process and thread using the dataset sees the shards created by the others, the next time it looks past the end of
+*   its last shard. \n
+*
+*/
+
+#ifndef SHARDEDFILE_H
+#define SHARDEDFILE_H
+
+#include "CriticalFile.h"
+#include "SemaphoreSet.h"
+#include <memory>
+#include <mutex>
+#include <string>
+
+#define SHARD_MAX 256
+#define SHARD_SEMAPHORE_SETS (SHARD_MAX + 1) // the append lock, then one per shard
+
+/*!
+ *	\class ShardedFile
+ *	\brief DataFile of Records split into shard files by month range
+ *  \n
+*   A ShardedFile routes each record to the shard of its month, and creates shards as appends reach the boundaries. \n
+*   Accesses are synchronized through the SemaphoreSet of each shard, and the dataset's append lock. \n
+ */
+class ShardedFile : public DataFile<Record>
+{
+private:
+    /*!
+    *   \struct Shard
+    *   \brief An open shard file.
+    */
+    struct Shard{
+        int first; // first month
+        int fd;    // owned by file
+        std::shared_ptr<CriticalFile<Record>> file;
+    };
+
+    /*!
+    *	\var std::string directory - Directory of the shard files.
+    */
+    std::string directory;
+    /*!
+    *	\var int semid - Semaphores of the dataset: SHARD_SEMAPHORE_SETS sets.
+    */
+    int semid;
+    /*!
+    *	\var std::vector<int> boundaries - First months of new shards, ascending: those saved with the dataset once open.
+    */
+    std::vector<int> boundaries;
+    /*!
+    *	\var std::mutex opening - Guards shards, which the threads of a threaded server share.
+    */
+    std::mutex opening;
+    /*!
+    *	\var std::vector<Shard> shards - Shards opened by this process, by first month.
+    */
+    std::vector<Shard> shards;
+
+    /*!
+    *   \fn shardPath
+    *	\param int first : First month of a shard.
+    *	\brief Path of a shard file.
+    *	\return directory/<first>.bin
+    *
+    */
+    std::string shardPath(int first);
+    /*!
+    *   \fn loadBoundaries
+    *	\param None.
+    *	\brief Reads the boundaries saved in the directory, or saves the configured ones if there are none.
+    *	\return false on error.
+    *
+    *   \par Description
+    *   A dataset created before its boundaries were saved takes those of the run that first opens it since.
+    *   Must be called holding opening.
+    */
+    bool loadBoundaries();
+    /*!
+    *   \fn nextBoundary
+    *	\param int first : First month of a shard.
+    *	\brief Finds where the shard after one starting at a month starts.
+    *	\return The first boundary past it, or INT_MAX without boundaries.
+    *
+    */
+    int nextBoundary(int first);
+    /*!
+    *   \fn size
+    *	\param const Shard &shard : A shard.
+    *	\brief Counts the records of a shard.
+    *	\return Number of records, or -1 on error.
+    *
+    *   \par Description
+    *   Operation is NOT synched.
+    */
+    static long size(const Shard &shard);
+    /*!
+    *   \fn attach
+    *	\param int first : First month of the shard after the last one open.
+    *	\param bool create : Create the file if there is none.
+    *	\brief Opens the next shard.
+    *	\return false if there is no such shard, SHARD_MAX are open, or on error.
+    *
+    *   \par Description
+    *   Must be called holding opening.
+    */
+    bool attach(int first, bool create);
+    /*!
+    *   \fn discover
+    *	\param None.
+    *	\brief Opens the shards created since by any process.
+    *	\return void
+    *
+    *   \par Description
+    *   Looks for the next shard once the last one is full. Must be called holding opening.
+    */
+    void discover();
+    /*!
+    *   \fn current
+    *	\param None.
+    *	\brief Lists the shards, after opening those created since.
+    *	\return The shards, by first month.
+    *
+    */
+    std::vector<Shard> current();
+    /*!
+    *   \fn route
+    *	\param long recordNumber : Record number.
+    *	\brief Finds the shard of a record, after opening those created since.
+    *	\return The shard.
+    *
+    */
+    Shard route(long recordNumber);
+    /*!
+    *   \fn locate
+    *	\param const std::vector<Shard> &view : Shards, by first month.
+    *	\param long recordNumber : Record number.
+    *	\brief Finds the shard a record belongs to.
+    *	\return Index of the shard.
+    *
+    */
+    static int locate(const std::vector<Shard> &view, long recordNumber);
+    /*!
+    *   \fn numRecords
+    *	\param const std::vector<Shard> &view : Shards, by first month.
+    *	\brief Counts the records of the dataset.
+    *	\return Number of records, or -1 on error.
+    *
+    *   \par Description
+    *   The end of the last shard holding any, since a rolled back batch may leave empty shards behind.
+    *   Operation is NOT synched.
+    */
+    static long numRecords(const std::vector<Shard> &view);
+    /*!
+    *   \fn extend
+    *	\param long count : Records in the dataset.
+    *	\param long end : Records in the dataset after the appends.
+    *	\brief Creates the shards that appended records reach.
+    *	\return false if SHARD_MAX shards would not hold them, or on error.
+    *
+    *   \par Description
+    *   Must be called under the append lock.
+    */
+    bool extend(long count, long end);
+    /*!
+    *   \fn split
+    *	\param const std::vector<Shard> &view : Shards, by first month.
+    *	\param long first : First record number.
+    *	\param long count : Number of records.
+    *	\brief Cuts a range at the shards' bounds.
+    *	\return (first, count) of each part, in order.
+    *
+    */
+    static std::vector<std::pair<int, int>> split(const std::vector<Shard> &view, long first, long count);
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const char *directory : Directory of the shard files.
+    *	\param int semid : Semaphores of the dataset, SHARD_SEMAPHORE_SETS sets initialized for the readers-writers algorithm.
+    *	\param const std::vector<int> &boundaries : First months of new shards, ascending and positive.
+    *	\brief Constructs a ShardedFile.
+    *	\return ShardedFile
+    *
+    *   \par Description
+    *   The shards must be opened with open before it is used, which replaces the boundaries with the dataset's own.
+    *
+    */
+    ShardedFile(const char *directory, int semid, const std::vector<int> &boundaries);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes the shard files.
+    *	\return void
+    *
+    */
+    ~ShardedFile();
+    /*!
+    *   \fn open
+    *	\param bool create : Create the first shard if there is none.
+    *	\brief Opens the shards.
+    *	\return false if the directory holds no first shard, or on error.
+    *
+    */
+    bool open(bool create);
+    /*!
+    *   \fn shardCount
+    *	\param None.
+    *	\brief Counts the shards.
+    *	\return Number of shards.
+    *
+    */
+    int shardCount();
+    /*!
+    *   \fn readRecord
+    *	\param const int recordNumber : Record number to read
+    *	\param Record &buf : Buffer to read record into.
+    *	\brief Reads a record from its shard.
+    *	\return false on error, true otherwise.
+    *
+    */
+    bool readRecord(const int recordNumber, Record &buf);
+    /*!
+    *   \fn readRecords
+    *	\param const int first : First record number to read
+    *	\param const int count : Number of records to read
+    *	\param std::vector<Record> &buf : Filled with the records read.
+    *	\brief Reads a contiguous range of records, from its shards in parallel.
+    *	\return Number of records read, or -1 on error.
+    *
+    *   \par Description
+    *   Each shard is read under its own reader lock, so the range is not read at one point in time.
+    *
+    */
+    int readRecords(const int first, const int count, std::vector<Record> &buf);
+    /*!
+    *   \fn scanRecords
+    *	\param const int first : First record number to scan
+    *	\param const int count : Number of records to scan
+    *	\param std::function<bool(const Record*, int)> visit : Called with each chunk of records and its size. Returning false stops the scan.
+    *	\brief Scans a contiguous range of records in chunks, a shard after the other.
+    *	\return Number of records scanned, or -1 on error.
+    *
+    */
+    int scanRecords(const int first, const int count, std::function<bool(const Record*, int)> visit);
+    /*!
+    *   \fn writeRecord
+    *	\param Record &record : Record to append
+    *	\brief Appends a record
+    *	\return false on error
+    *
+    */
+    bool writeRecord(Record &record);
+    /*!
+    *   \fn writeRecords
+    *	\param const Record *records : Records to append
+    *	\param const int count : Number of records
+    *	\brief Appends several records
+    *	\return false on error
+    *
+    */
+    bool writeRecords(const Record *records, const int count);
+    /*!
+    *   \fn writeBatch
+    *	\param std::vector<int> &positions : Record number to overwrite for each record, or -1 to append it. Appended records get their new number.
+    *	\param std::vector<Record> &records : Records to write.
+    *	\param void (*number)(Record&, int) : Called on each appended record with its new number before it is written, or NULL.
+    *	\brief Writes a batch of updates and appends atomically.
+    *	\return Number of records in the dataset before the batch, or -1 if nothing was written.
+    *
+    *   \par Description
+    *   Under the append lock, creates the shards the appends reach, then writes each shard's part with one
+    *   CriticalFile::writeBatch, restoring the parts already written if one fails.
+    *
+    */
+    int writeBatch(std::vector<int> &positions, std::vector<Record> &records, void (*number)(Record &record, int recordNumber));
+    /*!
+    *   \fn updateRecord
+    *	\param const int recordNumber : record to update
+    *	\param Record &record : new record information
+    *	\brief Updates a record in its shard.
+    *	\return false on error.
+    *
+    */
+    bool updateRecord(const int recordNumber, Record &record);
+    /*!
+    *   \fn checkNumRecords
+    *	\param none
+    *	\brief Counts records in the dataset.
+    *	\return Number of records, or -1 on error
+    *
+    */
+    int checkNumRecords();
+    /*!
+    *   \fn partitions
+    *	\param const int first : First record number
+    *	\param const int count : Number of records
+    *	\brief Splits a range of records at the shards' bounds.
+    *	\return (first, count) of each part, in order.
+    *
+    */
+    std::vector<std::pair<int, int>> partitions(const int first, const int count);
+
+};
+
+#endif
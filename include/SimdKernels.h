@@ -0,0 +1,237 @@
+/*!	\file SimdKernels.h
+*	\brief  SimdKernels class header file.
+*   SimdKernels reduces and compares the float fields of Records with SIMD instructions: the sum, minimum, maximum
+*   and mean of a field, and a comparison of every value against a threshold into a bitmask. \n
+*   Every kernel works on a column of floats, as a ColumnFile reads them, or on one field of an array of Records,
+*   as the row engines read them. Both are a strided array of floats, one float apart in a column and a Record apart in a Record array. \n
+*   Each kernel is built three times: plain scalar loops, SSE2, which every x86-64 processor has, and AVX2.
+*   The fastest level the processor supports is picked on first use from cpuid, and can be lowered with setLevel,
+*   so the levels can be compared against each other and the scalar loops. \n
+*   AVX2 loads a column eight values at a time and gathers a field of eight Records with one instruction. SSE2 has no gather,
+*   so it loads a field of four Records one at a time and then works on them together. \n
+*   Sums are accumulated in doubles at every level, like the scalar loops, so only the order of the additions differs.
+*   Minimum and maximum are undefined for arrays holding NaN. \n
+*
+*/
+
+#ifndef SIMDKERNELS_H
+#define SIMDKERNELS_H
+
+#include "Packets.h"
+#include <stdint.h>
+
+/*!
+ *   \enum Simd_Level
+ *   \brief Instruction set a kernel is built for.
+ */
+enum Simd_Level
+{
+    SIMD_SCALAR, // plain loops
+    SIMD_SSE,    // SSE2, 4 floats per instruction
+    SIMD_AVX2    // AVX2, 8 floats per instruction
+};
+
+/*!
+ *	\class SimdKernels
+ *	\brief Runtime dispatched SIMD kernels over Record fields
+ *  \n
+ *   SimdKernels computes sums, minimums, maximums, means and threshold bitmasks over columns of floats and fields of Record arrays. \n
+ */
+class SimdKernels
+{
+public:
+    /*!
+    *   \struct Kernel_Table
+    *   \brief The kernels of one level, each over count values stride floats apart.
+    */
+    struct Kernel_Table{
+        double (*sum)(const float *values, long count, long stride);
+        float (*min)(const float *values, long count, long stride);
+        float (*max)(const float *values, long count, long stride);
+        long (*compare)(const float *values, long count, long stride, int op, float value, uint64_t *bits);
+    };
+
+private:
+    /*!
+    *	\var static const Kernel_Table *table - Kernels of the level in use, or NULL before the first call.
+    */
+    static const Kernel_Table *table;
+    /*!
+    *	\var static Simd_Level current - Level in use.
+    */
+    static Simd_Level current;
+
+    /*!
+    *   \fn kernels
+    *	\param None.
+    *	\brief Kernels of the level in use.
+    *	\return Kernel table, picked with detect on first use.
+    *
+    */
+    static const Kernel_Table *kernels();
+    /*!
+    *   \fn field
+    *	\param const Record *records : Record array.
+    *	\param float Record::* member : Field.
+    *	\brief First value of a field in a Record array.
+    *	\return Pointer to the field of the first record.
+    *
+    */
+    static const float *field(const Record *records, float Record::* member){return &(records->*member);}
+
+public:
+    /*!
+    *   \fn detect
+    *	\param None.
+    *	\brief Finds the best level the processor supports.
+    *	\return SIMD_AVX2, SIMD_SSE, or SIMD_SCALAR on processors other than x86.
+    *
+    */
+    static Simd_Level detect();
+    /*!
+    *   \fn level
+    *	\param None.
+    *	\brief Level in use.
+    *	\return Simd_Level.
+    *
+    */
+    static Simd_Level level();
+    /*!
+    *   \fn setLevel
+    *	\param Simd_Level level : Level to use.
+    *	\brief Picks the level kernels run at.
+    *	\return Level in use, lowered to detect() if the processor does not support the one asked for.
+    *
+    *   \par Description
+    *   Not thread safe. Meant for startup and for benchmarks.
+    *
+    */
+    static Simd_Level setLevel(Simd_Level level);
+    /*!
+    *   \fn name
+    *	\param Simd_Level level : Level.
+    *	\brief Names a level.
+    *	\return "scalar", "sse" or "avx2".
+    *
+    */
+    static const char *name(Simd_Level level);
+    /*!
+    *   \fn sum
+    *	\param const float *values : Column of values.
+    *	\param long count : Number of values.
+    *	\brief Sums a column.
+    *	\return Sum, accumulated in double precision.
+    *
+    */
+    static double sum(const float *values, long count){return kernels()->sum(values, count, 1);}
+    /*!
+    *   \fn min
+    *	\param const float *values : Column of values.
+    *	\param long count : Number of values.
+    *	\brief Finds the minimum of a column.
+    *	\return Minimum, or 0 for no values.
+    *
+    */
+    static float min(const float *values, long count){return kernels()->min(values, count, 1);}
+    /*!
+    *   \fn max
+    *	\param const float *values : Column of values.
+    *	\param long count : Number of values.
+    *	\brief Finds the maximum of a column.
+    *	\return Maximum, or 0 for no values.
+    *
+    */
+    static float max(const float *values, long count){return kernels()->max(values, count, 1);}
+    /*!
+    *   \fn mean
+    *	\param const float *values : Column of values.
+    *	\param long count : Number of values.
+    *	\brief Averages a column.
+    *	\return Mean, or 0 for no values.
+    *
+    */
+    static double mean(const float *values, long count){return count > 0 ? sum(values, count) / count : 0;}
+    /*!
+    *   \fn compare
+    *	\param const float *values : Column of values.
+    *	\param long count : Number of values.
+    *	\param int op : FILTER_LT, FILTER_LE, FILTER_GT, FILTER_GE, FILTER_EQ or FILTER_NE.
+    *	\param float value : Threshold each value is compared against, as in values[i] op value.
+    *	\param uint64_t *bits : Filled with (count + 63) / 64 words, bit i % 64 of word i / 64 set for each match.
+    *	\brief Compares a column against a threshold into a bitmask.
+    *	\return Number of matches.
+    *
+    *   \par Description
+    *   Bits past count are cleared.
+    *
+    */
+    static long compare(const float *values, long count, int op, float value, uint64_t *bits){
+        return kernels()->compare(values, count, 1, op, value, bits);
+    }
+    /*!
+    *   \fn sum
+    *	\param const Record *records : Record array.
+    *	\param long count : Number of records.
+    *	\param float Record::* member : Field to sum.
+    *	\brief Sums a field of a Record array.
+    *	\return Sum, accumulated in double precision.
+    *
+    */
+    static double sum(const Record *records, long count, float Record::* member){
+        return count > 0 ? kernels()->sum(field(records, member), count, sizeof(Record) / sizeof(float)) : 0;
+    }
+    /*!
+    *   \fn min
+    *	\param const Record *records : Record array.
+    *	\param long count : Number of records.
+    *	\param float Record::* member : Field.
+    *	\brief Finds the minimum of a field of a Record array.
+    *	\return Minimum, or 0 for no records.
+    *
+    */
+    static float min(const Record *records, long count, float Record::* member){
+        return count > 0 ? kernels()->min(field(records, member), count, sizeof(Record) / sizeof(float)) : 0;
+    }
+    /*!
+    *   \fn max
+    *	\param const Record *records : Record array.
+    *	\param long count : Number of records.
+    *	\param float Record::* member : Field.
+    *	\brief Finds the maximum of a field of a Record array.
+    *	\return Maximum, or 0 for no records.
+    *
+    */
+    static float max(const Record *records, long count, float Record::* member){
+        return count > 0 ? kernels()->max(field(records, member), count, sizeof(Record) / sizeof(float)) : 0;
+    }
+    /*!
+    *   \fn mean
+    *	\param const Record *records : Record array.
+    *	\param long count : Number of records.
+    *	\param float Record::* member : Field.
+    *	\brief Averages a field of a Record array.
+    *	\return Mean, or 0 for no records.
+    *
+    */
+    static double mean(const Record *records, long count, float Record::* member){
+        return count > 0 ? sum(records, count, member) / count : 0;
+    }
+    /*!
+    *   \fn compare
+    *	\param const Record *records : Record array.
+    *	\param long count : Number of records.
+    *	\param float Record::* member : Field compared.
+    *	\param int op : FILTER_LT, FILTER_LE, FILTER_GT, FILTER_GE, FILTER_EQ or FILTER_NE.
+    *	\param float value : Threshold each field is compared against.
+    *	\param uint64_t *bits : Filled with (count + 63) / 64 words, bit i % 64 of word i / 64 set for each match.
+    *	\brief Compares a field of a Record array against a threshold into a bitmask.
+    *	\return Number of matches.
+    *
+    */
+    static long compare(const Record *records, long count, float Record::* member, int op, float value, uint64_t *bits){
+        return count > 0 ? kernels()->compare(field(records, member), count, sizeof(Record) / sizeof(float), op, value, bits) : 0;
+    }
+
+};
+
+#endif
@@ -2,6 +2,9 @@
 *	\brief  SocketConnection header file.
 *   A SocketConnection object represents an active connection with another process through a socket. \n
 *   Messages can be sent through the encapsulated socket by calling its read and write methods.\n
+*   Non-blocking sockets can also be read and written from coroutines with asyncRead and asyncWrite. \n
+*   Incoming bytes can be buffered in a FrameReader with receive(), and taken out as complete protocol v1 or v2 messages with nextFrame(). \n
+*   Writes that would block a non-blocking socket are buffered, and sent by the owner of the connection with sendOutput() once the socket is writable. \n
 *   
 */
 
@@ -9,6 +12,9 @@
 #define SOCKETCONNECTION_H   
 
 #include "Packets.h"
+#include "CoExecutor.h"
+#include "FrameReader.h"
+#include <vector>
 
 /*!
  *	\class SocketConnection
@@ -28,6 +34,41 @@ private:
     *	\var sockaddr_in address - Internet address information of the other process.
     */
     const sockaddr_in address;
+    /*!
+    *	\var bool queueWrites - When set, writes are buffered in output instead of being sent.
+    */
+    bool queueWrites;
+    /*!
+    *	\var std::vector<char> output - Buffered outgoing bytes, sent by the owner of the connection.
+    */
+    std::vector<char> output;
+    /*!
+    *	\var size_t outputSent - Bytes at the front of output already sent by sendOutput.
+    */
+    size_t outputSent;
+    /*!
+    *	\var FrameReader input - Buffered incoming bytes.
+    */
+    FrameReader input;
+    /*!
+    *	\var std::vector<char> frameBuffer - Assembles a frame header and its payload into one write.
+    */
+    std::vector<char> frameBuffer;
+
+    /*!
+    *   \fn writeAll
+    *	\param const void* buf : pointer to message buffer
+    *	\param int size : Number of bytes to write
+    *	\brief Writes an entire buffer.
+    *	\return Number of bytes written, or 0 on error.
+    *   
+    *   \par Description
+    *   Writes until the whole buffer has been sent. 
+    *   If the socket is non-blocking and its send buffer is full, the rest is buffered in output instead, 
+    *   as is everything written after it until sendOutput has sent it all.
+    *
+    */
+    int writeAll(const void* buf, int size);
     
 public:
     /*!
@@ -57,7 +98,7 @@ public:
     *   \fn readMessage
     *	\param Record_Message &msg: Record_Message struct to store the received message.
     *	\brief Reads a message from the socket.
-    *	\return Number of bytes read, or -1 on error.
+    *	\return Number of bytes read, 0 on disconnection, or -1 if a non-blocking read would block.
     *   
     *   \par Description
     *   Reads a message from the socket, storing the read message into the passed struct.
@@ -69,7 +110,7 @@ public:
     *	\param void* msg : pointer to message buffer
     *	\param int size : Number of bytes to read
     *	\brief Generic read.
-    *	\return Number of bytes read, or -1 on error.
+    *	\return Number of bytes read, 0 on disconnection, or -1 if a non-blocking read would block.
     *   
     *   \par Description
     *   Generalized read method. Reads a message from the socket, storing the read message into the buffer.
@@ -100,6 +141,128 @@ public:
     */
     int writeMessage(void* msg, int size);
     /*!
+    *   \fn asyncRead
+    *	\param CoExecutor &executor : Executor the calling coroutine runs on.
+    *	\param void* msg : pointer to message buffer
+    *	\param int size : Number of bytes to read
+    *	\brief Reads a whole message from a non-blocking socket.
+    *	\return Awaitable yielding size, or 0 on disconnection or error.
+    *   
+    *   \par Description
+    *   Suspends the calling coroutine whenever the socket has no data, until all size bytes have arrived.
+    *   The socket must be watched by the executor.
+    *
+    */
+    CoTask<int> asyncRead(CoExecutor &executor, void* msg, int size);
+    /*!
+    *   \fn asyncWrite
+    *	\param CoExecutor &executor : Executor the calling coroutine runs on.
+    *	\param const void* msg : pointer to message buffer
+    *	\param int size : Number of bytes to write
+    *	\brief Writes a whole message to a non-blocking socket.
+    *	\return Awaitable yielding size, or 0 on error.
+    *   
+    *   \par Description
+    *   Suspends the calling coroutine whenever the send buffer is full, instead of blocking the thread.
+    *   The buffer must stay valid until the awaitable completes. The socket must be watched by the executor.
+    *
+    */
+    CoTask<int> asyncWrite(CoExecutor &executor, const void* msg, int size);
+    /*!
+    *   \fn receive
+    *	\param none
+    *	\brief Buffers whatever has arrived on the socket.
+    *	\return Number of bytes read, 0 on disconnection, or -1 if a non-blocking read would block.
+    *   
+    *   \par Description
+    *   One read() into the frame buffer. The messages it completed are then taken with nextFrame().
+    *
+    */
+    int receive();
+    /*!
+    *   \fn asyncReceive
+    *	\param CoExecutor &executor : Executor the calling coroutine runs on.
+    *	\brief Buffers the next bytes to arrive on a non-blocking socket.
+    *	\return Awaitable yielding the number of bytes read, or 0 on disconnection.
+    *   
+    *   \par Description
+    *   Suspends the calling coroutine until the socket has data. The socket must be watched by the executor.
+    *
+    */
+    CoTask<int> asyncReceive(CoExecutor &executor);
+    /*!
+    *   \fn feed
+    *	\param const void* data : Received bytes.
+    *	\param int size : Number of bytes.
+    *	\brief Buffers bytes that were received by the caller.
+    *	\return void
+    *   
+    *   \par Description
+    *   For I/O engines that receive into their own buffers.
+    *
+    */
+    void feed(const void* data, int size){input.feed(data, size);}
+    /*!
+    *   \fn nextFrame
+    *	\param Frame &frame : Filled with the next message.
+    *	\brief Takes the next complete buffered message.
+    *	\return false if no complete message is buffered.
+    *   
+    *   \par Description
+    *   The frame's payload is valid until the next receive.
+    *
+    */
+    bool nextFrame(Frame &frame){return input.next(frame);}
+    /*!
+    *   \fn hasFrame
+    *	\param none
+    *	\brief Checks for a complete buffered message.
+    *	\return true if nextFrame would return a message.
+    *
+    */
+    bool hasFrame(){return input.hasFrame();}
+    /*!
+    *   \fn readFrame
+    *	\param Frame &frame : Filled with the next message.
+    *	\brief Waits for the next complete message.
+    *	\return false on disconnection.
+    *   
+    *   \par Description
+    *   Receives until a complete message is buffered. For blocking sockets.
+    *
+    */
+    bool readFrame(Frame &frame);
+    /*!
+    *   \fn frameError
+    *	\param none
+    *	\brief Invalid stream check.
+    *	\return true once the peer has sent a malformed frame.
+    *
+    */
+    bool frameError(){return input.hasFailed();}
+    /*!
+    *   \fn getProtocol
+    *	\param none
+    *	\brief Protocol version getter.
+    *	\return PROTOCOL_V1 or PROTOCOL_V2, as detected from the peer's first message, or 0 before it has arrived.
+    *
+    */
+    int getProtocol(){return input.getVersion();}
+    /*!
+    *   \fn writeFrame
+    *	\param int opcode : Frame opcode.
+    *	\param uint32_t requestId : Request id the frame belongs to.
+    *	\param const void* payload : Payload bytes.
+    *	\param int length : Payload size.
+    *	\brief Writes a protocol v2 frame.
+    *	\return Number of bytes written, or 0 on error.
+    *   
+    *   \par Description
+    *   The header and payload go out in one write, or are buffered together while writes are queued.
+    *
+    */
+    int writeFrame(int opcode, uint32_t requestId, const void* payload, int length);
+    /*!
     *   \fn getSocketfd
     *	\param none 
     *	\brief Socket descriptor getter.
@@ -111,6 +274,61 @@ public:
     */
     int getSocketfd();
     /*!
+    *   \fn setNonBlocking
+    *	\param none 
+    *	\brief Puts the socket in non-blocking mode.
+    *	\return false on error.
+    *   
+    *   \par Description
+    *   Sets O_NONBLOCK on the socket descriptor. 
+    *   Reads that would block return -1. Writes that would block are buffered, see sendOutput.
+    *
+    */
+    bool setNonBlocking();
+    /*!
+    *   \fn setQueueWrites
+    *	\param bool queue : true to buffer writes.
+    *	\brief Enables or disables write buffering.
+    *	\return void
+    *   
+    *   \par Description
+    *   While enabled, writeMessage appends to an output buffer instead of calling write(). 
+    *   Used by I/O engines that send replies asynchronously.
+    *
+    */
+    void setQueueWrites(bool queue){queueWrites = queue;}
+    /*!
+    *   \fn getOutput
+    *	\param none 
+    *	\brief Buffered output getter.
+    *	\return Reference to the buffered outgoing bytes.
+    *   
+    *   \par Description
+    *   The buffer must not be modified while an asynchronous send of it is in flight.
+    *
+    */
+    std::vector<char>& getOutput(){return output;}
+    /*!
+    *   \fn sendOutput
+    *	\param none 
+    *	\brief Sends buffered output without blocking.
+    *	\return Number of bytes still buffered, or -1 on error.
+    *   
+    *   \par Description
+    *   Sends as much of the output left behind by writes to a full non-blocking socket as the socket takes. 
+    *   The owner calls it again when the socket becomes writable, until nothing is left.
+    *
+    */
+    int sendOutput();
+    /*!
+    *   \fn hasOutput
+    *	\param none 
+    *	\brief Buffered output check.
+    *	\return true if output is waiting to be sent.
+    *
+    */
+    bool hasOutput(){return !output.empty();}
+    /*!
     *   \fn getPort
     *	\param none 
     *	\brief Port getter.
@@ -0,0 +1,224 @@
+/*!	\file UringLoop.h
+*	\brief  UringLoop class header file.
+*   A UringLoop object services many clients from a single process with all socket I/O going through io_uring. \n
+*   Accepts, receives and reply sends are submission queue entries; every reply send is linked to the
+*   next receive on that connection. Received bytes are handed to the connection's Server, which replies to every complete request in them. \n
+*   Each pass of the loop submits the entries queued for every connection and reaps all available completions
+*   with one io_uring_enter call, and appends the log entries of every request handled in that pass with one write. \n
+*   Accesses to the binary file still go through CriticalFile, since they must be bracketed by the semaphores. \n
+*
+*/
+
+#ifndef URINGLOOP_H
+#define URINGLOOP_H
+
+#include "Server.h"
+#include "IoUring.h"
+#include <set>
+
+#define URING_RECV_SIZE 4096
+
+/*!
+ *	\class UringLoop
+ *	\brief io_uring driven connection multiplexer
+ *  \n
+ *   A UringLoop object services many clients from a single process with all socket I/O going through io_uring. \n
+ *   Each pass of the loop submits the entries queued for every connection and reaps all available completions
+ *   with one io_uring_enter call. \n
+ */
+class UringLoop
+{
+private:
+    /*!
+    *   \struct Uring_Connection
+    *   \brief State of one connection serviced through the ring.
+    */
+    struct Uring_Connection{
+        Server *server;
+        int fd;
+        char inbox[URING_RECV_SIZE];
+        int inflight;
+        bool closing;
+    };
+
+    /*!
+    *   \enum Uring_Op
+    *   \brief Operation tag stored in the low bits of a request's user_data.
+    */
+    enum Uring_Op{
+        OP_ACCEPT = 1,
+        OP_RECV = 2,
+        OP_SEND = 3
+    };
+
+    /*!
+    *	\var const int listenfd - Listening socket descriptor.
+    */
+    const int listenfd;
+    /*!
+    *	\var const int binfd - Open binary file descriptor. Duplicated for each connection.
+    */
+    const int binfd;
+    /*!
+    *	\var const int logfd - Open log file descriptor. Duplicated for each connection.
+    */
+    const int logfd;
+    /*!
+    *	\var const int semid - Established system semaphore set id.
+    */
+    const int semid;
+    /*!
+    *	\var int *connectionCount - Incremented for every accepted connection, or NULL.
+    */
+    int *connectionCount;
+    /*!
+    *	\var IoUring ring - The io_uring instance.
+    */
+    IoUring ring;
+    /*!
+    *	\var CriticalFile<Server_Log_Entry> *logFile - Log file used for batched appends.
+    */
+    CriticalFile<Server_Log_Entry> *logFile;
+    /*!
+    *	\var std::vector<Server_Log_Entry> logQueue - Log entries of the requests handled in the current pass.
+    */
+    std::vector<Server_Log_Entry> logQueue;
+    /*!
+    *	\var std::set<Uring_Connection*> connections - Live connections.
+    */
+    std::set<Uring_Connection*> connections;
+    /*!
+    *	\var sockaddr_in acceptAddress, socklen_t acceptLength - Filled in by the pending accept.
+    */
+    sockaddr_in acceptAddress;
+    socklen_t acceptLength;
+    /*!
+    *	\var unsigned long requests - Number of requests handled.
+    */
+    unsigned long requests;
+
+    /*!
+    *   \fn getSqe
+    *	\param None.
+    *	\brief Gets a submission queue entry, flushing the queue if it is full.
+    *	\return Zeroed submission queue entry.
+    *
+    */
+    io_uring_sqe* getSqe();
+    /*!
+    *   \fn queueAccept
+    *	\param None.
+    *	\brief Queues an accept on the listening socket.
+    *	\return void
+    *
+    */
+    void queueAccept();
+    /*!
+    *   \fn queueRecv
+    *	\param Uring_Connection *conn : Connection to receive from.
+    *	\brief Queues a receive on the connection.
+    *	\return void
+    *
+    */
+    void queueRecv(Uring_Connection *conn);
+    /*!
+    *   \fn queueReply
+    *	\param Uring_Connection *conn : Connection to reply on.
+    *	\brief Queues the buffered reply, linked to the next receive.
+    *	\return void
+    *
+    */
+    void queueReply(Uring_Connection *conn);
+    /*!
+    *   \fn completeAccept
+    *	\param int res : Accepted socket descriptor or negative errno.
+    *	\brief Handles an accept completion.
+    *	\return void
+    *
+    */
+    void completeAccept(int res);
+    /*!
+    *   \fn completeRecv
+    *	\param Uring_Connection *conn : Connection.
+    *	\param int res : Bytes received or negative errno.
+    *	\brief Handles a receive completion by servicing the received requests.
+    *	\return void
+    *
+    */
+    void completeRecv(Uring_Connection *conn, int res);
+    /*!
+    *   \fn completeSend
+    *	\param Uring_Connection *conn : Connection.
+    *	\param int res : Bytes sent or negative errno.
+    *	\brief Handles a send completion.
+    *	\return void
+    *
+    */
+    void completeSend(Uring_Connection *conn, int res);
+    /*!
+    *   \fn closeConnection
+    *	\param Uring_Connection *conn : Connection.
+    *	\brief Closes a connection once none of its requests are in flight.
+    *	\return void
+    *
+    *   \par Description
+    *   Shuts the socket down so pending requests complete, then destroys the connection when the last one has.
+    *
+    */
+    void closeConnection(Uring_Connection *conn);
+    /*!
+    *   \fn flushLogs
+    *	\param None.
+    *	\brief Appends the queued log entries.
+    *	\return void
+    *
+    *   \par Description
+    *   Writes the log entries of every request handled in this pass with one locked append.
+    *
+    */
+    void flushLogs();
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param const int listenfd : Listening socket descriptor.
+    *	\param const int bfd : Open binary file descriptor.
+    *	\param const int lfd : Open log file descriptor.
+    *	\param const int semid : Established system semaphore set id.
+    *	\param int *connectionCount : Optional accepted connection counter.
+    *	\brief Constructs a UringLoop.
+    *	\return UringLoop
+    *
+    */
+    UringLoop(const int listenfd, const int bfd, const int lfd, const int semid, int *connectionCount = NULL);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Destructor. Closes all connections.
+    *	\return void
+    *
+    */
+    ~UringLoop();
+    /*!
+    *   \fn init
+    *	\param None.
+    *	\brief Sets up the ring.
+    *	\return false if io_uring is unavailable, in which case the caller should fall back to EventLoop.
+    *
+    */
+    bool init();
+    /*!
+    *   \fn run
+    *	\param None.
+    *	\brief Event loop lifetime.
+    *	\return void
+    *
+    *   \par Description
+    *   Submits queued entries and dispatches completions until an unrecoverable error occurs.
+    *
+    */
+    void run();
+
+};
+
+#endif
@@ -0,0 +1,375 @@
+/*!	\file VersionStore.h
+*	\brief  VersionStore class header file.
+*   A VersionStore lets record reads run without the file's reader lock, so readers never wait for writers. \n
+*   Writers still lock the records they write, and take turns in the store only while they stamp versions. Before a writer overwrites records, it stamps the new contents as versions with
+*   the next commit sequence number. The first time a record is versioned, its current contents go in too, as the version
+*   every earlier snapshot sees. The writer then writes the file and publishes the sequence number. Writers of
+*   different records write the file concurrently, but publish in sequence order, each after the ones that stamped before it. \n
+*   A reader takes the last published sequence number as its snapshot and reads the newest version of its record
+*   no newer than the snapshot. A record with no versions is read from the file, and the read is retried if a writer
+*   versioned a record of the same hash bucket meanwhile. That can only be a write which may have torn the read. \n
+*   Appends need no versions: the records past the published record count do not exist for readers until the writer
+*   publishes the new count, after the records are written. \n
+*   Versions are kept in a ring, oldest first. A reader announces its snapshot in a slot while it reads. Writers drop the
+*   oldest versions once every announced snapshot sees a newer version of their record, or the file holds them.
+*   A dropped version is reused only once every reader that might still be looking at it has finished. \n
+*   A write with more records than the ring can version at once is published as a bulk write instead. Readers that find
+*   one in progress read under the reader lock, and retry if one started while they read. \n
+*   A writer waiting for its turn sleeps on a futex that every publish wakes. Each write in flight and each announced
+*   snapshot records the pid of its process, so a writer killed before publishing, or a reader killed while reading,
+*   cannot hold the others up: a waiter that sleeps too long aborts the writes of dead processes, and a writer short of
+*   ring entries frees the slots of dead readers. The mutex writers stamp under is robust, so a writer dying while it
+*   holds it releases it too. \n
+*   The state, the ring and the slots live in an anonymous shared mapping created at startup, so all the server
+*   processes and threads share one store. \n
+*
+*/
+
+#ifndef VERSIONSTORE_H
+#define VERSIONSTORE_H
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define VERSION_CAPACITY 65536
+#define VERSION_BUCKETS 16384
+#define VERSION_SLOTS 256
+#define VERSION_OWNERS 4096
+#define VERSION_NAP_NS 10000000L
+
+/*!
+*   \enum Version_Read
+*   \brief Outcome of a snapshot read.
+*/
+enum Version_Read
+{
+    VERSION_ABSENT = 0, // the record does not exist in the snapshot
+    VERSION_READ = 1,   // the record was read
+    VERSION_LOCKED = -1 // a bulk write is in progress; read under the reader lock instead
+};
+
+/*!
+*   \struct Version_Stats
+*   \brief Snapshot of a VersionStore's counters.
+*/
+struct Version_Stats{
+    long reads;     // snapshot reads
+    long versioned; // reads served from a version
+    long retries;   // file reads retried after a write
+    long locked;    // reads sent to the reader lock by a bulk write
+    long versions;  // versions stamped
+    long reclaimed; // versions dropped
+    long waits;     // writers that waited for readers to free the ring
+    long ordered;   // writers that waited to publish after a write that began before theirs
+    long abandoned; // writes aborted and snapshots dropped because their process died
+    int live;       // versions in the ring
+};
+
+/*!
+ *	\class VersionStore
+ *	\brief Shared multi-version record store for lock-free snapshot reads
+ *  \n
+ *   A VersionStore keeps the recent versions of updated records in shared memory, stamped with commit sequence numbers. \n
+ */
+class VersionStore
+{
+private:
+    /*!
+    *   \struct Version_Header
+    *   \brief Shared state at the start of the segment.
+    */
+    struct Version_Header{
+        std::atomic<uint64_t> committed; // last published commit sequence number
+        std::atomic<long> records;       // records readers may see, or -1 until the first append
+        std::atomic<uint64_t> bulk;      // odd while a bulk write is in progress
+        pthread_mutex_t writing;         // held by a writer while it stamps versions, or from begin to publish or abort for a bulk write; robust
+        std::atomic<uint32_t> turns;     // futex word, bumped by every publish or abort
+        std::atomic<int> sleepers;       // writers sleeping on turns
+        int owners[VERSION_OWNERS];      // pid of the process of each commit in flight, by sequence number, written under writing only
+        uint64_t issued;                 // last commit sequence number handed out
+        uint64_t bulkCommit;             // commit sequence number of the bulk write in progress, or 0
+        std::atomic<uint64_t> head;      // ring position of the next version, written under writing only
+        std::atomic<uint64_t> tail;      // ring position of the oldest version still linked, written under writing only
+        uint64_t reclaim;                // ring position of the oldest version not yet free
+        int capacity;
+        int numBuckets;
+        int numSlots;
+        int recordSize;
+        size_t entrySize;
+        std::atomic<long> reads;
+        std::atomic<long> versioned;
+        std::atomic<long> retries;
+        std::atomic<long> locked;
+        std::atomic<long> versions;
+        std::atomic<long> reclaimed;
+        std::atomic<long> waits;
+        std::atomic<long> ordered;
+        std::atomic<long> abandoned;
+    };
+
+    /*!
+    *   \struct Version_Entry
+    *   \brief A version in the ring, followed by the record's contents.
+    */
+    struct Version_Entry{
+        std::atomic<uint64_t> begin; // commit sequence number it was written at, 0 for contents from before, VERSION_DEAD if aborted
+        std::atomic<int> next;       // next older entry of the hash bucket, or -1
+        int recordNumber;
+        uint64_t retired;            // committed sequence number when it was dropped
+    };
+
+    /*!
+    *	\var size_t size - Length of the segment.
+    */
+    size_t size;
+    /*!
+    *	\var Version_Header *header - Segment header.
+    */
+    Version_Header *header;
+    /*!
+    *	\var std::atomic<int> *buckets - Newest entry of each hash bucket, or -1.
+    */
+    std::atomic<int> *buckets;
+    /*!
+    *	\var std::atomic<uint64_t> *changes - Count of versions stamped in each hash bucket.
+    */
+    std::atomic<uint64_t> *changes;
+    /*!
+    *	\var std::atomic<uint64_t> *slots - Snapshot of each reading reader, or 0 if free.
+    */
+    std::atomic<uint64_t> *slots;
+    /*!
+    *	\var std::atomic<int> *readers - Pid of the process of each reading reader, or 0 if free or not yet known.
+    */
+    std::atomic<int> *readers;
+    /*!
+    *	\var char *entries - The ring.
+    */
+    char *entries;
+
+    /*!
+    *   \fn entry
+    *	\param long index : Entry index, or a ring position.
+    *	\brief Finds an entry of the ring.
+    *	\return Pointer to the entry.
+    *
+    */
+    Version_Entry *entry(long index){return (Version_Entry *) (entries + (index % header->capacity) * header->entrySize);}
+    /*!
+    *   \fn contents
+    *	\param Version_Entry *e : Entry.
+    *	\brief Finds the record contents of an entry.
+    *	\return Pointer to the contents.
+    *
+    */
+    static char *contents(Version_Entry *e){return (char *) (e + 1);}
+    /*!
+    *   \fn bucket
+    *	\param int recordNumber : Record number.
+    *	\brief Hashes a record number to its bucket.
+    *	\return Bucket index.
+    *
+    */
+    int bucket(int recordNumber){return recordNumber % header->numBuckets;}
+    /*!
+    *   \fn announce
+    *	\param uint64_t &snapshot : Set to the snapshot taken.
+    *	\brief Takes a snapshot and announces it in a free slot.
+    *	\return Slot index.
+    *
+    *   \par Description
+    *   Retakes the snapshot until it is unchanged after being announced, so a writer that collects after missing the slot
+    *   can only have published sequence numbers the snapshot already includes.
+    *
+    */
+    int announce(uint64_t &snapshot);
+    /*!
+    *   \fn oldestSnapshot
+    *	\param None.
+    *	\brief Finds the oldest announced snapshot.
+    *	\return Oldest snapshot, or UINT64_MAX if nobody is reading.
+    *
+    */
+    uint64_t oldestSnapshot();
+    /*!
+    *   \fn obsolete
+    *	\param long position : Ring position of the oldest linked entry.
+    *	\param uint64_t oldest : Oldest snapshot any reader can hold.
+    *	\brief Checks if no reader needs an entry any more.
+    *	\return true if the entry was aborted, a newer version of its record is seen by oldest, or it is its record's newest
+    *   version and seen by oldest, so the file holds it.
+    *
+    */
+    bool obsolete(long position, uint64_t oldest);
+    /*!
+    *   \fn collect
+    *	\param None.
+    *	\brief Drops obsolete entries from the tail of the ring and frees those no reader can be looking at.
+    *	\return Number of free entries.
+    *
+    *   \par Description
+    *   Must be called between begin and publish or abort.
+    *
+    */
+    long collect();
+    /*!
+    *   \fn push
+    *	\param int recordNumber : Record number.
+    *	\param uint64_t begin : Commit sequence number of the version.
+    *	\param const void *record : Contents.
+    *	\brief Links a new entry at the head of its bucket.
+    *	\return void
+    *
+    */
+    void push(int recordNumber, uint64_t begin, const void *record);
+    /*!
+    *   \fn awaitTurn
+    *	\param uint64_t commit : Commit sequence number.
+    *	\brief Waits until every earlier write is published or aborted.
+    *	\return void
+    *
+    *   \par Description
+    *   Sleeps on the turns futex. Each time a sleep times out, aborts the earlier writes whose processes are gone.
+    *
+    */
+    void awaitTurn(uint64_t commit);
+    /*!
+    *   \fn advance
+    *	\param uint64_t commit : Sequence number just published or aborted.
+    *	\brief Publishes a sequence number and wakes the writers waiting for their turn.
+    *	\return void
+    *
+    */
+    void advance(uint64_t commit);
+    /*!
+    *   \fn lockWriting
+    *	\param bool wait : Block until the mutex is free, or only try.
+    *	\brief Takes the stamping mutex, repairing the ring if its holder died.
+    *	\return true if it was taken.
+    *
+    */
+    bool lockWriting(bool wait);
+    /*!
+    *   \fn skipDead
+    *	\param None.
+    *	\brief Aborts the oldest writes in flight while their processes are gone.
+    *	\return void
+    *
+    *   \par Description
+    *   Must be called holding writing.
+    *
+    */
+    void skipDead();
+    /*!
+    *   \fn reapReaders
+    *	\param None.
+    *	\brief Frees the slots announced by processes that are gone.
+    *	\return void
+    *
+    */
+    void reapReaders();
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param int capacity : Number of versions the ring holds.
+    *	\param int recordSize : Size of a record in bytes.
+    *	\brief Creates the shared store.
+    *	\return VersionStore
+    *
+    *   \par Description
+    *   Maps the segment shared and anonymous. Exits on failure. Processes forked afterwards share it.
+    *
+    */
+    VersionStore(int capacity, int recordSize);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Unmaps the segment.
+    *	\return void
+    *
+    */
+    ~VersionStore();
+    /*!
+    *   \fn getRecordSize
+    *	\param None.
+    *	\brief Size of the records versioned.
+    *	\return Size in bytes.
+    *
+    */
+    int getRecordSize(){return header->recordSize;}
+    /*!
+    *   \fn read
+    *	\param int recordNumber : Record number.
+    *	\param void *buf : Filled with the record.
+    *	\param std::function<bool(void*)> load : Reads the record from the file without any lock, false if it is not there.
+    *	\brief Reads a record as of a snapshot, without locks.
+    *	\return VERSION_READ, VERSION_ABSENT, or VERSION_LOCKED if the caller must read under the reader lock.
+    *
+    */
+    int read(int recordNumber, void *buf, std::function<bool(void*)> load);
+    /*!
+    *   \fn begin
+    *	\param const int *recordNumbers : Records about to be overwritten.
+    *	\param const void *records : New contents, contiguous.
+    *	\param int count : Number of records.
+    *	\param long numRecords : Records in the file before the write, or -1 if unknown.
+    *	\param std::function<bool(int, void*)> current : Reads a record's current contents from the file.
+    *	\brief Stamps a write's records as versions readers will see once it is published.
+    *	\return Commit sequence number of the write, to publish or abort.
+    *
+    *   \par Description
+    *   Waits for readers to free ring entries if it is full. A write of more records than a quarter of the ring is
+    *   turned into a bulk write. Appended records are not passed, only counted by publish.
+    *   Must be called under the write locks of the records, before the file is written. Other writers wait in begin
+    *   while it stamps, or until publish or abort after a bulk write.
+    *
+    */
+    uint64_t begin(const int *recordNumbers, const void *records, int count, long numRecords, std::function<bool(int, void*)> current);
+    /*!
+    *   \fn publish
+    *	\param uint64_t commit : Sequence number returned by begin.
+    *	\param long numRecords : Records in the file after the write, or -1 if unchanged.
+    *	\brief Makes a write visible to new snapshots.
+    *	\return void
+    *
+    *   \par Description
+    *   Must be called under the write locks of the records, once the file is written.
+    *   Waits for the writes that began earlier to be published first, so a snapshot includes every write before its sequence number.
+    *
+    */
+    void publish(uint64_t commit, long numRecords);
+    /*!
+    *   \fn abort
+    *	\param uint64_t commit : Sequence number returned by begin.
+    *	\brief Discards the versions of a write that failed and was rolled back.
+    *	\return void
+    *
+    *   \par Description
+    *   Must be called under the write locks of the records. Takes the write's turn like publish, publishing nothing.
+    *
+    */
+    void abort(uint64_t commit);
+    /*!
+    *   \fn stats
+    *	\param None.
+    *	\brief Reads the counters.
+    *	\return Version_Stats
+    *
+    */
+    Version_Stats stats();
+    /*!
+    *   \fn printStats
+    *	\param None.
+    *	\brief Prints the counters.
+    *	\return void
+    *
+    */
+    void printStats();
+
+};
+
+#endif
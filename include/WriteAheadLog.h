@@ -0,0 +1,239 @@
+/*!	\file WriteAheadLog.h
+*	\brief  WriteAheadLog class header file.
+*   A WriteAheadLog makes record writes durable before they are acknowledged. \n
+*   Every write to the data file is first appended to the log as entries holding the record number and contents,
+*   under the write locks of the records, so the log holds the writes to each record in the order they are applied. The
+*   log is synced past a write before any of it reaches the data file, so a crash either leaves a write whole in the log,
+*   to be replayed, or leaves the data file without any of it: a batch stays all or nothing even if the process dies
+*   halfway through writing it, and the data file itself is never synced on the write path. \n
+*   With group commit, writers waiting for the log to be synced elect a leader: it syncs the log up to everything
+*   appended so far while the others wait on a condition variable, so one fdatasync covers every writer that was waiting. \n
+*   A write whose data could not be written after it was logged is cancelled by a later entry, so it is not replayed. \n
+*   The log position, the sync state and the counters live in an anonymous shared mapping created at startup, so all
+*   the server processes and threads share one log. The log is checkpointed when it grows past WAL_CHECKPOINT_BYTES:
+*   once every logged write has reached the data file, the data file is synced and the log emptied; appends wait meanwhile.
+*   Appends and checkpoints take the log's mutex, so writers of different records can log concurrently. \n
+*   On startup, recover replays the complete entries of a log left by a crash into the data file, through a callback
+*   so any file format can be restored. Replaying is idempotent, and a torn entry at the end, or a batch without its
+*   last entry, is ignored. \n
+*
+*/
+
+#ifndef WRITEAHEADLOG_H
+#define WRITEAHEADLOG_H
+
+#include "Packets.h"
+#include <pthread.h>
+#include <functional>
+
+#define WAL_CHECKPOINT_BYTES (64L << 20)
+#define WAL_CANCEL -1
+
+/*!
+ *   \enum Durability_Mode
+ *   \brief When record writes are synced to disk.
+ */
+enum Durability_Mode
+{
+    DURABILITY_NONE,  // no log, writes reach disk whenever the kernel writes them back
+    DURABILITY_GROUP, // writers wait for a shared fdatasync of the log before writing the data
+    DURABILITY_SYNC   // every write syncs the log itself before writing the data
+};
+
+/*!
+*   \struct Wal_Entry_Header
+*   \brief Header of a log entry, followed by the record's contents.
+*/
+struct Wal_Entry_Header{
+    uint32_t checksum;    // of the rest of the header and the contents
+    int32_t recordNumber; // record written, or WAL_CANCEL for an entry whose contents hold the log offset ending a cancelled write
+    int32_t last;         // set on the last entry of a write; entries are only replayed up to one
+    int32_t size;         // bytes of contents
+};
+
+/*!
+ *	\class WriteAheadLog
+ *	\brief Shared, group committed log of record writes
+ *  \n
+ *   A WriteAheadLog appends every record write to a log file and syncs it before the write is acknowledged. \n
+ */
+class WriteAheadLog
+{
+private:
+    /*!
+    *   \struct Wal_State
+    *   \brief Shared log state.
+    */
+    struct Wal_State{
+        pthread_mutex_t lock;
+        pthread_cond_t synced;
+        long appended; // log sequence number after the last appended entry
+        long durable;  // log sequence number up to which the log is synced
+        long base;     // log sequence number at offset 0 of the log file
+        int syncing;   // a leader is syncing
+        pthread_cond_t drained;
+        int inflight;      // writes logged but not yet written to the data file
+        int checkpointing; // an append is waiting for inflight to drop to 0 to checkpoint
+        long commits;
+        long syncs;
+        long checkpoints;
+    };
+
+    /*!
+    *	\var const int fd - Open log file descriptor.
+    */
+    const int fd;
+    /*!
+    *	\var const Durability_Mode mode - Group commit or a sync per write.
+    */
+    const Durability_Mode mode;
+    /*!
+    *	\var Wal_State *state - Shared state.
+    */
+    Wal_State *state;
+
+    /*!
+    *   \fn checksum
+    *	\param const Wal_Entry_Header &header : Entry header.
+    *	\param const void *contents : Entry contents.
+    *	\brief Checksums an entry.
+    *	\return FNV-1a hash of the header after its checksum field and of the contents.
+    *
+    */
+    static uint32_t checksum(const Wal_Entry_Header &header, const void *contents);
+    /*!
+    *   \fn truncate
+    *	\param None.
+    *	\brief Truncates the log.
+    *	\return void
+    *
+    *   \par Description
+    *   Empties the log file and marks everything logged so far as durable. Must be called holding the state mutex.
+    *
+    */
+    void truncate();
+
+public:
+    /*!
+    *   \fn Constructor
+    *	\param int fd : Open log file descriptor, empty or recovered.
+    *	\param Durability_Mode mode : DURABILITY_GROUP or DURABILITY_SYNC.
+    *	\brief Creates the shared log state.
+    *	\return WriteAheadLog
+    *
+    *   \par Description
+    *   Maps the state shared and anonymous. Exits on failure. Processes forked afterwards share it.
+    *
+    */
+    WriteAheadLog(int fd, Durability_Mode mode);
+    /*!
+    *   \fn Destructor
+    *	\param None.
+    *	\brief Unmaps the state.
+    *	\return void
+    *
+    */
+    ~WriteAheadLog();
+    /*!
+    *   \fn append
+    *	\param int dataFd : Open data file descriptor, synced before a full log is emptied.
+    *	\param const int *recordNumbers : Record number of each record written.
+    *	\param const void *records : Records written, contiguous.
+    *	\param int count : Number of records.
+    *	\param int recordSize : Size of a record in bytes.
+    *	\brief Logs a write.
+    *	\return Log sequence number to commit, or -1 on error.
+    *
+    *   \par Description
+    *   Appends an entry per record with one pwrite, the last one marked as ending the write. A full log is checkpointed
+    *   first: the append waits for every write logged so far to be applied, then syncs the data file.
+    *   In DURABILITY_SYNC mode the log is synced before returning.
+    *   Must be called under the write locks of the records, before any of them is written to the data file. Unless it
+    *   returns -1, the write counts as in flight until applied is called.
+    *
+    */
+    long append(int dataFd, const int *recordNumbers, const void *records, int count, int recordSize);
+    /*!
+    *   \fn commit
+    *	\param long lsn : Log sequence number returned by append.
+    *	\brief Waits for a write to be durable.
+    *	\return false if the log could not be synced.
+    *
+    *   \par Description
+    *   Returns once the log is synced up to lsn. The first writer to find nobody syncing becomes the leader and syncs
+    *   everything appended so far, and the writers arriving meanwhile wait for it or the next leader.
+    *   Called under the record locks, before the data is written; writers of other records append meanwhile and share the sync.
+    *
+    */
+    bool commit(long lsn);
+    /*!
+    *   \fn cancel
+    *	\param long lsn : Log sequence number returned by append.
+    *	\param int recordSize : Size of a record in bytes, at least that of a long.
+    *	\brief Cancels a logged write whose data could not be written.
+    *	\return void
+    *
+    *   \par Description
+    *   Appends an entry telling recover to skip the write, synced along with the next writes. Must be called before applied.
+    *
+    */
+    void cancel(long lsn, int recordSize);
+    /*!
+    *   \fn applied
+    *	\param None.
+    *	\brief Marks an in flight write as written to the data file, or given up.
+    *	\return void
+    *
+    *   \par Description
+    *   Must be called once per successful append, right after the data write and before waiting on anything else, since a
+    *   checkpoint waits for it.
+    *
+    */
+    void applied();
+    /*!
+    *   \fn full
+    *	\param None.
+    *	\brief Checks if the log is due a checkpoint.
+    *	\return true once the log holds WAL_CHECKPOINT_BYTES or more.
+    *
+    */
+    bool full(){return state->appended - state->base >= WAL_CHECKPOINT_BYTES;}
+    /*!
+    *   \fn checkpoint
+    *	\param None.
+    *	\brief Empties the log.
+    *	\return void
+    *
+    *   \par Description
+    *   Truncates the log, and marks everything logged so far as durable. The caller must have synced the data file first,
+    *   so every logged write is durable without the log.
+    *   Called on shutdown so the next start has nothing to replay, once no writer is left. Appends checkpoint a full log themselves.
+    *
+    */
+    void checkpoint();
+    /*!
+    *   \fn printStats
+    *	\param None.
+    *	\brief Prints the counters.
+    *	\return void
+    *
+    */
+    void printStats();
+    /*!
+    *   \fn recover
+    *	\param int walfd : Log file descriptor.
+    *	\param int recordSize : Size of a record in bytes.
+    *	\param std::function<bool(int, const void*)> apply : Writes a record to the data file, given its number and contents.
+    *	\brief Replays a log into the data file.
+    *	\return Number of records replayed, or -1 on error.
+    *
+    *   \par Description
+    *   Applies every complete write in the log that was not cancelled, in log order. The caller then syncs the data file and empties the log with checkpoint.
+    *   Must be called before any server is started.
+    *
+    */
+    static int recover(int walfd, int recordSize, std::function<bool(int, const void*)> apply);
+
+};
+
+#endif
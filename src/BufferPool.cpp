@@ -0,0 +1,206 @@
+/*!	\file BufferPool.cpp
+*	\brief  BufferPool class implementation file.
+*/
+
+#include "BufferPool.h"
+#include <sys/mman.h>
+
+
+
+/*!
+*	\brief Creates the shared pool.
+*/
+BufferPool::BufferPool(int numFrames, int recordSize){
+    //twice as many chains as frames keeps them short
+    int numBuckets = numFrames * 2;
+    size = sizeof(Pool_Header) + numFrames * sizeof(Pool_Frame) + numBuckets * sizeof(int) +
+        (size_t) numFrames * POOL_PAGE_RECORDS * recordSize;
+
+    void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED){
+        perror("Buffer pool mmap");
+        exit(3);
+    }
+
+    header = (Pool_Header *) segment;
+    frames = (Pool_Frame *) (header + 1);
+    buckets = (int *) (frames + numFrames);
+    data = (char *) (buckets + numBuckets);
+
+    //the mutex lives in the segment, so it must be shareable between processes
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    header->numFrames = numFrames;
+    header->numBuckets = numBuckets;
+    header->recordSize = recordSize;
+    header->hand = 0;
+    header->used = 0;
+    header->hits = 0;
+    header->misses = 0;
+    header->evictions = 0;
+
+    for (int i = 0; i < numFrames; i++){
+        frames[i].page = -1;
+        frames[i].count = 0;
+        frames[i].next = -1;
+        frames[i].referenced = 0;
+    }
+    for (int i = 0; i < numBuckets; i++){
+        buckets[i] = -1;
+    }
+}
+
+
+
+/*!
+*	\brief Unmaps the segment.
+*/
+BufferPool::~BufferPool(){
+    munmap(header, size);
+}
+
+
+
+/*!
+*	\brief Finds a cached page.
+*/
+int BufferPool::find(int page){
+    int frame = buckets[page % header->numBuckets];
+    while (frame != -1 && frames[frame].page != page){
+        frame = frames[frame].next;
+    }
+    return frame;
+}
+
+
+
+/*!
+*	\brief Picks a frame for a new page.
+*/
+int BufferPool::evict(){
+    if (header->used < header->numFrames){
+        return header->used++;
+    }
+
+    int frame;
+    while (1){
+        frame = header->hand;
+        header->hand = (header->hand + 1) % header->numFrames;
+        if (!frames[frame].referenced){
+            break;
+        }
+        frames[frame].referenced = 0;
+    }
+
+    //unlink it from its chain
+    int *link = &buckets[frames[frame].page % header->numBuckets];
+    while (*link != frame){
+        link = &frames[*link].next;
+    }
+    *link = frames[frame].next;
+
+    frames[frame].page = -1;
+    header->evictions++;
+    return frame;
+}
+
+
+
+/*!
+*	\brief Reads a record from the pool.
+*/
+bool BufferPool::read(int recordNumber, void *buf){
+    int page = recordNumber / POOL_PAGE_RECORDS;
+    int index = recordNumber % POOL_PAGE_RECORDS;
+    bool hit = false;
+
+    pthread_mutex_lock(&header->lock);
+    int frame = find(page);
+    if (frame != -1 && index < frames[frame].count){
+        memcpy(buf, frameData(frame) + index * header->recordSize, header->recordSize);
+        frames[frame].referenced = 1;
+        header->hits++;
+        hit = true;
+    }
+    else{
+        header->misses++;
+    }
+    pthread_mutex_unlock(&header->lock);
+
+    return hit;
+}
+
+
+
+/*!
+*	\brief Writes a record through to the pool.
+*/
+void BufferPool::update(int recordNumber, const void *record){
+    int page = recordNumber / POOL_PAGE_RECORDS;
+    int index = recordNumber % POOL_PAGE_RECORDS;
+
+    pthread_mutex_lock(&header->lock);
+    int frame = find(page);
+    if (frame != -1 && index < frames[frame].count){
+        memcpy(frameData(frame) + index * header->recordSize, record, header->recordSize);
+    }
+    pthread_mutex_unlock(&header->lock);
+}
+
+
+
+/*!
+*	\brief Caches a page.
+*/
+void BufferPool::insert(int page, const void *records, int count){
+    if (count <= 0){
+        return;
+    }
+
+    pthread_mutex_lock(&header->lock);
+    int frame = find(page);
+    if (frame == -1){
+        frame = evict();
+        frames[frame].page = page;
+        frames[frame].next = buckets[page % header->numBuckets];
+        buckets[page % header->numBuckets] = frame;
+    }
+    memcpy(frameData(frame), records, (size_t) count * header->recordSize);
+    frames[frame].count = count;
+    frames[frame].referenced = 1;
+    pthread_mutex_unlock(&header->lock);
+}
+
+
+
+/*!
+*	\brief Reads the counters.
+*/
+Pool_Stats BufferPool::stats(){
+    Pool_Stats s;
+    pthread_mutex_lock(&header->lock);
+    s.frames = header->numFrames;
+    s.used = header->used;
+    s.hits = header->hits;
+    s.misses = header->misses;
+    s.evictions = header->evictions;
+    pthread_mutex_unlock(&header->lock);
+    return s;
+}
+
+
+
+/*!
+*	\brief Prints the counters.
+*/
+void BufferPool::printStats(){
+    Pool_Stats s = stats();
+    long lookups = s.hits + s.misses;
+    printf("Buffer pool: %d/%d pages | %ld hits | %ld misses | %ld evictions | %.1f%% hit rate\n", s.used, s.frames,
+        s.hits, s.misses, s.evictions, lookups > 0 ? 100.0 * s.hits / lookups : 0.0);
+    fflush(stdout);
+}
@@ -4,13 +4,15 @@
 
 #include "Client.h"
 #include "CriticalFile.h"
+#include <algorithm>
+#include <climits>
 
 /*!
 *	\brief Constructs a client.
 */
 Client::Client(const int serfd, const int lfd, const sockaddr_in serAddr, const int semid) : 
     pid(getpid()), serverSocket(serfd, serAddr), 
-    shmem(getpid(), SemaphoreSet(semid, 1) ), logFile(lfd, SemaphoreSet(semid, 0) )
+    shmem(getpid(), SemaphoreSet(semid, 1) ), logFile(lfd, SemaphoreSet(semid, 0) ), nextRequestId(1)
 {}
 
 
@@ -43,11 +45,23 @@ void Client::run(){
 
     while (true){
 
+        //replies that arrived with an earlier one are already buffered, and select won't report them
+        uint32_t requestId;
+        while (serverSocket.hasFrame()){
+            readReply(msg, requestId);
+            messageSwitch(msg);
+        }
+
         prompt("\
 N)New Record\n\
 D)Display Record\n\
 C)Change Record\n\
 S)Show Server Log\n\
+A)Aggregate Field\n\
+F)Filter Records\n\
+I)Indexed Range\n\
+K)Keyed Record\n\
+T)Use Dataset\n\
 L)Show Client Log\n\
 P)Show Connected Clients\n\
 X)Exit\n\
@@ -79,7 +93,8 @@ X)Exit\n\
         else{
             if (FD_ISSET(sockfd, &readfds)){
                 // printf("Message from socket\n");
-                if (serverSocket.readMessage(msg) == 0){
+                uint32_t requestId;
+                if (!readReply(msg, requestId)){
                     printf("Server disconnected.\n");
                     return;
                 }
@@ -99,6 +114,97 @@ X)Exit\n\
 
 
 
+/*!
+*	\brief Sends a request to the server.
+*/
+uint32_t Client::sendRequest(Record_Message &msg){
+    return sendRequest(msg.action, &msg, sizeof(Record_Message));
+}
+
+
+
+/*!
+*	\brief Sends a request with its own payload type to the server.
+*/
+uint32_t Client::sendRequest(int opcode, const void* payload, int length){
+    uint32_t requestId = nextRequestId++;
+
+    //0 is never used, so it can report an error
+    if (nextRequestId == 0){
+        nextRequestId = 1;
+    }
+
+    return (serverSocket.writeFrame(opcode, requestId, payload, length) > 0) ? requestId : 0;
+}
+
+
+
+/*!
+*	\brief Waits for the next reply from the server.
+*/
+bool Client::readReply(Record_Message &msg, uint32_t &requestId){
+    Frame frame;
+    memset(&msg, 0x0, sizeof(Record_Message));
+
+    if (!serverSocket.readFrame(frame)){
+        return false;
+    }
+
+    memcpy(&msg, frame.payload, std::min((size_t) frame.length, sizeof(Record_Message)));
+    msg.action = frame.opcode;
+    requestId = frame.requestId;
+    return true;
+}
+
+
+
+/*!
+*	\brief Waits for the reply to one request.
+*/
+bool Client::awaitReply(uint32_t requestId, Record_Message &msg){
+    uint32_t replyId;
+
+    while (readReply(msg, replyId)){
+        if (replyId == requestId){
+            return true;
+        }
+        messageSwitch(msg);
+    }
+
+    return false;
+}
+
+
+
+/*!
+*	\brief Waits for the next reply frame of one request.
+*/
+bool Client::awaitFrame(uint32_t requestId, Frame &frame){
+    while (serverSocket.readFrame(frame)){
+        if (frame.requestId == requestId){
+            return true;
+        }
+        dispatchFrame(frame);
+    }
+
+    return false;
+}
+
+
+
+/*!
+*	\brief Hands a reply to another request in flight to messageSwitch.
+*/
+void Client::dispatchFrame(Frame &frame){
+    Record_Message msg;
+    memset(&msg, 0x0, sizeof(Record_Message));
+    memcpy(&msg, frame.payload, std::min((size_t) frame.length, sizeof(Record_Message)));
+    msg.action = frame.opcode;
+    messageSwitch(msg);
+}
+
+
+
 /*!
 *	\brief Routes server reply to a handler function.
 */
@@ -144,6 +250,21 @@ bool Client::menuSwitch(char choice){
     case 'L': //Client Log
         clientLog();
         break;
+    case 'A': //Aggregate
+        aggregateMenu();
+        break;
+    case 'F': //Filter
+        filterMenu();
+        break;
+    case 'I': //Index range
+        indexMenu();
+        break;
+    case 'K': //Keyed record
+        keyMenu();
+        break;
+    case 'T': //Dataset
+        datasetMenu();
+        break;
     case 'P': //Client Log
         connectedClientsInfo();
         break;
@@ -225,19 +346,10 @@ int Client::requestCount(){
     Record_Message msg = {0};
     msg.action = 1;
 
-    serverSocket.writeMessage(msg);
-
-    /*If a stdin input comes immediately after submitting a command
-    that requests another command which begins with a count request,
-    the count request will be sent before the reply to the first command
-    is received.
-    This read would then read the first reply from the socket,
-    interpret its argument as the count, and supply that incorrect count
-    to the caller. 
-    We loop reads here to properly process any late replies so that this doesn't occur.
-    */
-    while ( (serverSocket.readMessage(msg) > 0) && (msg.action != 1) && (msg.arg != -1) ){
-        messageSwitch(msg);
+    //replies to commands sent before this one may still be on their way
+    uint32_t requestId = sendRequest(msg);
+    if (requestId == 0 || !awaitReply(requestId, msg)){
+        return -1;
     }
 
     return msg.arg;
@@ -249,13 +361,13 @@ int Client::requestCount(){
 /*!
 *	\brief Requests a record from the server.
 */
-bool Client::requestRead(const int recordNumber){
+uint32_t Client::requestRead(const int recordNumber){
     Record_Message msg = {0};
 
     msg.action = 2;
     msg.arg = recordNumber;
 
-    return (serverSocket.writeMessage(msg) > 0);
+    return sendRequest(msg);
 }
 
 
@@ -281,20 +393,44 @@ void Client::receiveRead(Record_Message &msg){
 */
 void Client::readAll(const int count){
     std::vector<Record> records;
-    Record_Message msg;
+    Range_Request range = {0, count};
 
-    //request each individual record
-    for (int i = 0; i < count; i++){
-        memset(&msg, 0x0, sizeof(Record_Message));
-        requestRead(i);
-        if ( (serverSocket.readMessage(msg) <= 0 ) || (msg.arg == -1) ){
-            printf("Server error retrieving record %d.\n", i);
+    //one request for the whole file
+    uint32_t requestId = sendRequest(6, &range, sizeof(Range_Request));
+    if (requestId == 0 || !receiveRecords(requestId, records)){
+        printf("Server error retrieving records.\n");
+        return;
+    }
+
+    writeLog(7, 0);
+    if (records.size() > 0) printRecords(records);
+}
+
+
+
+/*!
+*	\brief Receives the records streamed in reply to a request.
+*/
+bool Client::receiveRecords(uint32_t requestId, std::vector<Record> &records){
+    Frame frame;
+
+    //frames of records, ended by the number sent
+    while (true){
+        if (!awaitFrame(requestId, frame)){
+            return false;
+        }
+        if (frame.length == sizeof(int)){
             break;
         }
-        records.push_back(msg.record);
-        writeLog(2, i);
+
+        size_t n = frame.length / sizeof(Record);
+        records.resize(records.size() + n);
+        memcpy(&records[records.size() - n], frame.payload, n * sizeof(Record));
     }
-    if (records.size() > 0) printRecords(records);
+
+    int sent;
+    memcpy(&sent, frame.payload, sizeof(int));
+    return sent != -1;
 }
 
 
@@ -352,9 +488,8 @@ void Client::updateMenu(){
 
     //Retrieve that Record
     Record_Message msg;
-    requestRead(choice);
-    serverSocket.readMessage(msg);
-    if (msg.arg == -1){
+    uint32_t requestId = requestRead(choice);
+    if (requestId == 0 || !awaitReply(requestId, msg) || msg.arg == -1){
         printf("Server error retrieving record %d.\n", choice);
         return;
     }
@@ -424,7 +559,7 @@ bool Client::requestUpdate(const int recordNumber, const Record &rec){
     msg.action = 3;
     msg.arg = recordNumber;
 
-    return (serverSocket.writeMessage(msg) > 0);
+    return sendRequest(msg);
 
 }
 
@@ -475,7 +610,7 @@ bool Client::requestCreate(const Record &rec){
     memcpy(&msg.record, &rec, sizeof(Record)); //Copy input record
     msg.action = 4;
 
-    return (serverSocket.writeMessage(msg) > 0);
+    return sendRequest(msg);
 }
 
 
@@ -497,6 +632,328 @@ void Client::receiveCreate(Record_Message &msg){
 
 
 
+/*!
+*	\brief Gets user input for a filter and prints the matching records.
+*/
+void Client::filterMenu(){
+    prompt("Filtering Records");
+
+    Filter_Request query;
+    memset(&query, 0x0, sizeof(Filter_Request));
+    query.end = INT_MAX;
+    query.combine = FILTER_AND;
+
+    //up to MAX_FILTER_TERMS comparisons, all of which must hold
+    char c;
+    while (query.count < MAX_FILTER_TERMS){
+        Filter_Term &term = query.terms[query.count];
+
+        printf("Select a Field: A)ndroid I)OS K)aios O)ther, or R)un\n");
+        printf(" >>>");
+        fflush(stdout);
+        while( (c = getchar()) == '\n');
+
+        switch (toupper(c)){
+        case 'A':
+            term.field = FIELD_ANDROID;
+            break;
+        case 'I':
+            term.field = FIELD_IOS;
+            break;
+        case 'K':
+            term.field = FIELD_KAIOS;
+            break;
+        case 'O':
+            term.field = FIELD_OTHER;
+            break;
+        case 'R':
+            break;
+        default:
+            printf("Invalid\n");
+            continue;
+        }
+        if (toupper(c) == 'R'){
+            break;
+        }
+
+        printf("Select a Comparison: <)less >)greater =)equal\n");
+        printf(" >>>");
+        fflush(stdout);
+        while( (c = getchar()) == '\n');
+
+        switch (c){
+        case '<':
+            term.op = FILTER_LT;
+            break;
+        case '>':
+            term.op = FILTER_GT;
+            break;
+        case '=':
+            term.op = FILTER_EQ;
+            break;
+        default:
+            printf("Invalid\n");
+            continue;
+        }
+
+        printf("Enter Market Share Percentage:\n");
+        term.value = getFloat();
+        query.count++;
+    }
+
+    std::vector<Record> records;
+    uint32_t requestId = sendRequest(9, &query, sizeof(Filter_Request));
+    if (requestId == 0 || !receiveRecords(requestId, records)){
+        printf("Server error filtering records.\n");
+        return;
+    }
+    writeLog(10, records.size());
+
+    if (records.empty()){
+        printf("No matching records.\n");
+        return;
+    }
+    printRecords(records);
+}
+
+
+
+/*!
+*	\brief Gets user input for an index range query and prints the records found.
+*/
+void Client::indexMenu(){
+    prompt("Records by Market Share");
+
+    Index_Request query;
+    memset(&query, 0x0, sizeof(Index_Request));
+    char c;
+
+    printf("Select a Field: A)ndroid I)OS K)aios O)ther\n");
+    printf(" >>>");
+    fflush(stdout);
+    while( (c = getchar()) == '\n');
+
+    switch (toupper(c)){
+    case 'A':
+        query.field = FIELD_ANDROID;
+        break;
+    case 'I':
+        query.field = FIELD_IOS;
+        break;
+    case 'K':
+        query.field = FIELD_KAIOS;
+        break;
+    case 'O':
+        query.field = FIELD_OTHER;
+        break;
+    default:
+        printf("Invalid\n");
+        return;
+    }
+
+    printf("Lowest Market Share Percentage:\n");
+    query.low = getFloat();
+    printf("Highest Market Share Percentage:\n");
+    query.high = getFloat();
+
+    printf("Order: H)ighest first L)owest first\n");
+    printf(" >>>");
+    fflush(stdout);
+    while( (c = getchar()) == '\n');
+    query.order = (toupper(c) == 'H') ? INDEX_DESCENDING : INDEX_ASCENDING;
+
+    printf("Most Records to Show (0 for all):\n");
+    query.limit = std::max(0, getInt());
+
+    std::vector<Record> records;
+    uint32_t requestId = sendRequest(10, &query, sizeof(Index_Request));
+    if (requestId == 0 || !receiveRecords(requestId, records)){
+        printf("Server error looking up records. Is the field indexed?\n");
+        return;
+    }
+    writeLog(11, records.size());
+
+    if (records.empty()){
+        printf("No matching records.\n");
+        return;
+    }
+    printRecords(records);
+}
+
+
+
+/*!
+*	\brief Gets user input for a keyed request and prints the record it read or wrote.
+*/
+void Client::keyMenu(){
+    prompt("Records by Key");
+
+    Key_Message msg;
+    memset(&msg, 0x0, sizeof(Key_Message));
+    char c;
+    int opcode;
+
+    printf("Select an Operation: R)ead U)pdate C)reate D)elete\n");
+    printf(" >>>");
+    fflush(stdout);
+    while( (c = getchar()) == '\n');
+
+    switch (toupper(c)){
+    case 'R':
+        opcode = 11;
+        break;
+    case 'U':
+        opcode = 12;
+        break;
+    case 'C':
+        opcode = 13;
+        break;
+    case 'D':
+        opcode = 14;
+        break;
+    default:
+        printf("Invalid\n");
+        return;
+    }
+
+    printf("Record Key (e.g. 202101 for January 2021):\n");
+    int64_t key = getKey();
+    msg.key = key;
+    if (opcode == 12 || opcode == 13){
+        getRecord(msg.record);
+    }
+
+    Frame frame;
+    uint32_t requestId = sendRequest(opcode, &msg, sizeof(Key_Message));
+    if (requestId == 0 || !awaitFrame(requestId, frame) || frame.length != sizeof(Key_Message)){
+        printf("Server error. Are keyed records enabled?\n");
+        return;
+    }
+    memcpy(&msg, frame.payload, sizeof(Key_Message));
+    if (msg.slot == -1){
+        printf("Key %lld %s.\n", (long long) key, (opcode == 13) ? "is already in use" : "was not found");
+        return;
+    }
+    writeLog(opcode + 1, msg.slot);
+
+    std::vector<Record> records = {msg.record};
+    printf("%s key %lld, in record %d:\n", (opcode == 14) ? "Deleted" : "Record of", (long long) key, msg.slot);
+    printRecords(records);
+}
+
+
+
+/*!
+*	\brief Gets user input for a dataset request and reports the dataset selected.
+*/
+void Client::datasetMenu(){
+    prompt("Selecting a Dataset");
+
+    Dataset_Request request;
+    memset(&request, 0x0, sizeof(Dataset_Request));
+    char name[DATASET_NAME_MAX];
+    char c;
+
+    printf("Dataset Name, or * for the server's data file:\n");
+    printf(" >>>");
+    fflush(stdout);
+    if (scanf("%31s", name) != 1){
+        printf("Invalid\n");
+        return;
+    }
+    if (strcmp(name, "*") != 0){
+        strncpy(request.name, name, DATASET_NAME_MAX);
+        printf("Create it if it does not exist? Y)es N)o\n");
+        printf(" >>>");
+        fflush(stdout);
+        while( (c = getchar()) == '\n');
+        request.create = (toupper(c) == 'Y') ? 1 : 0;
+    }
+
+    Frame frame;
+    int count;
+    uint32_t requestId = sendRequest(15, &request, sizeof(Dataset_Request));
+    if (requestId == 0 || !awaitFrame(requestId, frame) || frame.length != sizeof(int)){
+        printf("Server error selecting the dataset.\n");
+        return;
+    }
+    memcpy(&count, frame.payload, sizeof(int));
+    if (count == -1){
+        printf("Dataset %s cannot be used. Does it exist, and are datasets enabled?\n", name);
+        return;
+    }
+    writeLog(16, count);
+
+    printf("Using %s: %d records.\n", (request.name[0] == '\0') ? "the server's data file" : request.name, count);
+}
+
+
+
+/*!
+*	\brief Gets user input for an aggregate query and prints its result.
+*/
+void Client::aggregateMenu(){
+    prompt("Aggregating a Field");
+
+    Aggregate_Request query;
+    char field;
+
+    printf("Select a Field: A)ndroid I)OS K)aios O)ther\n");
+    printf(" >>>");
+    fflush(stdout);
+    while( (field = getchar()) == '\n');
+
+    switch (toupper(field)){
+    case 'A':
+        query.field = FIELD_ANDROID;
+        break;
+    case 'I':
+        query.field = FIELD_IOS;
+        break;
+    case 'K':
+        query.field = FIELD_KAIOS;
+        break;
+    case 'O':
+        query.field = FIELD_OTHER;
+        break;
+    default:
+        printf("Invalid\n");
+        return;
+    }
+
+    printf("First Month:\n");
+    query.start = getInt();
+    printf("Last Month:\n");
+    //the server takes an exclusive end, and INT_MAX already covers every record
+    query.end = getInt();
+    if (query.end < INT_MAX){
+        query.end++;
+    }
+
+    //only the result comes back
+    Frame frame;
+    Aggregate_Reply result;
+    uint32_t requestId = sendRequest(8, &query, sizeof(Aggregate_Request));
+    if (requestId == 0 || !awaitFrame(requestId, frame) || frame.length != sizeof(Aggregate_Reply)){
+        printf("Server error aggregating records.\n");
+        return;
+    }
+    memcpy(&result, frame.payload, sizeof(Aggregate_Reply));
+    if (result.count == -1){
+        printf("Server error aggregating records.\n");
+        return;
+    }
+    writeLog(9, result.count);
+
+    char buf[128];
+    sprintf(buf, "%7s | %8s | %8s | %8s | %10s", "Records", "Avg%", "Min%", "Max%", "Sum");
+    prompt(buf);
+    printf("%7d | %7.2f%% | %7.2f%% | %7.2f%% | %10.2f\n", result.count, result.avg, result.min, result.max, result.sum);
+    prompt("");
+}
+
+
+
 /*!
 *	\brief Requests the log file entries from the server
 */
@@ -504,8 +961,9 @@ bool Client::requestLog(){
     Record_Message msg = {0};
     msg.action = 5;
 
-    if (serverSocket.writeMessage(msg) > 0){
-        receiveLog();
+    uint32_t requestId = sendRequest(msg);
+    if (requestId != 0){
+        receiveLog(requestId);
         return true;
     }
 
@@ -517,18 +975,23 @@ bool Client::requestLog(){
 /*!
 *	\brief Receives all log entries from server.
 */
-void Client::receiveLog(){
-    Log_Message logmsg;
+void Client::receiveLog(uint32_t requestId){
+    Frame frame;
     std::vector<Server_Log_Entry> logs;
 
-    while (serverSocket.readMessage(&logmsg, sizeof(Log_Message)) && (logmsg.arg > 0) ){
-        logs.push_back(logmsg.log);
-        memset(&logmsg, 0x0, sizeof(Log_Message));
-    }
+    //frames of entries, ended by an empty one
+    while (true){
+        if (!awaitFrame(requestId, frame)){
+            printf("Server error retrieving logs.\n");
+            return;
+        }
+        if (frame.length == 0){
+            break;
+        }
 
-    if (logmsg.arg == -1){
-        printf("Server error retrieving logs.\n");
-        return;
+        size_t count = frame.length / sizeof(Server_Log_Entry);
+        logs.resize(logs.size() + count);
+        memcpy(&logs[logs.size() - count], frame.payload, count * sizeof(Server_Log_Entry));
     }
 
     printLogs(logs);
@@ -632,6 +1095,26 @@ float Client::getFloat(){
 
 
 
+/*!
+*	\brief Gets a record key from the user
+*/
+int64_t Client::getKey(){
+    long long value;
+    while (true){
+        printf(" >>>");
+        fflush(stdout);
+        if (scanf("%lld", &value) == 0){
+            printf("Invalid.\n");
+            while( (getchar()) != '\n'); //Clean garbage
+        }
+        else{
+            return value;
+        }
+    }
+}
+
+
+
 /*!
 *	\brief Logs an operation.
 */
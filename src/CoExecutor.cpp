@@ -0,0 +1,134 @@
+/*!	\file CoExecutor.cpp
+*	\brief  CoExecutor class implementation file.
+*/
+
+#include "CoExecutor.h"
+
+#define MAX_EVENTS 64
+
+
+
+/*!
+*	\brief Constructs a CoExecutor.
+*/
+CoExecutor::CoExecutor(){
+    if ( (epollfd = epoll_create1(0)) == -1){
+        perror("epoll_create1");
+        exit(5);
+    }
+}
+
+
+
+/*!
+*	\brief Destructor. Closes the epoll instance.
+*/
+CoExecutor::~CoExecutor(){
+    close(epollfd);
+}
+
+
+
+/*!
+*	\brief Registers a descriptor so coroutines can wait on it.
+*/
+bool CoExecutor::watch(int fd, bool exclusive){
+    epoll_event ev;
+    ev.events = exclusive ? (EPOLLIN | EPOLLET | EPOLLEXCLUSIVE) : (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+    ev.data.fd = fd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) == -1){
+        perror("epoll_ctl add");
+        return false;
+    }
+
+    waiters[fd] = Co_Waiters();
+    return true;
+}
+
+
+
+/*!
+*	\brief Deregisters a descriptor before it is closed.
+*/
+void CoExecutor::unwatch(int fd){
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+    waiters.erase(fd);
+}
+
+
+
+/*!
+*	\brief Suspends a coroutine on a descriptor.
+*/
+void CoExecutor::park(int fd, bool write, std::coroutine_handle<> h){
+    Co_Waiters &w = waiters[fd];
+    if (write){
+        w.writer = h;
+    }
+    else{
+        w.reader = h;
+    }
+}
+
+
+
+/*!
+*	\brief Executor lifetime.
+*/
+void CoExecutor::run(){
+    epoll_event events[MAX_EVENTS];
+    int n;
+
+    //block all signals
+    sigset_t sigset, oldset;
+    sigfillset(&sigset);
+    sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+    while (1)
+    {
+        //only coroutines that were ready before this pass run in it, so yielding coroutines cannot starve epoll
+        size_t count = ready.size();
+        for (size_t i = 0; i < count; i++){
+            std::coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+
+        //unblock signals while waiting
+        sigemptyset(&sigset);
+        sigaddset(&sigset, SIGINT);
+        sigaddset(&sigset, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &sigset, &oldset);
+
+        n = epoll_wait(epollfd, events, MAX_EVENTS, ready.empty() ? -1 : 0);
+
+        sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+        if (n == -1){
+            if (errno == EINTR){
+                continue;
+            }
+            perror("epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < n; i++){
+            auto it = waiters.find(events[i].data.fd);
+            if (it == waiters.end()){
+                continue;
+            }
+
+            //errors and hangups wake both sides so the failing call reports them
+            Co_Waiters &w = it->second;
+            bool failed = events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP);
+            if (w.reader && (failed || (events[i].events & EPOLLIN))){
+                ready.push_back(w.reader);
+                w.reader = nullptr;
+            }
+            if (w.writer && (failed || (events[i].events & EPOLLOUT))){
+                ready.push_back(w.writer);
+                w.writer = nullptr;
+            }
+        }
+    }
+}
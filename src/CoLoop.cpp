@@ -0,0 +1,95 @@
+/*!	\file CoLoop.cpp
+*	\brief  CoLoop class implementation file.
+*/
+
+#include "CoLoop.h"
+
+
+
+/*!
+*	\brief Constructs a CoLoop.
+*/
+CoLoop::CoLoop(const int listenfd, const int bfd, const int lfd, const int semid, int *connectionCount) :
+    listenfd(listenfd), binfd(bfd), logfd(lfd), semid(semid), connectionCount(connectionCount)
+{}
+
+
+
+/*!
+*	\brief Event loop lifetime.
+*/
+void CoLoop::run(){
+    printf("%d: Coroutine loop servicing connections.\n", getpid());
+
+    //only one waiting worker is woken per incoming connection
+    if (!executor.watch(listenfd, true)){
+        return;
+    }
+
+    executor.spawn(acceptConnections());
+    executor.run();
+}
+
+
+
+/*!
+*	\brief Accepts connections for the loop's lifetime.
+*/
+CoTask<> CoLoop::acceptConnections(){
+    sockaddr_in clientAddress;
+    socklen_t sockAddrLength;
+    int clientfd;
+
+    while (1){
+        memset(&clientAddress, 0x0, sizeof(sockaddr_in));
+        sockAddrLength = sizeof(sockaddr_in);
+
+        if ( (clientfd = accept(listenfd, (sockaddr *)&clientAddress, &sockAddrLength)) < 0){
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                co_await executor.readable(listenfd);
+            }
+            else if (errno != EINTR){
+                //the listener stays readable, so retry after the other coroutines have run
+                perror("Accept:");
+                co_await executor.yield();
+            }
+            continue;
+        }
+
+        //each Server closes its own descriptors on destruction
+        int bfd = dup(binfd);
+        int lfd = dup(logfd);
+        if (bfd == -1 || lfd == -1){
+            perror("dup");
+            if (bfd != -1) close(bfd);
+            if (lfd != -1) close(lfd);
+            close(clientfd);
+            continue;
+        }
+
+        if (connectionCount != NULL){
+            (*connectionCount)++;
+        }
+        printf("Client connected: %s : %d\n", inet_ntoa(clientAddress.sin_addr), (int)ntohs(clientAddress.sin_port));
+
+        Server *server = new Server(bfd, clientfd, lfd, clientAddress, semid);
+        if (!server->setNonBlocking() || !executor.watch(clientfd)){
+            delete server;
+            continue;
+        }
+
+        executor.spawn(serviceConnection(server));
+    }
+}
+
+
+
+/*!
+*	\brief Connection lifetime.
+*/
+CoTask<> CoLoop::serviceConnection(Server *server){
+    co_await server->serve(executor);
+
+    executor.unwatch(server->getSocketfd());
+    delete server;
+}
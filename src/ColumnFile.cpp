@@ -0,0 +1,621 @@
+/*!	\file ColumnFile.cpp
+*	\brief  ColumnFile class implementation file.
+*/
+
+#include "ColumnFile.h"
+#include <algorithm>
+#include <cstddef>
+#include <climits>
+
+#define COLUMN_SIZE 4
+
+//a column per member, at the member's offset / COLUMN_SIZE
+static_assert(sizeof(Record) == NUM_COLUMNS * COLUMN_SIZE, "Record must be NUM_COLUMNS 4 byte members");
+
+/*!
+*	\brief Constructs a ColumnFile.
+*/
+ColumnFile::ColumnFile(const int filedesc, SemaphoreSet ss) : DataFile<Record>(ss), fd(filedesc){}
+
+
+
+/*!
+*	\brief Destructor. Closes the file.
+*/
+ColumnFile::~ColumnFile(){
+    close(this->fd);
+}
+
+
+
+/*!
+*	\brief Checks a columnar file, writing the header of an empty one.
+*/
+bool ColumnFile::initialize(int fd){
+    Column_Header header;
+    ssize_t r = pread(fd, &header, sizeof(header), 0);
+    if (r == 0){
+        char page[COLUMN_HEADER];
+        memset(page, 0x0, sizeof(page));
+        header.magic = COLUMN_MAGIC;
+        header.records = 0;
+        header.segment = COLUMN_SEGMENT;
+        memcpy(page, &header, sizeof(header));
+        if (pwrite(fd, page, sizeof(page), 0) != sizeof(page)){
+            perror("Column header write");
+            return false;
+        }
+        return true;
+    }
+    if (r != sizeof(header)){
+        perror("Column header read");
+        return false;
+    }
+    if (header.magic != COLUMN_MAGIC || header.segment != COLUMN_SEGMENT || header.records < 0){
+        printf("Not a columnar file with %d record segments.\n", COLUMN_SEGMENT);
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Maps a field to its column.
+*/
+int ColumnFile::column(float Record::* member){
+    if (member == &Record::android) return 1;
+    if (member == &Record::ios) return 2;
+    if (member == &Record::kaios) return 3;
+    if (member == &Record::other) return 4;
+    return -1;
+}
+
+
+
+/*!
+*	\brief File offset of a record's value in a column.
+*/
+off_t ColumnFile::offset(int column, long recordNumber){
+    long segment = recordNumber / COLUMN_SEGMENT;
+    return COLUMN_HEADER + (off_t) segment * COLUMN_SEGMENT * NUM_COLUMNS * COLUMN_SIZE +
+        (off_t) column * COLUMN_SEGMENT * COLUMN_SIZE + (recordNumber % COLUMN_SEGMENT) * COLUMN_SIZE;
+}
+
+
+
+/*!
+*	\brief Reads the record count from the header.
+*/
+long ColumnFile::numRecords(){
+    Column_Header header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)){
+        perror("Column count read");
+        return -1;
+    }
+    return header.records;
+}
+
+
+
+/*!
+*	\brief Writes the record count to the header.
+*/
+bool ColumnFile::setNumRecords(long records){
+    int32_t count = (int32_t) records;
+    if (pwrite(fd, &count, sizeof(count), offsetof(Column_Header, records)) != sizeof(count)){
+        perror("Column count write");
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Cuts a range short at the end of the file.
+*/
+long ColumnFile::clamp(const int first, const int count){
+    long records = numRecords();
+    if (records < 0){
+        return -1;
+    }
+    long available = records - first;
+    return (available <= 0) ? 0 : std::min((long) count, available);
+}
+
+
+
+/*!
+*	\brief Reads consecutive values of a column.
+*/
+bool ColumnFile::readColumn(int column, long first, int count, void *buf){
+    char *out = (char *) buf;
+    while (count > 0){
+        //to the end of the segment at most
+        int n = std::min(count, (int) (COLUMN_SEGMENT - first % COLUMN_SEGMENT));
+        size_t size = n * COLUMN_SIZE;
+        size_t done = 0;
+        off_t at = offset(column, first);
+        while (done < size){
+            ssize_t r = pread(fd, out + done, size - done, at + done);
+            if (r < 0 && errno == EINTR){
+                continue;
+            }
+            if (r <= 0){
+                perror("Column read");
+                return false;
+            }
+            done += r;
+        }
+        out += size;
+        first += n;
+        count -= n;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes consecutive values of a column.
+*/
+bool ColumnFile::writeColumn(int column, long first, int count, const void *buf){
+    const char *in = (const char *) buf;
+    while (count > 0){
+        int n = std::min(count, (int) (COLUMN_SEGMENT - first % COLUMN_SEGMENT));
+        size_t size = n * COLUMN_SIZE;
+        size_t done = 0;
+        off_t at = offset(column, first);
+        while (done < size){
+            ssize_t w = pwrite(fd, in + done, size - done, at + done);
+            if (w < 0 && errno == EINTR){
+                continue;
+            }
+            if (w <= 0){
+                perror("Column write");
+                return false;
+            }
+            done += w;
+        }
+        in += size;
+        first += n;
+        count -= n;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Gathers consecutive records from their columns.
+*/
+bool ColumnFile::readRows(long first, int count, Record *buf){
+    columns.resize(count);
+    for (int c = 0; c < NUM_COLUMNS; c++){
+        if (!readColumn(c, first, count, columns.data())){
+            return false;
+        }
+        for (int i = 0; i < count; i++){
+            memcpy((char *) &buf[i] + c * COLUMN_SIZE, &columns[i], COLUMN_SIZE);
+        }
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Scatters consecutive records into their columns.
+*/
+bool ColumnFile::writeRows(long first, int count, const Record *records){
+    columns.resize(count);
+    for (int c = 0; c < NUM_COLUMNS; c++){
+        for (int i = 0; i < count; i++){
+            memcpy(&columns[i], (const char *) &records[i] + c * COLUMN_SIZE, COLUMN_SIZE);
+        }
+        if (!writeColumn(c, first, count, columns.data())){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Counts records in file.
+*/
+int ColumnFile::checkNumRecords(){
+    lockRange(0, INT_MAX, false);
+    long records = numRecords();
+    if (records >= 0){
+        printf("Counted %ld\n", records);
+    }
+    unlockRange(0, INT_MAX, false);
+    return (int) records;
+}
+
+
+
+/*!
+*	\brief Reads a record into the buffer.
+*/
+bool ColumnFile::readRecord(const int recordNumber, Record &buf){
+    if (recordNumber < 0){
+        return false;
+    }
+
+    if (versions != NULL){
+        int res = snapshotRead(recordNumber, buf, [&](Record &record){
+            return recordNumber < numRecords() && readRows(recordNumber, 1, &record);
+        });
+        if (res != VERSION_LOCKED){
+            return res == VERSION_READ;
+        }
+    }
+
+    lockRange(recordNumber, 1, false);
+    bool ok = recordNumber < numRecords() && readRows(recordNumber, 1, &buf);
+    unlockRange(recordNumber, 1, false);
+    return ok;
+}
+
+
+
+/*!
+*	\brief Reads a contiguous range of records.
+*/
+int ColumnFile::readRecords(const int first, const int count, std::vector<Record> &buf){
+    buf.clear();
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    lockRange(first, count, false);
+    long n = clamp(first, count);
+    if (n > 0){
+        buf.resize(n);
+        if (!readRows(first, (int) n, buf.data())){
+            buf.clear();
+            n = -1;
+        }
+    }
+    unlockRange(first, count, false);
+    return (int) n;
+}
+
+
+
+/*!
+*	\brief Scans a contiguous range of records in chunks.
+*/
+int ColumnFile::scanRecords(const int first, const int count, std::function<bool(const Record*, int)> visit){
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    lockRange(first, count, false);
+    long total = clamp(first, count);
+    if (total < 0){
+        unlockRange(first, count, false);
+        return -1;
+    }
+
+    //chunks end on segment boundaries, so each column of a chunk is one pread
+    std::vector<Record> chunk(std::min(total, (long) COLUMN_SEGMENT));
+    long scanned = 0;
+    while (scanned < total){
+        long at = first + scanned;
+        int n = (int) std::min(total - scanned, COLUMN_SEGMENT - at % COLUMN_SEGMENT);
+        if (!readRows(at, n, chunk.data())){
+            unlockRange(first, count, false);
+            return -1;
+        }
+        scanned += n;
+        if (!visit(chunk.data(), n)){
+            break;
+        }
+    }
+
+    unlockRange(first, count, false);
+    return (int) scanned;
+}
+
+
+
+/*!
+*	\brief Scans one field of a contiguous range of records in chunks.
+*/
+int ColumnFile::scanField(float Record::* member, const int first, const int count, std::function<bool(const float*, int)> visit){
+    int c = column(member);
+    if (c == -1){
+        return -1;
+    }
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    lockRange(first, count, false);
+    long total = clamp(first, count);
+    if (total < 0){
+        unlockRange(first, count, false);
+        return -1;
+    }
+
+    std::vector<float> values(std::min(total, (long) COLUMN_SEGMENT));
+    long scanned = 0;
+    while (scanned < total){
+        long at = first + scanned;
+        int n = (int) std::min(total - scanned, COLUMN_SEGMENT - at % COLUMN_SEGMENT);
+        if (!readColumn(c, at, n, values.data())){
+            unlockRange(first, count, false);
+            return -1;
+        }
+        scanned += n;
+        if (!visit(values.data(), n)){
+            break;
+        }
+    }
+
+    unlockRange(first, count, false);
+    return (int) scanned;
+}
+
+
+
+/*!
+*	\brief Selects the records of a contiguous range by one field.
+*/
+int ColumnFile::selectRecords(float Record::* member, const int first, const int count,
+    std::function<long(const float*, int, uint64_t*)> test, std::vector<Record> &matches){
+    int c = column(member);
+    if (c == -1){
+        return -1;
+    }
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    lockRange(first, count, false);
+    long total = clamp(first, count);
+    if (total < 0){
+        unlockRange(first, count, false);
+        return -1;
+    }
+
+    int size = (int) std::min(total, (long) COLUMN_SEGMENT);
+    std::vector<float> values(size);
+    std::vector<uint64_t> selected((size + 63) / 64);
+    std::vector<Record> rows;
+    long scanned = 0;
+    while (scanned < total){
+        long at = first + scanned;
+        int n = (int) std::min(total - scanned, COLUMN_SEGMENT - at % COLUMN_SEGMENT);
+        if (!readColumn(c, at, n, values.data())){
+            unlockRange(first, count, false);
+            return -1;
+        }
+        //the rest of the columns are only read for a chunk with something to return
+        if (test(values.data(), n, selected.data()) > 0){
+            rows.resize(n);
+            if (!readRows(at, n, rows.data())){
+                unlockRange(first, count, false);
+                return -1;
+            }
+            for (int w = 0; w < (n + 63) / 64; w++){
+                for (uint64_t bits = selected[w]; bits; bits &= bits - 1){
+                    matches.push_back(rows[w * 64 + __builtin_ctzll(bits)]);
+                }
+            }
+        }
+        scanned += n;
+    }
+
+    unlockRange(first, count, false);
+    return (int) scanned;
+}
+
+
+
+/*!
+*	\brief Appends a record
+*/
+bool ColumnFile::writeRecord(Record &record){
+    return writeRecords(&record, 1);
+}
+
+
+
+/*!
+*	\brief Appends several records
+*/
+bool ColumnFile::writeRecords(const Record *records, const int count){
+    if (count <= 0){
+        return true;
+    }
+
+    lockTail();
+
+    //the records only exist once the count says so
+    long first = numRecords();
+    if (first < 0){
+        unlockTail();
+        return false;
+    }
+    lockRange(first, count, true);
+    uint64_t commit = beginWrites(NULL, NULL, 0, first, NULL);
+
+    std::vector<int> numbers(count);
+    for (int i = 0; i < count; i++){
+        numbers[i] = first + i;
+    }
+    long lsn = logWrites(fd, numbers.data(), records, count);
+    if (lsn < 0){
+        abortWrites(commit);
+        unlockRange(first, count, true);
+        unlockTail();
+        return false;
+    }
+
+    if (!writeRows(first, count, records) || !setNumRecords(first + count)){
+        perror("Column append");
+        appliedWrites(lsn, false);
+        abortWrites(commit);
+        unlockRange(first, count, true);
+        unlockTail();
+        return false;
+    }
+    appliedWrites(lsn, true);
+    publishWrites(commit, first + count);
+
+    unlockRange(first, count, true);
+    unlockTail();
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes a batch of updates and appends atomically.
+*/
+int ColumnFile::writeBatch(std::vector<int> &positions, std::vector<Record> &records, void (*number)(Record &record, int recordNumber)){
+    //only a batch that appends needs the count to stay put
+    bool appends = std::find(positions.begin(), positions.end(), -1) != positions.end();
+    if (appends){
+        lockTail();
+    }
+
+    long before = numRecords();
+    if (before < 0){
+        if (appends){
+            unlockTail();
+        }
+        return -1;
+    }
+
+    //validate and number everything before writing anything
+    int next = (int) before;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] == -1){
+            positions[i] = next++;
+            if (number != NULL){
+                number(records[i], positions[i]);
+            }
+        }
+        else if (positions[i] < 0 || positions[i] >= before){
+            printf("Invalid record %d in batch.\n", positions[i]);
+            if (appends){
+                unlockTail();
+            }
+            return -1;
+        }
+    }
+    lockRecords(positions.data(), (int) positions.size());
+
+    //save what the updates overwrite
+    std::vector<std::pair<int, Record>> undo;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] < before){
+            Record old;
+            if (!readRows(positions[i], 1, &old)){
+                unlockBatch(positions, appends);
+                return -1;
+            }
+            undo.push_back(std::make_pair(positions[i], old));
+        }
+    }
+
+    //only the updates need versions; appended records are not visible until published
+    std::vector<int> updated;
+    std::vector<Record> contents;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] < before){
+            updated.push_back(positions[i]);
+            contents.push_back(records[i]);
+        }
+    }
+    uint64_t commit = beginWrites(updated.data(), contents.data(), (int) updated.size(), before,
+        [&](int recordNumber, Record &old){
+        return readRows(recordNumber, 1, &old);
+    });
+
+    //the whole batch is durable in the log before any of it is written, so a crash midway replays the rest
+    long lsn = logWrites(fd, positions.data(), records.data(), (int) records.size());
+    if (lsn < 0){
+        abortWrites(commit);
+        unlockBatch(positions, appends);
+        return -1;
+    }
+
+    //in batch order, so the last write to a record wins
+    bool ok = true;
+    for (size_t i = 0; ok && i < positions.size(); i++){
+        ok = writeRows(positions[i], 1, &records[i]);
+    }
+    if (ok && next > before){
+        ok = setNumRecords(next);
+    }
+
+    //all or nothing; appended records past the count do not exist
+    if (!ok){
+        for (size_t u = undo.size(); u-- > 0;){
+            if (!writeRows(undo[u].first, 1, &undo[u].second)){
+                perror("Batch rollback");
+            }
+        }
+        appliedWrites(lsn, false);
+        abortWrites(commit);
+        unlockBatch(positions, appends);
+        return -1;
+    }
+    appliedWrites(lsn, true);
+    //an update-only batch read the count without the tail lock, so it leaves the published count to the appends
+    publishWrites(commit, appends ? next : -1);
+
+    unlockBatch(positions, appends);
+    return (int) before;
+}
+
+
+
+/*!
+*	\brief Updates a record.
+*/
+bool ColumnFile::updateRecord(const int recordNumber, Record &record){
+    if (recordNumber < 0){
+        return false;
+    }
+
+    lockRange(recordNumber, 1, true);
+
+    long records = numRecords();
+    if (records <= recordNumber){
+        if (records >= 0){
+            printf("Invalid record %d.\n", recordNumber);
+        }
+        unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    uint64_t commit = beginWrites(&recordNumber, &record, 1, records, [&](int number, Record &old){
+        return readRows(number, 1, &old);
+    });
+    long lsn = logWrites(fd, &recordNumber, &record, 1);
+    if (lsn < 0){
+        abortWrites(commit);
+        unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    if (!writeRows(recordNumber, 1, &record)){
+        perror("Failed to write to file");
+        appliedWrites(lsn, false);
+        abortWrites(commit);
+        unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    appliedWrites(lsn, true);
+    publishWrites(commit, -1);
+
+    unlockRange(recordNumber, 1, true);
+    return true;
+}
@@ -0,0 +1,496 @@
+/*!	\file CoreScheduler.cpp
+*	\brief  CoreScheduler class implementation file.
+*/
+
+#include "CoreScheduler.h"
+#include <sys/eventfd.h>
+#include <pthread.h>
+
+#define MAX_EVENTS 64
+#define BUSY_POLL_MS 1
+
+
+
+/*!
+*	\brief Constructs a CoreScheduler.
+*/
+CoreScheduler::CoreScheduler(const int listenfd, const char *binPath, const char *logPath, const int semid, const int numCores) :
+    listenfd(listenfd), binPath(binPath), logPath(logPath), semid(semid), numCores(numCores), stopping(false)
+{
+    cores = new Core[numCores];
+
+    for (int i = 0; i < numCores; i++){
+        Core &core = cores[i];
+        core.index = i;
+        core.idle = false;
+        core.busy = false;
+        core.depth = 0;
+        core.executed = 0;
+        core.steals = 0;
+        core.stolen = 0;
+        core.accepted = 0;
+
+        if ( (core.epollfd = epoll_create1(0)) == -1){
+            perror("epoll_create1");
+            exit(5);
+        }
+        if ( (core.wakefd = eventfd(0, EFD_NONBLOCK)) == -1){
+            perror("eventfd");
+            exit(5);
+        }
+
+        //every core accepts, but only one is woken per incoming connection
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = listenfd;
+        if (epoll_ctl(core.epollfd, EPOLL_CTL_ADD, listenfd, &ev) == -1){
+            perror("epoll_ctl listen");
+            exit(5);
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.fd = core.wakefd;
+        if (epoll_ctl(core.epollfd, EPOLL_CTL_ADD, core.wakefd, &ev) == -1){
+            perror("epoll_ctl wake");
+            exit(5);
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Destructor.
+*/
+CoreScheduler::~CoreScheduler(){
+    for (int i = 0; i < numCores; i++){
+        if (cores[i].thread.joinable()){
+            cores[i].thread.detach();
+        }
+    }
+    delete[] cores;
+}
+
+
+
+/*!
+*	\brief Starts the core threads.
+*/
+void CoreScheduler::start(){
+    for (int i = 0; i < numCores; i++){
+        cores[i].thread = std::thread(&CoreScheduler::coreLoop, this, std::ref(cores[i]));
+    }
+    printf("Started %d core thread(s).\n", numCores);
+}
+
+
+
+/*!
+*	\brief Stops the core threads.
+*/
+void CoreScheduler::stop(){
+    stopping = true;
+
+    for (int i = 0; i < numCores; i++){
+        uint64_t one = 1;
+        if (write(cores[i].wakefd, &one, sizeof(one)) == -1){
+            perror("eventfd write");
+        }
+    }
+    for (int i = 0; i < numCores; i++){
+        if (cores[i].thread.joinable()){
+            cores[i].thread.join();
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Core thread lifetime.
+*/
+void CoreScheduler::coreLoop(Core &core){
+    //pin the thread so its connections' state stays in one core's cache
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core.index % cpus, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+    }
+
+    Core_Task task;
+    bool othersBusy;
+
+    while (!stopping)
+    {
+        //own tasks first, newest first while their connections are still warm
+        if (popTask(core, task)){
+            runTask(core, task);
+            continue;
+        }
+
+        if (pollEvents(core, core, 0) > 0){
+            continue;
+        }
+
+        if (stealTask(core, task)){
+            runTask(core, task);
+            continue;
+        }
+
+        //publish idleness before the last check so a pushing core either sees it or its task is seen here
+        core.idle = true;
+        if (othersPending(core, othersBusy)){
+            core.idle = false;
+            continue;
+        }
+
+        //a busy core cannot queue requests arriving behind its task, so keep checking its epoll instance
+        int n = pollEvents(core, core, othersBusy ? BUSY_POLL_MS : -1);
+        core.idle = false;
+        if (n == -1){
+            return;
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Turns ready connections into tasks.
+*/
+int CoreScheduler::pollEvents(Core &core, Core &owner, int timeout){
+    epoll_event events[MAX_EVENTS];
+    int n;
+
+    if ( (n = epoll_wait(owner.epollfd, events, MAX_EVENTS, timeout)) == -1){
+        if (errno == EINTR){
+            return 0;
+        }
+        perror("epoll_wait");
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++){
+        int fd = events[i].data.fd;
+
+        if (fd == listenfd){
+            acceptConnections(core);
+        }
+        else if (fd == owner.wakefd){
+            uint64_t count;
+            if (read(owner.wakefd, &count, sizeof(count)) == -1 && errno != EAGAIN){
+                perror("eventfd read");
+            }
+        }
+        else{
+            Core_Connection *conn = NULL;
+            {
+                std::lock_guard<std::mutex> guard(owner.connectionLock);
+                auto it = owner.connections.find(fd);
+                if (it != owner.connections.end()){
+                    conn = it->second;
+                }
+            }
+            if (conn != NULL && (events[i].events & EPOLLOUT)){
+                drainConnection(owner, conn);
+            }
+            else if (conn != NULL){
+                readRequest(owner, conn);
+            }
+        }
+    }
+
+    return n;
+}
+
+
+
+/*!
+*	\brief Accepts pending connections.
+*/
+void CoreScheduler::acceptConnections(Core &core){
+    sockaddr_in clientAddress;
+    socklen_t sockAddrLength;
+    int clientfd;
+
+    while (1){
+        memset(&clientAddress, 0x0, sizeof(sockaddr_in));
+        sockAddrLength = sizeof(sockaddr_in);
+
+        if ( (clientfd = accept(listenfd, (sockaddr *)&clientAddress, &sockAddrLength)) < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                perror("Accept:");
+            }
+            return;
+        }
+
+        //threads share descriptors, so each connection opens its own files to get its own offsets
+        int bfd = open(binPath, O_RDWR);
+        int lfd = open(logPath, O_RDWR);
+        if (bfd == -1 || lfd == -1){
+            perror("open");
+            if (bfd != -1) close(bfd);
+            if (lfd != -1) close(lfd);
+            close(clientfd);
+            continue;
+        }
+
+        core.accepted++;
+        printf("Client connected: %s : %d\n", inet_ntoa(clientAddress.sin_addr), (int)ntohs(clientAddress.sin_port));
+
+        Core_Connection *conn = new Core_Connection;
+        conn->server = new Server(bfd, clientfd, lfd, clientAddress, semid);
+        conn->fd = clientfd;
+        conn->owner = core.index;
+        conn->server->setNonBlocking();
+        conn->server->logConnection();
+
+        {
+            std::lock_guard<std::mutex> guard(core.connectionLock);
+            core.connections[clientfd] = conn;
+        }
+
+        //one-shot, so a connection has at most one request queued or running at a time
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.fd = clientfd;
+        if (epoll_ctl(core.epollfd, EPOLL_CTL_ADD, clientfd, &ev) == -1){
+            perror("epoll_ctl add");
+            closeConnection(core, conn);
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Queues a task for a connection's received requests.
+*/
+void CoreScheduler::readRequest(Core &core, Core_Connection *conn){
+    Core_Task task;
+    task.conn = conn;
+
+    int r = conn->server->receive();
+    if (r > 0 && conn->server->hasMessage()){
+        pushTask(core, task);
+        return;
+    }
+
+    if (r == 0){
+        conn->server->logDisconnection();
+        closeConnection(core, conn);
+        return;
+    }
+
+    //spurious wakeup or partial request, wait for the rest
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = conn->fd;
+    epoll_ctl(core.epollfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+
+
+/*!
+*	\brief Queues a task and wakes an idle core if the owner has a backlog.
+*/
+void CoreScheduler::pushTask(Core &core, Core_Task &task){
+    long depth;
+    {
+        std::lock_guard<std::mutex> guard(core.queueLock);
+        core.queue.push_back(task);
+        depth = ++core.depth;
+    }
+
+    //the owner will run one task itself; anything more is worth handing to a sleeping core
+    if (depth < 2){
+        return;
+    }
+
+    for (int i = 0; i < numCores; i++){
+        Core &other = cores[i];
+        bool expected = true;
+        if (&other != &core && other.idle.compare_exchange_strong(expected, false)){
+            uint64_t one = 1;
+            if (write(other.wakefd, &one, sizeof(one)) == -1){
+                perror("eventfd write");
+            }
+            return;
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Takes the newest task from the core's own deque.
+*/
+bool CoreScheduler::popTask(Core &core, Core_Task &task){
+    std::lock_guard<std::mutex> guard(core.queueLock);
+    if (core.queue.empty()){
+        return false;
+    }
+
+    task = core.queue.back();
+    core.queue.pop_back();
+    core.depth--;
+    return true;
+}
+
+
+
+/*!
+*	\brief Takes the oldest task from the most loaded other core.
+*/
+bool CoreScheduler::stealTask(Core &thief, Core_Task &task){
+    for (int attempt = 0; attempt < 2; attempt++){
+        //pick the deepest queue without locking; the lock below rechecks it
+        Core *victim = NULL;
+        long deepest = 0;
+        for (int i = 0; i < numCores; i++){
+            long depth = cores[i].depth;
+            if (&cores[i] != &thief && depth > deepest){
+                victim = &cores[i];
+                deepest = depth;
+            }
+        }
+
+        if (victim != NULL){
+            std::lock_guard<std::mutex> guard(victim->queueLock);
+            if (!victim->queue.empty()){
+                task = victim->queue.front();
+                victim->queue.pop_front();
+                victim->depth--;
+                thief.steals++;
+                victim->stolen++;
+                return true;
+            }
+            continue;
+        }
+
+        //nothing queued anywhere; queue whatever is waiting behind a running task, then try once more
+        bool polled = false;
+        for (int i = 0; i < numCores; i++){
+            if (&cores[i] != &thief && cores[i].busy && pollEvents(thief, cores[i], 0) > 0){
+                polled = true;
+            }
+        }
+        if (!polled){
+            return false;
+        }
+    }
+
+    return false;
+}
+
+
+
+/*!
+*	\brief Checks the other cores for queued tasks.
+*/
+bool CoreScheduler::othersPending(Core &core, bool &busy){
+    busy = false;
+    for (int i = 0; i < numCores; i++){
+        if (&cores[i] == &core){
+            continue;
+        }
+        if (cores[i].depth > 0){
+            return true;
+        }
+        if (cores[i].busy){
+            busy = true;
+        }
+    }
+    return false;
+}
+
+
+
+/*!
+*	\brief Handles a connection's requests and re-arms it.
+*/
+void CoreScheduler::runTask(Core &core, Core_Task &task){
+    Core_Connection *conn = task.conn;
+    Core &owner = cores[conn->owner];
+
+    core.busy = true;
+    int handled = conn->server->handleMessages();
+    core.busy = false;
+    core.executed++;
+
+    if (handled == -1){
+        conn->server->logDisconnection();
+        closeConnection(owner, conn);
+        return;
+    }
+
+    //the connection was disarmed when its request was read; replies the client has not taken yet come before its next requests
+    epoll_event ev;
+    ev.events = (conn->server->hasOutput() ? EPOLLOUT : EPOLLIN | EPOLLRDHUP) | EPOLLONESHOT;
+    ev.data.fd = conn->fd;
+    if (epoll_ctl(owner.epollfd, EPOLL_CTL_MOD, conn->fd, &ev) == -1){
+        perror("epoll_ctl mod");
+        closeConnection(owner, conn);
+    }
+}
+
+
+
+/*!
+*	\brief Sends a connection's buffered replies.
+*/
+void CoreScheduler::drainConnection(Core &core, Core_Connection *conn){
+    int left = conn->server->sendOutput();
+    if (left == -1){
+        conn->server->logDisconnection();
+        closeConnection(core, conn);
+        return;
+    }
+
+    epoll_event ev;
+    ev.events = (left > 0 ? EPOLLOUT : EPOLLIN | EPOLLRDHUP) | EPOLLONESHOT;
+    ev.data.fd = conn->fd;
+    if (epoll_ctl(core.epollfd, EPOLL_CTL_MOD, conn->fd, &ev) == -1){
+        perror("epoll_ctl mod");
+        closeConnection(core, conn);
+    }
+}
+
+
+
+/*!
+*	\brief Closes a connection.
+*/
+void CoreScheduler::closeConnection(Core &core, Core_Connection *conn){
+    {
+        std::lock_guard<std::mutex> guard(core.connectionLock);
+        core.connections.erase(conn->fd);
+    }
+
+    epoll_ctl(core.epollfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    delete conn->server;
+    delete conn;
+}
+
+
+
+/*!
+*	\brief Prints per-core counters.
+*/
+void CoreScheduler::printStats(){
+    long executed = 0, steals = 0, accepted = 0;
+
+    printf("Core | Connections | Queued | Executed | Steals | Stolen\n");
+    for (int i = 0; i < numCores; i++){
+        Core &core = cores[i];
+        printf("%4d | %11ld | %6ld | %8ld | %6ld | %6ld\n", i, core.accepted.load(), core.depth.load(),
+            core.executed.load(), core.steals.load(), core.stolen.load());
+        accepted += core.accepted;
+        executed += core.executed;
+        steals += core.steals;
+    }
+    printf("Total| %11ld |        | %8ld | %6ld |\n", accepted, executed, steals);
+    fflush(stdout);
+}
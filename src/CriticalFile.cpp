@@ -3,6 +3,12 @@
 */
 
 #include "CriticalFile.h"
+#include <algorithm>
+#include <sys/uio.h>
+#include <climits>
+#include <sys/stat.h>
+
+#define SCAN_CHUNK 65536
 
 template class CriticalFile<Record>;
 template class CriticalFile<Server_Log_Entry>;
@@ -12,7 +18,7 @@ template class CriticalFile<Client_Log_Entry>;
 *	\brief Constructs a CriticalFile.
 */
 template <typename T>
-CriticalFile<T>::CriticalFile(const int filedesc, SemaphoreSet ss) : fd(filedesc), sems(ss){}
+CriticalFile<T>::CriticalFile(const int filedesc, SemaphoreSet ss) : DataFile<T>(ss), fd(filedesc), pool(NULL){}
 
 
 
@@ -27,24 +33,38 @@ CriticalFile<T>::~CriticalFile(){
 
 
 
+/*!
+*	\brief Size of the file in bytes.
+*/
+template <typename T>
+off_t CriticalFile<T>::fileSize(){
+    struct stat st;
+    if (fstat(fd, &st) == -1){
+        perror("File stat");
+        return -1;
+    }
+    return st.st_size;
+}
+
+
+
 /*!
 *	\brief Counts records in the file.
 */
 template <typename T>
 int CriticalFile<T>::checkNumRecords(){
-    int len;
+    off_t len;
 
-    sems.readerLock();
-    if ( (len = lseek(fd, 0, SEEK_END) ) < 0 ){
-        perror("Count seek: ");
-        sems.readerUnlock();
+    this->lockRange(0, INT_MAX, false);
+    if ( (len = fileSize()) < 0 ){
+        this->unlockRange(0, INT_MAX, false);
         return -1;
     }
     else{
         int count = len / sizeof(T); 
         printf("Counted %d\n", count);
         
-        sems.readerUnlock();
+        this->unlockRange(0, INT_MAX, false);
         return count;
     }
 }
@@ -56,38 +76,189 @@ int CriticalFile<T>::checkNumRecords(){
 */
 template <typename T>
 bool CriticalFile<T>::readRecord(const int recordNumber, T &buf){
-    sems.readerLock();
-
-    if (!seekRecord(recordNumber)){
+    if (recordNumber < 0){
         return false;
     }
+    if (this->versions != NULL){
+        int res = this->snapshotRead(recordNumber, buf, [&](T &record){
+            ssize_t r;
+            while ( (r = pread(fd, &record, sizeof(T), (off_t) recordNumber * sizeof(T))) < 0 && errno == EINTR);
+            return r == sizeof(T);
+        });
+        if (res != VERSION_LOCKED){
+            return res == VERSION_READ;
+        }
+    }
+    if (pool != NULL){
+        if (pool->read(recordNumber, &buf)){
+            return true;
+        }
+        return readPage(recordNumber, buf);
+    }
 
-    int res = read(fd, &buf, sizeof(T));
-    if (res <= 0){
-        perror("Failed to read from file");
-        sems.readerUnlock();
+    this->lockRange(recordNumber, 1, false);
+
+    ssize_t res;
+    while ( (res = pread(fd, &buf, sizeof(T), (off_t) recordNumber * sizeof(T))) < 0 && errno == EINTR);
+    if (res != sizeof(T)){
+        if (res < 0){
+            perror("Failed to read from file");
+        }
+        this->unlockRange(recordNumber, 1, false);
         return false;
     }
 
-    sems.readerUnlock();
+    this->unlockRange(recordNumber, 1, false);
     return true;
 }
 
 
 
 /*!
-*	\brief Seeks to record
+*	\brief Reads a record's page into the pool.
 */
 template <typename T>
-bool CriticalFile<T>::seekRecord(const int recordNumber){
-    // sems.readerLock();
-    if (lseek(fd, recordNumber * sizeof(T), 0) == -1){
-        perror("Seek error: ");
+bool CriticalFile<T>::readPage(const int recordNumber, T &buf){
+    int page = recordNumber / POOL_PAGE_RECORDS;
+    int index = recordNumber % POOL_PAGE_RECORDS;
+    T records[POOL_PAGE_RECORDS];
 
-        // sems.readerUnlock();
+    //cached while still holding the page's reader locks, so no update can land between the read and the insert
+    this->lockRange((long) page * POOL_PAGE_RECORDS, POOL_PAGE_RECORDS, false);
+
+    ssize_t res;
+    while ( (res = pread(fd, records, sizeof(records), (off_t) page * sizeof(records))) < 0 && errno == EINTR);
+    if (res < 0){
+        perror("Failed to read page from file");
+        this->unlockRange((long) page * POOL_PAGE_RECORDS, POOL_PAGE_RECORDS, false);
+        return false;
+    }
+    int count = res / sizeof(T);
+    pool->insert(page, records, count);
+
+    this->unlockRange((long) page * POOL_PAGE_RECORDS, POOL_PAGE_RECORDS, false);
+
+    if (index >= count){
         return false;
     }
-    // sems.readerUnlock();
+    buf = records[index];
+    return true;
+}
+
+
+
+/*!
+*	\brief Reads a contiguous range of records.
+*/
+template <typename T>
+int CriticalFile<T>::readRecords(const int first, const int count, std::vector<T> &buf){
+    buf.clear();
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    this->lockRange(first, count, false);
+
+    //clamp to the records in the file before sizing the buffer
+    off_t len;
+    if ( (len = fileSize()) < 0){
+        this->unlockRange(first, count, false);
+        return -1;
+    }
+    long available = len / sizeof(T) - first;
+    int n = (available <= 0) ? 0 : (int) std::min((long) count, available);
+    buf.resize(n);
+
+    size_t size = n * sizeof(T);
+    size_t done = 0;
+    off_t offset = (off_t) first * sizeof(T);
+    while (done < size){
+        ssize_t r = pread(fd, (char *) buf.data() + done, size - done, offset + done);
+        if (r < 0 && errno == EINTR){
+            continue;
+        }
+        if (r <= 0){
+            perror("Failed to read range from file");
+            this->unlockRange(first, count, false);
+            buf.clear();
+            return -1;
+        }
+        done += r;
+    }
+
+    this->unlockRange(first, count, false);
+    return n;
+}
+
+
+
+/*!
+*	\brief Scans a contiguous range of records in chunks.
+*/
+template <typename T>
+int CriticalFile<T>::scanRecords(const int first, const int count, std::function<bool(const T*, int)> visit){
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    this->lockRange(first, count, false);
+
+    off_t len;
+    if ( (len = fileSize()) < 0){
+        this->unlockRange(first, count, false);
+        return -1;
+    }
+    long available = len / sizeof(T) - first;
+    long total = (available <= 0) ? 0 : std::min((long) count, available);
+
+    std::vector<T> chunk(std::min(total, (long) SCAN_CHUNK));
+    long scanned = 0;
+    while (scanned < total){
+        int n = (int) std::min(total - scanned, (long) SCAN_CHUNK);
+        size_t size = n * sizeof(T);
+        size_t done = 0;
+        off_t offset = (off_t) (first + scanned) * sizeof(T);
+        while (done < size){
+            ssize_t r = pread(fd, (char *) chunk.data() + done, size - done, offset + done);
+            if (r < 0 && errno == EINTR){
+                continue;
+            }
+            if (r <= 0){
+                perror("Failed to scan file");
+                this->unlockRange(first, count, false);
+                return -1;
+            }
+            done += r;
+        }
+
+        scanned += n;
+        if (!visit(chunk.data(), n)){
+            break;
+        }
+    }
+
+    this->unlockRange(first, count, false);
+    return (int) scanned;
+}
+
+
+
+/*!
+*	\brief Writes a buffer at an offset.
+*/
+template <typename T>
+bool CriticalFile<T>::writeAt(const void *buf, size_t size, off_t offset){
+    size_t done = 0;
+    while (done < size){
+        ssize_t w = pwrite(fd, (const char *) buf + done, size - done, offset + done);
+        if (w < 0 && errno == EINTR){
+            continue;
+        }
+        if (w <= 0){
+            return false;
+        }
+        done += w;
+    }
     return true;
 }
 
@@ -98,26 +269,228 @@ bool CriticalFile<T>::seekRecord(const int recordNumber){
 */
 template <typename T>
 bool CriticalFile<T>::writeRecord(T &record){
-    sems.writerLock();
-    if (lseek(fd, 0, SEEK_END) == -1){
-        perror("Create seek:");
+    return writeRecords(&record, 1);
+}
+
+
+
+/*!
+*	\brief Appends several records
+*/
+template <typename T>
+bool CriticalFile<T>::writeRecords(const T *records, const int count){
+    if (count <= 0){
+        return true;
+    }
+
+    //appenders are serialized, so the end of the file cannot move between the stat and the write
+    this->lockTail();
+    off_t len;
+    if ( (len = fileSize()) < 0){
+        this->unlockTail();
+        return false;
+    }
+    long first = len / sizeof(T);
+    this->lockRange(first, count, true);
+
+    uint64_t commit = this->beginWrites(NULL, NULL, 0, len / sizeof(T), NULL);
+
+    std::vector<int> numbers(count);
+    for (int i = 0; i < count; i++){
+        numbers[i] = first + i;
+    }
+    long lsn = this->logWrites(fd, numbers.data(), records, count);
+    if (lsn < 0){
+        this->abortWrites(commit);
+        this->unlockRange(first, count, true);
+        this->unlockTail();
         return false;
     }
-    
-    if (write(fd, &record, sizeof(T)) == -1){
+
+    //a torn append leaves no partial record behind
+    if (!writeAt(records, count * sizeof(T), len)){
         perror("Create Write:");
-        sems.writerUnlock();
+        if (ftruncate(fd, len) == -1){
+            perror("Create rollback truncate");
+        }
+        this->appliedWrites(lsn, false);
+        this->abortWrites(commit);
+        this->unlockRange(first, count, true);
+        this->unlockTail();
         return false;
     }
-    else{
-        // printf("Wrote new record.\n");
-        // msg.arg = checkNumRecords(fd);
-        // memcpy(&msg.record, &rec, sizeof(Record));
-        sems.writerUnlock();
+    this->appliedWrites(lsn, true);
+    this->publishWrites(commit, first + count);
+
+    this->unlockRange(first, count, true);
+    this->unlockTail();
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes a batch of updates and appends atomically.
+*/
+template <typename T>
+int CriticalFile<T>::writeBatch(std::vector<int> &positions, std::vector<T> &records, void (*number)(T &record, int recordNumber)){
+    //only a batch that appends needs the end of the file to stay put; records that exist stay valid without it
+    bool appends = std::find(positions.begin(), positions.end(), -1) != positions.end();
+    if (appends){
+        this->lockTail();
+    }
+
+    off_t len;
+    if ( (len = fileSize()) < 0){
+        if (appends){
+            this->unlockTail();
+        }
+        return -1;
+    }
+    int count = len / sizeof(T);
+
+    //validate and number everything before writing anything
+    std::vector<std::pair<int, int>> writes; //(record number, index in records)
+    int next = count;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] == -1){
+            positions[i] = next++;
+            if (number != NULL){
+                number(records[i], positions[i]);
+            }
+        }
+        else if (positions[i] < 0 || positions[i] >= count){
+            printf("Invalid record %d in batch.\n", positions[i]);
+            if (appends){
+                this->unlockTail();
+            }
+            return -1;
+        }
+        writes.push_back(std::make_pair(positions[i], (int) i));
+    }
+    this->lockRecords(positions.data(), (int) positions.size());
+
+    //without the tail lock, a failed append may have truncated the file since it was measured; as in updateRecord,
+    //the end cannot drop below records once they are locked
+    if (!appends){
+        if ( (len = fileSize()) < 0){
+            this->unlockRecords(positions.data(), (int) positions.size());
+            return -1;
+        }
+        count = next = len / sizeof(T);
+        for (size_t i = 0; i < positions.size(); i++){
+            if (positions[i] >= count){
+                printf("Invalid record %d in batch.\n", positions[i]);
+                this->unlockRecords(positions.data(), (int) positions.size());
+                return -1;
+            }
+        }
+    }
+
+    //in file order, and only the last write to a record
+    std::stable_sort(writes.begin(), writes.end(),
+        [](const std::pair<int, int> &a, const std::pair<int, int> &b){return a.first < b.first;});
+    size_t unique = 0;
+    for (size_t i = 0; i < writes.size(); i++){
+        if (i + 1 < writes.size() && writes[i + 1].first == writes[i].first){
+            continue;
+        }
+        writes[unique++] = writes[i];
+    }
+    writes.resize(unique);
+
+    //save what the updates overwrite
+    std::vector<std::pair<int, T>> undo;
+    for (size_t i = 0; i < writes.size() && writes[i].first < count; i++){
+        T old;
+        if (pread(fd, &old, sizeof(T), (off_t) writes[i].first * sizeof(T)) != sizeof(T)){
+            perror("Batch undo read");
+            this->unlockBatch(positions, appends);
+            return -1;
+        }
+        undo.push_back(std::make_pair(writes[i].first, old));
+    }
+
+    //the overwritten records are versioned as saved, so snapshot readers never read them mid-write
+    std::vector<int> updated(undo.size());
+    std::vector<T> contents(undo.size());
+    for (size_t u = 0; u < undo.size(); u++){
+        updated[u] = undo[u].first;
+        contents[u] = records[writes[u].second];
+    }
+    uint64_t commit = this->beginWrites(updated.data(), contents.data(), (int) undo.size(), count,
+        [&](int recordNumber, T &record){
+        record = undo[std::lower_bound(updated.begin(), updated.end(), recordNumber) - updated.begin()].second;
         return true;
+    });
 
-        //the server should call checknum after to get the new number of records.
+    //the whole batch is durable in the log before any of it is written, so a crash midway replays the rest
+    long lsn = 0;
+    if (this->wal != NULL){
+        std::vector<int> numbers(writes.size());
+        std::vector<T> written(writes.size());
+        for (size_t w = 0; w < writes.size(); w++){
+            numbers[w] = writes[w].first;
+            written[w] = records[writes[w].second];
+        }
+        lsn = this->logWrites(fd, numbers.data(), written.data(), (int) writes.size());
+        if (lsn < 0){
+            this->abortWrites(commit);
+            this->unlockBatch(positions, appends);
+            return -1;
+        }
     }
+
+    //one pwritev per run of consecutive records
+    bool ok = true;
+    std::vector<iovec> iov;
+    size_t i = 0;
+    while (ok && i < writes.size()){
+        int first = writes[i].first;
+        iov.clear();
+        while (i < writes.size() && writes[i].first == first + (int) iov.size() && iov.size() < IOV_MAX){
+            iovec v;
+            v.iov_base = &records[writes[i].second];
+            v.iov_len = sizeof(T);
+            iov.push_back(v);
+            i++;
+        }
+
+        ssize_t w = pwritev(fd, iov.data(), iov.size(), (off_t) first * sizeof(T));
+        if (w != (ssize_t) (iov.size() * sizeof(T))){
+            perror("Batch write");
+            ok = false;
+        }
+    }
+
+    //all or nothing
+    if (!ok){
+        for (size_t u = 0; u < undo.size(); u++){
+            if (pwrite(fd, &undo[u].second, sizeof(T), (off_t) undo[u].first * sizeof(T)) != sizeof(T)){
+                perror("Batch rollback");
+            }
+        }
+        if (next > count && ftruncate(fd, len) == -1){
+            perror("Batch rollback truncate");
+        }
+        this->appliedWrites(lsn, false);
+        this->abortWrites(commit);
+        this->unlockBatch(positions, appends);
+        return -1;
+    }
+    this->appliedWrites(lsn, true);
+    //an update-only batch read the count without the tail lock, so it leaves the published count to the appends
+    this->publishWrites(commit, appends ? next : -1);
+
+    //appended records lie past the records held by any cached page, and are loaded on a miss
+    if (pool != NULL){
+        for (size_t w = 0; w < writes.size() && writes[w].first < count; w++){
+            pool->update(writes[w].first, &records[writes[w].second]);
+        }
+    }
+
+    this->unlockBatch(positions, appends);
+    return count;
 }
 
 
@@ -127,17 +500,42 @@ bool CriticalFile<T>::writeRecord(T &record){
 */
 template <typename T>
 bool CriticalFile<T>::updateRecord(const int recordNumber, T &record){
-    sems.writerLock();
-    if (seekRecord(recordNumber)){
-        if (write(fd, &record, sizeof(T)) > 0){
-            // printf("Updated record %d.\n", recordNumber);
-            sems.writerUnlock();
-            return true;
+    if (recordNumber < 0){
+        return false;
+    }
+
+    //appends may run concurrently, so an update must not write past the end
+    this->lockRange(recordNumber, 1, true);
+    off_t len = fileSize();
+    if (len < 0 || recordNumber >= len / (off_t) sizeof(T)){
+        if (len >= 0){
+            printf("Invalid record %d.\n", recordNumber);
         }
-        else{
-            perror("Failed to write to file");
+        this->unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    uint64_t commit = this->beginWrites(&recordNumber, &record, 1, -1, [&](int number, T &old){
+        return pread(fd, &old, sizeof(T), (off_t) number * sizeof(T)) == sizeof(T);
+    });
+    long lsn = this->logWrites(fd, &recordNumber, &record, 1);
+    if (lsn < 0){
+        this->abortWrites(commit);
+        this->unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    if (writeAt(&record, sizeof(T), (off_t) recordNumber * sizeof(T))){
+        // printf("Updated record %d.\n", recordNumber);
+        this->appliedWrites(lsn, true);
+        this->publishWrites(commit, -1);
+        if (pool != NULL){
+            pool->update(recordNumber, &record);
         }
+        this->unlockRange(recordNumber, 1, true);
+        return true;
     }
-    sems.writerUnlock();
+    perror("Failed to write to file");
+    this->appliedWrites(lsn, false);
+    this->abortWrites(commit);
+    this->unlockRange(recordNumber, 1, true);
     return false;
-}
+}
\ No newline at end of file
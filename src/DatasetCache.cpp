@@ -0,0 +1,228 @@
+/*!	\file DatasetCache.cpp
+*	\brief  DatasetCache class implementation file.
+*/
+
+#include "DatasetCache.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <new>
+
+
+
+/*!
+*	\brief Creates an empty registry.
+*/
+DatasetCache::DatasetCache(int capacity, const std::vector<int> &boundaries) : capacity(capacity), boundaries(boundaries){
+    void *segment = mmap(NULL, sizeof(Dataset_Registry), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED){
+        perror("Dataset registry mmap");
+        exit(3);
+    }
+
+    registry = new (segment) Dataset_Registry();
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&registry->registering, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    registry->count = 0;
+    registry->hits = registry->misses = registry->evictions = 0;
+}
+
+
+
+/*!
+*	\brief Closes the cached files and unmaps the registry.
+*/
+DatasetCache::~DatasetCache(){
+    handles.clear();
+    munmap(registry, sizeof(Dataset_Registry));
+}
+
+
+
+/*!
+*	\brief Checks a dataset name.
+*/
+bool DatasetCache::validName(const char *name){
+    size_t length = strnlen(name, DATASET_NAME_MAX);
+    if (length == 0 || length == DATASET_NAME_MAX){
+        return false;
+    }
+    for (size_t i = 0; i < length; i++){
+        if (!isalnum((unsigned char) name[i]) && name[i] != '_' && name[i] != '-'){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Finds the semaphores of a dataset, creating them the first time.
+*/
+int DatasetCache::semaphores(const char *name, int sets){
+    pthread_mutex_lock(&registry->registering);
+    for (int i = 0; i < registry->count; i++){
+        if (strcmp(registry->entries[i].name, name) == 0){
+            int semid = registry->entries[i].semid;
+            pthread_mutex_unlock(&registry->registering);
+            return semid;
+        }
+    }
+    if (registry->count == DATASET_MAX){
+        printf("Dataset %s not opened: %d datasets are already in use.\n", name, DATASET_MAX);
+        pthread_mutex_unlock(&registry->registering);
+        return -1;
+    }
+
+    //sets like the server's: the reader count mutex, the reader count, and the write mutex
+    int semid = semget(IPC_PRIVATE, 3 * sets, 0600 | IPC_CREAT);
+    if (semid == -1){
+        perror("Dataset semaphore creation failed");
+        pthread_mutex_unlock(&registry->registering);
+        return -1;
+    }
+    std::vector<unsigned short> values(3 * sets);
+    for (int i = 0; i < sets; i++){
+        values[3 * i] = 1;
+        values[3 * i + 1] = 0;
+        values[3 * i + 2] = 1;
+    }
+    union semun {
+        int val;
+        struct semid_ds *buf;
+        unsigned short *array;
+    } arg;
+    arg.array = values.data();
+    if (semctl(semid, 0, SETALL, arg) == -1){
+        perror("Dataset semaphore initialization failed");
+        semctl(semid, 0, IPC_RMID, 0);
+        pthread_mutex_unlock(&registry->registering);
+        return -1;
+    }
+
+    Dataset_Entry &entry = registry->entries[registry->count];
+    strncpy(entry.name, name, DATASET_NAME_MAX);
+    entry.semid = semid;
+    entry.sets = sets;
+    registry->count++;
+    pthread_mutex_unlock(&registry->registering);
+    return semid;
+}
+
+
+
+/*!
+*	\brief Opens a dataset.
+*/
+std::shared_ptr<DataFile<Record>> DatasetCache::open(const char *name, bool create){
+    if (!validName(name)){
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(caching);
+    for (auto it = handles.begin(); it != handles.end(); ++it){
+        if (it->first == name){
+            handles.splice(handles.begin(), handles, it);
+            registry->hits++;
+            return handles.front().second;
+        }
+    }
+
+    //a dataset stays as it was created: a directory of shards, or one file
+    std::string path = std::string(DATASET_DIR) + "/" + name;
+    struct stat st;
+    bool sharded = stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    if (!sharded && create && !boundaries.empty() && access((path + ".bin").c_str(), F_OK) == -1){
+        if (mkdir(path.c_str(), 0700) == -1 && errno != EEXIST){
+            perror("Failed to create dataset");
+            return NULL;
+        }
+        sharded = true;
+    }
+
+    std::shared_ptr<DataFile<Record>> file;
+    if (sharded){
+        int semid = semaphores(name, SHARD_SEMAPHORE_SETS);
+        if (semid == -1){
+            return NULL;
+        }
+        std::shared_ptr<ShardedFile> shards = std::make_shared<ShardedFile>(path.c_str(), semid, boundaries);
+        if (!shards->open(create)){
+            return NULL;
+        }
+        file = shards;
+    }
+    else{
+        int fd = ::open((path + ".bin").c_str(), create ? (O_CREAT | O_RDWR) : O_RDWR, 0600);
+        if (fd == -1){
+            if (errno != ENOENT){
+                perror("Failed to open dataset");
+            }
+            return NULL;
+        }
+        int semid = semaphores(name, 1);
+        if (semid == -1){
+            close(fd);
+            return NULL;
+        }
+        file = std::make_shared<CriticalFile<Record>>(fd, SemaphoreSet(semid, 0));
+    }
+    registry->misses++;
+
+    //dropped from the cache, a handle in use is closed once its last user lets go of it
+    handles.emplace_front(name, file);
+    while (handles.size() > capacity){
+        handles.pop_back();
+        registry->evictions++;
+    }
+    return file;
+}
+
+
+
+/*!
+*	\brief Removes the semaphores of every registered dataset.
+*/
+void DatasetCache::destroy(){
+    pthread_mutex_lock(&registry->registering);
+    for (int i = 0; i < registry->count; i++){
+        if (semctl(registry->entries[i].semid, 0, IPC_RMID, 0) == -1){
+            perror("Failed to remove dataset semaphores");
+        }
+    }
+    pthread_mutex_unlock(&registry->registering);
+}
+
+
+
+/*!
+*	\brief Reads the counters.
+*/
+Dataset_Stats DatasetCache::stats(){
+    Dataset_Stats stats;
+    stats.hits = registry->hits.load();
+    stats.misses = registry->misses.load();
+    stats.evictions = registry->evictions.load();
+    pthread_mutex_lock(&registry->registering);
+    stats.datasets = registry->count;
+    stats.sharded = 0;
+    for (int i = 0; i < registry->count; i++){
+        stats.sharded += registry->entries[i].sets > 1;
+    }
+    pthread_mutex_unlock(&registry->registering);
+    return stats;
+}
+
+
+
+/*!
+*	\brief Prints the counters.
+*/
+void DatasetCache::printStats(){
+    Dataset_Stats s = stats();
+    printf("Datasets: %ld registered (%ld sharded) | %zu handles per process | %ld cache hits | %ld files opened | %ld evicted\n",
+        s.datasets, s.sharded, capacity, s.hits, s.misses, s.evictions);
+}
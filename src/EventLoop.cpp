@@ -0,0 +1,215 @@
+/*!	\file EventLoop.cpp
+*	\brief  EventLoop class implementation file.
+*/
+
+#include "EventLoop.h"
+
+#define MAX_EVENTS 64
+
+
+
+/*!
+*	\brief Constructs an EventLoop.
+*/
+EventLoop::EventLoop(const int listenfd, const int bfd, const int lfd, const int semid, int *connectionCount) :
+    listenfd(listenfd), binfd(bfd), logfd(lfd), semid(semid), connectionCount(connectionCount)
+{
+    if ( (epollfd = epoll_create1(0)) == -1){
+        perror("epoll_create1");
+        exit(5);
+    }
+
+    //only one waiting worker is woken per incoming connection
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.fd = listenfd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &ev) == -1){
+        perror("epoll_ctl listen");
+        exit(5);
+    }
+}
+
+
+
+/*!
+*	\brief Destructor. Closes all connections.
+*/
+EventLoop::~EventLoop(){
+    for (auto &conn : connections){
+        delete conn.second;
+    }
+    connections.clear();
+    close(epollfd);
+}
+
+
+
+/*!
+*	\brief Event loop lifetime.
+*/
+void EventLoop::run(){
+    printf("%d: Event loop servicing connections.\n", getpid());
+
+    epoll_event events[MAX_EVENTS];
+    int n;
+
+    //block all signals
+    sigset_t sigset, oldset;
+    sigfillset(&sigset);
+    sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+    while (1)
+    {
+        //unblock signals while waiting
+        sigemptyset(&sigset);
+        sigaddset(&sigset, SIGINT);
+        sigaddset(&sigset, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &sigset, &oldset);
+
+        if ( (n = epoll_wait(epollfd, events, MAX_EVENTS, -1)) == -1){
+            if (errno == EINTR){
+                continue;
+            }
+            perror("epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < n; i++){
+            if (events[i].data.fd == listenfd){
+                acceptConnections();
+            }
+            else if (events[i].events & EPOLLOUT){
+                drainConnection(events[i].data.fd);
+            }
+            else{
+                serviceConnection(events[i].data.fd);
+            }
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Accepts pending connections.
+*/
+void EventLoop::acceptConnections(){
+    sockaddr_in clientAddress;
+    socklen_t sockAddrLength;
+    int clientfd;
+
+    while (1){
+        memset(&clientAddress, 0x0, sizeof(sockaddr_in));
+        sockAddrLength = sizeof(sockaddr_in);
+
+        if ( (clientfd = accept(listenfd, (sockaddr *)&clientAddress, &sockAddrLength)) < 0){
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                perror("Accept:");
+            }
+            return;
+        }
+
+        //each Server closes its own descriptors on destruction
+        int bfd = dup(binfd);
+        int lfd = dup(logfd);
+        if (bfd == -1 || lfd == -1){
+            perror("dup");
+            if (bfd != -1) close(bfd);
+            if (lfd != -1) close(lfd);
+            close(clientfd);
+            continue;
+        }
+
+        if (connectionCount != NULL){
+            (*connectionCount)++;
+        }
+        printf("Client connected: %s : %d\n", inet_ntoa(clientAddress.sin_addr), (int)ntohs(clientAddress.sin_port));
+
+        Server *server = new Server(bfd, clientfd, lfd, clientAddress, semid);
+        server->setNonBlocking();
+
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = clientfd;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, clientfd, &ev) == -1){
+            perror("epoll_ctl add");
+            delete server;
+            continue;
+        }
+
+        connections[clientfd] = server;
+        server->logConnection();
+    }
+}
+
+
+
+/*!
+*	\brief Services a readable connection.
+*/
+void EventLoop::serviceConnection(const int fd){
+    auto it = connections.find(fd);
+    if (it == connections.end()){
+        return;
+    }
+
+    if (!it->second->serviceMessage()){
+        closeConnection(fd);
+    }
+    else if (it->second->hasOutput() && !watch(fd, EPOLLOUT)){
+        closeConnection(fd);
+    }
+}
+
+
+
+/*!
+*	\brief Sends a connection's buffered replies.
+*/
+void EventLoop::drainConnection(const int fd){
+    auto it = connections.find(fd);
+    if (it == connections.end()){
+        return;
+    }
+
+    int left = it->second->sendOutput();
+    if (left == -1){
+        it->second->logDisconnection();
+        closeConnection(fd);
+    }
+    else if (left == 0 && !watch(fd, EPOLLIN | EPOLLRDHUP)){
+        closeConnection(fd);
+    }
+}
+
+
+
+/*!
+*	\brief Changes the events a connection is watched for.
+*/
+bool EventLoop::watch(const int fd, uint32_t events){
+    epoll_event ev;
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev) == -1){
+        perror("epoll_ctl mod");
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Closes a connection.
+*/
+void EventLoop::closeConnection(const int fd){
+    auto it = connections.find(fd);
+    if (it == connections.end()){
+        return;
+    }
+
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+    delete it->second;
+    connections.erase(it);
+}
@@ -0,0 +1,538 @@
+/*!	\file FieldIndex.cpp
+*	\brief  FieldIndex class implementation file.
+*/
+
+#include "FieldIndex.h"
+#include "RecordQuery.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <climits>
+
+static_assert(sizeof(Index_Page) == INDEX_PAGE, "Index_Page must be INDEX_PAGE bytes");
+static_assert(sizeof(Index_Header) <= INDEX_PAGE, "Index_Header must fit in a page");
+
+static const char *fieldNames[] = {"android", "ios", "kaios", "other"};
+
+
+
+/*!
+*	\brief Orders keys by value, then by record number.
+*/
+static bool keyLess(const Index_Key &a, const Index_Key &b){
+    return a.value < b.value || (a.value == b.value && a.recordNumber < b.recordNumber);
+}
+
+
+
+/*!
+*	\brief Finds the first branch of an inner page whose key is above a key.
+*/
+static int upperBranch(const Index_Page &page, const Index_Key &key){
+    const Index_Branch *end = page.branches + page.count;
+    return std::upper_bound(page.branches, end, key, [](const Index_Key &k, const Index_Branch &b){
+        return keyLess(k, b.key);
+    }) - page.branches;
+}
+
+
+
+/*!
+*	\brief Constructs a FieldIndex.
+*/
+FieldIndex::FieldIndex(const int filedesc, const int field, SemaphoreSet sems) : fd(filedesc), field(field), sems(sems){}
+
+
+
+/*!
+*	\brief Destructor. Closes the file.
+*/
+FieldIndex::~FieldIndex(){
+    close(this->fd);
+}
+
+
+
+/*!
+*	\brief Names a field.
+*/
+const char *FieldIndex::fieldName(int field){
+    return (field >= 0 && field < NUM_FIELDS) ? fieldNames[field] : NULL;
+}
+
+
+
+/*!
+*	\brief Finds a field by name.
+*/
+int FieldIndex::fieldCode(const char *name){
+    for (int f = 0; f < NUM_FIELDS; f++){
+        if (strcmp(name, fieldNames[f]) == 0){
+            return f;
+        }
+    }
+    return -1;
+}
+
+
+
+/*!
+*	\brief Reads a page of the index file.
+*/
+bool FieldIndex::readPage(int page, void *buf){
+    size_t done = 0;
+    while (done < INDEX_PAGE){
+        ssize_t r = pread(fd, (char *) buf + done, INDEX_PAGE - done, (off_t) page * INDEX_PAGE + done);
+        if (r < 0 && errno == EINTR){
+            continue;
+        }
+        if (r <= 0){
+            if (r < 0){
+                perror("Index read");
+            }
+            return false;
+        }
+        done += r;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes a page of the index file.
+*/
+bool FieldIndex::writePage(int page, const void *buf){
+    size_t done = 0;
+    while (done < INDEX_PAGE){
+        ssize_t w = pwrite(fd, (const char *) buf + done, INDEX_PAGE - done, (off_t) page * INDEX_PAGE + done);
+        if (w < 0 && errno == EINTR){
+            continue;
+        }
+        if (w <= 0){
+            perror("Index write");
+            return false;
+        }
+        done += w;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Reads the header of the index file.
+*/
+bool FieldIndex::readHeader(Index_Header &header){
+    char page[INDEX_PAGE];
+    if (!readPage(0, page)){
+        return false;
+    }
+    memcpy(&header, page, sizeof(Index_Header));
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes the header of the index file.
+*/
+bool FieldIndex::writeHeader(const Index_Header &header){
+    char page[INDEX_PAGE];
+    memset(page, 0x0, INDEX_PAGE);
+    memcpy(page, &header, sizeof(Index_Header));
+    return writePage(0, page);
+}
+
+
+
+/*!
+*	\brief Reads the modification time of the data file.
+*/
+int64_t FieldIndex::dataStamp(int binfd){
+    struct stat st;
+    if (fstat(binfd, &st) == -1){
+        perror("Data file stat");
+        return -1;
+    }
+    return (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+
+
+/*!
+*	\brief Checks that the index still matches the data file.
+*/
+bool FieldIndex::check(int binfd, long records){
+    Index_Header header;
+    return readHeader(header) && header.magic == INDEX_MAGIC && header.field == field && header.clean == 1 &&
+        header.entries == records && header.stamp == dataStamp(binfd);
+}
+
+
+
+/*!
+*	\brief Rebuilds the index from the data file.
+*/
+bool FieldIndex::rebuild(DataFile<Record> &file){
+    int records = file.checkNumRecords();
+    if (records < 0){
+        return false;
+    }
+
+    std::vector<Index_Key> keys;
+    keys.reserve(records);
+    int scanned = file.scanField(RecordQuery::fieldMember(field), 0, records, [&](const float *values, int n){
+        for (int i = 0; i < n; i++){
+            keys.push_back({values[i], (int32_t) keys.size()});
+        }
+        return true;
+    });
+    if (scanned != records){
+        return false;
+    }
+    std::sort(keys.begin(), keys.end(), keyLess);
+
+    if (ftruncate(fd, 0) == -1){
+        perror("Index truncate");
+        return false;
+    }
+
+    //leaves first, in key order, each linked to its neighbours
+    Index_Page page;
+    std::vector<std::pair<int, Index_Key>> level;
+    int perLeaf = INDEX_LEAF_KEYS * INDEX_FILL / 100;
+    int numLeaves = std::max(1, (int) ((keys.size() + perLeaf - 1) / perLeaf));
+    for (int l = 0; l < numLeaves; l++){
+        memset(&page, 0x0, INDEX_PAGE);
+        size_t first = (size_t) l * perLeaf;
+        size_t n = std::min((size_t) perLeaf, keys.size() - std::min(first, keys.size()));
+        page.leaf = 1;
+        page.count = n;
+        page.prev = (l == 0) ? 0 : l;
+        page.next = (l == numLeaves - 1) ? 0 : l + 2;
+        std::copy(keys.begin() + first, keys.begin() + first + n, page.keys);
+        if (!writePage(l + 1, &page)){
+            return false;
+        }
+        level.push_back(std::make_pair(l + 1, (n > 0) ? page.keys[0] : Index_Key{0, 0}));
+    }
+
+    //then each level of inner pages over the one below, until a single page is left
+    int next = numLeaves + 1;
+    int height = 1;
+    int perInner = INDEX_BRANCHES * INDEX_FILL / 100 + 1;
+    while (level.size() > 1){
+        std::vector<std::pair<int, Index_Key>> above;
+        for (size_t c = 0; c < level.size(); c += perInner){
+            size_t n = std::min((size_t) perInner, level.size() - c);
+            memset(&page, 0x0, INDEX_PAGE);
+            page.first = level[c].first;
+            page.count = n - 1;
+            for (size_t i = 1; i < n; i++){
+                page.branches[i - 1].key = level[c + i].second;
+                page.branches[i - 1].child = level[c + i].first;
+            }
+            if (!writePage(next, &page)){
+                return false;
+            }
+            above.push_back(std::make_pair(next++, level[c].second));
+        }
+        level.swap(above);
+        height++;
+    }
+
+    Index_Header header;
+    memset(&header, 0x0, sizeof(Index_Header));
+    header.magic = INDEX_MAGIC;
+    header.field = field;
+    header.root = level[0].first;
+    header.height = height;
+    header.pages = next;
+    header.clean = 0;
+    header.entries = keys.size();
+    return writeHeader(header);
+}
+
+
+
+/*!
+*	\brief Records whether the index matches the data file, and syncs it.
+*/
+bool FieldIndex::markClean(int binfd, bool clean){
+    Index_Header header;
+    if (!readHeader(header)){
+        return false;
+    }
+
+    //the pages must be on disk before a header that vouches for them
+    if (clean && fdatasync(fd) == -1){
+        perror("Index sync");
+        return false;
+    }
+    header.clean = clean ? 1 : 0;
+    header.stamp = clean ? dataStamp(binfd) : 0;
+    if (!writeHeader(header) || fdatasync(fd) == -1){
+        perror("Index sync");
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Locks the index.
+*/
+void FieldIndex::lock(bool write){
+    if (write){
+        sems.writerLock();
+    }
+    else{
+        sems.readerLock();
+    }
+}
+
+
+
+/*!
+*	\brief Unlocks the index.
+*/
+void FieldIndex::unlock(bool write){
+    if (write){
+        sems.writerUnlock();
+    }
+    else{
+        sems.readerUnlock();
+    }
+}
+
+
+
+/*!
+*	\brief Descends the tree to the leaf of a key.
+*/
+int FieldIndex::findLeaf(int root, const Index_Key &key, Index_Page &leaf, std::vector<int> *path){
+    int page = root;
+    while (true){
+        if (!readPage(page, &leaf)){
+            return -1;
+        }
+        if (leaf.leaf){
+            return page;
+        }
+        if (path != NULL){
+            path->push_back(page);
+        }
+
+        //the last child whose smallest key is not above the key
+        int b = upperBranch(leaf, key);
+        page = (b == 0) ? leaf.first : leaf.branches[b - 1].child;
+    }
+}
+
+
+
+/*!
+*	\brief Links the new half of a split page into its parent, splitting the parents that are full.
+*/
+bool FieldIndex::insertBranch(Index_Header &header, std::vector<int> &path, Index_Key key, int child){
+    Index_Page page;
+    while (!path.empty()){
+        int parent = path.back();
+        path.pop_back();
+        if (!readPage(parent, &page)){
+            return false;
+        }
+
+        int b = upperBranch(page, key);
+        std::vector<Index_Branch> branches(page.branches, page.branches + page.count);
+        branches.insert(branches.begin() + b, Index_Branch{key, child});
+        if (branches.size() <= INDEX_BRANCHES){
+            std::copy(branches.begin(), branches.end(), page.branches);
+            page.count = branches.size();
+            return writePage(parent, &page);
+        }
+
+        //the middle branch moves up, and its child becomes the first of the new page
+        size_t mid = branches.size() / 2;
+        Index_Page right;
+        memset(&right, 0x0, INDEX_PAGE);
+        right.first = branches[mid].child;
+        right.count = branches.size() - mid - 1;
+        std::copy(branches.begin() + mid + 1, branches.end(), right.branches);
+        page.count = mid;
+        std::copy(branches.begin(), branches.begin() + mid, page.branches);
+
+        int rightPage = header.pages++;
+        if (!writePage(rightPage, &right) || !writePage(parent, &page)){
+            return false;
+        }
+        key = branches[mid].key;
+        child = rightPage;
+    }
+
+    //the root was split
+    Index_Page root;
+    memset(&root, 0x0, INDEX_PAGE);
+    root.first = header.root;
+    root.count = 1;
+    root.branches[0] = Index_Branch{key, child};
+    header.root = header.pages++;
+    header.height++;
+    return writePage(header.root, &root);
+}
+
+
+
+/*!
+*	\brief Adds a record's key.
+*/
+bool FieldIndex::insert(int recordNumber, float value){
+    Index_Header header;
+    if (!readHeader(header)){
+        return false;
+    }
+
+    Index_Key key = {value, recordNumber};
+    Index_Page leaf;
+    std::vector<int> path;
+    int page = findLeaf(header.root, key, leaf, &path);
+    if (page == -1){
+        return false;
+    }
+
+    Index_Key *end = leaf.keys + leaf.count;
+    Index_Key *at = std::lower_bound(leaf.keys, end, key, keyLess);
+    if (at != end && !keyLess(key, *at)){
+        return true;
+    }
+
+    if (leaf.count < INDEX_LEAF_KEYS){
+        std::copy_backward(at, end, end + 1);
+        *at = key;
+        leaf.count++;
+        header.entries++;
+        return writePage(page, &leaf) && writeHeader(header);
+    }
+
+    //split the leaf in half, the new one after it in the chain
+    std::vector<Index_Key> keys(leaf.keys, end);
+    keys.insert(keys.begin() + (at - leaf.keys), key);
+    size_t half = keys.size() / 2;
+
+    Index_Page right;
+    memset(&right, 0x0, INDEX_PAGE);
+    int rightPage = header.pages++;
+    right.leaf = 1;
+    right.count = keys.size() - half;
+    right.prev = page;
+    right.next = leaf.next;
+    std::copy(keys.begin() + half, keys.end(), right.keys);
+    leaf.count = half;
+    leaf.next = rightPage;
+    std::copy(keys.begin(), keys.begin() + half, leaf.keys);
+
+    if (right.next != 0){
+        Index_Page after;
+        if (!readPage(right.next, &after)){
+            return false;
+        }
+        after.prev = rightPage;
+        if (!writePage(right.next, &after)){
+            return false;
+        }
+    }
+    if (!writePage(rightPage, &right) || !writePage(page, &leaf) || !insertBranch(header, path, right.keys[0], rightPage)){
+        return false;
+    }
+    header.entries++;
+    return writeHeader(header);
+}
+
+
+
+/*!
+*	\brief Removes a record's key.
+*/
+bool FieldIndex::erase(int recordNumber, float value){
+    Index_Header header;
+    if (!readHeader(header)){
+        return false;
+    }
+
+    Index_Key key = {value, recordNumber};
+    Index_Page leaf;
+    int page = findLeaf(header.root, key, leaf, NULL);
+    if (page == -1){
+        return false;
+    }
+
+    Index_Key *end = leaf.keys + leaf.count;
+    Index_Key *at = std::lower_bound(leaf.keys, end, key, keyLess);
+    if (at == end || keyLess(key, *at)){
+        return false;
+    }
+
+    //left in place even if empty: its parent's key still bounds what may be inserted into it
+    std::copy(at + 1, end, at);
+    leaf.count--;
+    header.entries--;
+    return writePage(page, &leaf) && writeHeader(header);
+}
+
+
+
+/*!
+*	\brief Finds the records with a value in a range.
+*/
+bool FieldIndex::lookup(float low, float high, bool descending, int limit, std::vector<int> &recordNumbers){
+    recordNumbers.clear();
+    Index_Header header;
+    if (!readHeader(header)){
+        return false;
+    }
+
+    //from the first key of the range on one side, following the leaf links to the other
+    Index_Key from = descending ? Index_Key{high, INT_MAX} : Index_Key{low, INT_MIN};
+    Index_Page leaf;
+    int page = findLeaf(header.root, from, leaf, NULL);
+    if (page == -1){
+        return false;
+    }
+
+    if (descending){
+        int i = std::upper_bound(leaf.keys, leaf.keys + leaf.count, from, keyLess) - leaf.keys - 1;
+        while (true){
+            for (; i >= 0; i--){
+                if (leaf.keys[i].value < low || (limit > 0 && (int) recordNumbers.size() == limit)){
+                    return true;
+                }
+                recordNumbers.push_back(leaf.keys[i].recordNumber);
+            }
+            if (leaf.prev == 0){
+                return true;
+            }
+            if (!readPage(leaf.prev, &leaf)){
+                return false;
+            }
+            i = leaf.count - 1;
+        }
+    }
+
+    int i = std::lower_bound(leaf.keys, leaf.keys + leaf.count, from, keyLess) - leaf.keys;
+    while (true){
+        for (; i < leaf.count; i++){
+            if (leaf.keys[i].value > high || (limit > 0 && (int) recordNumbers.size() == limit)){
+                return true;
+            }
+            recordNumbers.push_back(leaf.keys[i].recordNumber);
+        }
+        if (leaf.next == 0){
+            return true;
+        }
+        if (!readPage(leaf.next, &leaf)){
+            return false;
+        }
+        i = 0;
+    }
+}
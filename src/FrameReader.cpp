@@ -0,0 +1,159 @@
+/*!	\file FrameReader.cpp
+*	\brief  FrameReader class implementation file.
+*/
+
+#include "FrameReader.h"
+
+#define READ_CHUNK 4096
+
+
+
+/*!
+*	\brief Constructs an empty FrameReader.
+*/
+FrameReader::FrameReader() : buffer(READ_CHUNK), start(0), end(0), version(0), failed(false) {}
+
+
+
+/*!
+*	\brief Makes room for more bytes.
+*/
+char* FrameReader::reserve(size_t size){
+    if (start == end){
+        start = end = 0;
+    }
+
+    if (buffer.size() - end < size){
+        //slide the partial message to the front before growing
+        if (start > 0){
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        if (buffer.size() - end < size){
+            buffer.resize(end + size);
+        }
+    }
+
+    return buffer.data() + end;
+}
+
+
+
+/*!
+*	\brief Reads whatever has arrived on the socket.
+*/
+int FrameReader::fill(int fd){
+    char *p = reserve(READ_CHUNK);
+
+    int r;
+    do{
+        r = read(fd, p, buffer.size() - end);
+    } while (r < 0 && errno == EINTR);
+
+    if (r < 0){
+        if (errno == EAGAIN || errno == EWOULDBLOCK){
+            return -1;
+        }
+        perror("Read:");
+        return 0;
+    }
+
+    end += r;
+    return r;
+}
+
+
+
+/*!
+*	\brief Appends bytes received by the caller.
+*/
+void FrameReader::feed(const void *data, int size){
+    memcpy(reserve(size), data, size);
+    end += size;
+}
+
+
+
+/*!
+*	\brief Finds the next complete message.
+*/
+size_t FrameReader::parse(Frame &frame){
+    size_t available = end - start;
+    const char *p = buffer.data() + start;
+
+    if (failed){
+        return 0;
+    }
+
+    if (version == 0){
+        if (available < sizeof(uint32_t)){
+            return 0;
+        }
+        uint32_t magic;
+        memcpy(&magic, p, sizeof(uint32_t));
+        version = (magic == FRAME_MAGIC) ? PROTOCOL_V2 : PROTOCOL_V1;
+    }
+
+    if (version == PROTOCOL_V1){
+        if (available < sizeof(Record_Message)){
+            return 0;
+        }
+        Record_Message msg;
+        memcpy(&msg, p, sizeof(Record_Message));
+        frame.version = PROTOCOL_V1;
+        frame.opcode = msg.action;
+        frame.requestId = 0;
+        frame.payload = p;
+        frame.length = sizeof(Record_Message);
+        return sizeof(Record_Message);
+    }
+
+    if (available < sizeof(Frame_Header)){
+        return 0;
+    }
+
+    Frame_Header header;
+    memcpy(&header, p, sizeof(Frame_Header));
+    if (header.magic != FRAME_MAGIC || header.version != PROTOCOL_V2 || header.length > MAX_FRAME_PAYLOAD){
+        printf("Invalid frame header.\n");
+        failed = true;
+        return 0;
+    }
+
+    if (available < sizeof(Frame_Header) + header.length){
+        return 0;
+    }
+
+    frame.version = PROTOCOL_V2;
+    frame.opcode = header.opcode;
+    frame.requestId = header.requestId;
+    frame.payload = p + sizeof(Frame_Header);
+    frame.length = header.length;
+    return sizeof(Frame_Header) + header.length;
+}
+
+
+
+/*!
+*	\brief Takes the next complete message from the buffer.
+*/
+bool FrameReader::next(Frame &frame){
+    size_t size = parse(frame);
+    if (size == 0){
+        return false;
+    }
+
+    start += size;
+    return true;
+}
+
+
+
+/*!
+*	\brief Checks for a complete buffered message without taking it.
+*/
+bool FrameReader::hasFrame(){
+    Frame frame;
+    return parse(frame) > 0;
+}
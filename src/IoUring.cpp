@@ -0,0 +1,163 @@
+/*!	\file IoUring.cpp
+*	\brief  IoUring class implementation file.
+*/
+
+#include "IoUring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+
+/*!
+*	\brief Constructs an uninitialized IoUring.
+*/
+IoUring::IoUring() :
+    ringfd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqRingSize(0), cqRingSize(0),
+    sqes((io_uring_sqe*)MAP_FAILED), localTail(0), enterCalls(0)
+{
+    memset(&params, 0x0, sizeof(io_uring_params));
+}
+
+
+
+/*!
+*	\brief Destructor. Unmaps the rings and closes the instance.
+*/
+IoUring::~IoUring(){
+    if (sqes != MAP_FAILED){
+        munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing){
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED){
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringfd != -1){
+        close(ringfd);
+    }
+}
+
+
+
+/*!
+*	\brief Sets up the ring.
+*/
+bool IoUring::init(unsigned entries){
+    memset(&params, 0x0, sizeof(io_uring_params));
+
+    if ( (ringfd = syscall(__NR_io_uring_setup, entries, &params)) == -1){
+        perror("io_uring_setup");
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    //newer kernels map both rings with one mmap
+    if (params.features & IORING_FEAT_SINGLE_MMAP){
+        if (cqRingSize > sqRingSize){
+            sqRingSize = cqRingSize;
+        }
+        cqRingSize = sqRingSize;
+    }
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED){
+        perror("mmap sq ring");
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP){
+        cqRing = sqRing;
+    }
+    else{
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED){
+            perror("mmap cq ring");
+            return false;
+        }
+    }
+
+    sqes = (io_uring_sqe*) mmap(NULL, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED){
+        perror("mmap sqes");
+        return false;
+    }
+
+    char *sq = (char*) sqRing;
+    sqHead = (unsigned*) (sq + params.sq_off.head);
+    sqTail = (unsigned*) (sq + params.sq_off.tail);
+    sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*) (sq + params.sq_off.array);
+
+    char *cq = (char*) cqRing;
+    cqHead = (unsigned*) (cq + params.cq_off.head);
+    cqTail = (unsigned*) (cq + params.cq_off.tail);
+    cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    localTail = *sqTail;
+    return true;
+}
+
+
+
+/*!
+*	\brief Gets a free submission queue entry.
+*/
+io_uring_sqe* IoUring::getSqe(){
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (localTail - head >= params.sq_entries){
+        return NULL;
+    }
+
+    unsigned index = localTail & *sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0x0, sizeof(io_uring_sqe));
+    sqArray[index] = index;
+    localTail++;
+    return sqe;
+}
+
+
+
+/*!
+*	\brief Submits queued entries.
+*/
+int IoUring::submit(unsigned waitNr){
+    unsigned toSubmit = localTail - *sqTail;
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+
+    if (toSubmit == 0 && waitNr == 0){
+        return 0;
+    }
+
+    int r;
+    do{
+        enterCalls++;
+        r = syscall(__NR_io_uring_enter, ringfd, toSubmit, waitNr, waitNr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (r == -1 && errno == EINTR);
+
+    if (r == -1){
+        perror("io_uring_enter");
+    }
+    return r;
+}
+
+
+
+/*!
+*	\brief Pops a completion.
+*/
+bool IoUring::peekCompletion(io_uring_cqe &cqe){
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)){
+        return false;
+    }
+
+    cqe = cqes[head & *cqMask];
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
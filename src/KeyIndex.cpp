@@ -0,0 +1,460 @@
+/*!	\file KeyIndex.cpp
+*	\brief  KeyIndex class implementation file.
+*/
+
+#include "KeyIndex.h"
+#include <sys/stat.h>
+
+static_assert(sizeof(Key_Entry) * KEY_PAGE_ENTRIES == KEY_PAGE, "KEY_PAGE_ENTRIES entries must fill a KEY_PAGE");
+static_assert(sizeof(Key_Header) <= KEY_PAGE, "Key_Header must fit in a page");
+
+
+
+/*!
+*	\brief Spreads the bits of a key over the table.
+*/
+static uint64_t hashKey(int64_t key){
+    uint64_t h = (uint64_t) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+
+/*!
+*	\brief Constructs a KeyIndex.
+*/
+KeyIndex::KeyIndex(const int filedesc, SemaphoreSet sems) : fd(filedesc), sems(sems){}
+
+
+
+/*!
+*	\brief Destructor. Closes the file.
+*/
+KeyIndex::~KeyIndex(){
+    ::close(this->fd);
+}
+
+
+
+/*!
+*	\brief Reads pages of the index file.
+*/
+bool KeyIndex::readPages(long page, long count, void *buf){
+    size_t done = 0;
+    size_t size = (size_t) count * KEY_PAGE;
+    while (done < size){
+        ssize_t r = pread(fd, (char *) buf + done, size - done, (off_t) page * KEY_PAGE + done);
+        if (r < 0 && errno == EINTR){
+            continue;
+        }
+        if (r <= 0){
+            if (r < 0){
+                perror("Key index read");
+            }
+            return false;
+        }
+        done += r;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes pages of the index file.
+*/
+bool KeyIndex::writePages(long page, long count, const void *buf){
+    size_t done = 0;
+    size_t size = (size_t) count * KEY_PAGE;
+    while (done < size){
+        ssize_t w = pwrite(fd, (const char *) buf + done, size - done, (off_t) page * KEY_PAGE + done);
+        if (w < 0 && errno == EINTR){
+            continue;
+        }
+        if (w <= 0){
+            perror("Key index write");
+            return false;
+        }
+        done += w;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Reads the header of the index file.
+*/
+bool KeyIndex::readHeader(Key_Header &header){
+    char page[KEY_PAGE];
+    if (!readPages(0, 1, page)){
+        return false;
+    }
+    memcpy(&header, page, sizeof(Key_Header));
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes the header of the index file.
+*/
+bool KeyIndex::writeHeader(const Key_Header &header){
+    char page[KEY_PAGE];
+    memset(page, 0x0, KEY_PAGE);
+    memcpy(page, &header, sizeof(Key_Header));
+    return writePages(0, 1, page);
+}
+
+
+
+/*!
+*	\brief Writes one entry of the table.
+*/
+bool KeyIndex::writeEntry(const Key_Header &header, long position, const Key_Entry &entry){
+    off_t offset = (off_t) header.table * KEY_PAGE + (off_t) position * sizeof(Key_Entry);
+    if (pwrite(fd, &entry, sizeof(Key_Entry), offset) != sizeof(Key_Entry)){
+        perror("Key index write");
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Reads the modification time of the data file.
+*/
+int64_t KeyIndex::dataStamp(int binfd){
+    struct stat st;
+    if (fstat(binfd, &st) == -1){
+        perror("Data file stat");
+        return -1;
+    }
+    return (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+
+
+/*!
+*	\brief Prepares the index for use.
+*/
+bool KeyIndex::open(int binfd){
+    Key_Header header;
+    struct stat st;
+    if (fstat(fd, &st) == -1){
+        perror("Key index stat");
+        return false;
+    }
+
+    if (st.st_size == 0){
+        //the table's pages read back as zeros, which are empty entries
+        memset(&header, 0x0, sizeof(Key_Header));
+        header.magic = KEY_MAGIC;
+        header.freeHead = -1;
+        header.table = 1;
+        header.capacity = KEY_INITIAL_PAGES * KEY_PAGE_ENTRIES;
+        if (ftruncate(fd, (off_t) (1 + KEY_INITIAL_PAGES) * KEY_PAGE) == -1){
+            perror("Key index truncate");
+            return false;
+        }
+    }
+    else if (!readHeader(header) || header.magic != KEY_MAGIC){
+        printf("Not a key index.\n");
+        return false;
+    }
+    else if (header.clean == 1 && header.stamp != dataStamp(binfd)){
+        printf("The data file changed since the key index was closed.\n");
+        return false;
+    }
+
+    //a crash from here on leaves it as the last write made it
+    header.clean = 0;
+    header.stamp = 0;
+    if (!writeHeader(header) || fdatasync(fd) == -1){
+        perror("Key index sync");
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Marks the index closed cleanly, and syncs it.
+*/
+bool KeyIndex::close(int binfd){
+    Key_Header header;
+    if (!readHeader(header)){
+        return false;
+    }
+
+    //the table must be on disk before a header that vouches for it
+    if (fdatasync(fd) == -1){
+        perror("Key index sync");
+        return false;
+    }
+    header.clean = 1;
+    header.stamp = dataStamp(binfd);
+    if (!writeHeader(header) || fdatasync(fd) == -1){
+        perror("Key index sync");
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Locks the index.
+*/
+void KeyIndex::lock(bool write){
+    if (write){
+        sems.writerLock();
+    }
+    else{
+        sems.readerLock();
+    }
+}
+
+
+
+/*!
+*	\brief Unlocks the index.
+*/
+void KeyIndex::unlock(bool write){
+    if (write){
+        sems.writerUnlock();
+    }
+    else{
+        sems.readerUnlock();
+    }
+}
+
+
+
+/*!
+*	\brief Probes the table for a key, from the entry it hashes to.
+*/
+long KeyIndex::probe(const Key_Header &header, int64_t key, Key_Entry &found, long &vacant){
+    Key_Entry page[KEY_PAGE_ENTRIES];
+    long mask = header.capacity - 1;
+    long position = hashKey(key) & mask;
+    long loaded = -1;
+    vacant = -1;
+
+    //the table is never full, so an empty entry ends every probe
+    for (long n = 0; n < header.capacity; n++, position = (position + 1) & mask){
+        long p = position / KEY_PAGE_ENTRIES;
+        if (p != loaded){
+            if (!readPages(header.table + p, 1, page)){
+                return -2;
+            }
+            loaded = p;
+        }
+
+        Key_Entry &entry = page[position % KEY_PAGE_ENTRIES];
+        if (entry.state == KEY_USED && entry.key == key){
+            found = entry;
+            return position;
+        }
+        if (entry.state != KEY_USED && vacant == -1){
+            vacant = position;
+        }
+        if (entry.state == KEY_EMPTY){
+            return -1;
+        }
+    }
+    return -1;
+}
+
+
+
+/*!
+*	\brief Moves the keys to a new table.
+*/
+bool KeyIndex::rehash(Key_Header &header, long capacity){
+    long oldPages = header.capacity / KEY_PAGE_ENTRIES;
+    long pages = capacity / KEY_PAGE_ENTRIES;
+    std::vector<Key_Entry> entries(header.capacity);
+    if (!readPages(header.table, oldPages, entries.data())){
+        return false;
+    }
+
+    std::vector<Key_Entry> table(capacity);
+    memset(table.data(), 0x0, capacity * sizeof(Key_Entry));
+    long mask = capacity - 1;
+    for (const Key_Entry &entry : entries){
+        if (entry.state != KEY_USED){
+            continue;
+        }
+        long position = hashKey(entry.key) & mask;
+        while (table[position].state == KEY_USED){
+            position = (position + 1) & mask;
+        }
+        table[position] = entry;
+    }
+
+    //written where it overlaps nothing in use, before the header points at it
+    long oldTable = header.table;
+    long at = (pages < oldTable) ? 1 : oldTable + oldPages;
+    if (!writePages(at, pages, table.data())){
+        return false;
+    }
+    header.table = at;
+    header.capacity = capacity;
+    header.erased = 0;
+    if (!writeHeader(header)){
+        return false;
+    }
+
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) oldTable * KEY_PAGE, (off_t) oldPages * KEY_PAGE) == -1){
+        perror("Key index hole punch");
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Finds the slot of a key.
+*/
+int KeyIndex::find(int64_t key){
+    Key_Header header;
+    Key_Entry found;
+    long vacant;
+    if (!readHeader(header) || probe(header, key, found, vacant) < 0){
+        return -1;
+    }
+    return found.slot;
+}
+
+
+
+/*!
+*	\brief Adds a key.
+*/
+bool KeyIndex::insert(int64_t key, int slot){
+    Key_Header header;
+    if (!readHeader(header)){
+        return false;
+    }
+
+    //erased entries are dropped by a rehash, so the table only doubles for the keys in use
+    if ((header.used + header.erased + 1) * 100 > header.capacity * KEY_MAX_LOAD){
+        long capacity = ((header.used + 1) * 200 > header.capacity * KEY_MAX_LOAD) ? header.capacity * 2 : header.capacity;
+        if (!rehash(header, capacity)){
+            return false;
+        }
+    }
+
+    Key_Entry found;
+    long vacant;
+    long position = probe(header, key, found, vacant);
+    if (position != -1 || vacant == -1){
+        return false;
+    }
+
+    Key_Entry entry;
+    memset(&entry, 0x0, sizeof(Key_Entry));
+    entry.key = key;
+    entry.slot = slot;
+    entry.state = KEY_USED;
+
+    //the entry an erased one leaves behind is reused
+    Key_Entry page[KEY_PAGE_ENTRIES];
+    if (!readPages(header.table + vacant / KEY_PAGE_ENTRIES, 1, page)){
+        return false;
+    }
+    if (page[vacant % KEY_PAGE_ENTRIES].state == KEY_ERASED){
+        header.erased--;
+    }
+    header.used++;
+    return writeEntry(header, vacant, entry) && writeHeader(header);
+}
+
+
+
+/*!
+*	\brief Removes a key.
+*/
+int KeyIndex::erase(int64_t key){
+    Key_Header header;
+    Key_Entry found;
+    long vacant;
+    if (!readHeader(header)){
+        return -1;
+    }
+    long position = probe(header, key, found, vacant);
+    if (position < 0){
+        return -1;
+    }
+
+    //probes for the keys behind it must go on past it
+    Key_Entry entry = found;
+    entry.state = KEY_ERASED;
+    header.used--;
+    header.erased++;
+    if (!writeEntry(header, position, entry) || !writeHeader(header)){
+        return -1;
+    }
+    return found.slot;
+}
+
+
+
+/*!
+*	\brief Takes the first slot of the free list.
+*/
+int KeyIndex::popFree(DataFile<Record> &file, Record &tombstone){
+    Key_Header header;
+    if (!readHeader(header) || header.freeHead == -1){
+        return -1;
+    }
+
+    int slot = header.freeHead;
+    if (!file.readRecord(slot, tombstone)){
+        return -1;
+    }
+    if (tombstone.month >= 0){
+        printf("Free slot %d was overwritten. Dropped %ld free slots.\n", slot, (long) header.freeSlots);
+        header.freeHead = -1;
+        header.freeSlots = 0;
+        writeHeader(header);
+        return -1;
+    }
+
+    //a tombstone's month is -2 - the next free slot
+    header.freeHead = -tombstone.month - 2;
+    header.freeSlots--;
+    if (!writeHeader(header)){
+        return -1;
+    }
+    return slot;
+}
+
+
+
+/*!
+*	\brief Frees a slot.
+*/
+bool KeyIndex::pushFree(DataFile<Record> &file, int slot, Record &tombstone){
+    Key_Header header;
+    if (!readHeader(header)){
+        return false;
+    }
+
+    memset(&tombstone, 0x0, sizeof(Record));
+    tombstone.month = -header.freeHead - 2;
+    if (!file.updateRecord(slot, tombstone)){
+        return false;
+    }
+    header.freeHead = slot;
+    header.freeSlots++;
+    return writeHeader(header);
+}
@@ -0,0 +1,231 @@
+/*!	\file LockStripes.cpp
+*	\brief  LockStripes class implementation file.
+*/
+
+#include "LockStripes.h"
+#include <sys/mman.h>
+#include <new>
+
+
+
+/*!
+*	\brief Creates the stripes.
+*/
+LockStripes::LockStripes(int numStripes) : numStripes(numStripes){
+    if ( (semid = semget(IPC_PRIVATE, numStripes + 1, 0600 | IPC_CREAT)) == -1){
+        perror("Stripe semaphore creation failed");
+        exit(3);
+    }
+
+    std::vector<unsigned short> values(numStripes + 1, STRIPE_READERS);
+    values[numStripes] = 1;
+    union semun {
+        int val;
+        struct semid_ds *buf;
+        unsigned short *array;
+    } arg;
+    arg.array = values.data();
+    if (semctl(semid, 0, SETALL, arg) == -1){
+        perror("Stripe semaphore initialization failed");
+        exit(3);
+    }
+
+    void *segment = mmap(NULL, sizeof(Stripe_Counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED){
+        perror("Stripe counters mmap");
+        exit(3);
+    }
+    counters = new (segment) Stripe_Counters();
+    counters->acquired = counters->waited = counters->tails = counters->tailWaits = 0;
+}
+
+
+
+/*!
+*	\brief Unmaps the counters.
+*/
+LockStripes::~LockStripes(){
+    munmap(counters, sizeof(Stripe_Counters));
+}
+
+
+
+/*!
+*	\brief Removes the semaphore set.
+*/
+void LockStripes::destroy(){
+    if (semctl(semid, 0, IPC_RMID, 0) == -1){
+        perror("Failed to remove stripe semaphores");
+    }
+}
+
+
+
+/*!
+*	\brief Applies semaphore operations atomically, waiting if they cannot be yet.
+*/
+void LockStripes::apply(std::vector<sembuf> &ops, std::atomic<long> &waits){
+    for (sembuf &op : ops){
+        op.sem_flg = IPC_NOWAIT;
+    }
+    if (semop(semid, ops.data(), ops.size()) == 0){
+        return;
+    }
+    if (errno != EAGAIN){
+        perror("Stripe semop");
+        return;
+    }
+
+    waits++;
+    for (sembuf &op : ops){
+        op.sem_flg = 0;
+    }
+    while (semop(semid, ops.data(), ops.size()) == -1){
+        if (errno != EINTR){
+            perror("Stripe semop");
+            return;
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Builds the operations on a set of stripes.
+*/
+std::vector<sembuf> LockStripes::stripeOps(std::vector<char> &marked, bool write, int sign){
+    std::vector<sembuf> ops;
+    short amount = (short) (sign * (write ? STRIPE_READERS : 1));
+    for (int s = 0; s < numStripes; s++){
+        if (marked[s]){
+            ops.push_back({(unsigned short) s, amount, 0});
+        }
+    }
+    return ops;
+}
+
+
+
+/*!
+*	\brief Builds the operations on the stripes of a range of records.
+*/
+std::vector<sembuf> LockStripes::rangeOps(long first, long count, bool write, int sign){
+    std::vector<char> marked(numStripes, count >= numStripes);
+    for (long i = 0; i < count && i < numStripes; i++){
+        marked[(first + i) % numStripes] = 1;
+    }
+    return stripeOps(marked, write, sign);
+}
+
+
+
+/*!
+*	\brief Builds the operations on the stripes of a set of records.
+*/
+std::vector<sembuf> LockStripes::recordOps(const int *recordNumbers, int count, bool write, int sign){
+    std::vector<char> marked(numStripes, 0);
+    for (int i = 0; i < count; i++){
+        marked[recordNumbers[i] % numStripes] = 1;
+    }
+    return stripeOps(marked, write, sign);
+}
+
+
+
+/*!
+*	\brief Locks the stripes of a range of records.
+*/
+void LockStripes::lockRange(long first, long count, bool write){
+    if (count <= 0){
+        return;
+    }
+    std::vector<sembuf> ops = rangeOps(first, count, write, -1);
+    counters->acquired++;
+    apply(ops, counters->waited);
+}
+
+
+
+/*!
+*	\brief Unlocks what lockRange locked.
+*/
+void LockStripes::unlockRange(long first, long count, bool write){
+    if (count <= 0){
+        return;
+    }
+    std::vector<sembuf> ops = rangeOps(first, count, write, 1);
+    apply(ops, counters->waited);
+}
+
+
+
+/*!
+*	\brief Locks the stripes of a set of records.
+*/
+void LockStripes::lockRecords(const int *recordNumbers, int count, bool write){
+    if (count <= 0){
+        return;
+    }
+    std::vector<sembuf> ops = recordOps(recordNumbers, count, write, -1);
+    counters->acquired++;
+    apply(ops, counters->waited);
+}
+
+
+
+/*!
+*	\brief Unlocks what lockRecords locked.
+*/
+void LockStripes::unlockRecords(const int *recordNumbers, int count, bool write){
+    if (count <= 0){
+        return;
+    }
+    std::vector<sembuf> ops = recordOps(recordNumbers, count, write, 1);
+    apply(ops, counters->waited);
+}
+
+
+
+/*!
+*	\brief Locks the end of the file for an append.
+*/
+void LockStripes::lockTail(){
+    std::vector<sembuf> ops = {{(unsigned short) numStripes, -1, 0}};
+    counters->tails++;
+    apply(ops, counters->tailWaits);
+}
+
+
+
+/*!
+*	\brief Unlocks the end of the file.
+*/
+void LockStripes::unlockTail(){
+    std::vector<sembuf> ops = {{(unsigned short) numStripes, 1, 0}};
+    apply(ops, counters->tailWaits);
+}
+
+
+
+/*!
+*	\brief Reads the counters.
+*/
+Stripe_Stats LockStripes::stats(){
+    Stripe_Stats stats;
+    stats.acquired = counters->acquired.load();
+    stats.waited = counters->waited.load();
+    stats.tails = counters->tails.load();
+    stats.tailWaits = counters->tailWaits.load();
+    return stats;
+}
+
+
+
+/*!
+*	\brief Prints the counters.
+*/
+void LockStripes::printStats(){
+    Stripe_Stats s = stats();
+    printf("Lock stripes: %d stripes | %ld acquisitions | %ld waited | %ld appends | %ld appends waited\n",
+        numStripes, s.acquired, s.waited, s.tails, s.tailWaits);
+}
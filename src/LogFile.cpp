@@ -0,0 +1,428 @@
+/*!	\file LogFile.cpp
+*	\brief  LogFile class implementation file.
+*/
+
+#include "LogFile.h"
+#include <algorithm>
+#include <climits>
+
+/*!
+*	\brief Constructs a LogFile.
+*/
+LogFile::LogFile(const int filedesc, SemaphoreSet ss, LogIndex *index) : DataFile<Record>(ss), fd(filedesc), index(index){}
+
+
+
+/*!
+*	\brief Destructor. Closes the file.
+*/
+LogFile::~LogFile(){
+    close(this->fd);
+}
+
+
+
+/*!
+*	\brief Reads a record's latest entry.
+*/
+bool LogFile::fetch(int recordNumber, Record &buf){
+    Log_Entry entry;
+    uint64_t at = index->offset(recordNumber);
+    while (true){
+        ssize_t r = pread(fd, &entry, LOG_ENTRY, at);
+        if (r < 0 && errno == EINTR){
+            continue;
+        }
+        if (r == LOG_ENTRY && LogIndex::valid(entry, recordNumber)){
+            buf = entry.record;
+            return true;
+        }
+
+        //moved by the compactor meanwhile, or not there at all
+        uint64_t now = index->offset(recordNumber);
+        if (now == at){
+            if (r < 0){
+                perror("Log read");
+            }
+            else{
+                printf("Corrupt log entry of record %d.\n", recordNumber);
+            }
+            return false;
+        }
+        at = now;
+    }
+}
+
+
+
+/*!
+*	\brief Reads consecutive records, with one pread per run of adjacent entries.
+*/
+bool LogFile::fetchRange(long first, int count, Record *buf){
+    std::vector<Log_Entry> entries(count);
+    int i = 0;
+    while (i < count){
+        uint64_t at = index->offset(first + i);
+        int n = 1;
+        while (i + n < count && index->offset(first + i + n) == at + (uint64_t) n * LOG_ENTRY){
+            n++;
+        }
+
+        char *out = (char *) &entries[i];
+        size_t size = (size_t) n * LOG_ENTRY;
+        size_t done = 0;
+        while (done < size){
+            ssize_t r = pread(fd, out + done, size - done, at + done);
+            if (r < 0 && errno == EINTR){
+                continue;
+            }
+            if (r <= 0){
+                perror("Log read");
+                return false;
+            }
+            done += r;
+        }
+        i += n;
+    }
+
+    for (i = 0; i < count; i++){
+        if (!LogIndex::valid(entries[i], first + i)){
+            printf("Corrupt log entry of record %ld.\n", first + i);
+            return false;
+        }
+        buf[i] = entries[i].record;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Cuts a range short at the end of the file.
+*/
+long LogFile::clamp(const int first, const int count){
+    long available = index->numRecords() - first;
+    return (available <= 0) ? 0 : std::min((long) count, available);
+}
+
+
+
+/*!
+*	\brief Compacts the segment with the most garbage.
+*/
+bool LogFile::compact(){
+    long segment = index->pickSegment();
+    if (segment == -1){
+        return false;
+    }
+
+    //the head has left the segment, so its entries can only stop being live
+    std::vector<Log_Entry> entries(LOG_SEGMENT_ENTRIES);
+    uint64_t base = (uint64_t) segment * LOG_SEGMENT;
+    size_t done = 0;
+    while (done < LOG_SEGMENT){
+        ssize_t r = pread(fd, (char *) entries.data() + done, LOG_SEGMENT - done, base + done);
+        if (r < 0 && errno == EINTR){
+            continue;
+        }
+        if (r < 0){
+            perror("Log compaction read");
+            return false;
+        }
+        if (r == 0){
+            break;
+        }
+        done += r;
+    }
+
+    //copied in record order, so ranges of them read back with a pread per run
+    std::vector<std::pair<int, int>> live;
+    for (size_t e = 0; e < done / LOG_ENTRY; e++){
+        int recordNumber = entries[e].recordNumber;
+        if (LogIndex::valid(entries[e], -1) && recordNumber < index->numRecords() && index->offset(recordNumber) == base + e * LOG_ENTRY){
+            live.push_back(std::make_pair(recordNumber, (int) e));
+        }
+    }
+    std::sort(live.begin(), live.end());
+
+    std::vector<int> numbers;
+    std::vector<int> moving;
+    std::vector<Record> records;
+    for (size_t b = 0; b < live.size(); b += LOG_COMPACT_BATCH){
+        size_t n = std::min(live.size() - b, (size_t) LOG_COMPACT_BATCH);
+        numbers.clear();
+        for (size_t i = b; i < b + n; i++){
+            numbers.push_back(live[i].first);
+        }
+        lockRecords(numbers.data(), (int) numbers.size());
+
+        //a write may have replaced the record since
+        moving.clear();
+        records.clear();
+        for (size_t i = b; i < b + n; i++){
+            if (index->offset(live[i].first) == base + (uint64_t) live[i].second * LOG_ENTRY){
+                moving.push_back(live[i].first);
+                records.push_back(entries[live[i].second].record);
+            }
+        }
+        bool ok = index->append(fd, moving.data(), records.data(), (int) moving.size(), true);
+
+        unlockRecords(numbers.data(), (int) numbers.size());
+        if (!ok){
+            return false;
+        }
+    }
+
+    return index->release(fd, segment);
+}
+
+
+
+/*!
+*	\brief Counts records in file.
+*/
+int LogFile::checkNumRecords(){
+    lockRange(0, INT_MAX, false);
+    long records = index->numRecords();
+    printf("Counted %ld\n", records);
+    unlockRange(0, INT_MAX, false);
+    return (int) records;
+}
+
+
+
+/*!
+*	\brief Reads a record into the buffer.
+*/
+bool LogFile::readRecord(const int recordNumber, Record &buf){
+    if (recordNumber < 0){
+        return false;
+    }
+
+    if (versions != NULL){
+        int res = snapshotRead(recordNumber, buf, [&](Record &record){
+            return recordNumber < index->numRecords() && fetch(recordNumber, record);
+        });
+        if (res != VERSION_LOCKED){
+            return res == VERSION_READ;
+        }
+    }
+
+    lockRange(recordNumber, 1, false);
+    bool ok = recordNumber < index->numRecords() && fetch(recordNumber, buf);
+    unlockRange(recordNumber, 1, false);
+    return ok;
+}
+
+
+
+/*!
+*	\brief Reads a contiguous range of records.
+*/
+int LogFile::readRecords(const int first, const int count, std::vector<Record> &buf){
+    buf.clear();
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    lockRange(first, count, false);
+    long n = clamp(first, count);
+    if (n > 0){
+        buf.resize(n);
+        if (!fetchRange(first, (int) n, buf.data())){
+            buf.clear();
+            n = -1;
+        }
+    }
+    unlockRange(first, count, false);
+    return (int) n;
+}
+
+
+
+/*!
+*	\brief Scans a contiguous range of records in chunks.
+*/
+int LogFile::scanRecords(const int first, const int count, std::function<bool(const Record*, int)> visit){
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    lockRange(first, count, false);
+    long total = clamp(first, count);
+
+    std::vector<Record> chunk(std::min(total, (long) LOG_SEGMENT_ENTRIES));
+    long scanned = 0;
+    while (scanned < total){
+        int n = (int) std::min(total - scanned, (long) LOG_SEGMENT_ENTRIES);
+        if (!fetchRange(first + scanned, n, chunk.data())){
+            unlockRange(first, count, false);
+            return -1;
+        }
+        scanned += n;
+        if (!visit(chunk.data(), n)){
+            break;
+        }
+    }
+
+    unlockRange(first, count, false);
+    return (int) scanned;
+}
+
+
+
+/*!
+*	\brief Appends a record
+*/
+bool LogFile::writeRecord(Record &record){
+    return writeRecords(&record, 1);
+}
+
+
+
+/*!
+*	\brief Appends several records
+*/
+bool LogFile::writeRecords(const Record *records, const int count){
+    if (count <= 0){
+        return true;
+    }
+
+    lockTail();
+
+    long first = index->numRecords();
+    lockRange(first, count, true);
+    std::vector<int> numbers(count);
+    for (int i = 0; i < count; i++){
+        numbers[i] = first + i;
+    }
+    uint64_t commit = beginWrites(NULL, NULL, 0, first, NULL);
+    long lsn = logWrites(fd, numbers.data(), records, count);
+    if (lsn < 0){
+        abortWrites(commit);
+        unlockRange(first, count, true);
+        unlockTail();
+        return false;
+    }
+    if (!index->append(fd, numbers.data(), records, count, false)){
+        appliedWrites(lsn, false);
+        abortWrites(commit);
+        unlockRange(first, count, true);
+        unlockTail();
+        return false;
+    }
+    appliedWrites(lsn, true);
+    publishWrites(commit, first + count);
+
+    unlockRange(first, count, true);
+    unlockTail();
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes a batch of updates and appends atomically.
+*/
+int LogFile::writeBatch(std::vector<int> &positions, std::vector<Record> &records, void (*number)(Record &record, int recordNumber)){
+    //only a batch that appends needs the count to stay put
+    bool appends = std::find(positions.begin(), positions.end(), -1) != positions.end();
+    if (appends){
+        lockTail();
+    }
+
+    //validate and number everything before writing anything
+    long before = index->numRecords();
+    int next = (int) before;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] == -1){
+            positions[i] = next++;
+            if (number != NULL){
+                number(records[i], positions[i]);
+            }
+        }
+        else if (positions[i] < 0 || positions[i] >= before){
+            printf("Invalid record %d in batch.\n", positions[i]);
+            if (appends){
+                unlockTail();
+            }
+            return -1;
+        }
+    }
+    lockRecords(positions.data(), (int) positions.size());
+
+    //only the updates need versions; appended records are not visible until published
+    std::vector<int> updated;
+    std::vector<Record> contents;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] < before){
+            updated.push_back(positions[i]);
+            contents.push_back(records[i]);
+        }
+    }
+    uint64_t commit = beginWrites(updated.data(), contents.data(), (int) updated.size(), before,
+        [&](int recordNumber, Record &old){
+        return fetch(recordNumber, old);
+    });
+
+    long lsn = logWrites(fd, positions.data(), records.data(), (int) records.size());
+    if (lsn < 0){
+        abortWrites(commit);
+        unlockBatch(positions, appends);
+        return -1;
+    }
+
+    //in batch order, so the last entry of a record wins; nothing points at them if the write fails
+    if (!index->append(fd, positions.data(), records.data(), (int) records.size(), false)){
+        appliedWrites(lsn, false);
+        abortWrites(commit);
+        unlockBatch(positions, appends);
+        return -1;
+    }
+    appliedWrites(lsn, true);
+    //an update-only batch read the count without the tail lock, so it leaves the published count to the appends
+    publishWrites(commit, appends ? next : -1);
+
+    unlockBatch(positions, appends);
+    return (int) before;
+}
+
+
+
+/*!
+*	\brief Updates a record.
+*/
+bool LogFile::updateRecord(const int recordNumber, Record &record){
+    if (recordNumber < 0){
+        return false;
+    }
+
+    lockRange(recordNumber, 1, true);
+
+    long records = index->numRecords();
+    if (records <= recordNumber){
+        printf("Invalid record %d.\n", recordNumber);
+        unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    uint64_t commit = beginWrites(&recordNumber, &record, 1, records, [&](int number, Record &old){
+        return fetch(number, old);
+    });
+    long lsn = logWrites(fd, &recordNumber, &record, 1);
+    if (lsn < 0){
+        abortWrites(commit);
+        unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    if (!index->append(fd, &recordNumber, &record, 1, false)){
+        appliedWrites(lsn, false);
+        abortWrites(commit);
+        unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    appliedWrites(lsn, true);
+    publishWrites(commit, -1);
+
+    unlockRange(recordNumber, 1, true);
+    return true;
+}
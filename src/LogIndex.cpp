@@ -0,0 +1,544 @@
+/*!	\file LogIndex.cpp
+*	\brief  LogIndex class implementation file.
+*/
+
+#include "LogIndex.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+static_assert(sizeof(Log_Entry) == LOG_ENTRY, "Log_Entry must be LOG_ENTRY bytes");
+static_assert(LOG_SEGMENT % LOG_ENTRY == 0, "entries must not straddle segments");
+
+
+
+/*!
+*	\brief Creates an empty shared index.
+*/
+LogIndex::LogIndex(){
+    size_t headerSize = (sizeof(Log_Header) + 63) / 64 * 64;
+    size = headerSize + LOG_MAX_SEGMENTS * sizeof(std::atomic<int>) + (size_t) LOG_MAX_RECORDS * sizeof(std::atomic<uint64_t>);
+
+    //reserved, not committed: untouched pages of the index cost nothing
+    void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (segment == MAP_FAILED){
+        perror("Log index mmap");
+        exit(3);
+    }
+
+    header = new (segment) Log_Header();
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&header->appending, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    live = (std::atomic<int> *) ((char *) segment + headerSize);
+    offsets = (std::atomic<uint64_t> *) (live + LOG_MAX_SEGMENTS);
+
+    //the mapping is zeroed, which is what every counter and offset starts at
+    header->records = 0;
+    header->head = 0;
+    header->tail = 0;
+    header->appended = header->moved = header->compacted = 0;
+}
+
+
+
+/*!
+*	\brief Unmaps the state.
+*/
+LogIndex::~LogIndex(){
+    munmap(header, size);
+}
+
+
+
+/*!
+*	\brief Computes the checksum of an entry's fields.
+*/
+uint32_t LogIndex::checksum(const Log_Entry &entry){
+    const unsigned char *bytes = (const unsigned char *) &entry;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(Log_Entry, checksum); i++){
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+
+/*!
+*	\brief Checks an entry read from the file.
+*/
+bool LogIndex::valid(const Log_Entry &entry, int recordNumber){
+    return entry.magic == LOG_MAGIC && entry.recordNumber >= 0 && entry.checksum == checksum(entry) &&
+        (recordNumber == -1 || entry.recordNumber == recordNumber);
+}
+
+
+
+/*!
+*	\brief Reads the entries of the file from an offset on, skipping the punched holes.
+*/
+long LogIndex::replay(int fd, uint64_t from, off_t end, std::vector<char> &present, const std::function<void(const Log_Entry &, uint64_t)> &visit){
+    std::vector<char> buf(LOG_SEGMENT);
+    long replayed = 0;
+    for (off_t at = from; at < end; ){
+        //compacted segments are holes, skipped without reading them
+        off_t data = lseek(fd, at, SEEK_DATA);
+        if (data == -1 && errno == ENXIO){
+            break;
+        }
+        if (data == -1){
+            perror("Log seek");
+            return -1;
+        }
+        at = std::max((off_t) from, data / LOG_SEGMENT * LOG_SEGMENT);
+        present[at / LOG_SEGMENT] = 1;
+
+        off_t stop = std::min((at / LOG_SEGMENT + 1) * LOG_SEGMENT, end);
+        size_t size = stop - at;
+        size_t done = 0;
+        while (done < size){
+            ssize_t r = pread(fd, buf.data() + done, size - done, at + done);
+            if (r < 0 && errno == EINTR){
+                continue;
+            }
+            if (r <= 0){
+                perror("Log replay");
+                return -1;
+            }
+            done += r;
+        }
+
+        for (size_t e = 0; e + LOG_ENTRY <= size; e += LOG_ENTRY){
+            Log_Entry entry;
+            memcpy(&entry, buf.data() + e, LOG_ENTRY);
+            if (valid(entry, -1)){
+                visit(entry, at + e);
+                replayed++;
+            }
+        }
+        at = stop;
+    }
+    return replayed;
+}
+
+
+
+/*!
+*	\brief Identifies the file a checkpoint is taken of.
+*/
+bool LogIndex::identify(int fd, Log_Checkpoint &checkpoint){
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_INO | STATX_BTIME, &stx) == -1){
+        perror("Log statx");
+        return false;
+    }
+    checkpoint.inode = stx.stx_ino;
+    checkpoint.birth = (stx.stx_mask & STATX_BTIME) ? (int64_t) stx.stx_btime.tv_sec * 1000000000 + stx.stx_btime.tv_nsec : 0;
+    return true;
+}
+
+
+
+/*!
+*	\brief Rebuilds the index by replaying the file.
+*/
+long LogIndex::load(int fd){
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end == -1){
+        perror("Log size");
+        return -1;
+    }
+
+    //a later entry of a record always replaces an earlier one
+    long numSegments = (end + LOG_SEGMENT - 1) / LOG_SEGMENT;
+    std::vector<char> present(numSegments + 1, 0);
+    std::vector<uint64_t> latest;
+    long replayed = replay(fd, 0, end, present, [&latest](const Log_Entry &entry, uint64_t at){
+        if ((size_t) entry.recordNumber >= latest.size()){
+            latest.resize(entry.recordNumber + 1, UINT64_MAX);
+        }
+        latest[entry.recordNumber] = at;
+    });
+    if (replayed == -1){
+        return -1;
+    }
+
+    //records are appended in order, so anything past the first missing one is from a torn append
+    long records = 0;
+    std::vector<int> counts(numSegments + 1, 0);
+    while (records < (long) latest.size() && records < LOG_MAX_RECORDS && latest[records] != UINT64_MAX){
+        offsets[records] = latest[records];
+        counts[latest[records] / LOG_SEGMENT]++;
+        records++;
+    }
+
+    //a torn entry at the end is overwritten by the next append
+    uint64_t head = (end + LOG_ENTRY - 1) / LOG_ENTRY * LOG_ENTRY;
+    long headSegment = head / LOG_SEGMENT;
+    long tail = 0;
+    while (tail < headSegment && !present[tail]){
+        tail++;
+    }
+    if (headSegment - tail >= LOG_MAX_SEGMENTS){
+        printf("Log spans more than %d segments.\n", LOG_MAX_SEGMENTS);
+        return -1;
+    }
+    for (long s = tail; s <= headSegment; s++){
+        live[s % LOG_MAX_SEGMENTS] = (present[s] || s == headSegment) ? counts[s] : -1;
+    }
+
+    header->records = records;
+    header->head = head;
+    header->tail = tail;
+    return replayed;
+}
+
+
+
+/*!
+*	\brief Restores the index from a checkpoint, then replays the entries appended after it.
+*/
+long LogIndex::restore(int fd, const char *path){
+    int cfd = open(path, O_RDONLY);
+    if (cfd == -1){
+        if (errno != ENOENT){
+            perror("Checkpoint open");
+        }
+        return -1;
+    }
+    struct stat st;
+    if (fstat(cfd, &st) == -1 || st.st_size < (off_t) sizeof(Log_Checkpoint)){
+        close(cfd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, cfd, 0);
+    close(cfd);
+    if (map == MAP_FAILED){
+        perror("Checkpoint mmap");
+        return -1;
+    }
+
+    const Log_Checkpoint *checkpoint = (const Log_Checkpoint *) map;
+    Log_Checkpoint file;
+    off_t end = lseek(fd, 0, SEEK_END);
+    long checkpointSegment = checkpoint->head / LOG_SEGMENT;
+    long segments = checkpointSegment - checkpoint->tail + 1;
+    uint64_t head = (end + LOG_ENTRY - 1) / LOG_ENTRY * LOG_ENTRY;
+    long headSegment = head / LOG_SEGMENT;
+
+    //one taken of another file, or cut short, is of no use
+    if (end == -1 || !identify(fd, file) || checkpoint->magic != LOG_CHECKPOINT_MAGIC || checkpoint->inode != file.inode ||
+        checkpoint->birth != file.birth || checkpoint->head > (uint64_t) end || checkpoint->head % LOG_ENTRY != 0 ||
+        checkpoint->records < 0 || checkpoint->records > LOG_MAX_RECORDS || checkpoint->tail < 0 || segments < 1 ||
+        headSegment - checkpoint->tail >= LOG_MAX_SEGMENTS ||
+        st.st_size != (off_t) (sizeof(Log_Checkpoint) + checkpoint->records * sizeof(uint64_t) + segments * sizeof(int32_t))){
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    long records = checkpoint->records;
+    long tail = checkpoint->tail;
+    const uint64_t *savedOffsets = (const uint64_t *) (checkpoint + 1);
+    const int32_t *savedLive = (const int32_t *) (savedOffsets + records);
+    for (long r = 0; r < records; r++){
+        offsets[r].store(savedOffsets[r], std::memory_order_relaxed);
+    }
+    for (long s = tail; s <= checkpointSegment; s++){
+        live[s % LOG_MAX_SEGMENTS] = savedLive[s - tail];
+    }
+    uint64_t from = checkpoint->head;
+    munmap(map, st.st_size);
+
+    //segments entered after the checkpoint
+    for (long s = (from + LOG_SEGMENT - 1) / LOG_SEGMENT; s <= headSegment; s++){
+        live[s % LOG_MAX_SEGMENTS] = 0;
+    }
+
+    //the tail is replayed as append made it, moving records from the entries they replace
+    std::vector<char> present(headSegment + 1, 0);
+    std::vector<uint64_t> latest;
+    long replayed = replay(fd, from, end, present, [&](const Log_Entry &entry, uint64_t at){
+        long number = entry.recordNumber;
+        if (number < records){
+            segment(offsets[number].load())--;
+            offsets[number] = at;
+            segment(at)++;
+            return;
+        }
+        if ((size_t) (number - records) >= latest.size()){
+            latest.resize(number - records + 1, UINT64_MAX);
+        }
+        latest[number - records] = at;
+    });
+    if (replayed == -1){
+        return -1;
+    }
+    for (size_t n = 0; n < latest.size() && records < LOG_MAX_RECORDS && latest[n] != UINT64_MAX; n++){
+        offsets[records] = latest[n];
+        segment(latest[n])++;
+        records++;
+    }
+
+    //segments compacted since the checkpoint are holes now
+    for (long s = tail; s < headSegment; s++){
+        if (live[s % LOG_MAX_SEGMENTS].load() == -1 || present[s]){
+            continue;
+        }
+        off_t data = lseek(fd, (off_t) s * LOG_SEGMENT, SEEK_DATA);
+        if (data == -1 || data >= (off_t) (s + 1) * LOG_SEGMENT){
+            live[s % LOG_MAX_SEGMENTS] = -1;
+        }
+    }
+    while (tail < headSegment && live[tail % LOG_MAX_SEGMENTS].load() == -1){
+        tail++;
+    }
+
+    header->records = records;
+    header->head = head;
+    header->tail = tail;
+    return replayed;
+}
+
+
+
+/*!
+*	\brief Writes a checkpoint of the index.
+*/
+bool LogIndex::checkpoint(int fd, const char *path){
+    Log_Checkpoint checkpoint;
+    memset(&checkpoint, 0x0, sizeof(Log_Checkpoint));
+    checkpoint.magic = LOG_CHECKPOINT_MAGIC;
+    if (!identify(fd, checkpoint)){
+        return false;
+    }
+
+    std::vector<uint64_t> savedOffsets;
+    std::vector<int32_t> savedLive;
+    pthread_mutex_lock(&header->appending);
+    checkpoint.head = header->head.load();
+    checkpoint.tail = header->tail.load();
+    checkpoint.records = header->records.load();
+    savedOffsets.resize(checkpoint.records);
+    for (long r = 0; r < checkpoint.records; r++){
+        savedOffsets[r] = offsets[r].load(std::memory_order_relaxed);
+    }
+    for (long s = checkpoint.tail; s <= (long) (checkpoint.head / LOG_SEGMENT); s++){
+        savedLive.push_back(live[s % LOG_MAX_SEGMENTS].load());
+    }
+    pthread_mutex_unlock(&header->appending);
+
+    //the entries it points at must be on disk before it
+    if (fdatasync(fd) == -1){
+        perror("Log sync");
+        return false;
+    }
+
+    std::string temporary = std::string(path) + ".tmp";
+    int cfd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (cfd == -1){
+        perror("Checkpoint open");
+        return false;
+    }
+    const std::pair<const void *, size_t> parts[] = {
+        {&checkpoint, sizeof(Log_Checkpoint)},
+        {savedOffsets.data(), savedOffsets.size() * sizeof(uint64_t)},
+        {savedLive.data(), savedLive.size() * sizeof(int32_t)}};
+    for (const auto &part : parts){
+        size_t done = 0;
+        while (done < part.second){
+            ssize_t w = write(cfd, (const char *) part.first + done, part.second - done);
+            if (w < 0 && errno == EINTR){
+                continue;
+            }
+            if (w <= 0){
+                perror("Checkpoint write");
+                close(cfd);
+                unlink(temporary.c_str());
+                return false;
+            }
+            done += w;
+        }
+    }
+    if (fdatasync(cfd) == -1 || close(cfd) == -1 || rename(temporary.c_str(), path) == -1){
+        perror("Checkpoint sync");
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes entries at the head and indexes them.
+*/
+bool LogIndex::append(int fd, const int *recordNumbers, const Record *records, int count, bool moving){
+    if (count <= 0){
+        return true;
+    }
+
+    std::vector<Log_Entry> entries(count);
+    for (int i = 0; i < count; i++){
+        entries[i].magic = LOG_MAGIC;
+        entries[i].recordNumber = recordNumbers[i];
+        entries[i].record = records[i];
+        entries[i].checksum = checksum(entries[i]);
+    }
+
+    pthread_mutex_lock(&header->appending);
+
+    //new records must come next, in order
+    long next = header->records.load();
+    for (int i = 0; i < count; i++){
+        if (recordNumbers[i] < 0 || recordNumbers[i] > next || recordNumbers[i] >= LOG_MAX_RECORDS){
+            printf("Invalid record %d in log append.\n", recordNumbers[i]);
+            pthread_mutex_unlock(&header->appending);
+            return false;
+        }
+        if (recordNumbers[i] == next){
+            next++;
+        }
+    }
+
+    uint64_t at = header->head.load();
+    uint64_t end = at + (uint64_t) count * LOG_ENTRY;
+    long last = (end - 1) / LOG_SEGMENT;
+    if (last - header->tail.load() >= LOG_MAX_SEGMENTS){
+        printf("Log full: %d segments not compacted.\n", LOG_MAX_SEGMENTS);
+        pthread_mutex_unlock(&header->appending);
+        return false;
+    }
+
+    //one write for the whole block; nothing points at it until it is all there
+    size_t size = (size_t) count * LOG_ENTRY;
+    size_t done = 0;
+    const char *bytes = (const char *) entries.data();
+    while (done < size){
+        ssize_t w = pwrite(fd, bytes + done, size - done, at + done);
+        if (w < 0 && errno == EINTR){
+            continue;
+        }
+        if (w <= 0){
+            perror("Log append");
+            pthread_mutex_unlock(&header->appending);
+            return false;
+        }
+        done += w;
+    }
+
+    //segments entered for the first time
+    for (long s = (at + LOG_SEGMENT - 1) / LOG_SEGMENT; s <= last; s++){
+        live[s % LOG_MAX_SEGMENTS] = 0;
+    }
+    long existing = header->records.load();
+    for (int i = 0; i < count; i++){
+        int number = recordNumbers[i];
+        uint64_t offset = at + (uint64_t) i * LOG_ENTRY;
+        if (number < existing){
+            segment(offsets[number].load())--;
+        }
+        offsets[number] = offset;
+        segment(offset)++;
+    }
+    header->records = next;
+    header->head = end;
+    (moving ? header->moved : header->appended) += count;
+
+    pthread_mutex_unlock(&header->appending);
+    return true;
+}
+
+
+
+/*!
+*	\brief Picks the segment to compact next.
+*/
+long LogIndex::pickSegment(){
+    long best = -1;
+    int fewest = LOG_SEGMENT_ENTRIES / 2 + 1;
+
+    pthread_mutex_lock(&header->appending);
+    long headSegment = header->head.load() / LOG_SEGMENT;
+    for (long s = header->tail.load(); s < headSegment; s++){
+        int n = live[s % LOG_MAX_SEGMENTS].load();
+        if (n >= 0 && n < fewest){
+            best = s;
+            fewest = n;
+        }
+    }
+    pthread_mutex_unlock(&header->appending);
+    return best;
+}
+
+
+
+/*!
+*	\brief Punches a compacted segment out of the file.
+*/
+bool LogIndex::release(int fd, long segment){
+    if (live[segment % LOG_MAX_SEGMENTS].load() != 0){
+        return false;
+    }
+    if (fdatasync(fd) == -1){
+        perror("Log sync");
+        return false;
+    }
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) segment * LOG_SEGMENT, LOG_SEGMENT) == -1){
+        perror("Log punch");
+        return false;
+    }
+
+    pthread_mutex_lock(&header->appending);
+    live[segment % LOG_MAX_SEGMENTS] = -1;
+    long headSegment = header->head.load() / LOG_SEGMENT;
+    long tail = header->tail.load();
+    while (tail < headSegment && live[tail % LOG_MAX_SEGMENTS].load() == -1){
+        tail++;
+    }
+    header->tail = tail;
+    header->compacted++;
+    pthread_mutex_unlock(&header->appending);
+    return true;
+}
+
+
+
+/*!
+*	\brief Reads the counters.
+*/
+Log_Stats LogIndex::stats(){
+    Log_Stats stats;
+    pthread_mutex_lock(&header->appending);
+    stats.appended = header->appended.load();
+    stats.moved = header->moved.load();
+    stats.compacted = header->compacted.load();
+    stats.records = header->records.load();
+    stats.segments = 0;
+    long headSegment = header->head.load() / LOG_SEGMENT;
+    for (long s = header->tail.load(); s <= headSegment; s++){
+        if (live[s % LOG_MAX_SEGMENTS].load() != -1){
+            stats.segments++;
+        }
+    }
+    pthread_mutex_unlock(&header->appending);
+    return stats;
+}
+
+
+
+/*!
+*	\brief Prints the counters.
+*/
+void LogIndex::printStats(){
+    Log_Stats s = stats();
+    printf("Log store: %ld entries appended | %ld moved | %ld segments compacted | %ld records | %ld segments\n",
+        s.appended, s.moved, s.compacted, s.records, s.segments);
+}
@@ -0,0 +1,399 @@
+/*!	\file MappedFile.cpp
+*	\brief  MappedFile class implementation file.
+*/
+
+#include "MappedFile.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <climits>
+
+#define SCAN_CHUNK 65536
+
+template class MappedFile<Record>;
+
+/*!
+*	\brief Constructs a MappedFile.
+*/
+template <typename T>
+MappedFile<T>::MappedFile(const int filedesc, SemaphoreSet ss) : DataFile<T>(ss), fd(filedesc), map(NULL), mapped(0), numRecords(0){}
+
+
+
+/*!
+*	\brief Destructor. Unmaps and closes the file.
+*/
+template <typename T>
+MappedFile<T>::~MappedFile(){
+    if (map != NULL){
+        munmap(map, mapped);
+    }
+    close(this->fd);
+}
+
+
+
+/*!
+*	\brief Grows the mapping.
+*/
+template <typename T>
+bool MappedFile<T>::reserve(size_t size){
+    if (map != NULL && size <= mapped){
+        return true;
+    }
+
+    size_t length = std::max((size_t) MAP_CHUNK, (size + MAP_CHUNK - 1) / MAP_CHUNK * MAP_CHUNK);
+    void *m;
+    if (map == NULL){
+        m = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    else{
+        m = mremap(map, mapped, length, MREMAP_MAYMOVE);
+    }
+    if (m == MAP_FAILED){
+        perror("Map file");
+        return false;
+    }
+
+    map = (char *) m;
+    mapped = length;
+    return true;
+}
+
+
+
+/*!
+*	\brief Rereads the file size.
+*/
+template <typename T>
+long MappedFile<T>::refresh(){
+    struct stat st;
+    if (fstat(fd, &st) == -1){
+        perror("Map stat");
+        return -1;
+    }
+
+    long records = st.st_size / sizeof(T);
+    if (!reserve(records * sizeof(T))){
+        return -1;
+    }
+    numRecords = records;
+    return numRecords;
+}
+
+
+
+/*!
+*	\brief Grows the file.
+*/
+template <typename T>
+bool MappedFile<T>::extend(long records){
+    if (!reserve(records * sizeof(T))){
+        return false;
+    }
+    if (ftruncate(fd, (off_t) records * sizeof(T)) == -1){
+        perror("Map extend");
+        return false;
+    }
+    numRecords = records;
+    return true;
+}
+
+
+
+/*!
+*	\brief Counts records in the file.
+*/
+template <typename T>
+int MappedFile<T>::checkNumRecords(){
+    this->lockRange(0, INT_MAX, false);
+    long records = refresh();
+    if (records >= 0){
+        printf("Counted %ld\n", records);
+    }
+    this->unlockRange(0, INT_MAX, false);
+    return (int) records;
+}
+
+
+
+/*!
+*	\brief Reads a record into the buffer.
+*/
+template <typename T>
+bool MappedFile<T>::readRecord(const int recordNumber, T &buf){
+    if (recordNumber < 0){
+        return false;
+    }
+    if (this->versions != NULL){
+        int res = this->snapshotRead(recordNumber, buf, [&](T &copy){
+            if ((map == NULL || recordNumber >= numRecords) && refresh() <= recordNumber){
+                return false;
+            }
+            memcpy(&copy, record(recordNumber), sizeof(T));
+            return true;
+        });
+        if (res != VERSION_LOCKED){
+            return res == VERSION_READ;
+        }
+    }
+
+    this->lockRange(recordNumber, 1, false);
+
+    //only go back to the kernel when another process may have appended the record
+    if (map == NULL || recordNumber >= numRecords){
+        if (refresh() <= recordNumber){
+            this->unlockRange(recordNumber, 1, false);
+            return false;
+        }
+    }
+
+    memcpy(&buf, record(recordNumber), sizeof(T));
+
+    this->unlockRange(recordNumber, 1, false);
+    return true;
+}
+
+
+
+/*!
+*	\brief Reads a contiguous range of records.
+*/
+template <typename T>
+int MappedFile<T>::readRecords(const int first, const int count, std::vector<T> &buf){
+    buf.clear();
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    this->lockRange(first, count, false);
+
+    long records = refresh();
+    if (records < 0){
+        this->unlockRange(first, count, false);
+        return -1;
+    }
+    long available = records - first;
+    int n = (available <= 0) ? 0 : (int) std::min((long) count, available);
+    buf.assign(record(first), record(first) + n);
+
+    this->unlockRange(first, count, false);
+    return n;
+}
+
+
+
+/*!
+*	\brief Scans a contiguous range of records in chunks.
+*/
+template <typename T>
+int MappedFile<T>::scanRecords(const int first, const int count, std::function<bool(const T*, int)> visit){
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    this->lockRange(first, count, false);
+
+    long records = refresh();
+    if (records < 0){
+        this->unlockRange(first, count, false);
+        return -1;
+    }
+    long available = records - first;
+    long total = (available <= 0) ? 0 : std::min((long) count, available);
+
+    long scanned = 0;
+    while (scanned < total){
+        int n = (int) std::min(total - scanned, (long) SCAN_CHUNK);
+        const T *chunk = record(first + scanned);
+        scanned += n;
+        if (!visit(chunk, n)){
+            break;
+        }
+    }
+
+    this->unlockRange(first, count, false);
+    return (int) scanned;
+}
+
+
+
+/*!
+*	\brief Appends a record
+*/
+template <typename T>
+bool MappedFile<T>::writeRecord(T &record){
+    return writeRecords(&record, 1);
+}
+
+
+
+/*!
+*	\brief Appends several records
+*/
+template <typename T>
+bool MappedFile<T>::writeRecords(const T *records, const int count){
+    if (count <= 0){
+        return true;
+    }
+
+    this->lockTail();
+
+    //writing the new records grows the file without first zero filling and faulting in the new pages
+    long first = refresh();
+    if (first < 0){
+        this->unlockTail();
+        return false;
+    }
+    this->lockRange(first, count, true);
+    uint64_t commit = this->beginWrites(NULL, NULL, 0, first, NULL);
+
+    std::vector<int> numbers(count);
+    for (int i = 0; i < count; i++){
+        numbers[i] = first + i;
+    }
+    long lsn = this->logWrites(fd, numbers.data(), records, count);
+    if (lsn < 0){
+        this->abortWrites(commit);
+        this->unlockRange(first, count, true);
+        this->unlockTail();
+        return false;
+    }
+
+    size_t size = count * sizeof(T);
+    if (!reserve((first + count) * sizeof(T)) || pwrite(fd, records, size, (off_t) first * sizeof(T)) != (ssize_t) size){
+        perror("Map append");
+        this->appliedWrites(lsn, false);
+        this->abortWrites(commit);
+        this->unlockRange(first, count, true);
+        this->unlockTail();
+        return false;
+    }
+    this->appliedWrites(lsn, true);
+    numRecords = first + count;
+    this->publishWrites(commit, numRecords);
+
+    this->unlockRange(first, count, true);
+    this->unlockTail();
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes a batch of updates and appends atomically.
+*/
+template <typename T>
+int MappedFile<T>::writeBatch(std::vector<int> &positions, std::vector<T> &records, void (*number)(T &record, int recordNumber)){
+    //only a batch that appends needs the end of the file to stay put
+    bool appends = std::find(positions.begin(), positions.end(), -1) != positions.end();
+    if (appends){
+        this->lockTail();
+    }
+
+    int before = (int) refresh();
+    if (before < 0){
+        if (appends){
+            this->unlockTail();
+        }
+        return -1;
+    }
+
+    //validate and number everything before writing anything
+    int next = before;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] == -1){
+            positions[i] = next++;
+            if (number != NULL){
+                number(records[i], positions[i]);
+            }
+        }
+        else if (positions[i] < 0 || positions[i] >= before){
+            printf("Invalid record %d in batch.\n", positions[i]);
+            if (appends){
+                this->unlockTail();
+            }
+            return -1;
+        }
+    }
+    this->lockRecords(positions.data(), (int) positions.size());
+
+    //only the updates need versions; appended records are not visible until published
+    std::vector<int> updated;
+    std::vector<T> contents;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] < before){
+            updated.push_back(positions[i]);
+            contents.push_back(records[i]);
+        }
+    }
+    uint64_t commit = this->beginWrites(updated.data(), contents.data(), (int) updated.size(), before,
+        [&](int recordNumber, T &old){
+        memcpy(&old, record(recordNumber), sizeof(T));
+        return true;
+    });
+
+    //the whole batch is durable in the log before any of it is written, so a crash midway replays the rest
+    long lsn = this->logWrites(fd, positions.data(), records.data(), (int) records.size());
+    if (lsn < 0){
+        this->abortWrites(commit);
+        this->unlockBatch(positions, appends);
+        return -1;
+    }
+    if (next > before && !extend(next)){
+        this->appliedWrites(lsn, false);
+        this->abortWrites(commit);
+        this->unlockBatch(positions, appends);
+        return -1;
+    }
+
+    //in batch order, so the last write to a record wins
+    for (size_t i = 0; i < positions.size(); i++){
+        memcpy(record(positions[i]), &records[i], sizeof(T));
+    }
+    this->appliedWrites(lsn, true);
+    //an update-only batch read the count without the tail lock, so it leaves the published count to the appends
+    this->publishWrites(commit, appends ? next : -1);
+
+    this->unlockBatch(positions, appends);
+    return before;
+}
+
+
+
+/*!
+*	\brief Updates a record.
+*/
+template <typename T>
+bool MappedFile<T>::updateRecord(const int recordNumber, T &record){
+    if (recordNumber < 0){
+        return false;
+    }
+
+    this->lockRange(recordNumber, 1, true);
+
+    if (map == NULL || recordNumber >= numRecords){
+        if (refresh() <= recordNumber){
+            printf("Invalid record %d.\n", recordNumber);
+            this->unlockRange(recordNumber, 1, true);
+            return false;
+        }
+    }
+
+    uint64_t commit = this->beginWrites(&recordNumber, &record, 1, numRecords, [&](int number, T &old){
+        memcpy(&old, this->record(number), sizeof(T));
+        return true;
+    });
+    long lsn = this->logWrites(fd, &recordNumber, &record, 1);
+    if (lsn < 0){
+        this->abortWrites(commit);
+        this->unlockRange(recordNumber, 1, true);
+        return false;
+    }
+    memcpy(this->record(recordNumber), &record, sizeof(T));
+    this->appliedWrites(lsn, true);
+    this->publishWrites(commit, -1);
+
+    this->unlockRange(recordNumber, 1, true);
+    return true;
+}
@@ -0,0 +1,274 @@
+/*!	\file RecordQuery.cpp
+*	\brief  RecordQuery class implementation file.
+*/
+
+#include "RecordQuery.h"
+#include "SimdKernels.h"
+#include "ScanPool.h"
+#include <algorithm>
+
+#define QUERY_CHUNK 65536
+
+
+
+/*!
+*	\brief Constructs a RecordQuery.
+*/
+RecordQuery::RecordQuery(DataFile<Record> &binFile, bool skipFreed) : binFile(binFile), skipFreed(skipFreed) {}
+
+
+
+/*!
+*	\brief Maps a field code to the Record member it names.
+*/
+float Record::* RecordQuery::fieldMember(int field){
+    switch (field){
+    case FIELD_ANDROID:
+        return &Record::android;
+    case FIELD_IOS:
+        return &Record::ios;
+    case FIELD_KAIOS:
+        return &Record::kaios;
+    case FIELD_OTHER:
+        return &Record::other;
+    default:
+        return NULL;
+    }
+}
+
+
+
+/*!
+*	\brief Evaluates one comparison over a chunk into the mask.
+*/
+void RecordQuery::evaluateTerm(const Record *records, int count, const Filter_Term &term){
+    SimdKernels::compare(records, count, fieldMember(term.field), term.op, term.value, mask.data());
+}
+
+
+
+/*!
+*	\brief Evaluates one comparison over a chunk of a field's values into the mask.
+*/
+void RecordQuery::evaluateTerm(const float *values, int count, const Filter_Term &term){
+    SimdKernels::compare(values, count, term.op, term.value, mask.data());
+}
+
+
+
+/*!
+*	\brief Combines the mask of a term into the match.
+*/
+long RecordQuery::combineTerm(int term, int count, bool any){
+    uint64_t *r = match.data();
+    const uint64_t *m = mask.data();
+    int words = (count + 63) / 64;
+    long hits = 0;
+    for (int w = 0; w < words; w++){
+        r[w] = (term == 0) ? m[w] : any ? (r[w] | m[w]) : (r[w] & m[w]);
+        hits += __builtin_popcountll(r[w]);
+    }
+    return hits;
+}
+
+
+
+/*!
+*	\brief Runs a task for each part of a range on parallel threads.
+*/
+bool RecordQuery::scatter(size_t parts, std::function<bool(size_t)> run){
+    return ScanPool::shared().run(parts, run);
+}
+
+
+
+/*!
+*	\brief Finds the records of a range matching a filter.
+*/
+bool RecordQuery::filter(const Filter_Request &request, std::vector<Record> &matches){
+    matches.clear();
+
+    if (request.start < 0 || request.end < request.start || request.count < 0 || request.count > MAX_FILTER_TERMS ||
+        (request.combine != FILTER_AND && request.combine != FILTER_OR)){
+        return false;
+    }
+    for (int t = 0; t < request.count; t++){
+        if (fieldMember(request.terms[t].field) == NULL || request.terms[t].op < FILTER_LT || request.terms[t].op > FILTER_NE){
+            return false;
+        }
+    }
+
+    //the parts of a sharded file are filtered concurrently, each by a query of its own, and their matches joined in order
+    std::vector<std::pair<int, int>> parts = binFile.partitions(request.start, request.end - request.start);
+    if (parts.size() > 1){
+        std::vector<std::vector<Record>> found(parts.size());
+        bool ok = scatter(parts.size(), [&](size_t p){
+            Filter_Request part = request;
+            part.start = parts[p].first;
+            part.end = parts[p].first + parts[p].second;
+            return RecordQuery(binFile, skipFreed).filter(part, found[p]);
+        });
+        for (size_t p = 0; ok && p < parts.size(); p++){
+            matches.insert(matches.end(), found[p].begin(), found[p].end());
+        }
+        return ok;
+    }
+
+    bool any = request.combine == FILTER_OR;
+    bool oneField = request.count > 0;
+    for (int t = 1; t < request.count; t++){
+        oneField = oneField && request.terms[t].field == request.terms[0].field;
+    }
+
+    int scanned;
+    if (oneField && !skipFreed){
+        //only the field is read for the tests, which a columnar file reads alone
+        scanned = binFile.selectRecords(fieldMember(request.terms[0].field), request.start, request.end - request.start,
+            [&](const float *values, int count, uint64_t *selected){
+            match.resize((count + 63) / 64);
+            mask.resize((count + 63) / 64);
+            long hits = 0;
+            for (int t = 0; t < request.count; t++){
+                evaluateTerm(values, count, request.terms[t]);
+                hits = combineTerm(t, count, any);
+            }
+            memcpy(selected, match.data(), match.size() * sizeof(uint64_t));
+            return hits;
+        }, matches);
+    }
+    else{
+        scanned = binFile.scanRecords(request.start, request.end - request.start, [&](const Record *records, int count){
+            int words = (count + 63) / 64;
+            match.resize(words);
+            mask.resize(words);
+            uint64_t *r = match.data();
+
+            //no terms matches everything; otherwise start from the first term's mask
+            if (request.count == 0){
+                memset(r, 0xff, words * sizeof(uint64_t));
+                if (count % 64){
+                    r[words - 1] = (1ULL << (count % 64)) - 1;
+                }
+            }
+            for (int t = 0; t < request.count; t++){
+                evaluateTerm(records, count, request.terms[t]);
+                combineTerm(t, count, any);
+            }
+            for (int i = 0; skipFreed && i < count; i++){
+                if (records[i].month < 0){
+                    r[i / 64] &= ~(1ULL << (i % 64));
+                }
+            }
+
+            for (int w = 0; w < words; w++){
+                for (uint64_t bits = r[w]; bits; bits &= bits - 1){
+                    matches.push_back(records[w * 64 + __builtin_ctzll(bits)]);
+                }
+            }
+            return true;
+        });
+    }
+
+    if (scanned == -1){
+        matches.clear();
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Computes the count, sum, average, minimum and maximum of a field over a range.
+*/
+bool RecordQuery::aggregate(const Aggregate_Request &request, Aggregate_Reply &reply){
+    memset(&reply, 0x0, sizeof(Aggregate_Reply));
+    reply.field = request.field;
+
+    float Record::* member = fieldMember(request.field);
+    if (member == NULL || request.start < 0 || request.end < request.start){
+        reply.count = -1;
+        return false;
+    }
+
+    double sum = 0;
+    float min = 0, max = 0;
+    int count = 0;
+
+    //the parts of a sharded file are aggregated concurrently, and their results merged
+    std::vector<std::pair<int, int>> parts = binFile.partitions(request.start, request.end - request.start);
+    if (parts.size() > 1){
+        std::vector<Aggregate_Reply> partial(parts.size());
+        bool ok = scatter(parts.size(), [&](size_t p){
+            Aggregate_Request part = request;
+            part.start = parts[p].first;
+            part.end = parts[p].first + parts[p].second;
+            return RecordQuery(binFile, skipFreed).aggregate(part, partial[p]);
+        });
+        if (!ok){
+            reply.count = -1;
+            return false;
+        }
+        for (const Aggregate_Reply &result : partial){
+            if (result.count == 0){
+                continue;
+            }
+            min = (count == 0) ? result.min : std::min(min, result.min);
+            max = (count == 0) ? result.max : std::max(max, result.max);
+            sum += result.sum;
+            count += result.count;
+        }
+    }
+    else{
+        auto reduce = [&](const float *values, int size){
+            if (size == 0){
+                return;
+            }
+            float low = SimdKernels::min(values, size), high = SimdKernels::max(values, size);
+            min = (count == 0) ? low : std::min(min, low);
+            max = (count == 0) ? high : std::max(max, high);
+            sum += SimdKernels::sum(values, size);
+            count += size;
+        };
+
+        std::vector<float> live;
+        for (long first = request.start; first < request.end; first += QUERY_CHUNK){
+            int length = (int) std::min((long) QUERY_CHUNK, request.end - first);
+            int n;
+            if (skipFreed){
+                //the months tell freed slots apart, so whole records are read and the live values gathered
+                n = binFile.scanRecords((int) first, length, [&](const Record *records, int size){
+                    live.clear();
+                    for (int i = 0; i < size; i++){
+                        if (records[i].month >= 0){
+                            live.push_back(records[i].*member);
+                        }
+                    }
+                    reduce(live.data(), (int) live.size());
+                    return true;
+                });
+            }
+            else{
+                //only the field is read, which a columnar file reads alone
+                n = binFile.scanField(member, (int) first, length, [&](const float *values, int size){
+                    reduce(values, size);
+                    return true;
+                });
+            }
+            if (n == -1){
+                reply.count = -1;
+                return false;
+            }
+            if (n == 0){
+                break; //past the end of the file
+            }
+        }
+    }
+
+    reply.count = count;
+    reply.sum = sum;
+    reply.avg = count > 0 ? sum / count : 0;
+    reply.min = min;
+    reply.max = max;
+    return true;
+}
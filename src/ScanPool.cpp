@@ -0,0 +1,103 @@
+/*!	\file ScanPool.cpp
+*	\brief  ScanPool class implementation file.
+*/
+
+#include "ScanPool.h"
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+
+
+
+/*!
+*	\brief Starts the helper threads.
+*/
+ScanPool::ScanPool(int helpers){
+    //the pool lives as long as its process, so its helpers are never joined
+    for (int t = 0; t < helpers; t++){
+        std::thread(&ScanPool::help, this).detach();
+    }
+}
+
+
+
+/*!
+*	\brief Finds the pool of this process, starting it the first time.
+*/
+ScanPool &ScanPool::shared(){
+    static std::mutex starting;
+    static ScanPool *pool = NULL;
+    static pid_t owner = 0;
+
+    //a forked process has the pointer but none of the threads, so it starts a pool of its own
+    std::lock_guard<std::mutex> lock(starting);
+    if (pool == NULL || owner != getpid()){
+        pool = new ScanPool((int) std::max(1u, std::thread::hardware_concurrency()) - 1);
+        owner = getpid();
+    }
+    return *pool;
+}
+
+
+
+/*!
+*	\brief Runs parts of the queued scans until the process exits.
+*/
+void ScanPool::help(){
+    std::unique_lock<std::mutex> lock(queueing);
+    while (true){
+        queued.wait(lock, [&](){return !jobs.empty();});
+        Scan_Job &job = *jobs.front();
+        job.users++;
+        work(job, lock);
+        job.users--;
+        finished.notify_all();
+    }
+}
+
+
+
+/*!
+*	\brief Takes and runs the parts of a scan until none is left.
+*/
+void ScanPool::work(Scan_Job &job, std::unique_lock<std::mutex> &lock){
+    while (job.next < job.parts){
+        size_t p = job.next++;
+        if (job.next == job.parts){
+            //nothing left to take, so the scan leaves the queue
+            jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+        }
+        lock.unlock();
+        bool ok = (*job.run)(p);
+        lock.lock();
+        job.ok = job.ok && ok;
+        job.done++;
+    }
+}
+
+
+
+/*!
+*	\brief Runs a task for each part, on the helpers and the calling thread.
+*/
+bool ScanPool::run(size_t parts, std::function<bool(size_t)> run){
+    //a single part is run here, without waking anyone
+    if (parts <= 1){
+        return parts == 0 || run(0);
+    }
+
+    Scan_Job job;
+    job.run = &run;
+    job.parts = parts;
+    job.next = job.done = job.users = 0;
+    job.ok = true;
+
+    std::unique_lock<std::mutex> lock(queueing);
+    jobs.push_back(&job);
+    queued.notify_all();
+    work(job, lock);
+
+    //the job lives on this stack, so it is only left once no helper holds it
+    finished.wait(lock, [&](){return job.done == job.parts && job.users == 0;});
+    return job.ok;
+}
@@ -4,6 +4,27 @@
 
 #include "Server.h"
 #include "SemaphoreSet.h"
+#include "RecordQuery.h"
+#include <algorithm>
+#include <map>
+
+#define LOG_CHUNK 64
+#define RANGE_CHUNK 4096
+#define INDEX_SCAN_DENSITY 64
+
+static_assert(KEY_SEMAPHORE_SET == INDEX_SEMAPHORE_SET + NUM_FIELDS, "the key index's semaphores follow the field indexes'");
+
+
+
+Storage_Engine Server::storage = STORAGE_SYSCALL;
+BufferPool *Server::pool = NULL;
+WriteAheadLog *Server::wal = NULL;
+VersionStore *Server::versions = NULL;
+LockStripes *Server::stripes = NULL;
+LogIndex *Server::logIndex = NULL;
+FieldIndex *Server::indexes[NUM_FIELDS] = {NULL};
+KeyIndex *Server::keys = NULL;
+DatasetCache *Server::datasets = NULL;
 
 
 
@@ -11,15 +32,44 @@
 *	\brief Constructs a data server
 */
 Server::Server(int bfd, int clifd, int lfd, sockaddr_in cliAddr, int semid) : 
-    /*binfd(bfd), logfd(lfd), */clientSocket(clifd, cliAddr), binFile(bfd, SemaphoreSet(semid, 0) ),
-    logFile(lfd, SemaphoreSet(semid, 1) ){}
+    /*binfd(bfd), logfd(lfd), */clientSocket(clifd, cliAddr), dataFile(openBinFile(bfd, semid)), binFile(dataFile),
+    logFile(lfd, SemaphoreSet(semid, 1) ), logQueue(NULL), requestId(0){}
 
 
 
 /*!
-*	\brief Default destructor
+*	\brief Destructor
 */
-Server::~Server() {}
+Server::~Server() {
+    delete dataFile;
+}
+
+
+
+/*!
+*	\brief Opens the binary file with the configured storage engine.
+*/
+DataFile<Record> *Server::openBinFile(const int bfd, const int semid){
+    DataFile<Record> *file;
+    if (storage == STORAGE_MMAP){
+        file = new MappedFile<Record>(bfd, SemaphoreSet(semid, 0));
+    }
+    else if (storage == STORAGE_COLUMNS){
+        file = new ColumnFile(bfd, SemaphoreSet(semid, 0));
+    }
+    else if (storage == STORAGE_LOG){
+        file = new LogFile(bfd, SemaphoreSet(semid, 0), logIndex);
+    }
+    else{
+        CriticalFile<Record> *critical = new CriticalFile<Record>(bfd, SemaphoreSet(semid, 0));
+        critical->setPool(pool);
+        file = critical;
+    }
+    file->setLog(wal);
+    file->setVersions(versions);
+    file->setStripes(stripes);
+    return file;
+}
 
 
 
@@ -27,11 +77,7 @@ Server::~Server() {}
 *	\brief Child data server lifetime.
 */
 void Server::run(){
-    printf("%d: Child connected to: %s : %d\n", getpid(), clientSocket.getipaddr(), clientSocket.getPort());
-    writeLog(5, 0);
-
-    Record_Message msg;
-    int r;
+    logConnection();
 
     //block all signals
     sigset_t sigset, oldset;
@@ -40,45 +86,271 @@ void Server::run(){
 
     while (1)
     {
-        memset(&msg, 0x0, sizeof(Record_Message));
-
         //unblock signals
         sigemptyset(&sigset);
         sigaddset(&sigset, SIGINT);
         sigaddset(&sigset, SIGCHLD);
         sigprocmask(SIG_UNBLOCK, &sigset, &oldset);
 
-        if ( (r = clientSocket.readMessage(msg)) > 0){
+        if (!serviceMessage()){
+            return;
+        }
+    }
+
+    return;
+}
+
+
+
+/*!
+*	\brief Records a new client connection.
+*/
+void Server::logConnection(){
+    printf("%d: Child connected to: %s : %d\n", getpid(), clientSocket.getipaddr(), clientSocket.getPort());
+    writeLog(5, 0);
+}
+
+
+
+/*!
+*	\brief Services one message from the client.
+*/
+bool Server::serviceMessage(){
+    int r;
+
+    if ( (r = clientSocket.receive()) > 0){
+
+        //block signals while the requests are handled
+        sigset_t sigset, oldset;
+        sigemptyset(&sigset);
+        sigaddset(&sigset, SIGINT);
+        sigaddset(&sigset, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+        if (handleMessages() == -1){
+            logDisconnection();
+            return false;
+        }
+    }
+    else if (r == 0){
+        logDisconnection();
+        return false;
+    }
+
+    return true;
+}
+
+
+
+/*!
+*	\brief Buffers whatever the client has sent without responding.
+*/
+int Server::receive(){
+    return clientSocket.receive();
+}
+
+
+
+/*!
+*	\brief Buffers bytes received by an I/O engine.
+*/
+void Server::feed(const void* data, int size){
+    clientSocket.feed(data, size);
+}
+
+
+
+/*!
+*	\brief Checks for a complete buffered request.
+*/
+bool Server::hasMessage(){
+    return clientSocket.hasFrame() || clientSocket.frameError();
+}
+
+
+
+/*!
+*	\brief Responds to every complete buffered request.
+*/
+int Server::handleMessages(){
+    Record_Message msg;
+    std::vector<uint32_t> deferred;
+    int handled = 0;
+
+    while (nextMessage(msg)){
+        handled++;
+        if (deferLog(msg)){
+            deferred.push_back(requestId);
+            continue;
+        }
+        messageSwitch(msg);
+    }
+
+    //the log dumps go out behind every cheap reply received with them
+    for (uint32_t id : deferred){
+        composeReply(msg);
+        msg.action = 5;
+        requestId = id;
+        messageSwitch(msg);
+    }
+
+    return clientSocket.frameError() ? -1 : handled;
+}
+
+
+
+/*!
+*	\brief Checks whether a request can be completed after the ones behind it.
+*/
+bool Server::deferLog(Record_Message &msg){
+    return msg.action == 5 && clientSocket.getProtocol() == PROTOCOL_V2;
+}
+
+
+
+/*!
+*	\brief Takes the next complete request from the receive buffer.
+*/
+bool Server::nextMessage(Record_Message &msg){
+    Frame frame;
+    if (!clientSocket.nextFrame(frame)){
+        return false;
+    }
+
+    //a short v2 payload leaves the remaining fields zeroed
+    memset(&msg, 0x0, sizeof(Record_Message));
+    memcpy(&msg, frame.payload, std::min((size_t) frame.length, sizeof(Record_Message)));
+    msg.action = frame.opcode;
+    requestId = frame.requestId;
+    request = frame;
+    return true;
+}
+
+
+
+/*!
+*	\brief Coroutine data server lifetime.
+*/
+CoTask<> Server::serve(CoExecutor &executor){
+    Record_Message msg;
+    std::vector<uint32_t> deferred;
+
+    logConnection();
 
-            //re-block signals
-            sigemptyset(&sigset);
-            sigaddset(&sigset, SIGINT);
-            sigaddset(&sigset, SIGCHLD);
-            sigprocmask(SIG_BLOCK, &sigset, &oldset);
+    //handlers write into the output buffer, which is sent without blocking
+    clientSocket.setQueueWrites(true);
 
+    while (1)
+    {
+        if ( (co_await clientSocket.asyncReceive(executor)) == 0){
+            logDisconnection();
+            co_return;
+        }
+
+        //replies to everything received are sent together
+        while (nextMessage(msg)){
+            if (deferLog(msg)){
+                deferred.push_back(requestId);
+                continue;
+            }
+            if (msg.action == 5){
+                printf("Received Request for Log\n");
+                if (!co_await logReplyAsync(executor)){
+                    co_return;
+                }
+                continue;
+            }
             messageSwitch(msg);
         }
-        else if (r == 0){
-            printf("%d: Client disconnected.\n", getpid());
-            writeLog(6, 0);
-            return;
+
+        if (clientSocket.frameError()){
+            logDisconnection();
+            co_return;
         }
-        else{
-            continue;
+        if (!co_await flushOutput(executor)){
+            co_return;
         }
+
+        //v2 log dumps are streamed once the cheap replies are on their way
+        for (uint32_t id : deferred){
+            printf("Received Request for Log\n");
+            requestId = id;
+            if (!co_await logReplyAsync(executor)){
+                co_return;
+            }
+        }
+        deferred.clear();
     }
+}
 
-    return;
+
+
+/*!
+*	\brief Records a client disconnection.
+*/
+void Server::logDisconnection(){
+    printf("%d: Client disconnected.\n", getpid());
+    writeLog(6, 0);
 }
 
 
 
+/*!
+*	\brief Hands reply and log I/O to the caller.
+*/
+void Server::setAsyncIO(std::vector<Server_Log_Entry> *queue){
+    logQueue = queue;
+    clientSocket.setQueueWrites(queue != NULL);
+}
+
+
+
+/*!
+*	\brief Buffered reply getter.
+*/
+std::vector<char>& Server::getOutput(){return clientSocket.getOutput();}
+
+
+
+/*!
+*	\brief Sends replies left buffered by a full non-blocking socket.
+*/
+int Server::sendOutput(){return clientSocket.sendOutput();}
+
+
+
+/*!
+*	\brief Checks for replies waiting to be sent.
+*/
+bool Server::hasOutput(){return clientSocket.hasOutput();}
+
+
+
+/*!
+*	\brief Client socket descriptor getter.
+*/
+int Server::getSocketfd(){return clientSocket.getSocketfd();}
+
+
+
+/*!
+*	\brief Puts the client socket in non-blocking mode.
+*/
+bool Server::setNonBlocking(){return clientSocket.setNonBlocking();}
+
+
+
 /*!
 *	\brief Routes commands to handlers.
 */
 void Server::messageSwitch(Record_Message &msg){
     int action = msg.action;
 
+    //v1 messages cannot carry the payloads of the newer requests, so those are echoed back as unspecified
+    if (action >= 6 && clientSocket.getProtocol() != PROTOCOL_V2){
+        action = 0;
+    }
+
     switch (action){
 
     case 1: //count
@@ -105,14 +377,65 @@ void Server::messageSwitch(Record_Message &msg){
         printf("Received Request for Log\n");
         logReply();
         break;
+
+    case 6: //Read range
+        printf("Received Request for Read Range\n");
+        rangeReply();
+        break;
+
+    case 7: //Batch write
+        printf("Received Request for Batch Write\n");
+        batchReply();
+        break;
+
+    case 8: //Aggregate
+        printf("Received Request for Aggregate\n");
+        aggregateReply();
+        break;
+
+    case 9: //Filter
+        printf("Received Request for Filter\n");
+        filterReply();
+        break;
+
+    case 10: //Index range
+        printf("Received Request for Index Range\n");
+        indexReply();
+        break;
+
+    case 11: //Keyed read
+        printf("Received Request for Keyed Read\n");
+        keyReadReply();
+        break;
+
+    case 12: //Keyed update
+        printf("Received Request for Keyed Update\n");
+        keyUpdateReply();
+        break;
+
+    case 13: //Keyed create
+        printf("Received Request for Keyed Create\n");
+        keyCreateReply();
+        break;
+
+    case 14: //Keyed delete
+        printf("Received Request for Keyed Delete\n");
+        keyDeleteReply();
+        break;
+
+    case 15: //Dataset
+        printf("Received Request for Dataset\n");
+        datasetReply();
+        break;
+
     default:
         printf("Received unspecified request.\n");
         break;
     }
 
-    //Logs send their own replies
-    if (action != 5){
-        this->clientSocket.writeMessage(&msg, sizeof(Record_Message));
+    //Logs, ranges, batches, aggregates, filters, index ranges, keyed and dataset requests send their own replies
+    if (action < 5 || action > 15){
+        sendReply(msg);
     }
 }
 
@@ -127,18 +450,41 @@ void Server::composeReply(Record_Message &msg){
 
 
 
+/*!
+*	\brief Sends a reply in the client's protocol.
+*/
+void Server::sendReply(Record_Message &msg){
+    if (clientSocket.getProtocol() == PROTOCOL_V2){
+        clientSocket.writeFrame(msg.action, requestId, &msg, sizeof(Record_Message));
+    }
+    else{
+        clientSocket.writeMessage(&msg, sizeof(Record_Message));
+    }
+}
+
+
+
 /*!
 *	\brief Replies to a count request.
 */
 void Server::countReply(Record_Message &msg){
     composeReply(msg);
     msg.action = 1;
-    msg.arg = binFile.checkNumRecords();
+    msg.arg = binFile->checkNumRecords();
     writeLog(1, msg.arg);
 }
 
 
 
+/*!
+*	\brief Gives a created record its month number.
+*/
+static void numberRecord(Record &record, int recordNumber){
+    record.month = recordNumber;
+}
+
+
+
 /*!
 *	\brief Replies to a create request. 
 */
@@ -148,18 +494,24 @@ void Server::createReply(Record_Message &msg){
     composeReply(msg);
     msg.action = 4;
 
-    //get number for new month
-    int month = binFile.checkNumRecords();
-    rec.month = month;
+    //numbered under the writer lock, since concurrent creates are only serialized by the index locks when there are any
+    bool indexed = lockIndexes();
+    std::vector<int> positions(1, -1);
+    std::vector<Record> records(1, rec);
 
     //append
-    if (binFile.writeRecord(rec)){
+    if (binFile->writeBatch(positions, records, numberRecord) != -1){
+        int month = positions[0];
         msg.arg = month;
-        binFile.readRecord(month, msg.record);
+        binFile->readRecord(month, msg.record);
+        if (indexed){
+            indexRecord(month, NULL, records[0]);
+        }
     }
     else{
         msg.arg = -1;
     }
+    unlockIndexes();
 
     //log
     writeLog(4, msg.arg);
@@ -176,7 +528,7 @@ void Server::readReply(Record_Message &msg){
     msg.action = 2;
     
     //read
-    if (binFile.readRecord(recNum, record)){
+    if (binFile->readRecord(recNum, record)){
         memcpy(&msg.record, &record, sizeof(Record));
         msg.arg = recNum;
     }
@@ -203,21 +555,41 @@ void Server::updateReply(Record_Message &msg){
     msg.action = 3;
 
     //check valid record number
-    int count = binFile.checkNumRecords();
+    int count = binFile->checkNumRecords();
     if (recNum > count || recNum < 0){
         printf("Invalid record.\n");
         msg.arg = -1;
         return;
     }
 
+    //under keyed records, a freed slot is only written by a keyed create, which the key lock keeps out
+    bool keyed = keys != NULL && dataset == NULL;
+    if (keyed){
+        keys->lock(false);
+    }
+
+    //the indexes hold the record's contents from before the update
+    Record old;
+    bool indexed = lockIndexes();
+    bool read = (indexed || keyed) && binFile->readRecord(recNum, old);
+    indexed = indexed && read;
+    bool freed = keyed && ((read && old.month < 0) || rec.month < 0);
+
     //update
-    if (binFile.updateRecord(recNum, rec)){
+    if (!freed && binFile->updateRecord(recNum, rec)){
         msg.arg = recNum;
-        binFile.readRecord(recNum, msg.record);
+        binFile->readRecord(recNum, msg.record);
+        if (indexed){
+            indexRecord(recNum, &old, rec);
+        }
     }
     else{
         msg.arg = -1;
     }
+    unlockIndexes();
+    if (keyed){
+        keys->unlock(false);
+    }
 
     //log
     writeLog(3, msg.arg);
@@ -225,29 +597,551 @@ void Server::updateReply(Record_Message &msg){
 
 
 
+/*!
+*	\brief Replies to a read range request.
+*/
+void Server::rangeReply(){
+    Range_Request range;
+    memset(&range, 0x0, sizeof(Range_Request));
+    memcpy(&range, request.payload, std::min((size_t) request.length, sizeof(Range_Request)));
+
+    //one lock and one read for the whole range
+    std::vector<Record> records;
+    int count = -1;
+    if (range.start >= 0 && range.end >= range.start){
+        count = binFile->readRecords(range.start, range.end - range.start, records);
+    }
+
+    sendRecords(6, records, count);
+    writeLog(7, count == -1 ? -1 : range.start);
+}
+
+
+
+/*!
+*	\brief Replies to a filter request.
+*/
+void Server::filterReply(){
+    Filter_Request query;
+    memset(&query, 0x0, sizeof(Filter_Request));
+    memcpy(&query, request.payload, std::min((size_t) request.length, sizeof(Filter_Request)));
+
+    std::vector<Record> matches;
+    int count = RecordQuery(*binFile, keys != NULL && dataset == NULL).filter(query, matches) ? (int) matches.size() : -1;
+
+    sendRecords(9, matches, count);
+    writeLog(10, count);
+}
+
+
+
+/*!
+*	\brief Replies to an index range request.
+*/
+void Server::indexReply(){
+    Index_Request query;
+    memset(&query, 0x0, sizeof(Index_Request));
+    memcpy(&query, request.payload, std::min((size_t) request.length, sizeof(Index_Request)));
+
+    std::vector<Record> records;
+    int count = -1;
+    FieldIndex *index = (query.field >= 0 && query.field < NUM_FIELDS && dataset == NULL) ? indexes[query.field] : NULL;
+    if (index != NULL && query.low <= query.high && query.limit >= 0){
+        std::vector<int> numbers;
+        index->lock(false);
+        if (index->lookup(query.low, query.high, query.order == INDEX_DESCENDING, query.limit, numbers)){
+            count = readIndexed(numbers, records) ? (int) numbers.size() : -1;
+        }
+        index->unlock(false);
+    }
+
+    sendRecords(10, records, count);
+    writeLog(11, count);
+}
+
+
+
+/*!
+*	\brief Reads the records an index lookup found, in the order found.
+*/
+bool Server::readIndexed(std::vector<int> &numbers, std::vector<Record> &records){
+    records.resize(numbers.size());
+    if (numbers.empty()){
+        return true;
+    }
+
+    //sparse matches are read one at a time
+    int first = *std::min_element(numbers.begin(), numbers.end());
+    int last = *std::max_element(numbers.begin(), numbers.end());
+    long span = (long) last - first + 1;
+    if ((long) numbers.size() * INDEX_SCAN_DENSITY < span){
+        for (size_t i = 0; i < numbers.size(); i++){
+            if (!binFile->readRecord(numbers[i], records[i])){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //dense ones with one scan of their span, each copied to its place in the reply
+    std::vector<std::pair<int, int>> places(numbers.size());
+    for (size_t i = 0; i < numbers.size(); i++){
+        places[i] = std::make_pair(numbers[i], (int) i);
+    }
+    std::sort(places.begin(), places.end());
+    size_t next = 0;
+    int at = first;
+    int scanned = binFile->scanRecords(first, (int) span, [&](const Record *chunk, int n){
+        for (; next < places.size() && places[next].first < at + n; next++){
+            records[places[next].second] = chunk[places[next].first - at];
+        }
+        at += n;
+        return next < places.size();
+    });
+    return scanned != -1 && next == places.size();
+}
+
+
+
+/*!
+*	\brief Takes the writer lock of every field index.
+*/
+bool Server::lockIndexes(){
+    bool indexed = false;
+    if (dataset != NULL){
+        return false;
+    }
+    for (int f = 0; f < NUM_FIELDS; f++){
+        if (indexes[f] != NULL){
+            indexes[f]->lock(true);
+            indexed = true;
+        }
+    }
+    return indexed;
+}
+
+
+
+/*!
+*	\brief Releases the writer lock of every field index.
+*/
+void Server::unlockIndexes(){
+    if (dataset != NULL){
+        return;
+    }
+    for (int f = NUM_FIELDS - 1; f >= 0; f--){
+        if (indexes[f] != NULL){
+            indexes[f]->unlock(true);
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Updates the field indexes after a write.
+*/
+void Server::indexRecord(int recordNumber, const Record *old, const Record &record){
+    for (int f = 0; f < NUM_FIELDS; f++){
+        if (indexes[f] == NULL){
+            continue;
+        }
+        //a freed keyed slot is in no index
+        const Record *was = (old != NULL && old->month >= 0) ? old : NULL;
+        bool live = record.month >= 0;
+        float Record::* member = RecordQuery::fieldMember(f);
+        if (was != NULL && live && (*was).*member == record.*member){
+            continue;
+        }
+        if ((was != NULL && !indexes[f]->erase(recordNumber, (*was).*member)) || (live && !indexes[f]->insert(recordNumber, record.*member))){
+            printf("Failed to index record %d by %s.\n", recordNumber, FieldIndex::fieldName(f));
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Streams records back to the client.
+*/
+void Server::sendRecords(int opcode, std::vector<Record> &records, int count){
+    if (count > 0 && keys != NULL && dataset == NULL){
+        records.resize(count);
+        records.erase(std::remove_if(records.begin(), records.end(), [](const Record &record){
+            return record.month < 0;
+        }), records.end());
+        count = (int) records.size();
+    }
+    for (int i = 0; i < count; i += RANGE_CHUNK){
+        int n = std::min(RANGE_CHUNK, count - i);
+        clientSocket.writeFrame(opcode, requestId, &records[i], n * sizeof(Record));
+    }
+    clientSocket.writeFrame(opcode, requestId, &count, sizeof(int)); //done
+}
+
+
+
+/*!
+*	\brief Replies to a batch write request.
+*/
+void Server::batchReply(){
+    //a batch is one or more whole messages; anything else is refused before locking
+    if (request.length == 0 || request.length % sizeof(Record_Message) != 0){
+        int rejected = -1;
+        clientSocket.writeFrame(7, requestId, &rejected, sizeof(int));
+        writeLog(8, -1);
+        return;
+    }
+
+    int count = request.length / sizeof(Record_Message);
+    std::vector<int> positions(count);
+    std::vector<Record> records(count);
+    bool valid = true;
+
+    //updates keep their record number, creates are numbered when appended
+    for (int i = 0; i < count; i++){
+        Record_Message op;
+        memcpy(&op, request.payload + i * sizeof(Record_Message), sizeof(Record_Message));
+        if (op.action == 3){
+            positions[i] = op.arg;
+        }
+        else if (op.action == 4){
+            positions[i] = -1;
+        }
+        else{
+            valid = false;
+        }
+        records[i] = op.record;
+    }
+
+    //under keyed records, a batch updating a freed slot is rejected whole, as in updateReply
+    bool keyed = keys != NULL && dataset == NULL;
+    if (keyed){
+        keys->lock(false);
+    }
+
+    //the contents the indexes hold for the updated records
+    std::map<int, Record> old;
+    bool indexed = lockIndexes();
+    for (int i = 0; valid && (indexed || keyed) && i < count; i++){
+        Record record;
+        if (positions[i] != -1 && old.count(positions[i]) == 0 && binFile->readRecord(positions[i], record)){
+            old[positions[i]] = record;
+        }
+        if (keyed && positions[i] != -1 && (records[i].month < 0 || (old.count(positions[i]) && old[positions[i]].month < 0))){
+            valid = false;
+        }
+    }
+
+    if (!valid || binFile->writeBatch(positions, records, numberRecord) == -1){
+        std::fill(positions.begin(), positions.end(), -1);
+    }
+    else if (indexed){
+        //the last write of a record is what it holds now
+        std::map<int, Record> written;
+        for (int i = 0; i < count; i++){
+            written[positions[i]] = records[i];
+        }
+        for (auto &w : written){
+            auto o = old.find(w.first);
+            indexRecord(w.first, (o == old.end()) ? NULL : &o->second, w.second);
+        }
+    }
+    unlockIndexes();
+    if (keyed){
+        keys->unlock(false);
+    }
+
+    clientSocket.writeFrame(7, requestId, positions.data(), count * sizeof(int));
+    writeLog(8, (count > 0 && positions[0] == -1) ? -1 : count);
+}
+
+
+
+/*!
+*	\brief Reads a keyed request.
+*/
+bool Server::keyRequest(Key_Message &msg){
+    memset(&msg, 0x0, sizeof(Key_Message));
+    memcpy(&msg, request.payload, std::min((size_t) request.length, sizeof(Key_Message)));
+    msg.slot = -1;
+    return keys != NULL && dataset == NULL;
+}
+
+
+
+/*!
+*	\brief Replies to a keyed read request.
+*/
+void Server::keyReadReply(){
+    Key_Message msg;
+    if (keyRequest(msg)){
+        keys->lock(false);
+        int slot = keys->find(msg.key);
+        if (slot != -1 && binFile->readRecord(slot, msg.record)){
+            msg.slot = slot;
+        }
+        keys->unlock(false);
+    }
+
+    clientSocket.writeFrame(11, requestId, &msg, sizeof(Key_Message));
+    writeLog(12, msg.slot);
+}
+
+
+
+/*!
+*	\brief Replies to a keyed update request.
+*/
+void Server::keyUpdateReply(){
+    Key_Message msg;
+    if (keyRequest(msg)){
+        keys->lock(false);
+        bool indexed = lockIndexes();
+        int slot = keys->find(msg.key);
+        Record old;
+        if (slot != -1 && (!indexed || binFile->readRecord(slot, old))){
+            msg.record.month = slot;
+            if (binFile->updateRecord(slot, msg.record)){
+                msg.slot = slot;
+                if (indexed){
+                    indexRecord(slot, &old, msg.record);
+                }
+            }
+        }
+        unlockIndexes();
+        keys->unlock(false);
+    }
+
+    clientSocket.writeFrame(12, requestId, &msg, sizeof(Key_Message));
+    writeLog(13, msg.slot);
+}
+
+
+
+/*!
+*	\brief Replies to a keyed create request.
+*/
+void Server::keyCreateReply(){
+    Key_Message msg;
+    if (keyRequest(msg)){
+        keys->lock(true);
+        bool indexed = lockIndexes();
+        if (keys->find(msg.key) == -1){
+            //a free slot is written over, anything else appended
+            Record old;
+            int freed = keys->popFree(*binFile, old);
+            msg.record.month = freed;
+            std::vector<int> positions(1, freed);
+            std::vector<Record> records(1, msg.record);
+
+            //the record is written before the key points at it, so a crash can only leak its slot
+            if (binFile->writeBatch(positions, records, numberRecord) != -1){
+                if (keys->insert(msg.key, positions[0])){
+                    msg.slot = positions[0];
+                    msg.record = records[0];
+                }
+                else{
+                    printf("Failed to key record %d.\n", positions[0]);
+                }
+                if (indexed){
+                    indexRecord(positions[0], (freed == -1) ? NULL : &old, records[0]);
+                }
+            }
+        }
+        unlockIndexes();
+        keys->unlock(true);
+    }
+
+    clientSocket.writeFrame(13, requestId, &msg, sizeof(Key_Message));
+    writeLog(14, msg.slot);
+}
+
+
+
+/*!
+*	\brief Replies to a keyed delete request.
+*/
+void Server::keyDeleteReply(){
+    Key_Message msg;
+    if (keyRequest(msg)){
+        keys->lock(true);
+        bool indexed = lockIndexes();
+        int slot = keys->find(msg.key);
+
+        //the key goes before the slot is freed, so a crash can only leak it
+        Record tombstone;
+        if (slot != -1 && binFile->readRecord(slot, msg.record) && keys->erase(msg.key) != -1){
+            msg.slot = slot;
+            if (!keys->pushFree(*binFile, slot, tombstone)){
+                printf("Failed to free record %d.\n", slot);
+            }
+            else if (indexed){
+                indexRecord(slot, &msg.record, tombstone);
+            }
+        }
+        unlockIndexes();
+        keys->unlock(true);
+    }
+
+    clientSocket.writeFrame(14, requestId, &msg, sizeof(Key_Message));
+    writeLog(15, msg.slot);
+}
+
+
+
+/*!
+*	\brief Replies to a dataset request.
+*/
+void Server::datasetReply(){
+    Dataset_Request select;
+    memset(&select, 0x0, sizeof(Dataset_Request));
+    memcpy(&select, request.payload, std::min((size_t) request.length, sizeof(Dataset_Request)));
+
+    int count = -1;
+    if (select.name[0] == '\0'){
+        dataset = NULL;
+        binFile = dataFile;
+        count = binFile->checkNumRecords();
+    }
+    else if (datasets != NULL){
+        std::shared_ptr<DataFile<Record>> opened = datasets->open(select.name, select.create == 1);
+        if (opened != NULL){
+            dataset = opened;
+            binFile = dataset.get();
+            count = binFile->checkNumRecords();
+        }
+    }
+
+    clientSocket.writeFrame(15, requestId, &count, sizeof(int));
+    writeLog(16, count);
+}
+
+
+
+/*!
+*	\brief Replies to an aggregate request.
+*/
+void Server::aggregateReply(){
+    Aggregate_Request query;
+    memset(&query, 0x0, sizeof(Aggregate_Request));
+    memcpy(&query, request.payload, std::min((size_t) request.length, sizeof(Aggregate_Request)));
+
+    Aggregate_Reply result;
+    RecordQuery(*binFile, keys != NULL && dataset == NULL).aggregate(query, result);
+
+    clientSocket.writeFrame(8, requestId, &result, sizeof(Aggregate_Reply));
+    writeLog(9, result.count);
+}
+
+
+
 /*!
 *	\brief Replies to a log request.
 */
 void Server::logReply(){
     int count = logFile.checkNumRecords();
 
-    Log_Message logmsg;
+    Server_Log_Entry entry;
 
     //loop through all log entries
     for (int i = 0; i < count; i++){
-        memset(&logmsg, 0x0, sizeof(Log_Message));
-        if (logFile.readRecord(i, logmsg.log)){
-            logmsg.arg = 1; //more coming
-            //send log
-            clientSocket.writeMessage(&logmsg, sizeof(Log_Message));
+        if (logFile.readRecord(i, entry)){
+            sendLogEntry(entry);
+        }
+    }
+    endLogReply();
+}
+
+
+
+/*!
+*	\brief Sends one entry of a log reply.
+*/
+void Server::sendLogEntry(Server_Log_Entry &entry){
+    if (clientSocket.getProtocol() == PROTOCOL_V2){
+        logChunk.push_back(entry);
+        if (logChunk.size() == LOG_CHUNK){
+            clientSocket.writeFrame(5, requestId, logChunk.data(), logChunk.size() * sizeof(Server_Log_Entry));
+            logChunk.clear();
+        }
+        return;
+    }
+
+    Log_Message logmsg;
+    memset(&logmsg, 0x0, sizeof(Log_Message));
+    memcpy(&logmsg.log, &entry, sizeof(Server_Log_Entry));
+    logmsg.arg = 1; //more coming
+    clientSocket.writeMessage(&logmsg, sizeof(Log_Message));
+}
+
+
+
+/*!
+*	\brief Ends a log reply.
+*/
+void Server::endLogReply(){
+    if (clientSocket.getProtocol() == PROTOCOL_V2){
+        if (!logChunk.empty()){
+            clientSocket.writeFrame(5, requestId, logChunk.data(), logChunk.size() * sizeof(Server_Log_Entry));
+            logChunk.clear();
         }
+        clientSocket.writeFrame(5, requestId, NULL, 0); //done
+        return;
     }
+
+    Log_Message logmsg;
+    memset(&logmsg, 0x0, sizeof(Log_Message));
     logmsg.arg = 0; //done
     clientSocket.writeMessage(&logmsg, sizeof(Log_Message));
 }
 
 
 
+/*!
+*	\brief Replies to a log request without blocking the thread.
+*/
+CoTask<bool> Server::logReplyAsync(CoExecutor &executor){
+    int count = logFile.checkNumRecords();
+
+    Server_Log_Entry entry;
+
+    //loop through all log entries
+    for (int i = 0; i < count; i++){
+        if (logFile.readRecord(i, entry)){
+            sendLogEntry(entry);
+        }
+
+        //send a chunk, then let the other clients run
+        if (clientSocket.getOutput().size() >= LOG_CHUNK * sizeof(Server_Log_Entry)){
+            if (!co_await flushOutput(executor)){
+                co_return false;
+            }
+            co_await executor.yield();
+        }
+    }
+    endLogReply();
+    co_return co_await flushOutput(executor);
+}
+
+
+
+/*!
+*	\brief Sends the buffered reply bytes.
+*/
+CoTask<bool> Server::flushOutput(CoExecutor &executor){
+    std::vector<char> &output = clientSocket.getOutput();
+    if (output.empty()){
+        co_return true;
+    }
+
+    int w = co_await clientSocket.asyncWrite(executor, output.data(), output.size());
+    output.clear();
+    co_return w != 0;
+}
+
+
+
 /*!
 *	\brief Logs an operation.
 */
@@ -260,6 +1154,12 @@ void Server::writeLog(int action, int arg){
     log.log.action = action;
     log.log.arg = arg;
 
+    //batched by the I/O engine
+    if (logQueue != NULL){
+        logQueue->push_back(log);
+        return;
+    }
+
     //write
     if (!logFile.writeRecord(log)){
         printf("Error writing to log.\n");
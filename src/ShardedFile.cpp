@@ -0,0 +1,518 @@
+/*!	\file ShardedFile.cpp
+*	\brief  ShardedFile class implementation file.
+*/
+
+#include "ShardedFile.h"
+#include "ScanPool.h"
+#include <algorithm>
+#include <climits>
+#include <sys/stat.h>
+
+
+
+/*!
+*	\brief Constructs a ShardedFile.
+*/
+ShardedFile::ShardedFile(const char *directory, int semid, const std::vector<int> &boundaries) :
+    DataFile<Record>(SemaphoreSet(semid, 0)), directory(directory), semid(semid), boundaries(boundaries){}
+
+
+
+/*!
+*	\brief Destructor. Closes the shard files.
+*/
+ShardedFile::~ShardedFile(){
+    shards.clear();
+}
+
+
+
+/*!
+*	\brief Path of a shard file.
+*/
+std::string ShardedFile::shardPath(int first){
+    return directory + "/" + std::to_string(first) + ".bin";
+}
+
+
+
+/*!
+*	\brief Reads the dataset's boundaries, saving this run's for a dataset that has none.
+*/
+bool ShardedFile::loadBoundaries(){
+    std::string path = directory + "/boundaries";
+    FILE *f = fopen(path.c_str(), "r");
+    if (f != NULL){
+        std::vector<int> saved;
+        int boundary;
+        while (fscanf(f, "%d", &boundary) == 1){
+            saved.push_back(boundary);
+        }
+        fclose(f);
+        boundaries = saved;
+        return true;
+    }
+    if (errno != ENOENT){
+        perror("Failed to read shard boundaries");
+        return false;
+    }
+
+    //written aside and renamed, so a process opening the dataset meanwhile reads all of them or none
+    std::string temporary = path + "." + std::to_string(getpid());
+    if ( (f = fopen(temporary.c_str(), "w")) == NULL){
+        perror("Failed to save shard boundaries");
+        return false;
+    }
+    for (int boundary : boundaries){
+        fprintf(f, "%d\n", boundary);
+    }
+    if (fflush(f) != 0 || fdatasync(fileno(f)) == -1 || fclose(f) != 0 || rename(temporary.c_str(), path.c_str()) == -1){
+        perror("Failed to save shard boundaries");
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Finds where the shard after one starting at a month starts.
+*/
+int ShardedFile::nextBoundary(int first){
+    for (int boundary : boundaries){
+        if (boundary > first){
+            return boundary;
+        }
+    }
+    if (boundaries.empty()){
+        return INT_MAX;
+    }
+
+    //past the last boundary, shards are as wide as the last interval
+    long last = boundaries.back();
+    long width = (boundaries.size() > 1) ? last - boundaries[boundaries.size() - 2] : last;
+    return (int) std::min(last + ((first - last) / width + 1) * width, (long) INT_MAX);
+}
+
+
+
+/*!
+*	\brief Counts the records of a shard.
+*/
+long ShardedFile::size(const Shard &shard){
+    struct stat st;
+    if (fstat(shard.fd, &st) == -1){
+        perror("Shard stat");
+        return -1;
+    }
+    return st.st_size / sizeof(Record);
+}
+
+
+
+/*!
+*	\brief Opens the next shard.
+*/
+bool ShardedFile::attach(int first, bool create){
+    if (shards.size() == SHARD_MAX){
+        if (create){
+            printf("Dataset %s not extended: it already has %d shards.\n", directory.c_str(), SHARD_MAX);
+        }
+        return false;
+    }
+
+    std::string path = shardPath(first);
+    int fd = ::open(path.c_str(), create ? (O_CREAT | O_RDWR) : O_RDWR, 0600);
+    if (fd == -1){
+        if (errno != ENOENT){
+            perror("Failed to open shard");
+        }
+        return false;
+    }
+
+    //a shard's lock is the set after the append lock's and those of the shards before it, the same in every process
+    Shard shard;
+    shard.first = first;
+    shard.fd = fd;
+    shard.file = std::make_shared<CriticalFile<Record>>(fd, SemaphoreSet(semid, (int) shards.size() + 1));
+    shards.push_back(shard);
+    return true;
+}
+
+
+
+/*!
+*	\brief Opens the shards created since by any process.
+*/
+void ShardedFile::discover(){
+    while (!shards.empty()){
+        int first = shards.back().first;
+        long n = size(shards.back());
+        if (n <= 0 || first + n < nextBoundary(first) || !attach((int) (first + n), false)){
+            return;
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Lists the shards, after opening those created since.
+*/
+std::vector<ShardedFile::Shard> ShardedFile::current(){
+    std::lock_guard<std::mutex> lock(opening);
+    discover();
+    return shards;
+}
+
+
+
+/*!
+*	\brief Finds the shard of a record, after opening those created since.
+*/
+ShardedFile::Shard ShardedFile::route(long recordNumber){
+    std::lock_guard<std::mutex> lock(opening);
+    discover();
+    return shards[locate(shards, recordNumber)];
+}
+
+
+
+/*!
+*	\brief Finds the shard a record belongs to.
+*/
+int ShardedFile::locate(const std::vector<Shard> &view, long recordNumber){
+    auto after = std::upper_bound(view.begin(), view.end(), recordNumber,
+        [](long number, const Shard &shard){return number < shard.first;});
+    return (after == view.begin()) ? 0 : (int) (after - view.begin()) - 1;
+}
+
+
+
+/*!
+*	\brief Counts the records of the dataset.
+*/
+long ShardedFile::numRecords(const std::vector<Shard> &view){
+    for (int s = (int) view.size() - 1; s >= 0; s--){
+        long n = size(view[s]);
+        if (n != 0){
+            return (n < 0) ? -1 : view[s].first + n;
+        }
+    }
+    return 0;
+}
+
+
+
+/*!
+*	\brief Creates the shards that appended records reach.
+*/
+bool ShardedFile::extend(long count, long end){
+    std::lock_guard<std::mutex> lock(opening);
+
+    //the shard the appends start in ends at the next shard, or the next boundary unless it is full past it already
+    int s = locate(shards, count);
+    long limit = (s + 1 < (int) shards.size()) ? shards[s + 1].first : std::max((long) nextBoundary(shards[s].first), count);
+    while (limit < end){
+        s++;
+        if (s == (int) shards.size() && !attach((int) limit, true)){
+            return false;
+        }
+        limit = (s + 1 < (int) shards.size()) ? shards[s + 1].first : nextBoundary(shards[s].first);
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Cuts a range at the shards' bounds.
+*/
+std::vector<std::pair<int, int>> ShardedFile::split(const std::vector<Shard> &view, long first, long count){
+    std::vector<std::pair<int, int>> parts;
+    long end = first + count;
+    for (int s = locate(view, first); s < (int) view.size() && first < end; s++){
+        long limit = (s + 1 < (int) view.size()) ? std::min(end, (long) view[s + 1].first) : end;
+        parts.push_back(std::make_pair((int) first, (int) (limit - first)));
+        first = limit;
+    }
+    return parts;
+}
+
+
+
+/*!
+*	\brief Opens the shards.
+*/
+bool ShardedFile::open(bool create){
+    std::lock_guard<std::mutex> lock(opening);
+    if (!shards.empty()){
+        return true;
+    }
+    //without its first shard there is no dataset, and nothing to save the boundaries of
+    return attach(0, create) && loadBoundaries();
+}
+
+
+
+/*!
+*	\brief Counts the shards.
+*/
+int ShardedFile::shardCount(){
+    std::lock_guard<std::mutex> lock(opening);
+    discover();
+    return (int) shards.size();
+}
+
+
+
+/*!
+*	\brief Reads a record from its shard.
+*/
+bool ShardedFile::readRecord(const int recordNumber, Record &buf){
+    if (recordNumber < 0){
+        return false;
+    }
+    Shard shard = route(recordNumber);
+    return shard.file->readRecord(recordNumber - shard.first, buf);
+}
+
+
+
+/*!
+*	\brief Reads a contiguous range of records, from its shards in parallel.
+*/
+int ShardedFile::readRecords(const int first, const int count, std::vector<Record> &buf){
+    buf.clear();
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    std::vector<Shard> view = current();
+    long total = numRecords(view);
+    if (total < 0){
+        return -1;
+    }
+    long n = std::min((long) count, total - first);
+    if (n <= 0){
+        return 0;
+    }
+    std::vector<std::pair<int, int>> parts = split(view, first, n);
+    buf.resize(n);
+
+    //the process's scan threads each take the next shard, reading it straight into its place in the buffer
+    std::vector<int> read(parts.size(), -1);
+    ScanPool::shared().run(parts.size(), [&](size_t p){
+        std::vector<Record> part;
+        const Shard &shard = view[locate(view, parts[p].first)];
+        read[p] = shard.file->readRecords(parts[p].first - shard.first, parts[p].second, part);
+        if (read[p] > 0){
+            memcpy(&buf[parts[p].first - first], part.data(), read[p] * sizeof(Record));
+        }
+        return read[p] != -1;
+    });
+
+    //the range ends where a shard was read short
+    long got = 0;
+    for (size_t p = 0; p < parts.size(); p++){
+        if (read[p] == -1){
+            buf.clear();
+            return -1;
+        }
+        got += read[p];
+        if (read[p] < parts[p].second){
+            break;
+        }
+    }
+    buf.resize(got);
+    return (int) got;
+}
+
+
+
+/*!
+*	\brief Scans a contiguous range of records in chunks, a shard after the other.
+*/
+int ShardedFile::scanRecords(const int first, const int count, std::function<bool(const Record*, int)> visit){
+    if (first < 0 || count <= 0){
+        return 0;
+    }
+
+    std::vector<Shard> view = current();
+    long scanned = 0;
+    bool stopped = false;
+    for (const std::pair<int, int> &part : split(view, first, count)){
+        const Shard &shard = view[locate(view, part.first)];
+        int n = shard.file->scanRecords(part.first - shard.first, part.second, [&](const Record *records, int size){
+            stopped = !visit(records, size);
+            return !stopped;
+        });
+        if (n == -1){
+            return -1;
+        }
+        scanned += n;
+        if (stopped || n < part.second){
+            break;
+        }
+    }
+    return (int) scanned;
+}
+
+
+
+/*!
+*	\brief Appends a record
+*/
+bool ShardedFile::writeRecord(Record &record){
+    return writeRecords(&record, 1);
+}
+
+
+
+/*!
+*	\brief Appends several records
+*/
+bool ShardedFile::writeRecords(const Record *records, const int count){
+    if (count <= 0){
+        return true;
+    }
+    std::vector<int> positions(count, -1);
+    std::vector<Record> contents(records, records + count);
+    return writeBatch(positions, contents, NULL) != -1;
+}
+
+
+
+/*!
+*	\brief Writes a batch of updates and appends atomically.
+*/
+int ShardedFile::writeBatch(std::vector<int> &positions, std::vector<Record> &records, void (*number)(Record &record, int recordNumber)){
+    //appenders and batches are serialized, so neither the end of the dataset nor the shards move under them
+    sems.writerLock();
+    std::vector<Shard> view = current();
+    long count = numRecords(view);
+    if (count < 0){
+        sems.writerUnlock();
+        return -1;
+    }
+
+    //validate and number everything before writing anything
+    long next = count;
+    for (size_t i = 0; i < positions.size(); i++){
+        if (positions[i] == -1){
+            positions[i] = (int) next++;
+            if (number != NULL){
+                number(records[i], positions[i]);
+            }
+        }
+        else if (positions[i] < 0 || positions[i] >= count){
+            printf("Invalid record %d in batch.\n", positions[i]);
+            sems.writerUnlock();
+            return -1;
+        }
+    }
+    if (next > count){
+        if (!extend(count, next)){
+            sems.writerUnlock();
+            return -1;
+        }
+        view = current();
+    }
+
+    std::vector<std::vector<size_t>> parts(view.size());
+    for (size_t i = 0; i < positions.size(); i++){
+        parts[locate(view, positions[i])].push_back(i);
+    }
+
+    //each shard's part is all or nothing; the parts written before one that fails are undone
+    struct Undo{
+        size_t shard;
+        long size;
+        std::vector<std::pair<int, Record>> updates;
+    };
+    std::vector<Undo> undos;
+    bool ok = true;
+    for (size_t s = 0; ok && s < view.size(); s++){
+        if (parts[s].empty()){
+            continue;
+        }
+        Undo undo;
+        undo.shard = s;
+        undo.size = size(view[s]);
+        ok = undo.size >= 0;
+
+        std::vector<int> local;
+        std::vector<Record> contents;
+        for (size_t k = 0; ok && k < parts[s].size(); k++){
+            size_t i = parts[s][k];
+            int at = positions[i] - view[s].first;
+            local.push_back((positions[i] >= count) ? -1 : at);
+            contents.push_back(records[i]);
+            if (positions[i] < count){
+                Record old;
+                ok = view[s].file->readRecord(at, old);
+                undo.updates.push_back(std::make_pair(at, old));
+            }
+        }
+
+        ok = ok && view[s].file->writeBatch(local, contents, NULL) != -1;
+        if (ok){
+            undos.push_back(undo);
+        }
+    }
+
+    if (!ok){
+        //the first saved contents of a record are restored last
+        for (auto undo = undos.rbegin(); undo != undos.rend(); ++undo){
+            Shard &shard = view[undo->shard];
+            for (auto update = undo->updates.rbegin(); update != undo->updates.rend(); ++update){
+                if (!shard.file->updateRecord(update->first, update->second)){
+                    printf("Batch rollback of shard %d failed.\n", shard.first);
+                }
+            }
+            if (ftruncate(shard.fd, undo->size * sizeof(Record)) == -1){
+                perror("Batch rollback truncate");
+            }
+        }
+        sems.writerUnlock();
+        return -1;
+    }
+
+    sems.writerUnlock();
+    return (int) count;
+}
+
+
+
+/*!
+*	\brief Updates a record in its shard.
+*/
+bool ShardedFile::updateRecord(const int recordNumber, Record &record){
+    if (recordNumber < 0){
+        return false;
+    }
+    Shard shard = route(recordNumber);
+    return shard.file->updateRecord(recordNumber - shard.first, record);
+}
+
+
+
+/*!
+*	\brief Counts records in the dataset.
+*/
+int ShardedFile::checkNumRecords(){
+    return (int) numRecords(current());
+}
+
+
+
+/*!
+*	\brief Splits a range of records at the shards' bounds.
+*/
+std::vector<std::pair<int, int>> ShardedFile::partitions(const int first, const int count){
+    if (first < 0 || count <= 0){
+        return DataFile<Record>::partitions(first, count);
+    }
+    return split(current(), first, count);
+}
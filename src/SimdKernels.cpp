@@ -0,0 +1,535 @@
+/*!	\file SimdKernels.cpp
+*	\brief  SimdKernels class implementation file.
+*/
+
+#include "SimdKernels.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+//the scalar kernels are the baseline the others are measured against, so the compiler must not vectorize them itself
+#define SCALAR __attribute__((optimize("no-tree-vectorize")))
+#define AVX2 __attribute__((target("avx2")))
+
+const SimdKernels::Kernel_Table *SimdKernels::table = NULL;
+Simd_Level SimdKernels::current = SIMD_SCALAR;
+
+
+
+/*!
+*	\brief Evaluates one comparison.
+*/
+template <int Op>
+static inline bool test(float v, float value){
+    switch (Op){
+    case FILTER_LT:
+        return v < value;
+    case FILTER_LE:
+        return v <= value;
+    case FILTER_GT:
+        return v > value;
+    case FILTER_GE:
+        return v >= value;
+    case FILTER_EQ:
+        return v == value;
+    default: //FILTER_NE
+        return v != value;
+    }
+}
+
+
+
+/*!
+*	\brief Picks the instantiation of a comparison kernel for op, so none of them branch per value.
+*/
+template <template <int> class Kernel>
+static long dispatch(const float *values, long count, long stride, int op, float value, uint64_t *bits){
+    switch (op){
+    case FILTER_LT:
+        return Kernel<FILTER_LT>::run(values, count, stride, value, bits);
+    case FILTER_LE:
+        return Kernel<FILTER_LE>::run(values, count, stride, value, bits);
+    case FILTER_GT:
+        return Kernel<FILTER_GT>::run(values, count, stride, value, bits);
+    case FILTER_GE:
+        return Kernel<FILTER_GE>::run(values, count, stride, value, bits);
+    case FILTER_EQ:
+        return Kernel<FILTER_EQ>::run(values, count, stride, value, bits);
+    default:
+        return Kernel<FILTER_NE>::run(values, count, stride, value, bits);
+    }
+}
+
+
+
+/*!
+*	\brief Compares the values from start, a multiple of 64, on one at a time into their words.
+*/
+template <int Op>
+SCALAR static long compareTail(const float *values, long start, long count, long stride, float value, uint64_t *bits){
+    long hits = 0;
+    for (long w = start / 64; w * 64 < count; w++){
+        uint64_t word = 0;
+        long end = std::min(count, (w + 1) * 64);
+        for (long i = w * 64; i < end; i++){
+            word |= (uint64_t) test<Op>(values[i * stride], value) << (i % 64);
+        }
+        bits[w] = word;
+        hits += __builtin_popcountll(word);
+    }
+    return hits;
+}
+
+
+
+/*!
+*	\brief Sums count values, stride floats apart.
+*/
+SCALAR static double scalarSum(const float *values, long count, long stride){
+    double sum = 0;
+    for (long i = 0; i < count; i++){
+        sum += values[i * stride];
+    }
+    return sum;
+}
+
+
+
+/*!
+*	\brief Finds the minimum of count values, stride floats apart.
+*/
+SCALAR static float scalarMin(const float *values, long count, long stride){
+    if (count <= 0){
+        return 0;
+    }
+    float min = values[0];
+    for (long i = 1; i < count; i++){
+        min = values[i * stride] < min ? values[i * stride] : min;
+    }
+    return min;
+}
+
+
+
+/*!
+*	\brief Finds the maximum of count values, stride floats apart.
+*/
+SCALAR static float scalarMax(const float *values, long count, long stride){
+    if (count <= 0){
+        return 0;
+    }
+    float max = values[0];
+    for (long i = 1; i < count; i++){
+        max = values[i * stride] > max ? values[i * stride] : max;
+    }
+    return max;
+}
+
+
+
+/*!
+*	\brief Compares count values, stride floats apart, into a bitmask.
+*/
+template <int Op>
+struct ScalarCompare{
+    static long run(const float *values, long count, long stride, float value, uint64_t *bits){
+        return compareTail<Op>(values, 0, count, stride, value, bits);
+    }
+};
+
+
+
+/*!
+*	\brief Kernels of the scalar level.
+*/
+static const SimdKernels::Kernel_Table *scalarKernels(){
+    static const SimdKernels::Kernel_Table kernels = {scalarSum, scalarMin, scalarMax, dispatch<ScalarCompare>};
+    return &kernels;
+}
+
+
+
+#ifdef SIMD_X86
+
+/*!
+*	\brief Loads four values, stride floats apart.
+*/
+static inline __m128 load4(const float *values, long stride){
+    if (stride == 1){
+        return _mm_loadu_ps(values);
+    }
+    //no gather before AVX2
+    return _mm_set_ps(values[3 * stride], values[2 * stride], values[stride], values[0]);
+}
+
+
+
+/*!
+*	\brief Sums count values, stride floats apart, four at a time.
+*/
+static double sseSum(const float *values, long count, long stride){
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    long i = 0;
+    for (; i + 4 <= count; i += 4){
+        __m128 v = load4(values + i * stride, stride);
+        acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(v));
+        acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + scalarSum(values + i * stride, count - i, stride);
+}
+
+
+
+/*!
+*	\brief Finds the minimum of count values, stride floats apart, four at a time.
+*/
+static float sseMin(const float *values, long count, long stride){
+    if (count < 4){
+        return scalarMin(values, count, stride);
+    }
+    __m128 acc = load4(values, stride);
+    long i = 4;
+    for (; i + 4 <= count; i += 4){
+        acc = _mm_min_ps(acc, load4(values + i * stride, stride));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    float min = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+    return i < count ? std::min(min, scalarMin(values + i * stride, count - i, stride)) : min;
+}
+
+
+
+/*!
+*	\brief Finds the maximum of count values, stride floats apart, four at a time.
+*/
+static float sseMax(const float *values, long count, long stride){
+    if (count < 4){
+        return scalarMax(values, count, stride);
+    }
+    __m128 acc = load4(values, stride);
+    long i = 4;
+    for (; i + 4 <= count; i += 4){
+        acc = _mm_max_ps(acc, load4(values + i * stride, stride));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    float max = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    return i < count ? std::max(max, scalarMax(values + i * stride, count - i, stride)) : max;
+}
+
+
+
+/*!
+*	\brief Compares four values against a threshold.
+*/
+template <int Op>
+static inline __m128 sseTest(__m128 v, __m128 value){
+    switch (Op){
+    case FILTER_LT:
+        return _mm_cmplt_ps(v, value);
+    case FILTER_LE:
+        return _mm_cmple_ps(v, value);
+    case FILTER_GT:
+        return _mm_cmpgt_ps(v, value);
+    case FILTER_GE:
+        return _mm_cmpge_ps(v, value);
+    case FILTER_EQ:
+        return _mm_cmpeq_ps(v, value);
+    default: //unordered, so NaN is not equal to anything, as in C++
+        return _mm_cmpneq_ps(v, value);
+    }
+}
+
+
+
+/*!
+*	\brief Compares count values, stride floats apart, into a bitmask, a word of 64 values at a time.
+*/
+template <int Op>
+struct SseCompare{
+    static long run(const float *values, long count, long stride, float value, uint64_t *bits){
+        __m128 threshold = _mm_set1_ps(value);
+        long hits = 0;
+        long i = 0;
+        for (; i + 64 <= count; i += 64){
+            uint64_t word = 0;
+            for (int j = 0; j < 64; j += 4){
+                word |= (uint64_t) _mm_movemask_ps(sseTest<Op>(load4(values + (i + j) * stride, stride), threshold)) << j;
+            }
+            bits[i / 64] = word;
+            hits += __builtin_popcountll(word);
+        }
+        return hits + compareTail<Op>(values, i, count, stride, value, bits);
+    }
+};
+
+
+
+/*!
+*	\brief Kernels of the SSE2 level.
+*/
+static const SimdKernels::Kernel_Table *sseKernels(){
+    static const SimdKernels::Kernel_Table kernels = {sseSum, sseMin, sseMax, dispatch<SseCompare>};
+    return &kernels;
+}
+
+
+
+/*!
+*	\brief Loads eight values, stride floats apart.
+*/
+template <bool Strided>
+AVX2 static inline __m256 load8(const float *values, __m256i index){
+    return Strided ? _mm256_i32gather_ps(values, index, 4) : _mm256_loadu_ps(values);
+}
+
+
+
+/*!
+*	\brief Gather offsets of eight values, stride floats apart.
+*/
+AVX2 static inline __m256i gatherIndex(long stride){
+    return _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int) stride));
+}
+
+
+
+/*!
+*	\brief Sums count values, stride floats apart, eight at a time.
+*/
+template <bool Strided>
+AVX2 static double avx2SumOf(const float *values, long count, long stride){
+    __m256i index = gatherIndex(stride);
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 8 <= count; i += 8){
+        __m256 v = load8<Strided>(values + i * stride, index);
+        acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+        acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalarSum(values + i * stride, count - i, stride);
+}
+
+
+
+/*!
+*	\brief Sums count values, stride floats apart, with loads for a column and gathers otherwise.
+*/
+AVX2 static double avx2Sum(const float *values, long count, long stride){
+    return stride == 1 ? avx2SumOf<false>(values, count, stride) : avx2SumOf<true>(values, count, stride);
+}
+
+
+
+/*!
+*	\brief Finds the minimum of count values, stride floats apart, eight at a time.
+*/
+template <bool Strided>
+AVX2 static float avx2MinOf(const float *values, long count, long stride){
+    if (count < 8){
+        return scalarMin(values, count, stride);
+    }
+    __m256i index = gatherIndex(stride);
+    __m256 acc = load8<Strided>(values, index);
+    long i = 8;
+    for (; i + 8 <= count; i += 8){
+        acc = _mm256_min_ps(acc, load8<Strided>(values + i * stride, index));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    float min = scalarMin(lanes, 8, 1);
+    return i < count ? std::min(min, scalarMin(values + i * stride, count - i, stride)) : min;
+}
+
+
+
+/*!
+*	\brief Finds the minimum of count values, stride floats apart, with loads for a column and gathers otherwise.
+*/
+AVX2 static float avx2Min(const float *values, long count, long stride){
+    return stride == 1 ? avx2MinOf<false>(values, count, stride) : avx2MinOf<true>(values, count, stride);
+}
+
+
+
+/*!
+*	\brief Finds the maximum of count values, stride floats apart, eight at a time.
+*/
+template <bool Strided>
+AVX2 static float avx2MaxOf(const float *values, long count, long stride){
+    if (count < 8){
+        return scalarMax(values, count, stride);
+    }
+    __m256i index = gatherIndex(stride);
+    __m256 acc = load8<Strided>(values, index);
+    long i = 8;
+    for (; i + 8 <= count; i += 8){
+        acc = _mm256_max_ps(acc, load8<Strided>(values + i * stride, index));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    float max = scalarMax(lanes, 8, 1);
+    return i < count ? std::max(max, scalarMax(values + i * stride, count - i, stride)) : max;
+}
+
+
+
+/*!
+*	\brief Finds the maximum of count values, stride floats apart, with loads for a column and gathers otherwise.
+*/
+AVX2 static float avx2Max(const float *values, long count, long stride){
+    return stride == 1 ? avx2MaxOf<false>(values, count, stride) : avx2MaxOf<true>(values, count, stride);
+}
+
+
+
+/*!
+*	\brief Compares eight values against a threshold.
+*/
+template <int Op>
+AVX2 static inline __m256 avx2Test(__m256 v, __m256 value){
+    switch (Op){
+    case FILTER_LT:
+        return _mm256_cmp_ps(v, value, _CMP_LT_OQ);
+    case FILTER_LE:
+        return _mm256_cmp_ps(v, value, _CMP_LE_OQ);
+    case FILTER_GT:
+        return _mm256_cmp_ps(v, value, _CMP_GT_OQ);
+    case FILTER_GE:
+        return _mm256_cmp_ps(v, value, _CMP_GE_OQ);
+    case FILTER_EQ:
+        return _mm256_cmp_ps(v, value, _CMP_EQ_OQ);
+    default: //unordered, so NaN is not equal to anything, as in C++
+        return _mm256_cmp_ps(v, value, _CMP_NEQ_UQ);
+    }
+}
+
+
+
+/*!
+*	\brief Compares count values, stride floats apart, into a bitmask, a word of 64 values at a time.
+*/
+template <int Op, bool Strided>
+AVX2 static long avx2CompareOf(const float *values, long count, long stride, float value, uint64_t *bits){
+    __m256i index = gatherIndex(stride);
+    __m256 threshold = _mm256_set1_ps(value);
+    long hits = 0;
+    long i = 0;
+    for (; i + 64 <= count; i += 64){
+        uint64_t word = 0;
+        for (int j = 0; j < 64; j += 8){
+            __m256 v = load8<Strided>(values + (i + j) * stride, index);
+            word |= (uint64_t) _mm256_movemask_ps(avx2Test<Op>(v, threshold)) << j;
+        }
+        bits[i / 64] = word;
+        hits += __builtin_popcountll(word);
+    }
+    return hits + compareTail<Op>(values, i, count, stride, value, bits);
+}
+
+
+
+/*!
+*	\brief Compares count values, stride floats apart, into a bitmask, with loads for a column and gathers otherwise.
+*/
+template <int Op>
+struct Avx2Compare{
+    AVX2 static long run(const float *values, long count, long stride, float value, uint64_t *bits){
+        if (stride == 1){
+            return avx2CompareOf<Op, false>(values, count, stride, value, bits);
+        }
+        return avx2CompareOf<Op, true>(values, count, stride, value, bits);
+    }
+};
+
+
+
+/*!
+*	\brief Kernels of the AVX2 level.
+*/
+static const SimdKernels::Kernel_Table *avx2Kernels(){
+    static const SimdKernels::Kernel_Table kernels = {avx2Sum, avx2Min, avx2Max, dispatch<Avx2Compare>};
+    return &kernels;
+}
+
+#endif
+
+
+
+/*!
+*	\brief Finds the best level the processor supports.
+*/
+Simd_Level SimdKernels::detect(){
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")){
+        return SIMD_SSE;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+
+
+/*!
+*	\brief Level in use.
+*/
+Simd_Level SimdKernels::level(){
+    kernels();
+    return current;
+}
+
+
+
+/*!
+*	\brief Picks the level kernels run at.
+*/
+Simd_Level SimdKernels::setLevel(Simd_Level level){
+    Simd_Level best = detect();
+    current = level > best ? best : level;
+#ifdef SIMD_X86
+    table = current == SIMD_AVX2 ? avx2Kernels() : current == SIMD_SSE ? sseKernels() : scalarKernels();
+#else
+    table = scalarKernels();
+#endif
+    return current;
+}
+
+
+
+/*!
+*	\brief Names a level.
+*/
+const char *SimdKernels::name(Simd_Level level){
+    switch (level){
+    case SIMD_AVX2:
+        return "avx2";
+    case SIMD_SSE:
+        return "sse";
+    default:
+        return "scalar";
+    }
+}
+
+
+
+/*!
+*	\brief Kernels of the level in use.
+*/
+const SimdKernels::Kernel_Table *SimdKernels::kernels(){
+    if (table == NULL){
+        setLevel(detect());
+    }
+    return table;
+}
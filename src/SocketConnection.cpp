@@ -9,7 +9,7 @@
 *	\brief Constructs a SocketConnection.
 */
 SocketConnection::SocketConnection(const int sockfd, const sockaddr_in addr) :
-    socketfd(sockfd), address(addr) {}
+    socketfd(sockfd), address(addr), queueWrites(false), outputSent(0) {}
 
 
 
@@ -30,6 +30,9 @@ int SocketConnection::readMessage(Record_Message &msg){
     // printf("Reading.\n");
     int r; 
     if ( (r = read(socketfd, &msg, sizeof(Record_Message) ) ) < 0){
+        if (errno == EAGAIN || errno == EWOULDBLOCK){
+            return -1;
+        }
         perror("Read:");
         return 0;
     }
@@ -51,6 +54,9 @@ int SocketConnection::readMessage(void* msg, int size){
     // printf("Reading.\n");
     int r; 
     if ( (r = read(socketfd, msg, size ) ) < 0){
+        if (errno == EAGAIN || errno == EWOULDBLOCK){
+            return -1;
+        }
         perror("Read:");
         return 0;
     }
@@ -67,16 +73,7 @@ int SocketConnection::readMessage(void* msg, int size){
 */
 int SocketConnection::writeMessage(Record_Message &msg){
     // printf("Writing.\n");
-    int w;
-    if ( (w = write(socketfd, &msg, sizeof(Record_Message) ) ) < 0){
-        perror("Write:");
-        return 0;
-    }
-    else{
-        // printf("Wrote: %d\n", w);
-        // printf("msg.arg = %d\n", msg.arg);
-        return w;
-    }
+    return writeAll(&msg, sizeof(Record_Message));
 }
 
 
@@ -86,15 +83,201 @@ int SocketConnection::writeMessage(Record_Message &msg){
 */
 int SocketConnection::writeMessage(void* msg, int size){
     // printf("Writing.\n");
-    int w;
-    if ( (w = write(socketfd, msg, size ) ) < 0){
-        perror("Write:");
-        return 0;
+    return writeAll(msg, size);
+}
+
+
+
+/*!
+*	\brief Writes an entire buffer.
+*/
+int SocketConnection::writeAll(const void* buf, int size){
+    const char* p = (const char*) buf;
+    int total = 0;
+
+    //queued for the owner, or behind output still waiting for the socket
+    if (queueWrites || !output.empty()){
+        output.insert(output.end(), p, p + size);
+        return size;
     }
-    else{
-        // printf("Wrote: %d\n", w);
-        return w;
+
+    while (total < size){
+        int w = write(socketfd, p + total, size - total);
+        if (w < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                //send buffer full - the owner sends the rest once the peer drains it
+                output.insert(output.end(), p + total, p + size);
+                return size;
+            }
+            perror("Write:");
+            return 0;
+        }
+        total += w;
+    }
+
+    return total;
+}
+
+
+
+/*!
+*	\brief Sends buffered output without blocking.
+*/
+int SocketConnection::sendOutput(){
+    while (outputSent < output.size()){
+        int w = send(socketfd, output.data() + outputSent, output.size() - outputSent, MSG_NOSIGNAL);
+        if (w < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                return output.size() - outputSent;
+            }
+            perror("Write:");
+            return -1;
+        }
+        outputSent += w;
+    }
+
+    output.clear();
+    outputSent = 0;
+    return 0;
+}
+
+
+
+/*!
+*	\brief Reads a whole message from a non-blocking socket.
+*/
+CoTask<int> SocketConnection::asyncRead(CoExecutor &executor, void* msg, int size){
+    char* p = (char*) msg;
+    int total = 0;
+
+    memset(msg, 0, size);
+
+    while (total < size){
+        int r = read(socketfd, p + total, size - total);
+        if (r == 0){
+            co_return 0;
+        }
+        if (r < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                co_await executor.readable(socketfd);
+                continue;
+            }
+            perror("Read:");
+            co_return 0;
+        }
+        total += r;
+    }
+
+    co_return total;
+}
+
+
+
+/*!
+*	\brief Writes a whole message to a non-blocking socket.
+*/
+CoTask<int> SocketConnection::asyncWrite(CoExecutor &executor, const void* msg, int size){
+    const char* p = (const char*) msg;
+    int total = 0;
+
+    while (total < size){
+        int w = send(socketfd, p + total, size - total, MSG_NOSIGNAL);
+        if (w < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK){
+                co_await executor.writable(socketfd);
+                continue;
+            }
+            perror("Write:");
+            co_return 0;
+        }
+        total += w;
+    }
+
+    co_return total;
+}
+
+
+
+/*!
+*	\brief Buffers whatever has arrived on the socket.
+*/
+int SocketConnection::receive(){
+    return input.fill(socketfd);
+}
+
+
+
+/*!
+*	\brief Buffers the next bytes to arrive on a non-blocking socket.
+*/
+CoTask<int> SocketConnection::asyncReceive(CoExecutor &executor){
+    int r;
+    while ( (r = input.fill(socketfd)) == -1){
+        co_await executor.readable(socketfd);
+    }
+    co_return r;
+}
+
+
+
+/*!
+*	\brief Waits for the next complete message.
+*/
+bool SocketConnection::readFrame(Frame &frame){
+    while (!input.next(frame)){
+        if (input.hasFailed() || input.fill(socketfd) <= 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+/*!
+*	\brief Writes a protocol v2 frame.
+*/
+int SocketConnection::writeFrame(int opcode, uint32_t requestId, const void* payload, int length){
+    Frame_Header header;
+    header.magic = FRAME_MAGIC;
+    header.version = PROTOCOL_V2;
+    header.opcode = opcode;
+    header.requestId = requestId;
+    header.length = length;
+
+    frameBuffer.resize(sizeof(Frame_Header) + length);
+    memcpy(frameBuffer.data(), &header, sizeof(Frame_Header));
+    if (length > 0){
+        memcpy(frameBuffer.data() + sizeof(Frame_Header), payload, length);
+    }
+
+    return writeAll(frameBuffer.data(), frameBuffer.size());
+}
+
+
+
+/*!
+*	\brief Puts the socket in non-blocking mode.
+*/
+bool SocketConnection::setNonBlocking(){
+    int flags = fcntl(socketfd, F_GETFL, 0);
+    if (flags == -1 || fcntl(socketfd, F_SETFL, flags | O_NONBLOCK) == -1){
+        perror("fcntl O_NONBLOCK");
+        return false;
     }
+    return true;
 }
 
 
@@ -0,0 +1,310 @@
+/*!	\file UringLoop.cpp
+*	\brief  UringLoop class implementation file.
+*/
+
+#include "UringLoop.h"
+
+#define RING_ENTRIES 256
+#define STATS_INTERVAL 100000
+
+
+
+/*!
+*	\brief Constructs a UringLoop.
+*/
+UringLoop::UringLoop(const int listenfd, const int bfd, const int lfd, const int semid, int *connectionCount) :
+    listenfd(listenfd), binfd(bfd), logfd(lfd), semid(semid), connectionCount(connectionCount),
+    logFile(NULL), acceptLength(0), requests(0)
+{}
+
+
+
+/*!
+*	\brief Destructor. Closes all connections.
+*/
+UringLoop::~UringLoop(){
+    for (Uring_Connection *conn : connections){
+        delete conn->server;
+        delete conn;
+    }
+    connections.clear();
+    delete logFile;
+}
+
+
+
+/*!
+*	\brief Sets up the ring.
+*/
+bool UringLoop::init(){
+    if (!ring.init(RING_ENTRIES)){
+        return false;
+    }
+
+    logFile = new CriticalFile<Server_Log_Entry>(dup(logfd), SemaphoreSet(semid, 1));
+
+    //the ring waits for readiness itself, so the listener can block
+    int flags = fcntl(listenfd, F_GETFL, 0);
+    fcntl(listenfd, F_SETFL, flags & ~O_NONBLOCK);
+    return true;
+}
+
+
+
+/*!
+*	\brief Event loop lifetime.
+*/
+void UringLoop::run(){
+    printf("%d: io_uring loop servicing connections.\n", getpid());
+
+    io_uring_cqe cqe;
+
+    //block all signals
+    sigset_t sigset, oldset;
+    sigfillset(&sigset);
+    sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+    queueAccept();
+
+    while (1)
+    {
+        //unblock signals while waiting
+        sigemptyset(&sigset);
+        sigaddset(&sigset, SIGINT);
+        sigaddset(&sigset, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &sigset, &oldset);
+
+        //submit everything queued in the last pass and wait for at least one completion
+        if (ring.submit(1) == -1){
+            return;
+        }
+
+        sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+        while (ring.peekCompletion(cqe)){
+            Uring_Op op = (Uring_Op) (cqe.user_data & 0x3);
+            Uring_Connection *conn = (Uring_Connection*) (cqe.user_data & ~(__u64)0x3);
+
+            switch (op){
+            case OP_ACCEPT:
+                completeAccept(cqe.res);
+                break;
+            case OP_RECV:
+                completeRecv(conn, cqe.res);
+                break;
+            case OP_SEND:
+                completeSend(conn, cqe.res);
+                break;
+            }
+        }
+
+        flushLogs();
+    }
+}
+
+
+
+/*!
+*	\brief Gets a submission queue entry, flushing the queue if it is full.
+*/
+io_uring_sqe* UringLoop::getSqe(){
+    io_uring_sqe *sqe;
+    while ( (sqe = ring.getSqe()) == NULL){
+        ring.submit(0);
+    }
+    return sqe;
+}
+
+
+
+/*!
+*	\brief Queues an accept on the listening socket.
+*/
+void UringLoop::queueAccept(){
+    memset(&acceptAddress, 0x0, sizeof(sockaddr_in));
+    acceptLength = sizeof(sockaddr_in);
+
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->addr = (__u64) &acceptAddress;
+    sqe->addr2 = (__u64) &acceptLength;
+    sqe->user_data = OP_ACCEPT;
+}
+
+
+
+/*!
+*	\brief Queues a receive on the connection.
+*/
+void UringLoop::queueRecv(Uring_Connection *conn){
+    //whatever has arrived, possibly several requests or part of one
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->addr = (__u64) conn->inbox;
+    sqe->len = URING_RECV_SIZE;
+    sqe->user_data = (__u64) conn | OP_RECV;
+    conn->inflight++;
+}
+
+
+
+/*!
+*	\brief Queues the buffered reply, linked to the next receive.
+*/
+void UringLoop::queueReply(Uring_Connection *conn){
+    std::vector<char> &output = conn->server->getOutput();
+
+    //MSG_WAITALL makes the kernel finish short sends itself, so the link only breaks on errors
+    io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (__u64) output.data();
+    sqe->len = output.size();
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (__u64) conn | OP_SEND;
+    conn->inflight++;
+
+    queueRecv(conn);
+}
+
+
+
+/*!
+*	\brief Handles an accept completion.
+*/
+void UringLoop::completeAccept(int res){
+    queueAccept();
+
+    if (res < 0){
+        errno = -res;
+        perror("Accept:");
+        return;
+    }
+
+    int bfd = dup(binfd);
+    int lfd = dup(logfd);
+    if (bfd == -1 || lfd == -1){
+        perror("dup");
+        if (bfd != -1) close(bfd);
+        if (lfd != -1) close(lfd);
+        close(res);
+        return;
+    }
+
+    if (connectionCount != NULL){
+        (*connectionCount)++;
+    }
+    printf("Client connected: %s : %d\n", inet_ntoa(acceptAddress.sin_addr), (int)ntohs(acceptAddress.sin_port));
+
+    Uring_Connection *conn = new Uring_Connection;
+    conn->server = new Server(bfd, res, lfd, acceptAddress, semid);
+    conn->fd = res;
+    conn->inflight = 0;
+    conn->closing = false;
+    conn->server->setAsyncIO(&logQueue);
+    connections.insert(conn);
+
+    conn->server->logConnection();
+    queueRecv(conn);
+}
+
+
+
+/*!
+*	\brief Handles a receive completion by servicing the received requests.
+*/
+void UringLoop::completeRecv(Uring_Connection *conn, int res){
+    conn->inflight--;
+
+    if (conn->closing || res <= 0){
+        //0 is a disconnection, -ECANCELED follows a failed linked send
+        if (!conn->closing && res == 0){
+            conn->server->logDisconnection();
+        }
+        closeConnection(conn);
+        return;
+    }
+
+    conn->server->feed(conn->inbox, res);
+    int handled = conn->server->handleMessages();
+    if (handled == -1){
+        conn->server->logDisconnection();
+        closeConnection(conn);
+        return;
+    }
+
+    unsigned long before = requests;
+    requests += handled;
+    if (requests / STATS_INTERVAL != before / STATS_INTERVAL){
+        printf("%d: %lu requests, %.3f io_uring_enter calls per request.\n", getpid(), requests,
+            (double) ring.getEnterCalls() / requests);
+    }
+
+    if (conn->server->getOutput().empty()){
+        queueRecv(conn);
+    }
+    else{
+        queueReply(conn);
+    }
+}
+
+
+
+/*!
+*	\brief Handles a send completion.
+*/
+void UringLoop::completeSend(Uring_Connection *conn, int res){
+    conn->inflight--;
+    std::vector<char> &output = conn->server->getOutput();
+
+    if (conn->closing || res < 0 || (size_t) res != output.size()){
+        if (!conn->closing && res < 0){
+            errno = -res;
+            perror("Write:");
+        }
+        closeConnection(conn);
+        return;
+    }
+
+    output.clear();
+}
+
+
+
+/*!
+*	\brief Closes a connection once none of its requests are in flight.
+*/
+void UringLoop::closeConnection(Uring_Connection *conn){
+    if (!conn->closing){
+        conn->closing = true;
+        //completes any pending receive
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+
+    if (conn->inflight > 0){
+        return;
+    }
+
+    connections.erase(conn);
+    delete conn->server;
+    delete conn;
+}
+
+
+
+/*!
+*	\brief Appends the queued log entries.
+*/
+void UringLoop::flushLogs(){
+    if (logQueue.empty()){
+        return;
+    }
+
+    if (!logFile->writeRecords(logQueue.data(), logQueue.size())){
+        printf("Error writing to log.\n");
+    }
+    logQueue.clear();
+}
@@ -0,0 +1,541 @@
+/*!	\file VersionStore.cpp
+*	\brief  VersionStore class implementation file.
+*/
+
+#include "VersionStore.h"
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+#define VERSION_DEAD UINT64_MAX
+
+//slot a thread last announced in, so a reader usually finds its own slot free on the first try
+static thread_local int slotHint = -1;
+
+
+
+/*!
+*	\brief Checks if a process has exited.
+*/
+static bool gone(int pid){
+    return pid > 0 && kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+
+
+/*!
+*	\brief Creates the shared store.
+*/
+VersionStore::VersionStore(int capacity, int recordSize){
+    size_t entrySize = (sizeof(Version_Entry) + recordSize + 7) / 8 * 8;
+    size = sizeof(Version_Header) + VERSION_BUCKETS * (sizeof(std::atomic<int>) + sizeof(std::atomic<uint64_t>)) +
+        VERSION_SLOTS * (sizeof(std::atomic<uint64_t>) + sizeof(std::atomic<int>)) + capacity * entrySize;
+
+    void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED){
+        perror("Version store mmap");
+        exit(3);
+    }
+
+    //lock-free atomics work across processes in a shared mapping, since they never touch process-local state
+    header = new (segment) Version_Header();
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->writing, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+    changes = (std::atomic<uint64_t> *) (header + 1);
+    slots = changes + VERSION_BUCKETS;
+    readers = (std::atomic<int> *) (slots + VERSION_SLOTS);
+    buckets = readers + VERSION_SLOTS;
+    entries = (char *) (buckets + VERSION_BUCKETS);
+
+    header->committed = 1;
+    header->issued = 1;
+    header->bulkCommit = 0;
+    header->records = -1;
+    header->bulk = 0;
+    header->turns = 0;
+    header->sleepers = 0;
+    memset(header->owners, 0, sizeof(header->owners));
+    header->head = header->tail = header->reclaim = 0;
+    header->capacity = capacity;
+    header->numBuckets = VERSION_BUCKETS;
+    header->numSlots = VERSION_SLOTS;
+    header->recordSize = recordSize;
+    header->entrySize = entrySize;
+    header->versions = header->reclaimed = header->waits = header->ordered = header->abandoned = 0;
+    for (int b = 0; b < VERSION_BUCKETS; b++){
+        new (&changes[b]) std::atomic<uint64_t>(0);
+        new (&buckets[b]) std::atomic<int>(-1);
+    }
+    for (int s = 0; s < VERSION_SLOTS; s++){
+        new (&slots[s]) std::atomic<uint64_t>(0);
+        new (&readers[s]) std::atomic<int>(0);
+    }
+    for (int i = 0; i < capacity; i++){
+        new (entry(i)) Version_Entry();
+    }
+}
+
+
+
+/*!
+*	\brief Unmaps the segment.
+*/
+VersionStore::~VersionStore(){
+    munmap(header, size);
+}
+
+
+
+/*!
+*	\brief Takes a snapshot and announces it in a free slot.
+*/
+int VersionStore::announce(uint64_t &snapshot){
+    int slot = (slotHint >= 0) ? slotHint : getpid() % header->numSlots;
+    snapshot = header->committed.load();
+    for (int tries = 0; ; tries++){
+        uint64_t expected = 0;
+        if (slots[slot].compare_exchange_strong(expected, snapshot)){
+            break;
+        }
+        slot = (slot + 1) % header->numSlots;
+        if (tries % header->numSlots == header->numSlots - 1){
+            reapReaders(); //every slot taken, maybe by readers that died
+            sched_yield();
+        }
+    }
+    slotHint = slot;
+    readers[slot].store(getpid());
+
+    for (uint64_t now; (now = header->committed.load()) != snapshot;){
+        snapshot = now;
+        slots[slot].store(snapshot);
+    }
+    return slot;
+}
+
+
+
+/*!
+*	\brief Finds the oldest announced snapshot.
+*/
+uint64_t VersionStore::oldestSnapshot(){
+    uint64_t oldest = UINT64_MAX;
+    for (int s = 0; s < header->numSlots; s++){
+        uint64_t snapshot = slots[s].load();
+        if (snapshot != 0 && snapshot < oldest){
+            oldest = snapshot;
+        }
+    }
+    return oldest;
+}
+
+
+
+/*!
+*	\brief Reads a record as of a snapshot, without locks.
+*/
+int VersionStore::read(int recordNumber, void *buf, std::function<bool(void*)> load){
+    if (recordNumber < 0){
+        return VERSION_ABSENT;
+    }
+    header->reads++;
+
+    uint64_t snapshot;
+    int slot = announce(snapshot);
+    int b = bucket(recordNumber);
+    int result;
+    while (true){
+        uint64_t bulk = header->bulk.load();
+        if (bulk & 1){
+            header->locked++;
+            result = VERSION_LOCKED;
+            break;
+        }
+        uint64_t changed = changes[b].load();
+
+        //newest first, so the first version the snapshot sees is the one to read
+        bool versioned = false;
+        bool found = false;
+        for (int i = buckets[b].load(); i != -1; i = entry(i)->next.load()){
+            Version_Entry *e = entry(i);
+            uint64_t stamp = e->begin.load();
+            if (e->recordNumber != recordNumber || stamp == VERSION_DEAD){
+                continue;
+            }
+            versioned = true;
+            if (stamp <= snapshot){
+                memcpy(buf, contents(e), header->recordSize);
+                found = true;
+                break;
+            }
+        }
+        if (found){
+            header->versioned++;
+            result = VERSION_READ;
+            break;
+        }
+        if (versioned){
+            result = VERSION_ABSENT; //only appended after the snapshot
+            break;
+        }
+
+        //no versions, so the file holds what the snapshot sees, unless a writer got to the record while it was read
+        long records = header->records.load();
+        bool loaded = (records < 0 || recordNumber < records) && load(buf);
+        if (changes[b].load() == changed && header->bulk.load() == bulk){
+            result = loaded ? VERSION_READ : VERSION_ABSENT;
+            break;
+        }
+        header->retries++;
+    }
+
+    readers[slot].store(0);
+    slots[slot].store(0);
+    return result;
+}
+
+
+
+/*!
+*	\brief Checks if no reader needs an entry any more.
+*/
+bool VersionStore::obsolete(long position, uint64_t oldest){
+    Version_Entry *e = entry(position);
+    uint64_t stamp = e->begin.load();
+    if (stamp == VERSION_DEAD){
+        return true;
+    }
+    if (stamp > oldest){
+        return false;
+    }
+
+    //the entry is the oldest linked one, so every other live entry of its record in the bucket is newer
+    bool newest = true;
+    uint64_t newer = 0;
+    for (int i = buckets[bucket(e->recordNumber)].load(); i != -1; i = entry(i)->next.load()){
+        Version_Entry *n = entry(i);
+        if (n == e){
+            break;
+        }
+        if (n->recordNumber == e->recordNumber && n->begin.load() != VERSION_DEAD){
+            newest = false;
+            newer = n->begin.load(); //ends as the next newer version
+        }
+    }
+    return newest || newer <= oldest;
+}
+
+
+
+/*!
+*	\brief Drops obsolete entries from the tail of the ring and frees those no reader can be looking at.
+*/
+long VersionStore::collect(){
+    uint64_t committed = header->committed.load();
+    uint64_t oldest = std::min(committed, oldestSnapshot());
+
+    while (header->tail < header->head && obsolete(header->tail, oldest)){
+        //the oldest linked entry is the last of its bucket
+        Version_Entry *e = entry(header->tail);
+        int index = header->tail % header->capacity;
+        std::atomic<int> *link = &buckets[bucket(e->recordNumber)];
+        while (link->load() != index){
+            link = &entry(link->load())->next;
+        }
+        link->store(-1);
+        e->retired = committed;
+        header->tail++;
+        header->reclaimed++;
+    }
+
+    //a reader announced after the unlinks cannot reach the entries, and neither can one that saw a later commit
+    uint64_t active = oldestSnapshot();
+    while (header->reclaim < header->tail && entry(header->reclaim)->retired < active){
+        header->reclaim++;
+    }
+    return header->capacity - (long) (header->head - header->reclaim);
+}
+
+
+
+/*!
+*	\brief Links a new entry at the head of its bucket.
+*/
+void VersionStore::push(int recordNumber, uint64_t begin, const void *record){
+    Version_Entry *e = entry(header->head);
+    int b = bucket(recordNumber);
+    e->recordNumber = recordNumber;
+    memcpy(contents(e), record, header->recordSize);
+    e->begin.store(begin);
+    e->next.store(buckets[b].load());
+    buckets[b].store(header->head % header->capacity);
+    header->head++;
+    header->versions++;
+}
+
+
+
+/*!
+*	\brief Stamps a write's records as versions readers will see once it is published.
+*/
+uint64_t VersionStore::begin(const int *recordNumbers, const void *records, int count, long numRecords,
+    std::function<bool(int, void*)> current){
+    //writers of different records may get here together; only the stamping is done one at a time
+    lockWriting(true);
+    for (int tries = 1; header->issued - header->committed.load() >= VERSION_OWNERS; tries++){
+        if (tries % 1024 == 0){
+            skipDead();
+        }
+        sched_yield();
+    }
+    //the owner goes in first, so the commit is never in flight with another process's pid
+    header->owners[(header->issued + 1) % VERSION_OWNERS] = getpid();
+    uint64_t commit = ++header->issued;
+    if (header->records.load() < 0 && numRecords >= 0){
+        header->records = numRecords;
+    }
+
+    if (count > header->capacity / 4){
+        //too many to version: readers of the records wait for the writer lock until publish, and see the new contents after.
+        //Other writers wait here until then, so bulk only changes for this write.
+        header->bulkCommit = commit;
+        header->bulk++;
+        for (int r = 0; r < count; r++){
+            for (int i = buckets[bucket(recordNumbers[r])].load(); i != -1; i = entry(i)->next.load()){
+                if (entry(i)->recordNumber == recordNumbers[r]){
+                    entry(i)->begin.store(VERSION_DEAD);
+                }
+            }
+        }
+        return commit;
+    }
+
+    std::vector<char> old(header->recordSize);
+    long free = collect();
+    for (int r = 0; r < count; r++){
+        for (int tries = 0; free < 2; tries++){
+            //a reader or writer that died keeps its snapshot or its versions pinned until it is cleared
+            if (tries % 1024 == 0){
+                reapReaders();
+                skipDead();
+            }
+            header->waits++;
+            sched_yield();
+            free = collect();
+        }
+
+        int number = recordNumbers[r];
+        bool versioned = false;
+        for (int i = buckets[bucket(number)].load(); i != -1 && !versioned; i = entry(i)->next.load()){
+            versioned = entry(i)->recordNumber == number && entry(i)->begin.load() != VERSION_DEAD;
+        }
+        if (!versioned && current(number, old.data())){
+            push(number, 0, old.data()); //what snapshots from before see
+            free--;
+        }
+        push(number, commit, (const char *) records + (size_t) r * header->recordSize);
+        free--;
+        changes[bucket(number)]++;
+    }
+    pthread_mutex_unlock(&header->writing);
+    return commit;
+}
+
+
+
+/*!
+*	\brief Waits until every earlier write is published or aborted.
+*/
+void VersionStore::awaitTurn(uint64_t commit){
+    if (header->committed.load() == commit - 1){
+        return;
+    }
+    header->ordered++;
+    while (true){
+        //counted as sleeping before checking, so a publish after the check sees the sleeper and wakes it
+        uint32_t seen = header->turns.load();
+        header->sleepers++;
+        if (header->committed.load() == commit - 1){
+            header->sleepers--;
+            return;
+        }
+        timespec nap = {0, VERSION_NAP_NS};
+        long slept = syscall(SYS_futex, (uint32_t *) &header->turns, FUTEX_WAIT, seen, &nap, NULL, 0);
+        header->sleepers--;
+
+        //nobody published for a while: the write ahead may belong to a process that died
+        if (slept == -1 && errno == ETIMEDOUT && lockWriting(false)){
+            skipDead();
+            pthread_mutex_unlock(&header->writing);
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Publishes a sequence number and wakes the writers waiting for their turn.
+*/
+void VersionStore::advance(uint64_t commit){
+    header->committed = commit;
+    header->turns++;
+    if (header->sleepers.load() > 0){
+        syscall(SYS_futex, (uint32_t *) &header->turns, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+
+
+/*!
+*	\brief Takes the stamping mutex, repairing the ring if its holder died.
+*/
+bool VersionStore::lockWriting(bool wait){
+    int locked = wait ? pthread_mutex_lock(&header->writing) : pthread_mutex_trylock(&header->writing);
+    if (locked == EOWNERDEAD){
+        //a push is complete once its entry heads the bucket; only counting it in head may be missing
+        Version_Entry *e = entry(header->head);
+        if (buckets[bucket(e->recordNumber)].load() == (int) (header->head % header->capacity)){
+            header->head++;
+        }
+        pthread_mutex_consistent(&header->writing);
+        locked = 0;
+    }
+    return locked == 0;
+}
+
+
+
+/*!
+*	\brief Aborts the oldest writes in flight while their processes are gone.
+*/
+void VersionStore::skipDead(){
+    while (header->committed.load() < header->issued){
+        uint64_t commit = header->committed.load() + 1;
+        if (!gone(header->owners[commit % VERSION_OWNERS])){
+            return;
+        }
+
+        //as in abort; the file holds whatever the write got to, as after any crash without the log
+        uint64_t head = header->head.load();
+        for (uint64_t p = header->tail.load(); p < head; p++){
+            if (entry(p)->begin.load() == commit){
+                entry(p)->begin.store(VERSION_DEAD);
+                changes[bucket(entry(p)->recordNumber)]++;
+            }
+        }
+        //its holder is dead, and this writer holds writing now, so the bulk write ends here
+        if (header->bulkCommit == commit){
+            header->bulkCommit = 0;
+            header->bulk++;
+        }
+        header->abandoned++;
+        advance(commit);
+    }
+}
+
+
+
+/*!
+*	\brief Frees the slots announced by processes that are gone.
+*/
+void VersionStore::reapReaders(){
+    for (int s = 0; s < header->numSlots; s++){
+        int pid = readers[s].load();
+        if (pid != 0 && gone(pid)){
+            //the pid goes first, so a reader taking the slot after it is freed keeps its own
+            readers[s].store(0);
+            slots[s].store(0);
+            header->abandoned++;
+        }
+    }
+}
+
+
+
+/*!
+*	\brief Makes a write visible to new snapshots.
+*/
+void VersionStore::publish(uint64_t commit, long numRecords){
+    //earlier writes need nothing this writer holds to finish, so waiting for them cannot deadlock
+    awaitTurn(commit);
+    if (numRecords >= 0){
+        header->records = numRecords;
+    }
+    advance(commit);
+    if (header->bulkCommit == commit){
+        header->bulkCommit = 0;
+        header->bulk++;
+        pthread_mutex_unlock(&header->writing);
+    }
+}
+
+
+
+/*!
+*	\brief Discards the versions of a write that failed and was rolled back.
+*/
+void VersionStore::abort(uint64_t commit){
+    //no snapshot could see them yet, so they are still linked; the contents from before the write stay, as the file holds them again
+    uint64_t head = header->head.load();
+    for (uint64_t p = header->tail.load(); p < head; p++){
+        if (entry(p)->begin.load() == commit){
+            entry(p)->begin.store(VERSION_DEAD);
+        }
+    }
+
+    //later writes wait for this sequence number to be taken
+    awaitTurn(commit);
+    advance(commit);
+    if (header->bulkCommit == commit){
+        header->bulkCommit = 0;
+        header->bulk++;
+        pthread_mutex_unlock(&header->writing);
+    }
+}
+
+
+
+/*!
+*	\brief Reads the counters.
+*/
+Version_Stats VersionStore::stats(){
+    Version_Stats stats;
+    stats.reads = header->reads.load();
+    stats.versioned = header->versioned.load();
+    stats.retries = header->retries.load();
+    stats.locked = header->locked.load();
+    stats.versions = header->versions.load();
+    stats.reclaimed = header->reclaimed.load();
+    stats.waits = header->waits.load();
+    stats.ordered = header->ordered.load();
+    stats.abandoned = header->abandoned.load();
+    stats.live = (int) (header->head - header->tail);
+    return stats;
+}
+
+
+
+/*!
+*	\brief Prints the counters.
+*/
+void VersionStore::printStats(){
+    Version_Stats s = stats();
+    printf("Version store: %ld snapshot reads | %ld from versions | %ld retried | %ld locked | %ld versions | %ld reclaimed | %d live | %ld writer waits | %ld ordered publishes | %ld abandoned\n",
+        s.reads, s.versioned, s.retries, s.locked, s.versions, s.reclaimed, s.live, s.waits, s.ordered, s.abandoned);
+}
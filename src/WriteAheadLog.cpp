@@ -0,0 +1,357 @@
+/*!	\file WriteAheadLog.cpp
+*	\brief  WriteAheadLog class implementation file.
+*/
+
+#include "WriteAheadLog.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <set>
+#include <vector>
+
+
+
+/*!
+*	\brief Creates the shared log state.
+*/
+WriteAheadLog::WriteAheadLog(int fd, Durability_Mode mode) : fd(fd), mode(mode){
+    void *segment = mmap(NULL, sizeof(Wal_State), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED){
+        perror("Log mmap");
+        exit(3);
+    }
+    state = (Wal_State *) segment;
+
+    //both live in the segment, so they must be shareable between processes
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&state->lock, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&state->synced, &cattr);
+    pthread_cond_init(&state->drained, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    struct stat st;
+    long size = (fstat(fd, &st) == -1) ? 0 : st.st_size;
+    state->appended = size;
+    state->durable = size;
+    state->base = 0;
+    state->syncing = 0;
+    state->inflight = 0;
+    state->checkpointing = 0;
+    state->commits = 0;
+    state->syncs = 0;
+    state->checkpoints = 0;
+}
+
+
+
+/*!
+*	\brief Unmaps the state.
+*/
+WriteAheadLog::~WriteAheadLog(){
+    munmap(state, sizeof(Wal_State));
+}
+
+
+
+/*!
+*	\brief Checksums an entry.
+*/
+uint32_t WriteAheadLog::checksum(const Wal_Entry_Header &header, const void *contents){
+    uint32_t hash = 2166136261u;
+    const unsigned char *bytes = (const unsigned char *) &header.recordNumber;
+    for (size_t i = 0; i < sizeof(Wal_Entry_Header) - sizeof(uint32_t); i++){
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    bytes = (const unsigned char *) contents;
+    for (int i = 0; i < header.size; i++){
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+
+/*!
+*	\brief Logs a write.
+*/
+long WriteAheadLog::append(int dataFd, const int *recordNumbers, const void *records, int count, int recordSize){
+    if (count <= 0){
+        return state->appended;
+    }
+
+    size_t entrySize = sizeof(Wal_Entry_Header) + recordSize;
+    std::vector<char> buf(entrySize * count);
+    for (int i = 0; i < count; i++){
+        Wal_Entry_Header header;
+        header.recordNumber = recordNumbers[i];
+        header.last = (i == count - 1);
+        header.size = recordSize;
+        const char *contents = (const char *) records + (size_t) i * recordSize;
+        header.checksum = checksum(header, contents);
+        memcpy(&buf[i * entrySize], &header, sizeof(Wal_Entry_Header));
+        memcpy(&buf[i * entrySize + sizeof(Wal_Entry_Header)], contents, recordSize);
+    }
+
+    //writers of different records append concurrently, so the mutex keeps the entries from overlapping
+    pthread_mutex_lock(&state->lock);
+    while (state->checkpointing){
+        pthread_cond_wait(&state->drained, &state->lock);
+    }
+    if (full()){
+        //a logged write is only in the data file once applied, so the log is kept until every one of them is
+        state->checkpointing = 1;
+        while (state->inflight > 0){
+            pthread_cond_wait(&state->drained, &state->lock);
+        }
+        bool synced = fdatasync(dataFd) != -1;
+        if (synced){
+            truncate();
+        }
+        state->checkpointing = 0;
+        pthread_cond_broadcast(&state->drained);
+        if (!synced){
+            perror("Checkpoint sync");
+            pthread_mutex_unlock(&state->lock);
+            return -1;
+        }
+    }
+
+    size_t done = 0;
+    off_t offset = state->appended - state->base;
+    while (done < buf.size()){
+        ssize_t w = pwrite(fd, buf.data() + done, buf.size() - done, offset + done);
+        if (w < 0 && errno == EINTR){
+            continue;
+        }
+        if (w <= 0){
+            perror("Log append");
+            pthread_mutex_unlock(&state->lock);
+            return -1;
+        }
+        done += w;
+    }
+
+    state->appended += buf.size();
+    long lsn = state->appended;
+    state->inflight++;
+    state->commits++;
+    pthread_mutex_unlock(&state->lock);
+
+    if (mode == DURABILITY_SYNC){
+        if (fdatasync(fd) == -1){
+            perror("Log sync");
+            cancel(lsn, recordSize);
+            applied();
+            return -1;
+        }
+        //everything up to lsn was written before the sync started
+        pthread_mutex_lock(&state->lock);
+        if (lsn > state->durable){
+            state->durable = lsn;
+        }
+        state->syncs++;
+        pthread_mutex_unlock(&state->lock);
+    }
+
+    return lsn;
+}
+
+
+
+/*!
+*	\brief Waits for a write to be durable.
+*/
+bool WriteAheadLog::commit(long lsn){
+    if (lsn < 0){
+        return false;
+    }
+
+    bool ok = true;
+    pthread_mutex_lock(&state->lock);
+    while (ok && state->durable < lsn){
+        if (state->syncing){
+            pthread_cond_wait(&state->synced, &state->lock);
+            continue;
+        }
+
+        //lead: sync everything appended so far, including the writes of whoever is waiting
+        state->syncing = 1;
+        long target = state->appended;
+        pthread_mutex_unlock(&state->lock);
+
+        if (fdatasync(fd) == -1){
+            perror("Log sync");
+            ok = false;
+        }
+
+        pthread_mutex_lock(&state->lock);
+        if (ok && target > state->durable){
+            state->durable = target;
+        }
+        state->syncs++;
+        state->syncing = 0;
+        pthread_cond_broadcast(&state->synced);
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return ok;
+}
+
+
+
+/*!
+*	\brief Cancels a logged write whose data could not be written.
+*/
+void WriteAheadLog::cancel(long lsn, int recordSize){
+    std::vector<char> buf(sizeof(Wal_Entry_Header) + recordSize, 0);
+    Wal_Entry_Header header;
+    header.recordNumber = WAL_CANCEL;
+    header.last = 1;
+    header.size = recordSize;
+
+    //the write is still in flight, so no checkpoint has moved the base since it was appended
+    pthread_mutex_lock(&state->lock);
+    long end = lsn - state->base;
+    memcpy(&buf[sizeof(Wal_Entry_Header)], &end, sizeof(long));
+    header.checksum = checksum(header, &buf[sizeof(Wal_Entry_Header)]);
+    memcpy(&buf[0], &header, sizeof(Wal_Entry_Header));
+    if (pwrite(fd, buf.data(), buf.size(), state->appended - state->base) != (ssize_t) buf.size()){
+        perror("Log cancel");
+    }
+    else{
+        state->appended += buf.size();
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+
+
+/*!
+*	\brief Marks an in flight write as written to the data file, or given up.
+*/
+void WriteAheadLog::applied(){
+    pthread_mutex_lock(&state->lock);
+    state->inflight--;
+    if (state->inflight == 0 && state->checkpointing){
+        pthread_cond_broadcast(&state->drained);
+    }
+    pthread_mutex_unlock(&state->lock);
+}
+
+
+
+/*!
+*	\brief Empties the log.
+*/
+void WriteAheadLog::checkpoint(){
+    pthread_mutex_lock(&state->lock);
+    truncate();
+    pthread_mutex_unlock(&state->lock);
+}
+
+
+
+/*!
+*	\brief Truncates the log.
+*/
+void WriteAheadLog::truncate(){
+    if (ftruncate(fd, 0) == -1){
+        perror("Checkpoint truncate");
+        return;
+    }
+
+    //everything logged so far is now durable in the data file
+    state->base = state->appended;
+    state->durable = state->appended;
+    state->checkpoints++;
+    pthread_cond_broadcast(&state->synced);
+}
+
+
+
+/*!
+*	\brief Prints the counters.
+*/
+void WriteAheadLog::printStats(){
+    pthread_mutex_lock(&state->lock);
+    long commits = state->commits, syncs = state->syncs, checkpoints = state->checkpoints;
+    pthread_mutex_unlock(&state->lock);
+
+    printf("Write-ahead log: %ld writes | %ld syncs | %.2f writes per sync | %ld checkpoints\n", commits, syncs,
+        syncs > 0 ? (double) commits / syncs : 0.0, checkpoints);
+    fflush(stdout);
+}
+
+
+
+/*!
+*	\brief Replays a log into the data file.
+*/
+int WriteAheadLog::recover(int walfd, int recordSize, std::function<bool(int, const void*)> apply){
+    struct stat st;
+    if (fstat(walfd, &st) == -1){
+        perror("Log stat");
+        return -1;
+    }
+    if (st.st_size == 0){
+        return 0;
+    }
+
+    std::vector<char> log(st.st_size);
+    if (pread(walfd, log.data(), log.size(), 0) != (ssize_t) log.size()){
+        perror("Log read");
+        return -1;
+    }
+
+    //collect each write's entries, keeping only the writes whose last entry is seen
+    size_t entrySize = sizeof(Wal_Entry_Header) + recordSize;
+    std::vector<size_t> pending;
+    std::vector<std::pair<long, std::vector<size_t>>> writes;
+    std::set<long> cancelled;
+    for (size_t offset = 0; offset + entrySize <= log.size(); offset += entrySize){
+        Wal_Entry_Header header;
+        memcpy(&header, &log[offset], sizeof(Wal_Entry_Header));
+        const char *contents = &log[offset + sizeof(Wal_Entry_Header)];
+        if (header.size != recordSize || header.recordNumber < WAL_CANCEL || header.checksum != checksum(header, contents)){
+            break;
+        }
+
+        //a write's entries are appended with one pwrite, so a cancel never falls between them
+        if (header.recordNumber == WAL_CANCEL){
+            long end;
+            memcpy(&end, contents, sizeof(long));
+            cancelled.insert(end);
+            continue;
+        }
+        pending.push_back(offset);
+        if (header.last){
+            writes.push_back(std::make_pair((long) (offset + entrySize), pending));
+            pending.clear();
+        }
+    }
+
+    //the record locks were held from the append to the cancel, so skipping a cancelled write reorders nothing
+    int replayed = 0;
+    for (auto &write : writes){
+        if (cancelled.count(write.first) > 0){
+            continue;
+        }
+        for (size_t p : write.second){
+            Wal_Entry_Header header;
+            memcpy(&header, &log[p], sizeof(Wal_Entry_Header));
+            if (!apply(header.recordNumber, &log[p + sizeof(Wal_Entry_Header)])){
+                printf("Failed to replay record %d.\n", header.recordNumber);
+                return -1;
+            }
+            replayed++;
+        }
+    }
+
+    return replayed;
+}
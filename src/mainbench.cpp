@@ -0,0 +1,581 @@
+/*!	\file mainbench.cpp
+*	\brief  Load generator for the data server.
+*   Opens many client connections against a running server and issues requests on each,
+*   reporting the connection rate, the request rate and the request latency distribution. \n
+*   Run it once against each server mode (e.g. bin/server and bin/server -m epoll -w 4) to compare them. \n
+*   A sentinel connection is held open for the whole run so a fork mode server does not shut down between connections. \n
+*   With -s, the read and write system calls made by all processes named "server" are sampled from /proc/<pid>/io
+*   before and after the run and reported per request. Processes that exit during the run (fork mode children) are not counted.
+*   Requests are sent as protocol v2 frames, or with -v 1 as bare v1 messages.
+*   With -p N, each connection keeps up to N requests in flight instead of waiting for every reply. \n
+*   -o range makes every request a v2 read range of the whole file, -o aggregate a v2 aggregate of a field over it,
+*   and -o filter a v2 filter of it for iOS shares above 27%. -o index finds the same records with a v2 index range request,
+*   so the server must index the iOS share (bin/server -x ios). \n
+*   -o key cycles each connection through a keyed create, read and delete of a key of its own, so the server must have keyed
+*   records enabled (bin/server -k). Deleted slots are reused, so the data file grows by at most a record per connection. \n
+*   With -d N, each connection first selects one of N named datasets, bench0 to bench<N-1>, creating it and giving it a
+*   record if it is empty, and sends its requests there, so the server must serve datasets (bin/server -t handles).
+*   Comparing -d 1 with -d 50 against a small -t shows the cost of the server's dataset file cache missing. \n
+*   -o create appends one record per request, and -o batch appends -b records per v2 batch write request;
+*   both grow the data file, so run them against a scratch copy. \n
+*
+*/
+
+#include "SocketConnection.h"
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <deque>
+#include <climits>
+#include <atomic>
+#include <cmath>
+#include <dirent.h>
+
+#define SERVER_ADDR "127.0.0.1"
+#define PORT 15006
+
+typedef std::chrono::steady_clock Clock;
+
+const char *serverAddr = SERVER_ADDR;
+int numConnections = 1000;
+int requestsPerConnection = 10;
+int numThreads = 8;
+int action = 2;
+bool countSyscalls = false;
+int protocol = PROTOCOL_V2;
+int pipelineDepth = 1;
+int batchSize = 1000;
+int numDatasets = 0;
+
+std::mutex resultsMutex;
+std::vector<double> latencies;
+int failures = 0;
+std::atomic<int> nextConnection(0);
+
+/*!
+*   \fn usage
+*	\param const char *prog: Program name.
+*	\brief Prints command line usage.
+*	\return void
+*
+*   \par Description
+*   Prints the supported options and exits.
+*
+*/
+void usage(const char *prog);
+/*!
+*   \fn connectServer
+*	\param sockaddr_in &addr: Filled with the server address.
+*	\brief Connects a socket to the server.
+*	\return Connected socket descriptor, or -1 on error.
+*
+*   \par Description
+*   Opens a TCP connection to the server under test.
+*
+*/
+int connectServer(sockaddr_in &addr);
+/*!
+*   \fn runConnections
+*	\param int count: Number of connections this thread opens.
+*	\brief Load generator thread.
+*	\return void
+*
+*   \par Description
+*   Opens count connections one after another and issues requestsPerConnection requests on each,
+*   keeping up to pipelineDepth of them in flight and timing each from its send to its reply.
+*
+*/
+void runConnections(int count);
+/*!
+*   \fn sendRequest
+*	\param SocketConnection &conn: Connection to the server.
+*	\param uint32_t requestId: v2 request id.
+*	\param int64_t keyBase: First key of the connection, for keyed requests.
+*	\brief Sends one benchmark request.
+*	\return false on error.
+*
+*/
+bool sendRequest(SocketConnection &conn, uint32_t requestId, int64_t keyBase);
+/*!
+*   \fn selectDataset
+*	\param SocketConnection &conn: Connection to the server.
+*	\param int connection: Index of the connection, which picks its dataset.
+*	\brief Selects the connection's dataset.
+*	\return false on error.
+*
+*   \par Description
+*   Sends a v2 dataset request for bench<connection % numDatasets>, created if missing, and appends a record to it if it
+*   is empty, so reads of record 0 succeed.
+*
+*/
+bool selectDataset(SocketConnection &conn, int connection);
+/*!
+*   \fn readReply
+*	\param SocketConnection &conn: Connection to the server.
+*	\param Record_Message &msg: Filled with the reply.
+*	\param uint32_t &requestId: Filled with the v2 request id of the reply.
+*	\brief Waits for the next reply.
+*	\return false on error.
+*
+*/
+bool readReply(SocketConnection &conn, Record_Message &msg, uint32_t &requestId);
+/*!
+*   \fn percentile
+*	\param std::vector<double> &sorted: Sorted samples.
+*	\param double p: Percentile in [0, 100].
+*	\brief Percentile of a sorted sample set.
+*	\return Sample value at percentile p.
+*
+*/
+double percentile(std::vector<double> &sorted, double p);
+/*!
+*   \fn serverSyscalls
+*	\param None.
+*	\brief Samples the server's I/O system call count.
+*	\return Sum of syscr and syscw over every running process named "server".
+*
+*/
+long serverSyscalls();
+
+
+
+/*!
+*   \fn main
+*	\param int argc:
+*	\param char const *argv[]:
+*	\brief Main routine
+*	\return int
+*
+*   \par Description
+*   Parses options, runs the load generator threads and prints the results.
+*
+*/
+int main(int argc, char const *argv[]){
+    int opt;
+    while ( (opt = getopt(argc, (char *const *)argv, "a:c:n:t:o:sv:p:b:d:")) != -1){
+        switch (opt){
+        case 'a':
+            serverAddr = optarg;
+            break;
+        case 'c':
+            numConnections = atoi(optarg);
+            break;
+        case 'n':
+            requestsPerConnection = atoi(optarg);
+            break;
+        case 't':
+            numThreads = atoi(optarg);
+            break;
+        case 'o':
+            if (strcmp(optarg, "count") == 0){
+                action = 1;
+            }
+            else if (strcmp(optarg, "read") == 0){
+                action = 2;
+            }
+            else if (strcmp(optarg, "range") == 0){
+                action = 6;
+            }
+            else if (strcmp(optarg, "aggregate") == 0){
+                action = 8;
+            }
+            else if (strcmp(optarg, "filter") == 0){
+                action = 9;
+            }
+            else if (strcmp(optarg, "index") == 0){
+                action = 10;
+            }
+            else if (strcmp(optarg, "key") == 0){
+                action = 11;
+            }
+            else if (strcmp(optarg, "create") == 0){
+                action = 4;
+            }
+            else if (strcmp(optarg, "batch") == 0){
+                action = 7;
+            }
+            else{
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            countSyscalls = true;
+            break;
+        case 'p':
+            pipelineDepth = atoi(optarg);
+            break;
+        case 'b':
+            batchSize = atoi(optarg);
+            break;
+        case 'd':
+            numDatasets = atoi(optarg);
+            break;
+        case 'v':
+            protocol = atoi(optarg);
+            if (protocol != PROTOCOL_V1 && protocol != PROTOCOL_V2){
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (numConnections < 1 || requestsPerConnection < 0 || numThreads < 1 || pipelineDepth < 1 ||
+        batchSize < 1 || batchSize > MAX_FRAME_PAYLOAD / (int) sizeof(Record_Message) || numDatasets < 0 ||
+        ((action >= 6 || numDatasets > 0) && protocol != PROTOCOL_V2)){
+        usage(argv[0]);
+    }
+
+    //keep the server up for the whole run
+    sockaddr_in addr;
+    int sentinel = connectServer(addr);
+    if (sentinel == -1){
+        printf("Server is not online.\n");
+        exit(1);
+    }
+
+    std::vector<std::thread> threads;
+    long syscallsBefore = countSyscalls ? serverSyscalls() : 0;
+    Clock::time_point start = Clock::now();
+
+    for (int i = 0; i < numThreads; i++){
+        int count = numConnections / numThreads + (i < numConnections % numThreads ? 1 : 0);
+        threads.push_back(std::thread(runConnections, count));
+    }
+    for (std::thread &t : threads){
+        t.join();
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    long syscallsAfter = countSyscalls ? serverSyscalls() : 0;
+    close(sentinel);
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("Connections : %d over %d threads, %d requests each, %d in flight\n", numConnections, numThreads,
+        requestsPerConnection, pipelineDepth);
+    printf("Elapsed     : %.3f s\n", elapsed);
+    printf("Conn/sec    : %.1f\n", numConnections / elapsed);
+    printf("Req/sec     : %.1f\n", latencies.size() / elapsed);
+    if (action == 7){
+        printf("Records/sec : %.1f\n", latencies.size() * batchSize / elapsed);
+    }
+    printf("Failures    : %d\n", failures);
+    if (!latencies.empty()){
+        printf("Latency us  : p50 %.1f | p99 %.1f | max %.1f\n",
+            percentile(latencies, 50), percentile(latencies, 99), latencies.back());
+    }
+    if (countSyscalls && !latencies.empty()){
+        printf("Server r/w syscalls per request : %.2f\n", (double) (syscallsAfter - syscallsBefore) / latencies.size());
+    }
+
+    return 0;
+}
+
+
+
+/*!
+*	\brief Prints command line usage.
+*/
+void usage(const char *prog){
+    printf("Usage: %s [-a addr] [-c connections] [-n requests] [-t threads] [-o read|count|range|aggregate|filter|index|key|create|batch] [-b batch] [-d datasets] [-s] [-v 1|2] [-p depth]\n", prog);
+    exit(0);
+}
+
+
+
+/*!
+*	\brief Connects a socket to the server.
+*/
+int connectServer(sockaddr_in &addr){
+    memset(&addr, 0x0, sizeof(sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = inet_addr(serverAddr);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1){
+        perror("Socket: ");
+        return -1;
+    }
+    if (connect(fd, (sockaddr *)&addr, sizeof(sockaddr_in)) == -1){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+
+/*!
+*	\brief Load generator thread.
+*/
+void runConnections(int count){
+    std::vector<double> samples;
+    int failed = 0;
+    Record_Message msg;
+    uint32_t requestId;
+
+    for (int c = 0; c < count; c++){
+        sockaddr_in addr;
+        int fd = connectServer(addr);
+        if (fd == -1){
+            failed++;
+            continue;
+        }
+
+        SocketConnection conn(fd, addr);
+        int connection = nextConnection++;
+        int64_t keyBase = ((int64_t) getpid() << 40) | ((int64_t) connection << 20);
+        if (numDatasets > 0 && !selectDataset(conn, connection)){
+            failed++;
+            continue;
+        }
+        std::deque<std::pair<uint32_t, Clock::time_point>> inflight;
+        int sent = 0, received = 0;
+
+        while (received < requestsPerConnection){
+            //top the window up
+            bool ok = true;
+            while (sent < requestsPerConnection && inflight.size() < (size_t) pipelineDepth){
+                if (!sendRequest(conn, sent + 1, keyBase)){
+                    ok = false;
+                    break;
+                }
+                inflight.push_back(std::make_pair(sent + 1, Clock::now()));
+                sent++;
+            }
+
+            //cheap requests are answered in order, so the reply belongs to the oldest one in flight
+            if (!ok || !readReply(conn, msg, requestId) || msg.arg == -1 ||
+                (protocol == PROTOCOL_V2 && requestId != inflight.front().first)){
+                failed++;
+                break;
+            }
+            samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - inflight.front().second).count());
+            inflight.pop_front();
+            received++;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(resultsMutex);
+    latencies.insert(latencies.end(), samples.begin(), samples.end());
+    failures += failed;
+}
+
+
+
+/*!
+*	\brief Sends one benchmark request.
+*/
+bool sendRequest(SocketConnection &conn, uint32_t requestId, int64_t keyBase){
+    Record_Message msg;
+    memset(&msg, 0x0, sizeof(Record_Message));
+    msg.action = action;
+    msg.arg = 0;
+
+    if (action == 4 || action == 7){
+        msg.action = 4;
+        msg.record.android = 70.0;
+        msg.record.ios = 28.0;
+        msg.record.kaios = 0.5;
+        msg.record.other = 1.5;
+    }
+
+    if (action == 6){
+        Range_Request range = {0, INT_MAX};
+        return conn.writeFrame(action, requestId, &range, sizeof(Range_Request)) > 0;
+    }
+    if (action == 9){
+        Filter_Request query;
+        memset(&query, 0x0, sizeof(Filter_Request));
+        query.end = INT_MAX;
+        query.combine = FILTER_AND;
+        query.count = 1;
+        query.terms[0].field = FIELD_IOS;
+        query.terms[0].op = FILTER_GT;
+        query.terms[0].value = 27.0;
+        return conn.writeFrame(action, requestId, &query, sizeof(Filter_Request)) > 0;
+    }
+    if (action == 10){
+        Index_Request query = {FIELD_IOS, INDEX_ASCENDING, 0, nextafterf(27.0, INFINITY), INFINITY};
+        return conn.writeFrame(action, requestId, &query, sizeof(Index_Request)) > 0;
+    }
+    if (action == 11){
+        //create, read, then delete each key
+        static const int cycle[] = {13, 11, 14};
+        Key_Message keyed;
+        memset(&keyed, 0x0, sizeof(Key_Message));
+        keyed.key = keyBase + (requestId - 1) / 3;
+        keyed.record = msg.record;
+        return conn.writeFrame(cycle[(requestId - 1) % 3], requestId, &keyed, sizeof(Key_Message)) > 0;
+    }
+    if (action == 8){
+        Aggregate_Request query = {FIELD_ANDROID, 0, INT_MAX};
+        return conn.writeFrame(action, requestId, &query, sizeof(Aggregate_Request)) > 0;
+    }
+    if (action == 7){
+        std::vector<Record_Message> batch(batchSize, msg);
+        return conn.writeFrame(action, requestId, batch.data(), batchSize * sizeof(Record_Message)) > 0;
+    }
+    if (protocol == PROTOCOL_V2){
+        return conn.writeFrame(msg.action, requestId, &msg, sizeof(Record_Message)) > 0;
+    }
+    return conn.writeMessage(msg) > 0;
+}
+
+
+
+/*!
+*	\brief Selects the connection's dataset.
+*/
+bool selectDataset(SocketConnection &conn, int connection){
+    Dataset_Request request;
+    memset(&request, 0x0, sizeof(Dataset_Request));
+    request.create = 1;
+    snprintf(request.name, DATASET_NAME_MAX, "bench%d", connection % numDatasets);
+
+    Frame frame;
+    int count;
+    if (conn.writeFrame(15, 0, &request, sizeof(Dataset_Request)) <= 0 || !conn.readFrame(frame) || frame.length != sizeof(int)){
+        return false;
+    }
+    memcpy(&count, frame.payload, sizeof(int));
+    if (count != 0){
+        return count > 0;
+    }
+
+    //the first connection to an empty dataset gives it a record to read
+    Record_Message msg;
+    memset(&msg, 0x0, sizeof(Record_Message));
+    msg.action = 4;
+    if (conn.writeFrame(4, 0, &msg, sizeof(Record_Message)) <= 0 || !conn.readFrame(frame) || frame.length != sizeof(Record_Message)){
+        return false;
+    }
+    memcpy(&msg, frame.payload, sizeof(Record_Message));
+    return msg.arg != -1;
+}
+
+
+
+/*!
+*	\brief Waits for the next reply.
+*/
+bool readReply(SocketConnection &conn, Record_Message &msg, uint32_t &requestId){
+    //the reader detects the protocol of the replies the same way the server does for requests
+    Frame frame;
+    if (action == 6 || action == 9 || action == 10){
+        //skip the records up to the frame holding the number sent
+        do{
+            if (!conn.readFrame(frame)){
+                return false;
+            }
+        } while (frame.length != sizeof(int));
+
+        memset(&msg, 0x0, sizeof(Record_Message));
+        memcpy(&msg.arg, frame.payload, sizeof(int));
+        requestId = frame.requestId;
+        return true;
+    }
+
+    if (action == 8){
+        Aggregate_Reply result;
+        if (!conn.readFrame(frame) || frame.length != sizeof(Aggregate_Reply)){
+            return false;
+        }
+        memcpy(&result, frame.payload, sizeof(Aggregate_Reply));
+        memset(&msg, 0x0, sizeof(Record_Message));
+        msg.arg = result.count;
+        requestId = frame.requestId;
+        return true;
+    }
+    if (action == 11){
+        Key_Message keyed;
+        if (!conn.readFrame(frame) || frame.length != sizeof(Key_Message)){
+            return false;
+        }
+        memcpy(&keyed, frame.payload, sizeof(Key_Message));
+        memset(&msg, 0x0, sizeof(Record_Message));
+        msg.arg = keyed.slot;
+        requestId = frame.requestId;
+        return true;
+    }
+    if (action == 7){
+        //the record numbers written, all -1 if the batch failed
+        if (!conn.readFrame(frame) || frame.length != batchSize * sizeof(int)){
+            return false;
+        }
+        memset(&msg, 0x0, sizeof(Record_Message));
+        memcpy(&msg.arg, frame.payload, sizeof(int));
+        requestId = frame.requestId;
+        return true;
+    }
+
+    if (!conn.readFrame(frame) || frame.length < sizeof(Record_Message)){
+        return false;
+    }
+
+    memcpy(&msg, frame.payload, sizeof(Record_Message));
+    requestId = frame.requestId;
+    return true;
+}
+
+
+
+/*!
+*	\brief Percentile of a sorted sample set.
+*/
+double percentile(std::vector<double> &sorted, double p){
+    size_t index = (size_t)((p / 100.0) * (sorted.size() - 1));
+    return sorted[index];
+}
+
+
+
+/*!
+*	\brief Samples the server's I/O system call count.
+*/
+long serverSyscalls(){
+    long total = 0;
+    DIR *proc = opendir("/proc");
+    if (proc == NULL){
+        perror("opendir /proc");
+        return 0;
+    }
+
+    dirent *entry;
+    char path[300], line[128];
+    while ( (entry = readdir(proc)) != NULL){
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9'){
+            continue;
+        }
+
+        sprintf(path, "/proc/%s/comm", entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (f == NULL){
+            continue;
+        }
+        bool isServer = (fgets(line, sizeof(line), f) != NULL) && (strcmp(line, "server\n") == 0);
+        fclose(f);
+        if (!isServer){
+            continue;
+        }
+
+        sprintf(path, "/proc/%s/io", entry->d_name);
+        if ( (f = fopen(path, "r")) == NULL){
+            continue;
+        }
+        long value;
+        while (fgets(line, sizeof(line), f) != NULL){
+            if (sscanf(line, "syscr: %ld", &value) == 1 || sscanf(line, "syscw: %ld", &value) == 1){
+                total += value;
+            }
+        }
+        fclose(f);
+    }
+
+    closedir(proc);
+    return total;
+}
@@ -0,0 +1,285 @@
+/*!	\file mainkernelbench.cpp
+*	\brief  Benchmark and check of the SIMD query kernels.
+*   Runs every SimdKernels kernel at every level the processor supports, over a column of random floats and over a field
+*   of an array of Records, and reports the GB/s each level reaches and its speedup over the scalar loops. \n
+*   GB/s counts the bytes of the array the kernel walks: four per value for a column, a whole Record per value for a Record array,
+*   since that is what has to come through the caches. \n
+*   Before it is timed, every level is checked against the scalar loops: on the full array, on a count that leaves a partial
+*   vector and a partial bitmask word, on a misaligned start, and on every count up to a few vectors. Minimum, maximum and
+*   every comparison must match exactly, sums to a relative 1e-9, since only the order of additions differs. \n
+*   Usage: bin/kernelbench [-k sum|min|max|mean|compare] [-l scalar|sse|avx2] [-r records] [-i iterations] \n
+*   -l caps the highest level run. The exit status is 1 if any check failed. \n
+*
+*/
+
+#include "SimdKernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+#include <random>
+
+#define SMALL_COUNTS 130
+
+typedef std::chrono::steady_clock Clock;
+
+int numRecords = 1 << 22;
+int iterations = 20;
+int kernelChoice = -1;
+Simd_Level maxLevel = SIMD_AVX2;
+int failures = 0;
+std::vector<float> column;
+std::vector<Record> records;
+
+/*!
+*   \enum Bench_Kernel
+*   \brief Kernel being measured.
+*/
+enum Bench_Kernel
+{
+    KERNEL_SUM,
+    KERNEL_MIN,
+    KERNEL_MAX,
+    KERNEL_MEAN,
+    KERNEL_COMPARE // every value against a threshold, into a bitmask
+};
+
+/*!
+*   \fn usage
+*	\param const char *prog: Program name.
+*	\brief Prints command line usage.
+*	\return void
+*
+*/
+void usage(const char *prog);
+/*!
+*   \fn runKernel
+*	\param Bench_Kernel kernel: Kernel to run.
+*	\param bool rows: true to run over the android field of records, false over column.
+*	\param long first: Index of the first value.
+*	\param long count: Number of values.
+*	\param int op: Comparison of KERNEL_COMPARE.
+*	\param float value: Threshold of KERNEL_COMPARE.
+*	\param std::vector<uint64_t> &bits: Bitmask of KERNEL_COMPARE.
+*	\brief Runs a kernel once at the current level.
+*	\return The result, or the number of matches of KERNEL_COMPARE.
+*
+*/
+double runKernel(Bench_Kernel kernel, bool rows, long first, long count, int op, float value, std::vector<uint64_t> &bits);
+/*!
+*   \fn checkKernel
+*	\param Bench_Kernel kernel: Kernel to check.
+*	\param bool rows: true to check over records, false over column.
+*	\param Simd_Level level: Level checked against the scalar loops.
+*	\brief Checks a level of a kernel against the scalar loops.
+*	\return Number of mismatches.
+*
+*/
+int checkKernel(Bench_Kernel kernel, bool rows, Simd_Level level);
+/*!
+*   \fn timeKernel
+*	\param Bench_Kernel kernel: Kernel to time.
+*	\param bool rows: true to time over records, false over column.
+*	\brief Times iterations runs of a kernel at the current level over the whole array.
+*	\return Seconds per run.
+*
+*/
+double timeKernel(Bench_Kernel kernel, bool rows);
+
+
+
+/*!
+*   \fn main
+*	\param int argc:
+*	\param char const *argv[]:
+*	\brief Main routine
+*	\return int
+*
+*   \par Description
+*   Parses options, fills the arrays, and checks and times the selected kernels at every level.
+*
+*/
+int main(int argc, char const *argv[]){
+    const char *kernels[] = {"sum", "min", "max", "mean", "compare"};
+    int opt;
+    while ( (opt = getopt(argc, (char *const *)argv, "k:l:r:i:")) != -1){
+        switch (opt){
+        case 'k':
+            kernelChoice = -1;
+            for (int k = KERNEL_SUM; k <= KERNEL_COMPARE; k++){
+                if (strcmp(optarg, kernels[k]) == 0){
+                    kernelChoice = k;
+                }
+            }
+            if (kernelChoice == -1){
+                usage(argv[0]);
+            }
+            break;
+        case 'l':
+            if (strcmp(optarg, "scalar") == 0){
+                maxLevel = SIMD_SCALAR;
+            }
+            else if (strcmp(optarg, "sse") == 0){
+                maxLevel = SIMD_SSE;
+            }
+            else if (strcmp(optarg, "avx2") == 0){
+                maxLevel = SIMD_AVX2;
+            }
+            else{
+                usage(argv[0]);
+            }
+            break;
+        case 'r':
+            numRecords = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (numRecords < 1 || iterations < 1){
+        usage(argv[0]);
+    }
+    if (maxLevel > SimdKernels::detect()){
+        maxLevel = SimdKernels::detect();
+    }
+
+    //market shares, with repeats so equality tests match something
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> share(0, 10000);
+    column.resize(numRecords);
+    records.resize(numRecords);
+    for (int i = 0; i < numRecords; i++){
+        column[i] = share(rng) / 100.0f;
+        records[i] = {i, column[i], share(rng) / 100.0f, share(rng) / 100.0f, share(rng) / 100.0f};
+    }
+
+    printf("%d values, %d iterations, detected %s\n", numRecords, iterations, SimdKernels::name(SimdKernels::detect()));
+    printf("Kernel  | Layout  | Level  | GB/s     | Speedup | Check\n");
+    for (int k = KERNEL_SUM; k <= KERNEL_COMPARE; k++){
+        if (kernelChoice != -1 && kernelChoice != k){
+            continue;
+        }
+        for (int rows = 0; rows <= 1; rows++){
+            double baseline = 0;
+            for (int level = SIMD_SCALAR; level <= maxLevel; level++){
+                int mismatches = checkKernel((Bench_Kernel) k, rows, (Simd_Level) level);
+                failures += mismatches;
+
+                SimdKernels::setLevel((Simd_Level) level);
+                double seconds = timeKernel((Bench_Kernel) k, rows);
+                if (level == SIMD_SCALAR){
+                    baseline = seconds;
+                }
+                double bytes = (double) numRecords * (rows ? sizeof(Record) : sizeof(float));
+                printf("%-7s | %-7s | %-6s | %8.2f | %6.2fx | %s\n", kernels[k], rows ? "records" : "column",
+                    SimdKernels::name((Simd_Level) level), bytes / seconds / 1e9, baseline / seconds,
+                    mismatches == 0 ? "ok" : "MISMATCH");
+            }
+        }
+    }
+
+    printf("Failures: %d\n", failures);
+    return failures == 0 ? 0 : 1;
+}
+
+
+
+/*!
+*	\brief Prints command line usage.
+*/
+void usage(const char *prog){
+    printf("Usage: %s [-k sum|min|max|mean|compare] [-l scalar|sse|avx2] [-r records] [-i iterations]\n", prog);
+    exit(0);
+}
+
+
+
+/*!
+*	\brief Runs a kernel once at the current level.
+*/
+double runKernel(Bench_Kernel kernel, bool rows, long first, long count, int op, float value, std::vector<uint64_t> &bits){
+    const float *values = column.data() + first;
+    const Record *recs = records.data() + first;
+    switch (kernel){
+    case KERNEL_SUM:
+        return rows ? SimdKernels::sum(recs, count, &Record::android) : SimdKernels::sum(values, count);
+    case KERNEL_MIN:
+        return rows ? SimdKernels::min(recs, count, &Record::android) : SimdKernels::min(values, count);
+    case KERNEL_MAX:
+        return rows ? SimdKernels::max(recs, count, &Record::android) : SimdKernels::max(values, count);
+    case KERNEL_MEAN:
+        return rows ? SimdKernels::mean(recs, count, &Record::android) : SimdKernels::mean(values, count);
+    default:
+        bits.resize((count + 63) / 64);
+        if (rows){
+            return SimdKernels::compare(recs, count, &Record::android, op, value, bits.data());
+        }
+        return SimdKernels::compare(values, count, op, value, bits.data());
+    }
+}
+
+
+
+/*!
+*	\brief Checks a level of a kernel against the scalar loops.
+*/
+int checkKernel(Bench_Kernel kernel, bool rows, Simd_Level level){
+    //the whole array, a partial vector and word at the end, a misaligned start, and every short count
+    std::vector<std::pair<long, long>> ranges = {{0, numRecords}, {0, std::max(0, numRecords - 13)}, {1, numRecords - 1}};
+    for (long n = 0; n <= SMALL_COUNTS && n + 3 <= numRecords; n++){
+        ranges.push_back({3, n});
+    }
+    int ops = (kernel == KERNEL_COMPARE) ? FILTER_NE + 1 : 1;
+
+    int mismatches = 0;
+    std::vector<uint64_t> expectedBits, bits;
+    for (auto &range : ranges){
+        for (int op = 0; op < ops; op++){
+            //a value that is in the array, so equality matches too
+            float value = column[(range.first + range.second / 2) % numRecords];
+
+            SimdKernels::setLevel(SIMD_SCALAR);
+            double expected = runKernel(kernel, rows, range.first, range.second, op, value, expectedBits);
+            SimdKernels::setLevel(level);
+            bits.assign(expectedBits.size(), ~0ULL); //stale bits must be overwritten
+            double result = runKernel(kernel, rows, range.first, range.second, op, value, bits);
+
+            bool same;
+            if (kernel == KERNEL_SUM || kernel == KERNEL_MEAN){
+                same = fabs(result - expected) <= 1e-9 * fabs(expected);
+            }
+            else{
+                same = result == expected && bits == expectedBits;
+            }
+            if (!same){
+                printf("%s mismatch: first %ld count %ld op %d: %.9g, scalar %.9g\n",
+                    SimdKernels::name(level), range.first, range.second, op, result, expected);
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+
+
+/*!
+*	\brief Times iterations runs of a kernel at the current level over the whole array.
+*/
+double timeKernel(Bench_Kernel kernel, bool rows){
+    std::vector<uint64_t> bits;
+    volatile double sink = 0;
+    runKernel(kernel, rows, 0, numRecords, FILTER_GT, 50.0f, bits); //warm the caches and fault the pages in
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < iterations; i++){
+        sink = sink + runKernel(kernel, rows, 0, numRecords, FILTER_GT, 50.0f, bits);
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count() / iterations;
+}
@@ -0,0 +1,175 @@
+/*!	\file mainreindex.cpp
+*	\brief  Offline rebuild of the server's field indexes.
+*   Rebuilds the FieldIndex of each listed field from the data file of a storage engine, with the server stopped, and marks
+*   it clean, so the server starts with it as it is. The server rebuilds a stale index itself on startup; this moves that
+*   work out of its startup, or recovers an index file that was removed or damaged. \n
+*   The log-structured data file is read through an index restored from its checkpoint and replayed from it, as the server's is. \n
+*   Usage: bin/reindex [-f syscall|mmap|columns|log] field[,field...] \n
+*
+*/
+
+#include "CriticalFile.h"
+#include "MappedFile.h"
+#include "ColumnFile.h"
+#include "LogFile.h"
+#include "FieldIndex.h"
+#include <chrono>
+
+#define SERVER_KEY 15006
+
+typedef std::chrono::steady_clock Clock;
+
+/*!
+*   \fn usage
+*	\param const char *prog: Program name.
+*	\brief Prints command line usage.
+*	\return void
+*
+*   \par Description
+*   Prints the supported options and exits.
+*
+*/
+void usage(const char *prog);
+
+/*!
+*   \fn main
+*	\param int argc:
+*	\param char const *argv[]:
+*	\brief Main routine
+*	\return int
+*
+*   \par Description
+*   Opens the data file, then rebuilds the index of every listed field from it.
+*
+*/
+int main(int argc, char const *argv[]){
+    Storage_Engine engine = STORAGE_SYSCALL;
+    const char *binPath = "data/out.bin";
+
+    int opt;
+    while ( (opt = getopt(argc, (char *const *)argv, "f:")) != -1){
+        switch (opt){
+        case 'f':
+            if (strcmp(optarg, "syscall") == 0){
+                engine = STORAGE_SYSCALL;
+            }
+            else if (strcmp(optarg, "mmap") == 0){
+                engine = STORAGE_MMAP;
+            }
+            else if (strcmp(optarg, "columns") == 0){
+                engine = STORAGE_COLUMNS;
+                binPath = "data/out.col";
+            }
+            else if (strcmp(optarg, "log") == 0){
+                engine = STORAGE_LOG;
+                binPath = "data/out.log";
+            }
+            else{
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1){
+        usage(argv[0]);
+    }
+
+    //the list is checked before anything is touched
+    std::vector<int> fields;
+    std::string names(argv[optind]);
+    for (size_t start = 0; start <= names.size(); ){
+        size_t end = std::min(names.find(',', start), names.size());
+        int field = FieldIndex::fieldCode(names.substr(start, end - start).c_str());
+        if (field == -1){
+            usage(argv[0]);
+        }
+        fields.push_back(field);
+        start = end + 1;
+    }
+
+    //a running server holds its semaphores, and its indexes open
+    if (semget(SERVER_KEY, 0, 0) != -1){
+        printf("The server is running. Stop it before rebuilding its indexes.\n");
+        exit(1);
+    }
+
+    int semid = SemaphoreSet::createSemaphores(getpid(), 1 + NUM_FIELDS);
+    if (semid == -1){
+        printf("Failed to create semaphores.\n");
+        exit(3);
+    }
+
+    int binfd = open(binPath, O_RDWR);
+    if (binfd == -1){
+        perror("Failed to open binary file");
+        semctl(semid, 0, IPC_RMID, 0);
+        exit(1);
+    }
+
+    LogIndex *logIndex = NULL;
+    DataFile<Record> *file;
+    if (engine == STORAGE_MMAP){
+        file = new MappedFile<Record>(dup(binfd), SemaphoreSet(semid, 0));
+    }
+    else if (engine == STORAGE_COLUMNS){
+        file = new ColumnFile(dup(binfd), SemaphoreSet(semid, 0));
+    }
+    else if (engine == STORAGE_LOG){
+        //restored from the server's checkpoint when it has a usable one
+        std::string checkpointPath = std::string(binPath) + ".ckpt";
+        logIndex = new LogIndex();
+        if (logIndex->restore(binfd, checkpointPath.c_str()) == -1){
+            delete logIndex;
+            logIndex = new LogIndex();
+            if (logIndex->load(binfd) == -1){
+                printf("Failed to replay %s.\n", binPath);
+                semctl(semid, 0, IPC_RMID, 0);
+                exit(3);
+            }
+        }
+        file = new LogFile(dup(binfd), SemaphoreSet(semid, 0), logIndex);
+    }
+    else{
+        file = new CriticalFile<Record>(dup(binfd), SemaphoreSet(semid, 0));
+    }
+
+    int status = 0;
+    for (int field : fields){
+        std::string path = std::string(binPath) + "." + FieldIndex::fieldName(field) + ".idx";
+        int fd = open(path.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd == -1){
+            perror("Failed to open index file");
+            status = 1;
+            continue;
+        }
+
+        FieldIndex index(fd, field, SemaphoreSet(semid, 1 + field));
+        Clock::time_point start = Clock::now();
+        if (!index.rebuild(*file) || !index.markClean(binfd, true)){
+            printf("Failed to rebuild %s.\n", path.c_str());
+            status = 3;
+            continue;
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        printf("Rebuilt %s in %.3f s.\n", path.c_str(), elapsed);
+    }
+
+    delete file;
+    delete logIndex;
+    close(binfd);
+    semctl(semid, 0, IPC_RMID, 0);
+    return status;
+}
+
+
+
+/*!
+*	\brief Prints command line usage.
+*/
+void usage(const char *prog){
+    printf("Usage: %s [-f syscall|mmap|columns|log] field[,field...]\n", prog);
+    printf("  fields : android, ios, kaios, other\n");
+    exit(0);
+}
@@ -35,25 +35,105 @@ It was cropped from January 2020 onward, and redundant fields were removed.
  *	\brief  Server program for a data server application.
  *   This application will perform operations on binary data received from a client program through a socket.
  *   Child processes are spawned to service individual clients.
+ *   Alternatively (-m epoll), a fixed number of worker processes (-w N) each multiplex many clients through an epoll event loop.
+ *   In pre-fork mode (-m prefork), the workers are started at boot, each with its own SO_REUSEPORT listening socket and its own event loop.
+ *   The workers' socket I/O can go through io_uring (-i uring) instead of epoll and plain system calls,
+ *   or their connections can be serviced by coroutines (-i coro) that suspend instead of blocking on slow clients.
+ *   In threaded mode (-m threads), one process runs a thread per core, each with its own epoll loop, and idle cores steal queued requests from busy ones.
+ *   The binary data file is accessed with a system call per operation, or with -f mmap through a shared memory mapping of it.
+ *   With -f columns, the records are kept in a columnar file instead, so aggregates and filters read only the fields they test.
+ *   With -f log, they are kept in a log-structured file: every create and update is appended, a shared index points each record
+ *   at its latest entry, and a compactor thread of this process frees the segments that writes left mostly garbage.
+ *   The index is checkpointed next to the file periodically and at shutdown, so startup replays only the entries appended after it.
+ *   System call access reads through a buffer pool of -c pages in shared memory, created here before any server is forked.
+ *   With -d group or -d sync, every write to the data file is logged to data/out.wal and only acknowledged once the log is synced,
+ *   by a group commit shared by the concurrent writers or by each write itself. A log left by a crash is replayed on startup.
+ *   With -r snapshot, record reads take no lock: writers keep the versions they overwrite in shared memory, and readers read the one
+ *   their snapshot sees. The buffer pool is left out then, since it fills under the reader lock.
+ *   Each record is locked by one of -l lock stripes, hashed by record number, and appends take a separate tail lock,
+ *   so operations on different records run concurrently. With -l 0, one readers-writers lock covers the whole file.
+ *   With -x, the listed fields are indexed in on-disk B+trees next to the data file, which creates, updates and batches keep up
+ *   to date and index range requests are answered from. An index that does not match the data file on startup is rebuilt from it.
+ *   With -k, records can also be created, read, updated and deleted by a 64-bit key, through a hash index next to the data file
+ *   that maps each key to its record's slot and lists the slots deletes freed for reuse.
+ *   With -t, clients can select named datasets, each a record file of its own in data/tables with its own lock, and each
+ *   server process keeps up to -t of them open in a cache. Their semaphores are created when a dataset is first opened.
+ *   Datasets are plain system call files, so -d, -r and -l only apply to the data file, which a warning says at startup.
+ *   With -s, new datasets are split into shard files at the listed months, and at intervals of the last one after them,
+ *   created as appends reach them. Range reads, aggregates and filters scan the shards in parallel.
  *   Operations on the binary data file and the log file are guarded by semaphores that are initialized on server startup if not present.
  *   Signals are used to track terminating child servers.
  *
  */
 
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
 
 #include "Server.h"
+#include "EventLoop.h"
+#include "UringLoop.h"
+#include "CoLoop.h"
+#include "CoreScheduler.h"
 
 #define PORT 15006
+#define POOL_PAGES 1024
+#define LOCK_STRIPES 64
+
+/*!
+ *   \enum Server_Mode
+ *   \brief How client connections are serviced.
+ */
+enum Server_Mode
+{
+    MODE_FORK,  // one forked child per connection
+    MODE_EPOLL,  // worker processes multiplexing connections with epoll
+    MODE_PREFORK, // long-lived workers, each accepting on its own SO_REUSEPORT socket
+    MODE_THREADS  // one process, one event loop thread per core, with work stealing
+};
+
+/*!
+ *   \enum IO_Engine
+ *   \brief How worker processes perform socket I/O.
+ */
+enum IO_Engine
+{
+    ENGINE_SYNC, // epoll readiness and plain system calls
+    ENGINE_URING, // io_uring submissions, falling back to ENGINE_SYNC if unavailable
+    ENGINE_CORO   // one coroutine per connection on a single-threaded executor
+};
 
 int numClients = 0;
 int semid = 0;
 int socketfd = 0;
 int logfd = 0;
 int binfd = 0;
+const char *binPath = "data/out.bin";
+std::string checkpointPath;
+const char *walPath = "data/out.wal";
 
 bool quickExit = false;
 
+Server_Mode mode = MODE_FORK;
+int numWorkers = 0;
+IO_Engine engine = ENGINE_SYNC;
+int *connectionCounts = NULL;
+int poolPages = POOL_PAGES;
+Durability_Mode durability = DURABILITY_NONE;
+CoreScheduler *scheduler = NULL;
+std::thread *compactor = NULL;
+std::atomic<bool> compactorStopping(false);
+bool snapshotReads = false;
+int numStripes = LOCK_STRIPES;
+bool stripesGiven = false;
+bool indexFields[NUM_FIELDS] = {false};
+bool keyedRecords = false;
+int datasetHandles = 0;
+std::vector<int> shardBoundaries;
+
 /*!
  *   \fn sigchldHandler
  *	\param int signum:
@@ -62,6 +142,7 @@ bool quickExit = false;
  *
  *   \par Description
  *   Sigint handler. Asks user if it should close the server. If it does, it destroys the semaphores.
+ *   The core threads of threaded mode and the log compactor are stopped before anything is closed.
  *
  */
 void sigintHandler(int signum);
@@ -76,6 +157,211 @@ void sigintHandler(int signum);
  *
  */
 void sigchldHandler(int signum);
+/*!
+ *   \fn sigusr1Handler
+ *	\param int signum:
+ *	\brief Sigusr1 handler
+ *	\return
+ *
+ *   \par Description
+ *   Sigusr1 handler. Prints the per-core scheduler counters in threaded mode, and the buffer pool and log counters.
+ *
+ */
+void sigusr1Handler(int signum);
+/*!
+ *   \fn usage
+ *	\param const char *prog: Program name.
+ *	\brief Prints command line usage.
+ *	\return void
+ *
+ *   \par Description
+ *   Prints the supported options and exits.
+ *
+ */
+void usage(const char *prog);
+/*!
+ *   \fn spawnEventLoops
+ *	\param None.
+ *	\brief Starts the epoll worker processes.
+ *	\return void
+ *
+ *   \par Description
+ *   Makes the listening socket non-blocking and forks numWorkers processes, each running an EventLoop over it.
+ *   The parent then waits on signals for the workers to shut down.
+ *
+ */
+void spawnEventLoops();
+/*!
+ *   \fn openListener
+ *	\param bool reusePort: Set SO_REUSEPORT so several sockets can bind the port.
+ *	\brief Opens the listening socket.
+ *	\return Listening socket descriptor.
+ *
+ *   \par Description
+ *   Creates, binds and listens on a socket on PORT. Exits on failure.
+ *
+ */
+int openListener(bool reusePort);
+/*!
+ *   \fn spawnPreforkWorkers
+ *	\param None.
+ *	\brief Starts the pre-forked worker pool.
+ *	\return void
+ *
+ *   \par Description
+ *   Forks numWorkers processes. Each opens its own non-blocking SO_REUSEPORT listener and runs an EventLoop over it,
+ *   so the kernel spreads new connections across the workers without a shared accept queue.
+ *   Per-worker connection counts are kept in an anonymous shared mapping so the parent can report them.
+ *   The parent then waits on signals for the workers to shut down.
+ *
+ */
+void spawnPreforkWorkers();
+/*!
+ *   \fn printConnectionCounts
+ *	\param None.
+ *	\brief Reports per-worker connection counts.
+ *	\return void
+ *
+ *   \par Description
+ *   Prints the number of connections each pre-forked worker has accepted.
+ *
+ */
+void printConnectionCounts();
+/*!
+ *   \fn runWorkerLoop
+ *	\param int *connectionCount: Optional accepted connection counter.
+ *	\brief Worker process lifetime.
+ *	\return void
+ *
+ *   \par Description
+ *   Services connections on socketfd with the selected I/O engine.
+ *   Falls back to the epoll EventLoop when io_uring cannot be set up.
+ *
+ */
+void runWorkerLoop(int *connectionCount);
+/*!
+ *   \fn importRecords
+ *	\param None.
+ *	\brief Prepares the columnar or log-structured data file.
+ *	\return void
+ *
+ *   \par Description
+ *   Writes the header of a new columnar file, and fills a new file of either kind with the records of data/out.bin.
+ *   An existing one is checked and left as it is, so data/out.bin is not read again once the file is in use. Exits on failure.
+ *
+ */
+void importRecords();
+/*!
+ *   \fn loadLogIndex
+ *	\param None.
+ *	\brief Rebuilds the index of the log-structured data file.
+ *	\return void
+ *
+ *   \par Description
+ *   Creates the shared LogIndex before any server is forked, and restores it from the checkpoint next to the file, replaying
+ *   only the entries appended after it. Without a usable checkpoint, the whole file is replayed. Exits on failure.
+ *
+ */
+void loadLogIndex();
+/*!
+ *   \fn startCompactor
+ *	\param None.
+ *	\brief Starts the log compactor thread.
+ *	\return void
+ *
+ *   \par Description
+ *   Compacts the log-structured data file in a thread of this process, with all signals blocked so they still reach the
+ *   main thread. It compacts a segment at a time while any has enough garbage, and otherwise sleeps LOG_COMPACT_INTERVAL microseconds.
+ *   Every LOG_CHECKPOINT_INTERVAL seconds, it also checkpoints the log index if anything was appended since the last checkpoint.
+ *   It runs until compactorStopping is set, and is joined through compactor.
+ *
+ */
+void startCompactor();
+/*!
+ *   \fn parseIndexFields
+ *	\param const char *list: Comma separated field names.
+ *	\brief Selects the fields to index.
+ *	\return false if a name is not a field.
+ *
+ */
+bool parseIndexFields(const char *list);
+/*!
+ *   \fn parseShardBoundaries
+ *	\param const char *list: Comma separated months.
+ *	\brief Sets the months where the shards of new datasets start.
+ *	\return false unless the months are positive and ascending.
+ *
+ */
+bool parseShardBoundaries(const char *list);
+/*!
+ *   \fn openIndexes
+ *	\param None.
+ *	\brief Opens the index of every selected field.
+ *	\return void
+ *
+ *   \par Description
+ *   Opens or creates <data file>.<field>.idx for each field, rebuilds those that were not closed cleanly with the data file
+ *   as it is now, and marks them in use, before any server is forked. Exits on failure.
+ *
+ */
+void openIndexes();
+/*!
+ *   \fn closeIndexes
+ *	\param None.
+ *	\brief Marks the field indexes closed cleanly.
+ *	\return void
+ *
+ *   \par Description
+ *   Syncs the data file, then each index, and stamps it with the data file's modification time, so the next start uses it as it is.
+ *
+ */
+void closeIndexes();
+/*!
+ *   \fn openKeys
+ *	\param None.
+ *	\brief Opens the key index.
+ *	\return void
+ *
+ *   \par Description
+ *   Opens or creates <data file>.keys and marks it in use, before any server is forked. Exits if it cannot be used,
+ *   as when the data file was changed without it: its keys cannot be rebuilt from the data file.
+ *
+ */
+void openKeys();
+/*!
+ *   \fn closeKeys
+ *	\param None.
+ *	\brief Marks the key index closed cleanly.
+ *	\return void
+ *
+ *   \par Description
+ *   Syncs the data file, then the index, and stamps it with the data file's modification time.
+ *
+ */
+void closeKeys();
+/*!
+ *   \fn recoverLog
+ *	\param int walfd: Open write-ahead log.
+ *	\brief Replays a write-ahead log into the data file.
+ *	\return void
+ *
+ *   \par Description
+ *   Replays the log through the configured storage engine, syncs the data file and empties the log. Exits on failure.
+ *
+ */
+void recoverLog(int walfd);
+/*!
+ *   \fn runCoreScheduler
+ *	\param None.
+ *	\brief Threaded server lifetime.
+ *	\return void
+ *
+ *   \par Description
+ *   Makes the listening socket non-blocking and starts numWorkers core threads with all signals blocked.
+ *   The main thread then waits on signals: SIGUSR1 prints the per-core counters and SIGINT shuts the server down.
+ *
+ */
+void runCoreScheduler();
 
 /*!
  *   \fn main
@@ -91,24 +377,198 @@ void sigchldHandler(int signum);
 int main(int argc, char const *argv[])
 {
 
-    if (argc > 1)
+    int opt;
+    while ((opt = getopt(argc, (char *const *)argv, "m:w:i:f:c:d:r:l:x:kt:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            if (strcmp(optarg, "fork") == 0)
+            {
+                mode = MODE_FORK;
+            }
+            else if (strcmp(optarg, "epoll") == 0)
+            {
+                mode = MODE_EPOLL;
+            }
+            else if (strcmp(optarg, "prefork") == 0)
+            {
+                mode = MODE_PREFORK;
+            }
+            else if (strcmp(optarg, "threads") == 0)
+            {
+                mode = MODE_THREADS;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'w':
+            if ((numWorkers = atoi(optarg)) < 1)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'i':
+            if (strcmp(optarg, "sync") == 0)
+            {
+                engine = ENGINE_SYNC;
+            }
+            else if (strcmp(optarg, "uring") == 0)
+            {
+                engine = ENGINE_URING;
+            }
+            else if (strcmp(optarg, "coro") == 0)
+            {
+                engine = ENGINE_CORO;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "syscall") == 0)
+            {
+                Server::storage = STORAGE_SYSCALL;
+            }
+            else if (strcmp(optarg, "mmap") == 0)
+            {
+                Server::storage = STORAGE_MMAP;
+            }
+            else if (strcmp(optarg, "columns") == 0)
+            {
+                Server::storage = STORAGE_COLUMNS;
+            }
+            else if (strcmp(optarg, "log") == 0)
+            {
+                Server::storage = STORAGE_LOG;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'c':
+            if ((poolPages = atoi(optarg)) < 0)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "none") == 0)
+            {
+                durability = DURABILITY_NONE;
+            }
+            else if (strcmp(optarg, "group") == 0)
+            {
+                durability = DURABILITY_GROUP;
+            }
+            else if (strcmp(optarg, "sync") == 0)
+            {
+                durability = DURABILITY_SYNC;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'r':
+            if (strcmp(optarg, "locked") == 0)
+            {
+                snapshotReads = false;
+            }
+            else if (strcmp(optarg, "snapshot") == 0)
+            {
+                snapshotReads = true;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'l':
+            stripesGiven = true;
+            numStripes = atoi(optarg);
+            if (numStripes < 0 || numStripes > MAX_STRIPES)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'x':
+            if (!parseIndexFields(optarg))
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            keyedRecords = true;
+            break;
+        case 't':
+            if ((datasetHandles = atoi(optarg)) < 1)
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            if (!parseShardBoundaries(optarg))
+            {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (engine != ENGINE_SYNC && (mode == MODE_FORK || mode == MODE_THREADS))
+    {
+        printf("The io_uring and coroutine engines require -m epoll or -m prefork.\n");
+        exit(0);
+    }
+
+    if (!shardBoundaries.empty() && datasetHandles == 0)
+    {
+        printf("Shards split named datasets, which require -t.\n");
+        exit(0);
+    }
+
+    // datasets are written and read without the log, snapshots or stripes, so their writes are not made durable
+    if (datasetHandles > 0 && (durability != DURABILITY_NONE || snapshotReads || stripesGiven))
+    {
+        printf("Warning: -d, -r and -l only apply to the data file; named datasets are neither logged, snapshot read nor striped.\n");
+    }
+
+    // threads default to one per online core, processes to one
+    if (numWorkers == 0)
+    {
+        numWorkers = (mode == MODE_THREADS) ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        if (numWorkers < 1)
+        {
+            numWorkers = 1;
+        }
+    }
+
+    if (optind < argc)
     {
-        if (strcmp(argv[1], "q") == 0)
+        if (strcmp(argv[optind], "q") == 0)
         {
             quickExit = true;
         }
     }
 
-    sockaddr_in serverAddress, clientAddress;
+    sockaddr_in clientAddress;
     socklen_t sockAddrLength = sizeof(sockaddr_in);
     int pid, clientfd;
 
     // Register handlers
     signal(SIGINT, sigintHandler);
     signal(SIGCHLD, sigchldHandler);
+    signal(SIGUSR1, sigusr1Handler);
 
     // init semaphores
-    semid = SemaphoreSet::createSemaphores(PORT, 2);
+    semid = SemaphoreSet::createSemaphores(PORT, KEY_SEMAPHORE_SET + 1);
     if (semid == -1)
     {
         printf("Failed to create semaphores.\n");
@@ -116,12 +576,85 @@ int main(int argc, char const *argv[])
     }
 
     // open bin file
-    binfd = open("data/out.bin", O_RDWR);
+    if (Server::storage == STORAGE_COLUMNS)
+    {
+        binPath = "data/out.col";
+        walPath = "data/out.col.wal";
+    }
+    if (Server::storage == STORAGE_LOG)
+    {
+        binPath = "data/out.log";
+        walPath = "data/out.log.wal";
+    }
+    bool imported = Server::storage == STORAGE_COLUMNS || Server::storage == STORAGE_LOG;
+    binfd = open(binPath, imported ? (O_CREAT | O_RDWR) : O_RDWR, 0600);
     if (binfd == -1)
     {
         perror("Failed to open binary file");
         exit(0);
     }
+    if (Server::storage == STORAGE_LOG)
+    {
+        loadLogIndex();
+    }
+    if (imported)
+    {
+        importRecords();
+    }
+
+    // the pool is shared by every server forked or started from here on
+    if (poolPages > 0 && Server::storage == STORAGE_SYSCALL && !snapshotReads)
+    {
+        Server::pool = new BufferPool(poolPages, sizeof(Record));
+    }
+
+    // replay what a crash left in the log before anything reads the data file, even if this run does not log
+    int walfd = open(walPath, (durability == DURABILITY_NONE) ? O_RDWR : (O_CREAT | O_RDWR), 0600);
+    if (walfd != -1)
+    {
+        recoverLog(walfd);
+        if (durability == DURABILITY_NONE)
+        {
+            close(walfd);
+        }
+        else
+        {
+            Server::wal = new WriteAheadLog(walfd, durability);
+        }
+    }
+    else if (durability != DURABILITY_NONE)
+    {
+        perror("Failed to open write-ahead log");
+        exit(0);
+    }
+
+    // created after the replay, so the store starts from what the data file holds
+    if (snapshotReads)
+    {
+        Server::versions = new VersionStore(VERSION_CAPACITY, sizeof(Record));
+    }
+    if (numStripes > 0)
+    {
+        Server::stripes = new LockStripes(numStripes);
+    }
+    openIndexes();
+    if (keyedRecords)
+    {
+        openKeys();
+    }
+    if (datasetHandles > 0)
+    {
+        if (mkdir(DATASET_DIR, 0700) == -1 && errno != EEXIST)
+        {
+            perror("Failed to create " DATASET_DIR);
+            exit(0);
+        }
+        Server::datasets = new DatasetCache(datasetHandles, shardBoundaries);
+    }
+    if (Server::storage == STORAGE_LOG)
+    {
+        startCompactor();
+    }
 
     // open log file
     logfd = open("logs/log.ser", O_CREAT | O_RDWR, 0600);
@@ -131,35 +664,23 @@ int main(int argc, char const *argv[])
         exit(1);
     }
 
-    // open socket
-    socketfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (socketfd < 0)
+    // pre-forked workers each open their own listener
+    if (mode == MODE_PREFORK)
     {
-        perror("Socket:");
-        exit(2);
+        spawnPreforkWorkers();
     }
 
-    // set socket to reuse address
-    int reuse = 1;
-    if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse)) < 0)
-        perror("setsockopt(SO_REUSEADDR) failed");
-
-    // bind socket
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(PORT);
-    serverAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    // open socket
+    socketfd = openListener(false);
 
-    if (bind(socketfd, (sockaddr *)&serverAddress, sizeof(serverAddress)) < 0)
+    if (mode == MODE_EPOLL)
     {
-        perror("Bind:");
-        exit(3);
+        spawnEventLoops();
     }
 
-    // listen on socket
-    if (listen(socketfd, 5) == -1)
+    if (mode == MODE_THREADS)
     {
-        perror("Listen:");
-        exit(4);
+        runCoreScheduler();
     }
 
     // block all signals
@@ -177,6 +698,7 @@ int main(int argc, char const *argv[])
         sigemptyset(&sigset);
         sigaddset(&sigset, SIGINT);
         sigaddset(&sigset, SIGCHLD);
+        sigaddset(&sigset, SIGUSR1);
         sigprocmask(SIG_UNBLOCK, &sigset, &oldset);
 
         /*If a signal interrupts accept, it won't reenter automatically.
@@ -193,6 +715,7 @@ int main(int argc, char const *argv[])
         sigemptyset(&sigset);
         sigaddset(&sigset, SIGINT);
         sigaddset(&sigset, SIGCHLD);
+        sigaddset(&sigset, SIGUSR1);
         sigprocmask(SIG_BLOCK, &sigset, &oldset);
 
         pid = fork();
@@ -215,6 +738,9 @@ int main(int argc, char const *argv[])
         }
         else
         { // parent
+            // the child owns the connection; keeping it open here would stop the child from closing it
+            close(clientfd);
+
             // increment numclients
             numClients++;
         }
@@ -227,6 +753,222 @@ int main(int argc, char const *argv[])
     return 0;
 }
 
+void usage(const char *prog)
+{
+    printf("Usage: %s [-m fork|epoll|prefork|threads] [-w workers] [-i sync|uring|coro] [-f syscall|mmap|columns|log] [-c pages] [-d none|group|sync] [-r locked|snapshot] [-l stripes] [-x fields] [-k] [-t handles] [-s months] [q]\n", prog);
+    printf("  -m fork    : fork a child server per connection (default)\n");
+    printf("  -m epoll   : multiplex connections in epoll worker processes\n");
+    printf("  -m prefork : pre-forked workers, each accepting on its own SO_REUSEPORT socket\n");
+    printf("  -m threads : one process with an event loop thread per core and work stealing\n");
+    printf("  -w N       : number of worker processes (default 1) or core threads (default: online cores)\n");
+    printf("  -i uring   : workers submit socket I/O through io_uring (falls back to sync)\n");
+    printf("  -i coro    : workers service each connection with a coroutine\n");
+    printf("  -f mmap    : access the data file through a shared memory mapping instead of read/write calls\n");
+    printf("  -f columns : keep the records in data/out.col, one column per field, imported from data/out.bin if new\n");
+    printf("  -f log     : append every write to data/out.log, compacted in the background, imported from data/out.bin if new\n");
+    printf("  -c N       : cache N pages of %d records in the shared buffer pool (default %d, 0 disables)\n", POOL_PAGE_RECORDS, POOL_PAGES);
+    printf("  -d group   : acknowledge writes once logged and synced, with one sync shared by concurrent writers\n");
+    printf("  -d sync    : acknowledge writes once logged and synced, with one sync per write\n");
+    printf("  -r snapshot: read records from a snapshot without waiting for writers (disables the buffer pool)\n");
+    printf("  -l N       : lock records with N stripes hashed by record number (default %d, max %d, 0 locks the whole file)\n", LOCK_STRIPES, MAX_STRIPES);
+    printf("  -x fields  : index the comma separated fields (android,ios,kaios,other) in B+trees for index range requests\n");
+    printf("  -k         : address records by 64-bit keys through a hash index, with deletes\n");
+    printf("  -t N       : serve named datasets from %s, keeping up to N files open per process\n", DATASET_DIR);
+    printf("               (datasets are neither logged by -d, snapshot read by -r nor striped by -l)\n");
+    printf("  -s months  : split new datasets into shards starting at the comma separated months, then every last interval\n");
+    printf("  q         : shut down without prompting once all clients leave\n");
+    exit(0);
+}
+
+int openListener(bool reusePort)
+{
+    sockaddr_in serverAddress;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("Socket:");
+        exit(2);
+    }
+
+    // set socket to reuse address
+    int reuse = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse)) < 0)
+        perror("setsockopt(SO_REUSEADDR) failed");
+
+    // let every worker bind its own socket to the port; the kernel balances connections between them
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const char *)&reuse, sizeof(reuse)) < 0)
+    {
+        perror("setsockopt(SO_REUSEPORT) failed");
+        exit(3);
+    }
+
+    // bind socket
+    memset(&serverAddress, 0x0, sizeof(sockaddr_in));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(PORT);
+    serverAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(fd, (sockaddr *)&serverAddress, sizeof(serverAddress)) < 0)
+    {
+        perror("Bind:");
+        exit(3);
+    }
+
+    // listen on socket
+    if (listen(fd, (mode == MODE_FORK) ? 5 : SOMAXCONN) == -1)
+    {
+        perror("Listen:");
+        exit(4);
+    }
+
+    return fd;
+}
+
+void spawnPreforkWorkers()
+{
+    // written by each worker, read by the parent
+    connectionCounts = (int *)mmap(NULL, numWorkers * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (connectionCounts == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(5);
+    }
+    memset(connectionCounts, 0x0, numWorkers * sizeof(int));
+
+    // block signals while the workers are forked
+    sigset_t sigset, oldset;
+    sigfillset(&sigset);
+    sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        int pid = fork();
+        if (pid == -1)
+        {
+            perror("Fork:");
+            continue;
+        }
+        else if (pid == 0)
+        { // worker
+            signal(SIGINT, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+
+            socketfd = openListener(true);
+            int flags = fcntl(socketfd, F_GETFL, 0);
+            fcntl(socketfd, F_SETFL, flags | O_NONBLOCK);
+
+            runWorkerLoop(&connectionCounts[i]);
+            exit(0);
+        }
+        else
+        { // parent
+            numClients++;
+        }
+    }
+
+    printf("Started %d pre-forked worker(s).\n", numClients);
+
+    // wait for signals until the workers are gone and the server shuts down
+    sigemptyset(&sigset);
+    while (1)
+    {
+        sigsuspend(&sigset);
+    }
+}
+
+void runWorkerLoop(int *connectionCount)
+{
+    if (engine == ENGINE_URING)
+    {
+        UringLoop *uring = new UringLoop(socketfd, binfd, logfd, semid, connectionCount);
+        if (uring->init())
+        {
+            uring->run();
+            delete uring;
+            return;
+        }
+        delete uring;
+        printf("%d: io_uring unavailable, falling back to epoll.\n", getpid());
+    }
+
+    if (engine == ENGINE_CORO)
+    {
+        CoLoop *coro = new CoLoop(socketfd, binfd, logfd, semid, connectionCount);
+        coro->run();
+        delete coro;
+        return;
+    }
+
+    EventLoop *loop = new EventLoop(socketfd, binfd, logfd, semid, connectionCount);
+    loop->run();
+    delete loop;
+}
+
+void printConnectionCounts()
+{
+    if (connectionCounts == NULL)
+    {
+        return;
+    }
+
+    int total = 0;
+    printf("Worker | Connections\n");
+    for (int i = 0; i < numWorkers; i++)
+    {
+        printf("%6d | %d\n", i, connectionCounts[i]);
+        total += connectionCounts[i];
+    }
+    printf(" Total | %d\n", total);
+}
+
+void spawnEventLoops()
+{
+    int flags = fcntl(socketfd, F_GETFL, 0);
+    if (fcntl(socketfd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        perror("fcntl O_NONBLOCK");
+        exit(4);
+    }
+
+    // block signals while the workers are forked
+    sigset_t sigset, oldset;
+    sigfillset(&sigset);
+    sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        int pid = fork();
+        if (pid == -1)
+        {
+            perror("Fork:");
+            continue;
+        }
+        else if (pid == 0)
+        { // worker
+            // interrupting a worker terminates it; the parent notices through sigchld
+            signal(SIGINT, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+
+            runWorkerLoop(NULL);
+            exit(0);
+        }
+        else
+        { // parent
+            numClients++;
+        }
+    }
+
+    printf("Started %d epoll worker(s).\n", numClients);
+
+    // wait for signals until the workers are gone and the server shuts down
+    sigemptyset(&sigset);
+    while (1)
+    {
+        sigsuspend(&sigset);
+    }
+}
+
 void sigintHandler(int signum)
 {
     if (numClients > 0)
@@ -257,10 +999,53 @@ void sigintHandler(int signum)
         }
     }
 
+    // no request may be running while the files are checkpointed and the indexes stamped clean
+    if (scheduler != NULL)
+    {
+        scheduler->stop();
+    }
+
+    // the compactor moves records and checkpoints the log index itself
+    if (compactor != NULL)
+    {
+        compactorStopping = true;
+        compactor->join();
+    }
+
+    // sync everything logged into the data file, so the next start has nothing to replay
+    if (Server::wal != NULL)
+    {
+        if (fdatasync(binfd) == -1)
+        {
+            perror("Checkpoint sync");
+        }
+        else
+        {
+            Server::wal->checkpoint();
+        }
+    }
+
+    // the next start restores the log index from here instead of replaying the whole file
+    if (Server::logIndex != NULL)
+    {
+        Server::logIndex->checkpoint(binfd, checkpointPath.c_str());
+    }
+
+    closeIndexes();
+    closeKeys();
+
     if (semctl(semid, 0, IPC_RMID, 0) == -1)
     {
         perror("Failed to remove semaphores");
     }
+    if (Server::stripes != NULL)
+    {
+        Server::stripes->destroy();
+    }
+    if (Server::datasets != NULL)
+    {
+        Server::datasets->destroy();
+    }
     // else{
     //     printf("Semaphores destroyed.\n");
     // }
@@ -269,6 +1054,36 @@ void sigintHandler(int signum)
     close(logfd);
     close(binfd);
 
+    printConnectionCounts();
+    if (scheduler != NULL)
+    {
+        scheduler->printStats();
+    }
+    if (Server::pool != NULL)
+    {
+        Server::pool->printStats();
+    }
+    if (Server::wal != NULL)
+    {
+        Server::wal->printStats();
+    }
+    if (Server::versions != NULL)
+    {
+        Server::versions->printStats();
+    }
+    if (Server::stripes != NULL)
+    {
+        Server::stripes->printStats();
+    }
+    if (Server::logIndex != NULL)
+    {
+        Server::logIndex->printStats();
+    }
+    if (Server::datasets != NULL)
+    {
+        Server::datasets->printStats();
+    }
+
     printf("\nServer shut down.\n");
 
     exit(0);
@@ -276,10 +1091,341 @@ void sigintHandler(int signum)
 
 void sigchldHandler(int signum)
 {
-    printf("Child shut down.\n");
-    numClients--;
-    if (numClients == 0)
+    // several children may exit while one sigchld is pending
+    int reaped = 0;
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+    {
+        printf("Child shut down.\n");
+        numClients--;
+        reaped++;
+    }
+    if (reaped > 0 && numClients == 0)
     {
         kill(getpid(), SIGINT);
     }
 }
+
+void runCoreScheduler()
+{
+    int flags = fcntl(socketfd, F_GETFL, 0);
+    if (fcntl(socketfd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        perror("fcntl O_NONBLOCK");
+        exit(4);
+    }
+
+    // the core threads inherit this mask, so signals are only delivered to the main thread
+    sigset_t sigset, oldset;
+    sigfillset(&sigset);
+    sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+    scheduler = new CoreScheduler(socketfd, binPath, "logs/log.ser", semid, numWorkers);
+    scheduler->start();
+
+    // wait for signals until the server shuts down
+    sigemptyset(&sigset);
+    while (1)
+    {
+        sigsuspend(&sigset);
+    }
+}
+
+void importRecords()
+{
+    if (Server::storage == STORAGE_COLUMNS && !ColumnFile::initialize(binfd))
+    {
+        exit(3);
+    }
+
+    DataFile<Record> *file = Server::openBinFile(dup(binfd), semid);
+    if (file->checkNumRecords() == 0)
+    {
+        int rowfd = open("data/out.bin", O_RDONLY);
+        struct stat st;
+        if (rowfd == -1 || fstat(rowfd, &st) == -1)
+        {
+            perror("Failed to open binary file");
+            exit(0);
+        }
+
+        std::vector<Record> records(st.st_size / sizeof(Record));
+        size_t size = records.size() * sizeof(Record);
+        if (pread(rowfd, records.data(), size, 0) != (ssize_t) size || !file->writeRecords(records.data(), records.size()))
+        {
+            printf("Failed to import data/out.bin.\n");
+            exit(3);
+        }
+        printf("Imported %zu records from data/out.bin into %s.\n", records.size(), binPath);
+        fflush(stdout);
+        close(rowfd);
+    }
+    delete file;
+}
+
+void loadLogIndex()
+{
+    checkpointPath = std::string(binPath) + ".ckpt";
+    auto start = std::chrono::steady_clock::now();
+    Server::logIndex = new LogIndex();
+    long replayed = Server::logIndex->restore(binfd, checkpointPath.c_str());
+    if (replayed != -1)
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Restored the log index from %s and replayed %ld log entries after it into %ld records in %.3f s.\n",
+            checkpointPath.c_str(), replayed, Server::logIndex->numRecords(), seconds);
+        fflush(stdout);
+        return;
+    }
+
+    // a failed restore may have filled part of it
+    delete Server::logIndex;
+    Server::logIndex = new LogIndex();
+    replayed = Server::logIndex->load(binfd);
+    if (replayed == -1)
+    {
+        printf("Failed to replay %s.\n", binPath);
+        exit(3);
+    }
+    if (replayed > 0)
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Replayed %ld log entries into %ld records in %.3f s.\n", replayed, Server::logIndex->numRecords(), seconds);
+        fflush(stdout);
+    }
+}
+
+void startCompactor()
+{
+    // opened before the thread starts, while nothing else runs
+    LogFile *file = (LogFile *)Server::openBinFile(dup(binfd), semid);
+
+    sigset_t sigset, oldset;
+    sigfillset(&sigset);
+    pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+    compactor = new std::thread([file]()
+    {
+        uint64_t checkpointed = Server::logIndex->getHead();
+        auto lastCheckpoint = std::chrono::steady_clock::now();
+        while (!compactorStopping)
+        {
+            if (!file->compact())
+            {
+                usleep(LOG_COMPACT_INTERVAL);
+            }
+            if (std::chrono::steady_clock::now() - lastCheckpoint >= std::chrono::seconds(LOG_CHECKPOINT_INTERVAL))
+            {
+                uint64_t head = Server::logIndex->getHead();
+                if (head != checkpointed && Server::logIndex->checkpoint(binfd, checkpointPath.c_str()))
+                {
+                    checkpointed = head;
+                }
+                lastCheckpoint = std::chrono::steady_clock::now();
+            }
+        }
+        delete file;
+    });
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+}
+
+bool parseIndexFields(const char *list)
+{
+    std::string names(list);
+    size_t start = 0;
+    while (start <= names.size())
+    {
+        size_t end = names.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = names.size();
+        }
+        int field = FieldIndex::fieldCode(names.substr(start, end - start).c_str());
+        if (field == -1)
+        {
+            return false;
+        }
+        indexFields[field] = true;
+        start = end + 1;
+    }
+    return true;
+}
+
+bool parseShardBoundaries(const char *list)
+{
+    std::string months(list);
+    size_t start = 0;
+    while (start <= months.size())
+    {
+        size_t end = months.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = months.size();
+        }
+        int month = atoi(months.substr(start, end - start).c_str());
+        if (month <= 0 || (!shardBoundaries.empty() && month <= shardBoundaries.back()))
+        {
+            return false;
+        }
+        shardBoundaries.push_back(month);
+        start = end + 1;
+    }
+    return true;
+}
+
+void openIndexes()
+{
+    DataFile<Record> *file = NULL;
+    int records = -1;
+    for (int f = 0; f < NUM_FIELDS; f++)
+    {
+        if (!indexFields[f])
+        {
+            continue;
+        }
+
+        std::string path = std::string(binPath) + "." + FieldIndex::fieldName(f) + ".idx";
+        int fd = open(path.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd == -1)
+        {
+            perror("Failed to open index file");
+            exit(0);
+        }
+        FieldIndex *index = new FieldIndex(fd, f, SemaphoreSet(semid, INDEX_SEMAPHORE_SET + f));
+
+        if (file == NULL)
+        {
+            file = Server::openBinFile(dup(binfd), semid);
+            records = file->checkNumRecords();
+        }
+        if (!index->check(binfd, records))
+        {
+            if (!index->rebuild(*file))
+            {
+                printf("Failed to rebuild %s.\n", path.c_str());
+                exit(3);
+            }
+            printf("Rebuilt %s from %d records.\n", path.c_str(), records);
+            fflush(stdout);
+        }
+
+        // a crash from here on leaves it to be rebuilt
+        if (!index->markClean(binfd, false))
+        {
+            exit(3);
+        }
+        Server::indexes[f] = index;
+    }
+    delete file;
+}
+
+void closeIndexes()
+{
+    bool synced = false;
+    for (int f = 0; f < NUM_FIELDS; f++)
+    {
+        if (Server::indexes[f] == NULL)
+        {
+            continue;
+        }
+        if (!synced && fdatasync(binfd) == -1)
+        {
+            perror("Data file sync");
+            return;
+        }
+        synced = true;
+        Server::indexes[f]->markClean(binfd, true);
+    }
+}
+
+void openKeys()
+{
+    std::string path = std::string(binPath) + ".keys";
+    int fd = open(path.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd == -1)
+    {
+        perror("Failed to open key index");
+        exit(0);
+    }
+    KeyIndex *keys = new KeyIndex(fd, SemaphoreSet(semid, KEY_SEMAPHORE_SET));
+    if (!keys->open(binfd))
+    {
+        printf("Cannot use %s. Remove it to start with no keys.\n", path.c_str());
+        exit(3);
+    }
+    Server::keys = keys;
+}
+
+void closeKeys()
+{
+    if (Server::keys == NULL)
+    {
+        return;
+    }
+    if (fdatasync(binfd) == -1)
+    {
+        perror("Data file sync");
+        return;
+    }
+    Server::keys->close(binfd);
+}
+
+void recoverLog(int walfd)
+{
+    // the log holds appends in order, so a record past the end is always the next one
+    DataFile<Record> *file = Server::openBinFile(dup(binfd), semid);
+    int records = file->checkNumRecords();
+    int replayed = WriteAheadLog::recover(walfd, sizeof(Record), [&](int recordNumber, const void *contents)
+    {
+        Record record;
+        memcpy(&record, contents, sizeof(Record));
+        if (recordNumber != records)
+        {
+            return file->updateRecord(recordNumber, record);
+        }
+        records++;
+        return file->writeRecord(record);
+    });
+    delete file;
+
+    if (replayed == -1 || fdatasync(binfd) == -1 || ftruncate(walfd, 0) == -1)
+    {
+        printf("Failed to recover the write-ahead log.\n");
+        exit(3);
+    }
+    if (replayed > 0)
+    {
+        printf("Replayed %d records from the write-ahead log.\n", replayed);
+        fflush(stdout);
+    }
+}
+
+void sigusr1Handler(int signum)
+{
+    if (scheduler != NULL)
+    {
+        scheduler->printStats();
+    }
+    if (Server::pool != NULL)
+    {
+        Server::pool->printStats();
+    }
+    if (Server::wal != NULL)
+    {
+        Server::wal->printStats();
+    }
+    if (Server::versions != NULL)
+    {
+        Server::versions->printStats();
+    }
+    if (Server::stripes != NULL)
+    {
+        Server::stripes->printStats();
+    }
+    if (Server::logIndex != NULL)
+    {
+        Server::logIndex->printStats();
+    }
+    if (Server::datasets != NULL)
+    {
+        Server::datasets->printStats();
+    }
+}
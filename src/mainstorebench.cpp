@@ -0,0 +1,1006 @@
+/*!	\file mainstorebench.cpp
+*	\brief  Benchmark of the binary file storage engines.
+*   Forks several processes that each issue random record reads, appends, updates, single-field scans, a mix of reads, updates and appends,
+*   or updates of records no other process touches,
+*   directly against a scratch copy of a record file through a DataFile, and reports the operation rate of each storage engine. \n
+*   No server is involved, so the numbers are the cost of the storage engine alone: the semaphores plus either
+*   a system call per access (CriticalFile), a copy out of a shared mapping (MappedFile), a system call per column (ColumnFile),
+*   or an append per write and a system call per read through a shared index (LogFile). \n
+*   Like the server's forked children, the processes inherit one open file description of the scratch file. \n
+*   Every read checks that the record holds its own month, appends check the final record count, and after a run
+*   every record must still hold its own month, so -o mixed doubles as a multi-process stress test of the engines. \n
+*   Usage: bin/storebench [-f syscall|mmap|columns|log] [-o read|append|update|scan|mixed|disjoint|startup|shards] [-p processes] [-n operations] [-r records] [-c pages] [-d none|group|sync] [-s] [-l stripes] \n
+*   With -c N, the system call engine reads through a shared BufferPool of N pages, as the server's does, and its counters are printed. \n
+*   With -d group or -d sync, writes are logged to a scratch WriteAheadLog and only return once it is synced, as the server's do,
+*   so the rates of the durability modes can be compared. The log's counters are printed. \n
+*   With -s, reads take snapshots from a scratch VersionStore instead of the reader lock, as the server's do with -r snapshot,
+*   and its counters are printed. Every read is timed, and the median and 99th percentile read latencies are printed,
+*   so -o mixed shows how much the writes hold the reads up with and without snapshots. \n
+*   A scan sums one field over SCAN_RECORDS records from a random start with DataFile::scanField, which a ColumnFile serves
+*   from that field's column alone. \n
+*   With -o disjoint, each process updates random records of its own slice of the file, so writers never need the same record.
+*   With one lock over the whole file they still wait for each other; with -l N, the file is locked with N LockStripes
+*   instead, as the server's is, so only writers whose records share a stripe wait. The stripes' counters are printed. \n
+*   The log-structured engine runs with its compactor in a thread of the parent, as the server's does, and its counters
+*   are printed. Its file is checked through an index replayed from the file, so the check covers recovery too. \n
+*   With -o startup, the log-structured engine's startup is measured instead: a file of -r records gets a checkpoint, then
+*   -n random updates after it, and the time to rebuild its index by replaying the whole file is compared with the time to
+*   restore it from the checkpoint and replay only those updates. Both indexes must point every record at the same entry. \n
+*   With -o shards, the sharded dataset engine is checked instead: a ShardedFile of shards SHARD_WIDTH records wide is
+*   written with random batches of appends and updates, some spanning shards and some rejected, and compared with a model
+*   of what it should hold, record by record and shard file by shard file. Then -p processes append to it at once, and
+*   it is reopened with other boundaries, which must not change where its records go. \n
+*   Without -f or -o, every engine is run for every operation but startup and shards. \n
+*
+*/
+
+#include "CriticalFile.h"
+#include "MappedFile.h"
+#include "ColumnFile.h"
+#include "LogFile.h"
+#include "ShardedFile.h"
+#include <dirent.h>
+#include <climits>
+#include <algorithm>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#define BENCH_FILE "data/bench.bin"
+#define BENCH_LOG "data/bench.wal"
+#define BENCH_CHECKPOINT "data/bench.bin.ckpt"
+#define SCAN_RECORDS 10000
+#define BENCH_SHARDS "data/bench.shards"
+#define SHARD_WIDTH 64
+#define SHARD_ROUNDS 300
+#define SHARD_APPENDS 2000
+
+typedef std::chrono::steady_clock Clock;
+
+int numProcesses = 4;
+int opsPerProcess = 200000;
+int numRecords = 100000;
+int engineChoice = -1;
+int opChoice = -1;
+int semid = -1;
+int *failures = NULL;
+int poolPages = 0;
+Durability_Mode durability = DURABILITY_NONE;
+bool snapshotReads = false;
+int numStripes = 0;
+float *latencies = NULL;
+long *readCounts = NULL;
+LogIndex *logIndex = NULL;
+
+/*!
+*   \enum Bench_Op
+*   \brief Operation every process repeats.
+*/
+enum Bench_Op
+{
+    OP_READ,   // read a random record
+    OP_APPEND, // append a record
+    OP_UPDATE, // update a random record
+    OP_SCAN,   // sum a field over SCAN_RECORDS records
+    OP_MIXED,  // mostly reads, with 5% updates and 5% appends
+    OP_DISJOINT, // update a random record of the process's own slice
+    OP_STARTUP, // rebuild the log-structured engine's index, from scratch and from a checkpoint
+    OP_SHARDS   // check a sharded dataset against a model
+};
+
+/*!
+*   \fn usage
+*	\param const char *prog: Program name.
+*	\brief Prints command line usage.
+*	\return void
+*
+*/
+void usage(const char *prog);
+/*!
+*   \fn openFile
+*	\param Storage_Engine engine: Engine to access the file with.
+*	\param int fd: Open descriptor of the scratch file, closed by the DataFile.
+*	\brief Opens the scratch file with an engine.
+*	\return The DataFile.
+*
+*/
+DataFile<Record> *openFile(Storage_Engine engine, int fd);
+/*!
+*   \fn resetFile
+*	\param Storage_Engine engine: Engine whose file format to write.
+*	\brief Recreates the scratch file.
+*	\return false on error.
+*
+*   \par Description
+*   Writes numRecords records to BENCH_FILE, each numbered with its position.
+*
+*/
+bool resetFile(Storage_Engine engine);
+/*!
+*   \fn checkFile
+*	\param Storage_Engine engine: Engine to read the file with.
+*	\param long &records: Set to the number of records in the file.
+*	\brief Checks the scratch file after a run.
+*	\return Number of records not holding their own month, or -1 on error.
+*
+*/
+int checkFile(Storage_Engine engine, long &records);
+/*!
+*   \fn numberRecord
+*	\param Record &record: Appended record.
+*	\param int recordNumber: Its record number.
+*	\brief Sets an appended record's month.
+*	\return void
+*
+*/
+void numberRecord(Record &record, int recordNumber);
+/*!
+*   \fn runProcess
+*	\param DataFile<Record> *file: The scratch file, opened on the inherited descriptor.
+*	\param Bench_Op op: Operation to repeat.
+*	\param int process: Index of the process, which picks its slice and seeds its random numbers.
+*	\param float *readLatencies: Filled with the microseconds each read took.
+*	\param long &reads: Set to the number of reads.
+*	\brief Benchmark process lifetime.
+*	\return Number of failed operations.
+*
+*/
+int runProcess(DataFile<Record> *file, Bench_Op op, int process, float *readLatencies, long &reads);
+/*!
+*   \fn percentile
+*	\param std::vector<float> &values: Values, reordered.
+*	\param double fraction: Fraction of the values at or below the result.
+*	\brief Finds a percentile.
+*	\return The value, or 0 for no values.
+*
+*/
+float percentile(std::vector<float> &values, double fraction);
+/*!
+*   \fn runBench
+*	\param Storage_Engine engine: Engine to access the file with.
+*	\param Bench_Op op: Operation to repeat.
+*	\brief Runs one engine and operation.
+*	\return void
+*
+*   \par Description
+*   Resets the scratch file, forks numProcesses processes and prints the combined operation rate.
+*
+*/
+void runBench(Storage_Engine engine, Bench_Op op);
+/*!
+*   \fn runStartup
+*	\param None.
+*	\brief Measures the startup of the log-structured engine.
+*	\return void
+*
+*   \par Description
+*   Writes numRecords records to a log-structured scratch file and checkpoints its index, then updates opsPerProcess random
+*   records and compacts what it can. Times a full replay of the file and a restore from the checkpoint, and compares them.
+*
+*/
+void runStartup();
+/*!
+*   \fn removeShards
+*	\param None.
+*	\brief Removes the scratch shard directory and its files.
+*	\return void
+*
+*/
+void removeShards();
+/*!
+*   \fn checkShards
+*	\param ShardedFile &file: The scratch dataset.
+*	\param const std::vector<Record> &model: What it should hold.
+*	\brief Compares a sharded dataset with its model.
+*	\return Number of differences.
+*
+*   \par Description
+*   Reads it whole and record by record, and checks that every shard file but the last holds SHARD_WIDTH records.
+*
+*/
+int checkShards(ShardedFile &file, const std::vector<Record> &model);
+/*!
+*   \fn runShards
+*	\param None.
+*	\brief Checks the sharded dataset engine.
+*	\return void
+*
+*   \par Description
+*   Writes random batches to a scratch ShardedFile and checks it against a model after each, then has numProcesses
+*   processes append to it at once, then reopens it with other boundaries and appends again.
+*
+*/
+void runShards();
+
+
+
+/*!
+*   \fn main
+*	\param int argc:
+*	\param char const *argv[]:
+*	\brief Main routine
+*	\return int
+*
+*   \par Description
+*   Parses options and runs the selected engines and operations.
+*
+*/
+int main(int argc, char const *argv[]){
+    int opt;
+    while ( (opt = getopt(argc, (char *const *)argv, "f:o:p:n:r:c:d:sl:")) != -1){
+        switch (opt){
+        case 'f':
+            if (strcmp(optarg, "syscall") == 0){
+                engineChoice = STORAGE_SYSCALL;
+            }
+            else if (strcmp(optarg, "mmap") == 0){
+                engineChoice = STORAGE_MMAP;
+            }
+            else if (strcmp(optarg, "columns") == 0){
+                engineChoice = STORAGE_COLUMNS;
+            }
+            else if (strcmp(optarg, "log") == 0){
+                engineChoice = STORAGE_LOG;
+            }
+            else{
+                usage(argv[0]);
+            }
+            break;
+        case 'o':
+            if (strcmp(optarg, "read") == 0){
+                opChoice = OP_READ;
+            }
+            else if (strcmp(optarg, "append") == 0){
+                opChoice = OP_APPEND;
+            }
+            else if (strcmp(optarg, "update") == 0){
+                opChoice = OP_UPDATE;
+            }
+            else if (strcmp(optarg, "scan") == 0){
+                opChoice = OP_SCAN;
+            }
+            else if (strcmp(optarg, "mixed") == 0){
+                opChoice = OP_MIXED;
+            }
+            else if (strcmp(optarg, "disjoint") == 0){
+                opChoice = OP_DISJOINT;
+            }
+            else if (strcmp(optarg, "startup") == 0){
+                opChoice = OP_STARTUP;
+            }
+            else if (strcmp(optarg, "shards") == 0){
+                opChoice = OP_SHARDS;
+            }
+            else{
+                usage(argv[0]);
+            }
+            break;
+        case 'p':
+            numProcesses = atoi(optarg);
+            break;
+        case 'n':
+            opsPerProcess = atoi(optarg);
+            break;
+        case 'r':
+            numRecords = atoi(optarg);
+            break;
+        case 'c':
+            poolPages = atoi(optarg);
+            break;
+        case 'd':
+            if (strcmp(optarg, "none") == 0){
+                durability = DURABILITY_NONE;
+            }
+            else if (strcmp(optarg, "group") == 0){
+                durability = DURABILITY_GROUP;
+            }
+            else if (strcmp(optarg, "sync") == 0){
+                durability = DURABILITY_SYNC;
+            }
+            else{
+                usage(argv[0]);
+            }
+            break;
+        case 's':
+            snapshotReads = true;
+            break;
+        case 'l':
+            numStripes = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (numProcesses < 1 || opsPerProcess < 1 || numRecords < numProcesses || poolPages < 0 || numStripes < 0 || numStripes > MAX_STRIPES){
+        usage(argv[0]);
+    }
+    if (opChoice == OP_STARTUP && engineChoice != -1 && engineChoice != STORAGE_LOG){
+        printf("Startup is only measured for -f log.\n");
+        usage(argv[0]);
+    }
+    if (opChoice == OP_SHARDS && engineChoice != -1 && engineChoice != STORAGE_SYSCALL){
+        printf("Shards are only checked for -f syscall.\n");
+        usage(argv[0]);
+    }
+
+    failures = (int *)mmap(NULL, numProcesses * sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (failures == MAP_FAILED){
+        perror("mmap");
+        exit(1);
+    }
+    latencies = (float *)mmap(NULL, (size_t) numProcesses * opsPerProcess * sizeof(float), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    readCounts = (long *)mmap(NULL, numProcesses * sizeof(long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (latencies == MAP_FAILED || readCounts == MAP_FAILED){
+        perror("mmap");
+        exit(1);
+    }
+
+    //a set of its own, so a running server's locks are not touched
+    if ( (semid = SemaphoreSet::createSemaphores(getpid(), 1)) == -1){
+        printf("Failed to create semaphores.\n");
+        exit(3);
+    }
+
+    if (opChoice == OP_STARTUP){
+        runStartup();
+        if (semctl(semid, 0, IPC_RMID, 0) == -1){
+            perror("Failed to remove semaphores");
+        }
+        unlink(BENCH_FILE);
+        unlink(BENCH_CHECKPOINT);
+        return 0;
+    }
+    if (opChoice == OP_SHARDS){
+        runShards();
+        if (semctl(semid, 0, IPC_RMID, 0) == -1){
+            perror("Failed to remove semaphores");
+        }
+        return 0;
+    }
+
+    printf("%d processes, %d operations each, %d records\n", numProcesses, opsPerProcess, numRecords);
+    const char *modes[] = {"none", "group", "sync"};
+    printf("Durability: %s\n", modes[durability]);
+    printf("Reads: %s\n", snapshotReads ? "snapshot" : "locked");
+    if (numStripes > 0){
+        printf("Locks: %d stripes\n", numStripes);
+    }
+    else{
+        printf("Locks: whole file\n");
+    }
+    printf("Engine  | Op       | Ops/sec      | Read p50 us | Read p99 us | Failures\n");
+    for (int op = OP_READ; op <= OP_DISJOINT; op++){
+        for (int engine = STORAGE_SYSCALL; engine <= STORAGE_LOG; engine++){
+            if ((opChoice == -1 || opChoice == op) && (engineChoice == -1 || engineChoice == engine)){
+                runBench((Storage_Engine) engine, (Bench_Op) op);
+            }
+        }
+    }
+
+    if (semctl(semid, 0, IPC_RMID, 0) == -1){
+        perror("Failed to remove semaphores");
+    }
+    unlink(BENCH_FILE);
+    unlink(BENCH_LOG);
+    return 0;
+}
+
+
+
+/*!
+*	\brief Prints command line usage.
+*/
+void usage(const char *prog){
+    printf("Usage: %s [-f syscall|mmap|columns|log] [-o read|append|update|scan|mixed|disjoint|startup|shards] [-p processes] [-n operations] [-r records] [-c pages] [-d none|group|sync] [-s] [-l stripes]\n", prog);
+    exit(0);
+}
+
+
+
+/*!
+*	\brief Opens the scratch file with an engine.
+*/
+DataFile<Record> *openFile(Storage_Engine engine, int fd){
+    if (engine == STORAGE_MMAP){
+        return new MappedFile<Record>(fd, SemaphoreSet(semid, 0));
+    }
+    if (engine == STORAGE_COLUMNS){
+        return new ColumnFile(fd, SemaphoreSet(semid, 0));
+    }
+    if (engine == STORAGE_LOG){
+        return new LogFile(fd, SemaphoreSet(semid, 0), logIndex);
+    }
+    return new CriticalFile<Record>(fd, SemaphoreSet(semid, 0));
+}
+
+
+
+/*!
+*	\brief Recreates the scratch file.
+*/
+bool resetFile(Storage_Engine engine){
+    int fd = open(BENCH_FILE, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (fd == -1){
+        perror("Failed to create bench file");
+        return false;
+    }
+    if (engine == STORAGE_COLUMNS && !ColumnFile::initialize(fd)){
+        close(fd);
+        return false;
+    }
+
+    std::vector<Record> records(numRecords);
+    for (int i = 0; i < numRecords; i++){
+        records[i].month = i;
+        records[i].android = 70.0;
+        records[i].ios = 28.0;
+        records[i].kaios = 0.5;
+        records[i].other = 1.5;
+    }
+
+    DataFile<Record> *file = openFile(engine, fd);
+    bool ok = file->writeRecords(records.data(), numRecords);
+    if (!ok){
+        printf("Failed to write bench file.\n");
+    }
+    delete file;
+    return ok;
+}
+
+
+
+/*!
+*	\brief Checks the scratch file after a run.
+*/
+int checkFile(Storage_Engine engine, long &records){
+    int fd = open(BENCH_FILE, O_RDWR);
+    if (fd == -1){
+        perror("Failed to open bench file");
+        return -1;
+    }
+
+    //replayed into a fresh index, as the server's is on startup
+    LogIndex *replayed = NULL;
+    if (engine == STORAGE_LOG){
+        replayed = new LogIndex();
+        if (replayed->load(fd) == -1){
+            delete replayed;
+            close(fd);
+            return -1;
+        }
+    }
+
+    DataFile<Record> *file = (engine == STORAGE_LOG) ? new LogFile(fd, SemaphoreSet(semid, 0), replayed) : openFile(engine, fd);
+    std::vector<Record> buf;
+    int wrong = 0;
+    records = file->readRecords(0, INT_MAX, buf);
+    for (long i = 0; i < records; i++){
+        if (buf[i].month != (int) i){
+            wrong++;
+        }
+    }
+
+    delete file;
+    delete replayed;
+    return (records < 0) ? -1 : wrong;
+}
+
+
+
+/*!
+*	\brief Sets an appended record's month.
+*/
+void numberRecord(Record &record, int recordNumber){
+    record.month = recordNumber;
+}
+
+
+
+/*!
+*	\brief Benchmark process lifetime.
+*/
+int runProcess(DataFile<Record> *file, Bench_Op op, int process, float *readLatencies, long &reads){
+    std::mt19937 rng(process + 1);
+    std::uniform_int_distribution<int> pick(0, numRecords - 1);
+    if (op == OP_DISJOINT){
+        long slice = numRecords / numProcesses;
+        pick = std::uniform_int_distribution<int>(process * slice, (process + 1) * slice - 1);
+    }
+    Record record;
+    memset(&record, 0x0, sizeof(Record));
+    std::vector<int> positions;
+    std::vector<Record> batch;
+    int failed = 0;
+    reads = 0;
+
+    for (int i = 0; i < opsPerProcess; i++){
+        int recordNumber = pick(rng);
+        int roll = (op == OP_MIXED) ? (int) (rng() % 20) : (op == OP_UPDATE || op == OP_DISJOINT) ? 0 : 2;
+
+        if (op == OP_SCAN){
+            //every value is a share, so the sum is bounded by 100 per record
+            double sum = 0;
+            int first = std::min(recordNumber, numRecords - SCAN_RECORDS);
+            int n = file->scanField(&Record::android, std::max(first, 0), SCAN_RECORDS, [&](const float *values, int count){
+                for (int v = 0; v < count; v++){
+                    sum += values[v];
+                }
+                return true;
+            });
+            if (n != std::min(SCAN_RECORDS, numRecords) || sum < 0 || sum > 100.0 * n){
+                failed++;
+            }
+        }
+        else if (op == OP_APPEND){
+            if (!file->writeRecord(record)){
+                failed++;
+            }
+        }
+        else if (roll == 0){
+            //rewrite a record under its own month, so readers can still check it
+            record.month = recordNumber;
+            record.android = (float) (rng() % 100);
+            if (!file->updateRecord(recordNumber, record)){
+                failed++;
+            }
+        }
+        else if (roll == 1){
+            //appended records are numbered under the writer lock
+            positions.assign(1, -1);
+            batch.assign(1, record);
+            if (file->writeBatch(positions, batch, numberRecord) == -1){
+                failed++;
+            }
+        }
+        else{
+            Clock::time_point start = Clock::now();
+            bool read = file->readRecord(recordNumber, record);
+            readLatencies[reads++] = std::chrono::duration<float, std::micro>(Clock::now() - start).count();
+            if (!read || record.month != recordNumber){
+                failed++;
+            }
+        }
+    }
+
+    return failed;
+}
+
+
+
+/*!
+*	\brief Finds a percentile.
+*/
+float percentile(std::vector<float> &values, double fraction){
+    if (values.empty()){
+        return 0;
+    }
+    size_t rank = std::min(values.size() - 1, (size_t) (fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+
+
+/*!
+*	\brief Runs one engine and operation.
+*/
+void runBench(Storage_Engine engine, Bench_Op op){
+    //an empty index for the file about to be rewritten
+    if (engine == STORAGE_LOG){
+        logIndex = new LogIndex();
+    }
+    if (!resetFile(engine)){
+        delete logIndex;
+        logIndex = NULL;
+        return;
+    }
+
+    //opened once, so every process shares the file description the way the server's children do
+    int fd = open(BENCH_FILE, O_RDWR);
+    if (fd == -1){
+        perror("Failed to open bench file");
+        return;
+    }
+
+    //a fresh pool, since the file was just rewritten
+    BufferPool *pool = NULL;
+    if (engine == STORAGE_SYSCALL && poolPages > 0){
+        pool = new BufferPool(poolPages, sizeof(Record));
+    }
+
+    //and an empty log
+    WriteAheadLog *wal = NULL;
+    int walfd = -1;
+    if (durability != DURABILITY_NONE){
+        if ( (walfd = open(BENCH_LOG, O_CREAT | O_TRUNC | O_RDWR, 0600)) == -1){
+            perror("Failed to create bench log");
+            close(fd);
+            delete logIndex;
+            logIndex = NULL;
+            return;
+        }
+        wal = new WriteAheadLog(walfd, durability);
+    }
+
+    //unlocked stripes
+    LockStripes *stripes = NULL;
+    if (numStripes > 0){
+        stripes = new LockStripes(numStripes);
+    }
+
+    //and no versions of it yet
+    VersionStore *versions = NULL;
+    if (snapshotReads){
+        versions = new VersionStore(VERSION_CAPACITY, sizeof(Record));
+    }
+
+    //the children must not inherit and flush what is still buffered
+    fflush(stdout);
+    memset(failures, 0x0, numProcesses * sizeof(int));
+    memset(readCounts, 0x0, numProcesses * sizeof(long));
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < numProcesses; i++){
+        pid_t pid = fork();
+        if (pid == -1){
+            perror("Fork:");
+            failures[i] = opsPerProcess;
+            continue;
+        }
+        if (pid == 0){
+            DataFile<Record> *file = openFile(engine, fd);
+            if (engine == STORAGE_SYSCALL){
+                ((CriticalFile<Record> *) file)->setPool(pool);
+            }
+            file->setLog(wal);
+            file->setVersions(versions);
+            file->setStripes(stripes);
+            failures[i] = runProcess(file, op, i, latencies + (size_t) i * opsPerProcess, readCounts[i]);
+            delete file;
+            exit(0);
+        }
+    }
+
+    //compacting alongside the processes, once they are forked
+    std::atomic<bool> running(true);
+    std::thread compactor;
+    if (engine == STORAGE_LOG){
+        LogFile *file = (LogFile *) openFile(engine, dup(fd));
+        file->setStripes(stripes);
+        compactor = std::thread([file, &running](){
+            while (running){
+                if (!file->compact()){
+                    usleep(LOG_COMPACT_INTERVAL);
+                }
+            }
+            delete file;
+        });
+    }
+    close(fd);
+
+    int status, failed = 0;
+    while (wait(&status) > 0){
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            failed++;
+        }
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    running = false;
+    if (compactor.joinable()){
+        compactor.join();
+    }
+    for (int i = 0; i < numProcesses; i++){
+        failed += failures[i];
+    }
+
+    //every append must have landed exactly once, and nothing else may have moved
+    long records;
+    int wrong = checkFile(engine, records);
+    if (op == OP_APPEND){
+        if (records != (long) numRecords + (long) numProcesses * opsPerProcess){
+            failed++;
+        }
+    }
+    else{
+        failed += (wrong == -1) ? 1 : wrong;
+    }
+
+    std::vector<float> readLatencies;
+    for (int i = 0; i < numProcesses; i++){
+        readLatencies.insert(readLatencies.end(), latencies + (size_t) i * opsPerProcess, latencies + (size_t) i * opsPerProcess + readCounts[i]);
+    }
+
+    const char *engines[] = {"syscall", "mmap", "columns", "log"};
+    const char *names[] = {"read", "append", "update", "scan", "mixed", "disjoint"};
+    printf("%-7s | %-8s | %12.1f | %11.2f | %11.2f | %d\n", engines[engine], names[op],
+        (double) numProcesses * opsPerProcess / elapsed, percentile(readLatencies, 0.5), percentile(readLatencies, 0.99), failed);
+    if (pool != NULL){
+        pool->printStats();
+        delete pool;
+    }
+    if (wal != NULL){
+        wal->printStats();
+        delete wal;
+        close(walfd);
+    }
+    if (versions != NULL){
+        versions->printStats();
+        delete versions;
+    }
+    if (stripes != NULL){
+        stripes->printStats();
+        stripes->destroy();
+        delete stripes;
+    }
+    if (logIndex != NULL){
+        logIndex->printStats();
+        delete logIndex;
+        logIndex = NULL;
+    }
+}
+
+
+
+/*!
+*	\brief Measures the startup of the log-structured engine.
+*/
+void runStartup(){
+    logIndex = new LogIndex();
+    unlink(BENCH_CHECKPOINT);
+    Clock::time_point start = Clock::now();
+    if (!resetFile(STORAGE_LOG)){
+        delete logIndex;
+        logIndex = NULL;
+        return;
+    }
+    double written = std::chrono::duration<double>(Clock::now() - start).count();
+    int fd = open(BENCH_FILE, O_RDWR);
+    if (fd == -1){
+        perror("Failed to open bench file");
+        delete logIndex;
+        logIndex = NULL;
+        return;
+    }
+
+    start = Clock::now();
+    bool checkpointed = logIndex->checkpoint(fd, BENCH_CHECKPOINT);
+    double checkpointTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+    //the tail the restore replays, compacted as the server's compactor would
+    LogFile *file = new LogFile(dup(fd), SemaphoreSet(semid, 0), logIndex);
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> pick(0, numRecords - 1);
+    int failed = checkpointed ? 0 : 1;
+    Record record;
+    memset(&record, 0x0, sizeof(Record));
+    for (int i = 0; i < opsPerProcess; i++){
+        record.month = pick(rng);
+        record.android = (float) (rng() % 100);
+        if (!file->updateRecord(record.month, record)){
+            failed++;
+        }
+    }
+    while (file->compact()){
+    }
+    delete file;
+    delete logIndex;
+    logIndex = NULL;
+
+    start = Clock::now();
+    LogIndex *replayed = new LogIndex();
+    long entries = replayed->load(fd);
+    double replayTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+    start = Clock::now();
+    LogIndex *restored = new LogIndex();
+    long tail = restored->restore(fd, BENCH_CHECKPOINT);
+    double restoreTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+    //the restored index must be the one a full replay builds
+    if (entries == -1 || tail == -1 || replayed->numRecords() != numRecords || restored->numRecords() != numRecords ||
+        replayed->stats().segments != restored->stats().segments){
+        failed++;
+    }
+    else{
+        for (int i = 0; i < numRecords; i++){
+            if (replayed->offset(i) != restored->offset(i)){
+                failed++;
+            }
+        }
+    }
+
+    struct stat st;
+    off_t checkpointSize = (stat(BENCH_CHECKPOINT, &st) == -1) ? 0 : st.st_size;
+    printf("%d records written in %.3f s, %d updates after the checkpoint\n", numRecords, written, opsPerProcess);
+    printf("Full replay     | %10.3f s | %ld entries\n", replayTime, entries);
+    printf("Checkpoint      | %10.3f s | %ld bytes\n", checkpointTime, (long) checkpointSize);
+    printf("Restore + tail  | %10.3f s | %ld entries | %.1fx faster\n", restoreTime, tail, (restoreTime > 0) ? replayTime / restoreTime : 0);
+    printf("Failures: %d\n", failed);
+    replayed->printStats();
+    delete replayed;
+    delete restored;
+    close(fd);
+}
+
+
+
+
+/*!
+*	\brief Removes the scratch shard directory and its files.
+*/
+void removeShards(){
+    DIR *dir = opendir(BENCH_SHARDS);
+    if (dir == NULL){
+        return;
+    }
+    for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)){
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0){
+            unlink((std::string(BENCH_SHARDS) + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(BENCH_SHARDS);
+}
+
+
+
+/*!
+*	\brief Compares a sharded dataset with its model.
+*/
+int checkShards(ShardedFile &file, const std::vector<Record> &model){
+    int wrong = 0;
+    auto same = [](const Record &a, const Record &b){
+        return a.month == b.month && a.android == b.android && a.ios == b.ios && a.kaios == b.kaios && a.other == b.other;
+    };
+
+    std::vector<Record> buf;
+    if (file.readRecords(0, INT_MAX, buf) != (int) model.size() || file.checkNumRecords() != (int) model.size()){
+        return 1;
+    }
+    for (size_t i = 0; i < model.size(); i++){
+        wrong += !same(buf[i], model[i]);
+    }
+    std::mt19937 rng(model.size());
+    for (int i = 0; i < 50 && !model.empty(); i++){
+        int n = rng() % model.size();
+        Record record;
+        wrong += !file.readRecord(n, record) || !same(record, model[n]);
+    }
+
+    //each record went to the shard file of its month
+    int shards = file.shardCount();
+    for (int s = 0; s < shards; s++){
+        struct stat st;
+        long expected = std::min((long) SHARD_WIDTH, (long) model.size() - (long) s * SHARD_WIDTH);
+        std::string path = std::string(BENCH_SHARDS) + "/" + std::to_string(s * SHARD_WIDTH) + ".bin";
+        if (stat(path.c_str(), &st) == -1 || st.st_size != (off_t) (std::max(expected, 0L) * sizeof(Record))){
+            wrong++;
+        }
+    }
+    return wrong;
+}
+
+
+
+/*!
+*	\brief Checks the sharded dataset engine.
+*/
+void runShards(){
+    removeShards();
+    int shardsemid = SemaphoreSet::createSemaphores(getpid() + 1, SHARD_SEMAPHORE_SETS);
+    if (shardsemid == -1 || mkdir(BENCH_SHARDS, 0700) == -1){
+        printf("Failed to create the scratch dataset.\n");
+        return;
+    }
+    std::vector<int> boundaries = {SHARD_WIDTH, 2 * SHARD_WIDTH};
+    ShardedFile *file = new ShardedFile(BENCH_SHARDS, shardsemid, boundaries);
+    int failed = file->open(true) ? 0 : 1;
+
+    //batches of appends and updates, some crossing shards, and a rejected one now and then
+    std::vector<Record> model;
+    std::mt19937 rng(1);
+    int rejected = 0;
+    for (int round = 0; round < SHARD_ROUNDS && !failed; round++){
+        std::vector<int> positions;
+        std::vector<Record> records;
+        std::vector<Record> after = model;
+        int size = 1 + rng() % 40;
+        for (int i = 0; i < size; i++){
+            Record record;
+            record.android = (float) (rng() % 100);
+            record.ios = (float) round;
+            record.kaios = (float) i;
+            record.other = 0;
+            if (!model.empty() && rng() % 10 < 3){
+                record.month = rng() % model.size();
+                positions.push_back(record.month);
+                after[record.month] = record;
+            }
+            else{
+                record.month = (int) after.size();
+                positions.push_back(-1);
+                after.push_back(record);
+            }
+            records.push_back(record);
+        }
+        bool reject = rng() % 20 == 0;
+        if (reject){
+            positions.push_back((int) after.size() + 5);
+            records.push_back(records.back());
+            rejected++;
+        }
+
+        int count = file->writeBatch(positions, records, numberRecord);
+        if (reject ? count != -1 : count != (int) model.size()){
+            failed++;
+        }
+        if (!reject){
+            model = after;
+        }
+        failed += checkShards(*file, model);
+    }
+    delete file;
+
+    //processes appending at once, each through a file of its own like the server's children
+    long before = model.size();
+    int appends = std::min(opsPerProcess, SHARD_APPENDS);
+    fflush(stdout);
+    for (int p = 0; p < numProcesses; p++){
+        failures[p] = 0;
+        if (fork() == 0){
+            ShardedFile child(BENCH_SHARDS, shardsemid, boundaries);
+            failures[p] = child.open(false) ? 0 : 1;
+            for (int i = 0; i < appends && failures[p] == 0; i++){
+                std::vector<int> positions(1, -1);
+                std::vector<Record> records(1);
+                records[0].android = (float) p;
+                records[0].ios = records[0].kaios = records[0].other = 0;
+                if (child.writeBatch(positions, records, numberRecord) == -1){
+                    failures[p]++;
+                }
+            }
+            exit(0);
+        }
+    }
+    while (wait(NULL) > 0){
+    }
+    for (int p = 0; p < numProcesses; p++){
+        failed += failures[p];
+    }
+
+    //reopened with other boundaries, the dataset keeps its own
+    file = new ShardedFile(BENCH_SHARDS, shardsemid, std::vector<int>(1, 1000));
+    failed += file->open(false) ? 0 : 1;
+    std::vector<Record> buf;
+    long total = file->readRecords(0, INT_MAX, buf);
+    if (total != before + (long) numProcesses * appends){
+        failed++;
+    }
+    for (long i = before; i < total; i++){
+        model.push_back(buf[i]);
+        failed += buf[i].month != (int) i;
+    }
+    for (int i = 0; i < 2 * SHARD_WIDTH; i++){
+        Record record;
+        memset(&record, 0x0, sizeof(Record));
+        record.month = (int) model.size();
+        if (!file->writeRecord(record)){
+            failed++;
+        }
+        model.push_back(record);
+    }
+    int shards = file->shardCount();
+    failed += checkShards(*file, model);
+    delete file;
+
+    printf("%d batches (%d rejected), %d processes appending %d records each\n", SHARD_ROUNDS, rejected, numProcesses, appends);
+    printf("%zu records in %d shards of %d\n", model.size(), shards, SHARD_WIDTH);
+    printf("Failures: %d\n", failed);
+    if (semctl(shardsemid, 0, IPC_RMID, 0) == -1){
+        perror("Failed to remove shard semaphores");
+    }
+    removeShards();
+}